@@ -0,0 +1,232 @@
+// Concurrent stress test for CacheManager against the single-map, single-lock
+// cache it replaced. Run: ./bin/cache_bench [milliseconds per case]
+
+#include "cache_manager.h"
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// ---- Previous implementation: one std::map behind one mutex ----
+
+struct LegacyCachedResponse {
+    HttpResponse response;
+    std::chrono::system_clock::time_point cached_time;
+    int ttl_seconds;
+
+    bool is_expired() const {
+        auto now = std::chrono::system_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - cached_time);
+        return duration.count() > ttl_seconds;
+    }
+};
+
+class LegacyCache {
+private:
+    std::map<std::string, LegacyCachedResponse> cache;
+    mutable std::mutex cache_mutex;
+
+    static std::string generate_cache_key(const HttpRequest& request) {
+        std::string host = request.headers.has("Host") ? std::string(request.headers.get("Host")) : "unknown";
+        std::string path = request.path;
+        size_t scheme_end = path.find("://");
+        if (scheme_end != std::string::npos) {
+            size_t path_start = path.find('/', scheme_end + 3);
+            path = (path_start != std::string::npos) ? path.substr(path_start) : "/";
+        }
+        std::ostringstream oss;
+        oss << request.method << ":" << host << ":" << path;
+        return oss.str();
+    }
+
+public:
+    bool get(const HttpRequest& request, HttpResponse& response) {
+        std::string key = generate_cache_key(request);
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            if (it->second.is_expired()) {
+                cache.erase(it);
+                return false;
+            }
+            response = it->second.response;
+            Logger::info("✓ CACHE HIT - Retrieved in 0ms");
+            Logger::info("Key: " + key);
+            return true;
+        }
+        Logger::info("➤ CACHE MISS - Will fetch from server");
+        Logger::info("  Key: " + key);
+        return false;
+    }
+
+    void put(const HttpRequest& request, const HttpResponse& response) {
+        std::string key = generate_cache_key(request);
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        LegacyCachedResponse cached;
+        cached.response = response;
+        cached.cached_time = std::chrono::system_clock::now();
+        cached.ttl_seconds = 300; // What the bench's Cache-Control yields
+        cache[key] = cached;
+        Logger::info("💾 CACHED - Saved to cache");
+        Logger::info("Key: " + key);
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        return cache.size();
+    }
+};
+
+// ---- Workload ----
+
+struct Workload {
+    size_t key_space;     // Distinct URLs
+    size_t body_size;
+    int put_percent;      // Share of operations that store a response
+};
+
+std::vector<HttpRequest> make_requests(size_t count) {
+    std::vector<HttpRequest> requests(count);
+    for (size_t i = 0; i < count; i++) {
+        requests[i].method = "GET";
+        requests[i].path = "http://origin" + std::to_string(i % 64) + ".example/assets/" + std::to_string(i) + ".js";
+        requests[i].version = "HTTP/1.1";
+        requests[i].headers.set("Host", "origin" + std::to_string(i % 64) + ".example");
+    }
+    return requests;
+}
+
+HttpResponse make_response(size_t body_size) {
+    HttpResponse response;
+    response.version = "HTTP/1.1";
+    response.status_code = 200;
+    response.status_message = "OK";
+    response.headers.set("Content-Type", "application/javascript");
+    response.headers.set("Content-Length", std::to_string(body_size));
+    response.headers.set("Cache-Control", "max-age=300");
+    response.body.assign(body_size, 'x');
+    return response;
+}
+
+// What a hit hands back: a full copy before, a shared block now
+HttpResponse lookup_target(LegacyCache&) { return HttpResponse(); }
+std::shared_ptr<const CachedBlock> lookup_target(CacheManager&) { return nullptr; }
+
+struct Outcome {
+    double ops_per_second;
+    double hit_ratio;
+};
+
+// Each thread draws skewed keys (a few hot URLs, a long tail) and mixes
+// lookups with stores, as a proxy's handler threads would
+template <typename Cache>
+Outcome run(Cache& cache, const Workload& workload, int threads, int milliseconds,
+            const std::vector<HttpRequest>& requests, const HttpResponse& response) {
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> operations(0);
+    std::atomic<uint64_t> lookups(0);
+    std::atomic<uint64_t> found(0);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937_64 random(t + 1);
+            // Squaring a uniform draw favours low indexes
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            auto out = lookup_target(cache);
+            uint64_t local_ops = 0, local_lookups = 0, local_found = 0;
+            while (!go) {
+                std::this_thread::yield();
+            }
+            while (!stop) {
+                for (int i = 0; i < 64; i++) {
+                    double u = uniform(random);
+                    const HttpRequest& request = requests[static_cast<size_t>(u * u * workload.key_space)];
+                    if (static_cast<int>(random() % 100) < workload.put_percent) {
+                        cache.put(request, response);
+                    } else {
+                        local_lookups++;
+                        local_found += cache.get(request, out) ? 1 : 0;
+                    }
+                }
+                local_ops += 64;
+            }
+            operations += local_ops;
+            lookups += local_lookups;
+            found += local_found;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    stop = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Outcome outcome;
+    outcome.ops_per_second = operations / seconds;
+    outcome.hit_ratio = lookups ? static_cast<double>(found) / lookups : 0.0;
+    return outcome;
+}
+
+void run_workload(const char* name, const Workload& workload, size_t budget, int milliseconds) {
+    std::vector<HttpRequest> requests = make_requests(workload.key_space);
+    HttpResponse response = make_response(workload.body_size);
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+
+    std::printf("%s: %zu URLs, %zu-byte bodies, %d%% puts, budget %zu MB\n", name,
+                workload.key_space, workload.body_size, workload.put_percent, budget >> 20);
+    std::printf("  %7s %14s %14s %8s %7s %7s %9s %9s %9s\n", "threads", "legacy ops/s", "sharded ops/s",
+                "speedup", "hit%", "hit%", "legacy n", "sharded n", "evicted");
+
+    for (int threads = 1; threads <= static_cast<int>(cpus * 2); threads *= 2) {
+        LegacyCache legacy;
+        Outcome before = run(legacy, workload, threads, milliseconds, requests, response);
+
+        CacheManager cache(budget);
+        Outcome after = run(cache, workload, threads, milliseconds, requests, response);
+        CacheManager::Stats stats = cache.get_stats();
+
+        std::printf("  %7d %14.0f %14.0f %7.2fx %6.1f%% %6.1f%% %9zu %9zu %9llu%s\n", threads,
+                    before.ops_per_second, after.ops_per_second,
+                    after.ops_per_second / before.ops_per_second,
+                    before.hit_ratio * 100, after.hit_ratio * 100, legacy.size(), stats.entries,
+                    static_cast<unsigned long long>(stats.evictions),
+                    stats.bytes > stats.capacity ? "  OVER BUDGET" : "");
+    }
+    std::printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int milliseconds = argc > 1 ? std::atoi(argv[1]) : 500;
+    if (milliseconds <= 0) {
+        milliseconds = 500;
+    }
+    Logger::set_level(ERROR);
+
+    std::printf("Cache stress benchmark (%d ms per case)\n\n", milliseconds);
+
+    // Everything fits: pure lock contention
+    run_workload("hot set", Workload{10000, 1024, 5}, 256u << 20, milliseconds);
+    // Working set several times the budget: eviction on most puts
+    run_workload("over budget", Workload{200000, 4096, 20}, 64u << 20, milliseconds);
+
+    return 0;
+}
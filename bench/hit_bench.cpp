@@ -0,0 +1,221 @@
+// Cost of serving one cache hit: the previous path (copy the HttpResponse out
+// of the cache, rewrite Connection, serialize through an ostringstream, send)
+// against shared pre-serialized blocks written with one sendmsg.
+// Run: ./bin/hit_bench [milliseconds per case]
+
+#include "cache_manager.h"
+#include "http_handler.h"
+#include "logger.h"
+#include "response_batch.h"
+#include "socket_utils.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+
+// ---- Allocation accounting ----
+// Every heap block a hit allocates is filled by a copy, so allocated bytes
+// stand in for bytes copied in user space.
+
+namespace {
+    std::atomic<bool> counting(false);
+    std::atomic<uint64_t> allocations(0);
+    std::atomic<uint64_t> allocated_bytes(0);
+}
+
+void* operator new(size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+// ---- Previous hit path ----
+
+class LegacyCache {
+public:
+    void put(const HttpRequest& request, const HttpResponse& response) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        cache[key_for(request)] = response;
+    }
+
+    bool get(const HttpRequest& request, HttpResponse& response) {
+        std::string key = key_for(request);
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = cache.find(key);
+        if (it == cache.end()) {
+            return false;
+        }
+        response = it->second;
+        Logger::info("✓ CACHE HIT - Retrieved in 0ms");
+        Logger::info("Key: " + key);
+        return true;
+    }
+
+private:
+    std::map<std::string, HttpResponse> cache;
+    std::mutex cache_mutex;
+
+    static std::string key_for(const HttpRequest& request) {
+        std::ostringstream oss;
+        oss << request.method << ":" << request.headers.get("Host") << ":" << request.path;
+        return oss.str();
+    }
+};
+
+// ---- Harness ----
+
+HttpRequest make_request() {
+    HttpRequest request;
+    request.method = "GET";
+    request.path = "/static/js/app.3f9c2b1e.js";
+    request.version = "HTTP/1.1";
+    request.headers.set("Host", "www.example.com");
+    return request;
+}
+
+HttpResponse make_response(size_t body_size) {
+    HttpResponse response;
+    response.version = "HTTP/1.1";
+    response.status_code = 200;
+    response.status_message = "OK";
+    response.headers.set("Server", "nginx/1.25.4");
+    response.headers.set("Date", "Tue, 11 Jun 2024 08:15:42 GMT");
+    response.headers.set("Content-Type", "application/javascript; charset=utf-8");
+    response.headers.set("Content-Length", std::to_string(body_size));
+    response.headers.set("Last-Modified", "Mon, 10 Jun 2024 17:02:11 GMT");
+    response.headers.set("ETag", "\"5f3c-18a2b9c4d10\"");
+    response.headers.set("Cache-Control", "public, max-age=31536000, immutable");
+    response.headers.set("Vary", "Accept-Encoding");
+    response.body.assign(body_size, 'x');
+    return response;
+}
+
+// Reads everything the hit wrote so the socket never fills up
+void drain(int fd, size_t expected) {
+    static char sink[1 << 16];
+    while (expected > 0) {
+        ssize_t received = recv(fd, sink, std::min(sizeof(sink), expected), 0);
+        if (received <= 0) {
+            std::perror("recv");
+            std::exit(1);
+        }
+        expected -= received;
+    }
+}
+
+// 'hit' serves one response and returns the bytes it sent
+void run_case(const char* name, int milliseconds, int reader, const std::function<size_t()>& hit) {
+    using Clock = std::chrono::steady_clock;
+
+    for (int i = 0; i < 1000; i++) {
+        drain(reader, hit());
+    }
+
+    uint64_t iterations = 0;
+    uint64_t sent = 0;
+    allocations = 0;
+    allocated_bytes = 0;
+    auto deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+    auto start = Clock::now();
+    Clock::time_point now;
+    do {
+        for (int i = 0; i < 64; i++) {
+            counting = true;
+            size_t bytes = hit();
+            counting = false;
+            sent += bytes;
+            drain(reader, bytes);
+        }
+        iterations += 64;
+        now = Clock::now();
+    } while (now < deadline);
+
+    double seconds = std::chrono::duration<double>(now - start).count();
+    std::printf("  %-28s %9.0f ns/hit %9.1f allocs/hit %11.0f B copied/hit %9llu B sent/hit\n", name,
+                seconds * 1e9 / iterations, static_cast<double>(allocations) / iterations,
+                static_cast<double>(allocated_bytes) / iterations,
+                static_cast<unsigned long long>(sent / iterations));
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int milliseconds = argc > 1 ? std::atoi(argv[1]) : 300;
+    if (milliseconds <= 0) {
+        milliseconds = 300;
+    }
+    Logger::set_level(ERROR);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        std::perror("socketpair");
+        return 1;
+    }
+    int buffer_size = 4 << 20;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    std::printf("Cache hit benchmark (%d ms per case; allocation bytes are heap blocks\n"
+                "filled per hit, i.e. user-space copies; the kernel copy is the same for both)\n\n",
+                milliseconds);
+
+    HttpRequest request = make_request();
+    for (size_t body_size : {size_t(512), size_t(16 * 1024), size_t(256 * 1024)}) {
+        HttpResponse response = make_response(body_size);
+        std::printf("%zu-byte body\n", body_size);
+
+        LegacyCache legacy;
+        legacy.put(request, response);
+        run_case("copy + serialize + send", milliseconds, fds[1], [&]() -> size_t {
+            HttpResponse cached;
+            legacy.get(request, cached);
+            HttpHandler::prepare_client_response(cached, true);
+            std::string serialized = HttpHandler::serialize_response(cached);
+            SocketUtils::send_all(fds[0], serialized.data(), serialized.size());
+            return serialized.size();
+        });
+
+        CacheManager cache;
+        cache.put(request, response);
+        ResponseBatch batch;
+        run_case("shared block + sendmsg", milliseconds, fds[1], [&]() -> size_t {
+            std::shared_ptr<const CachedBlock> block;
+            cache.get(request, block);
+            batch.add(std::move(block), true);
+            size_t bytes = batch.pending_bytes();
+            while (!batch.empty()) {
+                batch.send(fds[0]);
+            }
+            return bytes;
+        });
+        std::printf("\n");
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
@@ -0,0 +1,163 @@
+// Cache hits per second with INFO logging off, on through the asynchronous
+// logger, and on through the previous logger (localtime + put_time per line,
+// std::cout with std::endl). Log output goes to /dev/null; results are
+// printed to stderr. Run: ./bin/log_bench [milliseconds per case]
+
+#include "cache_manager.h"
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// ---- Previous logger ----
+
+class LegacyLogger {
+public:
+    static void info(const std::string& message) {
+        std::cout << "[" << get_timestamp() << "] [INFO] " << message << std::endl;
+    }
+
+private:
+    static std::string get_timestamp() {
+        auto now = std::chrono::system_clock::now();
+        auto time = std::chrono::system_clock::to_time_t(now);
+        std::ostringstream oss;
+        oss << std::put_time(std::localtime(&time), "%Y-%m-%d %H:%M:%S");
+        return oss.str();
+    }
+};
+
+// ---- Workload ----
+
+const size_t KEY_SPACE = 1000;
+
+std::vector<HttpRequest> make_requests() {
+    std::vector<HttpRequest> requests(KEY_SPACE);
+    for (size_t i = 0; i < KEY_SPACE; i++) {
+        requests[i].method = "GET";
+        requests[i].path = "http://origin.example/assets/" + std::to_string(i) + ".js";
+        requests[i].version = "HTTP/1.1";
+        requests[i].headers.set("Host", "origin.example");
+    }
+    return requests;
+}
+
+HttpResponse make_response() {
+    HttpResponse response;
+    response.version = "HTTP/1.1";
+    response.status_code = 200;
+    response.status_message = "OK";
+    response.headers.set("Content-Type", "application/javascript");
+    response.headers.set("Content-Length", "1024");
+    response.headers.set("Cache-Control", "max-age=300");
+    response.body.assign(1024, 'x');
+    return response;
+}
+
+// Returns hits per second over all threads
+double run(int threads, int milliseconds, const std::function<void(size_t)>& hit) {
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> operations(0);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            size_t next = static_cast<size_t>(t) * 7919;
+            uint64_t local_ops = 0;
+            while (!go) {
+                std::this_thread::yield();
+            }
+            while (!stop) {
+                for (int i = 0; i < 64; i++) {
+                    hit(next++ % KEY_SPACE);
+                }
+                local_ops += 64;
+            }
+            operations += local_ops;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+    stop = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return operations / seconds;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int milliseconds = argc > 1 ? std::atoi(argv[1]) : 500;
+    if (milliseconds <= 0) {
+        milliseconds = 500;
+    }
+    // Both loggers write to stdout; discard it
+    if (!std::freopen("/dev/null", "w", stdout)) {
+        std::perror("/dev/null");
+        return 1;
+    }
+
+    std::vector<HttpRequest> requests = make_requests();
+    HttpResponse response = make_response();
+    CacheManager cache;
+    Logger::set_level(ERROR);
+    for (const auto& request : requests) {
+        cache.put(request, response);
+    }
+
+    // Each hit logs four INFO lines from CacheManager::get
+    auto hit = [&](size_t i) {
+        std::shared_ptr<const CachedBlock> block;
+        cache.get(requests[i], block);
+    };
+    auto legacy_hit = [&](size_t i) {
+        std::shared_ptr<const CachedBlock> block;
+        cache.get(requests[i], block);
+        LegacyLogger::info("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+        LegacyLogger::info("✓ CACHE HIT - Retrieved in 0ms");
+        LegacyLogger::info("Key: GET:origin.example:/assets/" + std::to_string(i) + ".js");
+        LegacyLogger::info("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+    };
+
+    std::fprintf(stderr, "Logging cost on the cache hit path (%d ms per case, 4 INFO lines per hit)\n\n",
+                 milliseconds);
+    std::fprintf(stderr, "  %7s %14s %14s %14s %10s\n", "threads", "INFO off/s", "async INFO/s",
+                 "previous/s", "dropped");
+
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    for (int threads = 1; threads <= static_cast<int>(cpus * 2); threads *= 2) {
+        Logger::set_level(WARNING);
+        double off = run(threads, milliseconds, hit);
+
+        uint64_t dropped_before = Logger::dropped();
+        Logger::set_level(INFO);
+        double async = run(threads, milliseconds, hit);
+        uint64_t dropped = Logger::dropped() - dropped_before;
+
+        Logger::set_level(WARNING);
+        double previous = run(threads, milliseconds, legacy_hit);
+
+        std::fprintf(stderr, "  %7d %14.0f %14.0f %14.0f %9.1f%%\n", threads, off, async, previous,
+                     async > 0 ? 100.0 * dropped / (async * milliseconds / 1000.0 * 4) : 0.0);
+    }
+    std::fprintf(stderr, "\nDropped: share of async INFO records lost to full per-thread buffers.\n"
+                         "Build with -DPROXY_LOG_LEVEL=WARNING to compile INFO out entirely.\n");
+    return 0;
+}
@@ -0,0 +1,236 @@
+// Compares the incremental HttpParser with the istringstream-based parser
+// HttpHandler used before it. Run: ./bin/parser_bench [milliseconds per case]
+
+#include "http_handler.h"
+#include "http_parser.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// ---- Previous implementation, kept verbatim for comparison ----
+
+std::string legacy_trim(const std::string& str) {
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) return "";
+    size_t last = str.find_last_not_of(" \t\r\n");
+    return str.substr(first, (last - first + 1));
+}
+
+HttpRequest legacy_parse_request(const std::string& raw_request) {
+    HttpRequest req;
+    std::istringstream iss(raw_request);
+    std::string line;
+
+    if (std::getline(iss, line)) {
+        std::istringstream line_stream(line);
+        line_stream >> req.method >> req.path >> req.version;
+    }
+
+    while (std::getline(iss, line) && line != "\r") {
+        if (line.empty() || line == "\r") break;
+
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string key = legacy_trim(line.substr(0, colon));
+            std::string value = legacy_trim(line.substr(colon + 1));
+            req.headers.set(key, value);
+        }
+    }
+
+    std::string body_content;
+    while (std::getline(iss, body_content)) {
+        req.body += body_content + "\n";
+    }
+
+    return req;
+}
+
+HttpResponse legacy_parse_response(const std::string& raw_response) {
+    HttpResponse resp;
+    std::istringstream iss(raw_response);
+    std::string line;
+
+    if (std::getline(iss, line)) {
+        std::istringstream line_stream(line);
+        line_stream >> resp.version >> resp.status_code >> resp.status_message;
+    }
+
+    while (std::getline(iss, line) && line != "\r") {
+        if (line.empty() || line == "\r") break;
+
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string key = legacy_trim(line.substr(0, colon));
+            std::string value = legacy_trim(line.substr(colon + 1));
+            resp.headers.set(key, value);
+        }
+    }
+
+    std::string body_content;
+    while (std::getline(iss, body_content)) {
+        resp.body += body_content + "\n";
+    }
+
+    return resp;
+}
+
+// ---- Inputs ----
+
+const std::string SMALL_REQUEST =
+    "GET http://example.com/ HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+const std::string BROWSER_REQUEST =
+    "GET http://www.example.com/static/js/app.3f9c2b1e.js?v=20240611 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/126.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: http://www.example.com/products/category/outdoor-equipment?page=3&sort=price\r\n"
+    "Cookie: session=7b3c9f0e2a4d4b8c9e1f; prefs=theme%3Ddark%26lang%3Den; _ga=GA1.2.1234567890.1700000000; "
+    "_gid=GA1.2.987654321.1718000000; cart=a1b2c3d4e5f6\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "If-None-Match: \"5f3c-18a2b9c4d10\"\r\n"
+    "If-Modified-Since: Tue, 11 Jun 2024 08:15:42 GMT\r\n"
+    "Proxy-Connection: keep-alive\r\n"
+    "\r\n";
+
+std::string make_response() {
+    std::string body(1024, 'x');
+    return "HTTP/1.1 200 OK\r\n"
+           "Server: nginx/1.25.4\r\n"
+           "Date: Tue, 11 Jun 2024 08:15:42 GMT\r\n"
+           "Content-Type: application/javascript; charset=utf-8\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "Last-Modified: Mon, 10 Jun 2024 17:02:11 GMT\r\n"
+           "ETag: \"5f3c-18a2b9c4d10\"\r\n"
+           "Cache-Control: public, max-age=31536000, immutable\r\n"
+           "Vary: Accept-Encoding\r\n"
+           "Accept-Ranges: bytes\r\n"
+           "\r\n" + body;
+}
+
+// ---- Harness ----
+
+volatile size_t sink;
+
+void run_case(const char* name, size_t bytes, int milliseconds, const std::function<size_t()>& body) {
+    using Clock = std::chrono::steady_clock;
+
+    // Warm up caches and the branch predictor
+    for (int i = 0; i < 1000; i++) {
+        sink = body();
+    }
+
+    uint64_t iterations = 0;
+    auto deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+    auto start = Clock::now();
+    Clock::time_point now;
+    do {
+        for (int i = 0; i < 256; i++) {
+            sink = body();
+        }
+        iterations += 256;
+        now = Clock::now();
+    } while (now < deadline);
+
+    double seconds = std::chrono::duration<double>(now - start).count();
+    double ns_per_op = seconds * 1e9 / iterations;
+    double mb_per_s = (bytes * iterations) / seconds / (1024.0 * 1024.0);
+    std::printf("  %-34s %10.1f ns/op %10.1f MB/s\n", name, ns_per_op, mb_per_s);
+}
+
+// Feed 'message' to a parser in 'chunk'-byte reads, as the socket would
+size_t parse_in_chunks(HttpParser& parser, const std::string& message, size_t chunk) {
+    parser.reset();
+    HttpParser::Result result = HttpParser::Result::NEED_MORE;
+    for (size_t length = chunk; result == HttpParser::Result::NEED_MORE; length += chunk) {
+        result = parser.parse(message.data(), std::min(length, message.size()));
+    }
+    return parser.header_count();
+}
+
+// What the old read loop did: search the whole buffer for "\r\n\r\n" after
+// each read, then parse the head with the legacy parser
+size_t legacy_in_chunks(const std::string& message, size_t chunk) {
+    size_t header_end = std::string::npos;
+    std::string buffer;
+    for (size_t offset = 0; header_end == std::string::npos; offset += chunk) {
+        buffer.append(message, offset, chunk);
+        header_end = buffer.find("\r\n\r\n");
+    }
+    return legacy_parse_request(buffer.substr(0, header_end + 4)).headers.size();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int milliseconds = argc > 1 ? std::atoi(argv[1]) : 300;
+    if (milliseconds <= 0) {
+        milliseconds = 300;
+    }
+    const std::string response = make_response();
+
+    std::printf("HTTP parser benchmark (%d ms per case, scanner: %s)\n\n",
+                milliseconds, HttpParser::scan_implementation());
+
+    struct Input {
+        const char* name;
+        const std::string& request;
+    };
+    for (const Input& input : {Input{"small request", SMALL_REQUEST}, Input{"browser request", BROWSER_REQUEST}}) {
+        std::printf("%s (%zu bytes)\n", input.name, input.request.size());
+        const std::string& request = input.request;
+
+        run_case("legacy parse_request", request.size(), milliseconds, [&]() {
+            return legacy_parse_request(request).headers.size();
+        });
+        run_case("HttpHandler::parse_request", request.size(), milliseconds, [&]() {
+            return HttpHandler::parse_request(request).headers.size();
+        });
+        HttpParser parser(HttpParser::Kind::REQUEST);
+        run_case("HttpParser (views only)", request.size(), milliseconds, [&]() {
+            parser.reset();
+            parser.parse(request.data(), request.size());
+            return parser.header_count();
+        });
+        run_case("legacy, 64-byte reads", request.size(), milliseconds, [&]() {
+            return legacy_in_chunks(request, 64);
+        });
+        run_case("HttpParser, 64-byte reads", request.size(), milliseconds, [&]() {
+            return parse_in_chunks(parser, request, 64);
+        });
+        std::printf("\n");
+    }
+
+    std::printf("response with 1 KB body (%zu bytes)\n", response.size());
+    run_case("legacy parse_response", response.size(), milliseconds, [&]() {
+        return legacy_parse_response(response).body.size();
+    });
+    run_case("HttpHandler::parse_response", response.size(), milliseconds, [&]() {
+        return HttpHandler::parse_response(response).body.size();
+    });
+    HttpParser response_parser(HttpParser::Kind::RESPONSE);
+    run_case("HttpParser (views only)", response.size(), milliseconds, [&]() {
+        response_parser.reset();
+        response_parser.parse(response.data(), response.size());
+        return response_parser.head_length();
+    });
+
+    return 0;
+}
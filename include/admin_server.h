@@ -0,0 +1,37 @@
+#ifndef ADMIN_SERVER_H
+#define ADMIN_SERVER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include "proxy_context.h"
+
+// Serves GET /metrics in Prometheus text format on a loopback-only port,
+// from one thread of its own so scrapes never run on a proxy thread. The
+// response combines Metrics with the stats of the shared services.
+class AdminServer {
+public:
+    AdminServer(std::shared_ptr<ProxyContext> context, int port);
+    ~AdminServer();
+
+    AdminServer(const AdminServer&) = delete;
+    AdminServer& operator=(const AdminServer&) = delete;
+
+    bool start();
+    void stop();
+
+    std::string render_metrics() const;
+
+private:
+    std::shared_ptr<ProxyContext> context;
+    int port;
+    int server_socket;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    void serve();
+    void handle(int client_socket);
+};
+
+#endif // ADMIN_SERVER_H
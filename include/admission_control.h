@@ -0,0 +1,91 @@
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "metrics.h"
+
+// Overload protection shared by every shard: caps on open client
+// connections (in total and per client address), token-bucket request rates
+// (in total and per client address), and the queue-time target past which
+// requests that would go upstream are shed. Every limit is off at 0.
+// Refusals are counted in Metrics as they happen.
+//
+// Buckets are kept as the time the next request is due (GCRA), so taking a
+// token is one compare-and-swap for the global bucket and a shard lock for a
+// client's. A bucket holds one second's worth of tokens.
+class AdmissionControl {
+public:
+    struct Limits {
+        int max_connections = 0;
+        int max_connections_per_ip = 0;
+        int request_rate = 0;        // Requests per second
+        int request_rate_per_ip = 0;
+        std::chrono::milliseconds queue_target{0};
+    };
+
+    explicit AdmissionControl(const Limits& limits);
+
+    AdmissionControl(const AdmissionControl&) = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+    // Count a new client connection; false if it would exceed a limit, in
+    // which case nothing was counted. 'client' is set to the key the
+    // other calls take (the peer address, or empty when no per-client limit
+    // is set).
+    bool admit_connection(int client_socket, std::string& client);
+    // Once per admitted connection, when it closes
+    void release_connection(const std::string& client);
+    // Admitted connections not yet released
+    int open_connections() const { return connections.load(std::memory_order_relaxed); }
+
+    // Take a token for one request: 0 if admitted, otherwise the seconds
+    // until one is due, for Retry-After
+    int admit_request(const std::string& client);
+
+    // Whether a request that became ready at 'ready_since' has waited past
+    // the queue target
+    bool over_queue_target(Metrics::Clock::time_point ready_since) const {
+        return limits.queue_target.count() > 0 && Metrics::Clock::now() - ready_since > limits.queue_target;
+    }
+
+    // Forget clients with no connections and full buckets
+    void prune();
+
+    // Ready-to-send refusals: 503 for overload, 429 for a rate limit
+    static std::string overloaded_response(int retry_after = 1);
+    static std::string rate_limited_response(int retry_after);
+
+private:
+    struct Client {
+        int connections = 0;
+        int64_t next_request = 0; // Bucket state, ns on Metrics::Clock
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Client> clients;
+    };
+
+    static const size_t SHARD_COUNT = 16;
+
+    Limits limits;
+    bool per_client; // Any per-address limit set
+    int64_t interval;          // ns between requests at request_rate
+    int64_t interval_per_ip;
+    std::atomic<int> connections;
+    std::atomic<int64_t> next_request;
+    Shard shards[SHARD_COUNT];
+
+    Shard& shard_for(const std::string& client);
+    // Take a token from a bucket; 0 if there was one, otherwise the ns
+    // until there is
+    static int64_t take_token(int64_t& next_request, int64_t interval, int64_t now);
+    static int retry_after_seconds(int64_t wait);
+};
+
+#endif // ADMISSION_CONTROL_H
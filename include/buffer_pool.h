@@ -0,0 +1,43 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+
+// A fixed-size I/O buffer taken from a per-thread free list. Reads use these
+// instead of stack arrays or fresh heap blocks, so chunks can be large
+// without a malloc per read or a big frame on every worker stack. A buffer
+// goes back to the free list of the thread that drops it; each list keeps at
+// most MAX_FREE_PER_THREAD buffers and frees the rest, which bounds what an
+// idle thread holds on to. The lists take no lock.
+class PooledBuffer {
+public:
+    static const size_t SIZE = 32768;
+    static const size_t MAX_FREE_PER_THREAD = 32;
+
+    // Empty; holds no buffer
+    PooledBuffer() = default;
+    ~PooledBuffer() { release(); }
+
+    PooledBuffer(PooledBuffer&& other) noexcept : block(other.block) { other.block = nullptr; }
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    // A buffer from this thread's free list, allocated if the list is empty
+    static PooledBuffer acquire();
+
+    char* data() const { return block; }
+    static constexpr size_t size() { return SIZE; }
+    explicit operator bool() const { return block != nullptr; }
+
+    // Hand the buffer back to the free list now
+    void release();
+
+    // Buffers on the calling thread's free list
+    static size_t free_count();
+
+private:
+    char* block = nullptr;
+};
+
+#endif // BUFFER_POOL_H
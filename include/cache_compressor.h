@@ -0,0 +1,81 @@
+#ifndef CACHE_COMPRESSOR_H
+#define CACHE_COMPRESSOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include "http_handler.h"
+#include "thread_pool.h"
+
+struct CachedBlock;
+
+// Background gzip compression of cached text bodies. CacheManager stores a
+// response as it arrived and submits the block here; a worker thread deflates
+// the body and hands back a block whose head announces gzip, which then
+// replaces the stored one and is charged at its compressed size. The
+// compressed block keeps the original head, so a hit from a client without
+// gzip in Accept-Encoding is inflated on the fly.
+class CacheCompressor {
+public:
+    struct Stats {
+        uint64_t compressed;     // Bodies now stored compressed
+        uint64_t incompressible; // Compressed, but too little smaller to keep
+        uint64_t dropped;        // Not compressed: queue full or zlib error
+        uint64_t inflated;       // Hits decompressed for a client without gzip
+        uint64_t input_bytes;    // Body bytes of the compressed entries
+        uint64_t output_bytes;   // ... after compression
+        double deflate_seconds;  // CPU time spent compressing
+        double inflate_seconds;  // CPU time spent decompressing hits
+    };
+
+    // Runs on the worker thread with the compressed block
+    using Done = std::function<void(std::shared_ptr<const CachedBlock> compressed)>;
+
+    // Smaller bodies gain too little to be worth a worker's time
+    static const size_t MIN_BODY_BYTES = 256;
+
+    CacheCompressor(size_t threads, int level);
+    ~CacheCompressor();
+
+    CacheCompressor(const CacheCompressor&) = delete;
+    CacheCompressor& operator=(const CacheCompressor&) = delete;
+
+    // A 200 with a text body of at least MIN_BODY_BYTES that the origin did
+    // not encode, and at most Vary: Accept-Encoding
+    static bool is_compressible(const HttpResponse& response);
+    // gzip (or *) in Accept-Encoding with a non-zero q-value
+    static bool accepts_gzip(const HttpRequest& request);
+
+    // Queue the block's body for compression; 'done' runs only if the
+    // result is worth keeping. False if the queue is full.
+    bool submit(std::shared_ptr<const CachedBlock> block, Done done);
+
+    // The uncompressed copy of a compressed block for one client, counted in
+    // the stats; null if the body is corrupt
+    std::shared_ptr<const CachedBlock> inflate(const CachedBlock& block);
+    // Same without the stats, for callers that have no compressor
+    static std::shared_ptr<const CachedBlock> decompress(const CachedBlock& block);
+
+    // Compress what is queued, then stop the workers
+    void shutdown();
+
+    Stats get_stats() const;
+
+private:
+    int level;
+    std::unique_ptr<ThreadPool> workers;
+
+    std::atomic<uint64_t> compressed;
+    std::atomic<uint64_t> incompressible;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> inflated;
+    std::atomic<uint64_t> input_bytes;
+    std::atomic<uint64_t> output_bytes;
+    std::atomic<uint64_t> deflate_nanos;
+    std::atomic<uint64_t> inflate_nanos;
+
+    void compress(const CachedBlock& block, const Done& done);
+};
+
+#endif // CACHE_COMPRESSOR_H
@@ -0,0 +1,55 @@
+#ifndef CACHE_FILL_H
+#define CACHE_FILL_H
+
+#include <cstddef>
+#include "cache_manager.h"
+#include "http_framing.h"
+#include "http_handler.h"
+
+// Builds a cache entry from a response while it is relayed to the client.
+// The body arrives through the framer's body sink, already de-chunked, and
+// the entry is only stored once the framer has seen the response end where
+// its framing says it does. Buffering stops for good as soon as the response
+// turns out to be uncacheable or larger than the object limit, so a large
+// download is relayed without being held in memory.
+class CacheFill {
+public:
+    // max_object_bytes == 0 disables filling
+    explicit CacheFill(size_t max_object_bytes = 0);
+
+    CacheFill(const CacheFill&) = delete;
+    CacheFill& operator=(const CacheFill&) = delete;
+
+    // Start collecting the response 'framer' is about to parse. Only GET
+    // responses are collected; call again after replacing the framer.
+    void begin(const HttpRequest& request, ResponseFramer& framer);
+
+    // The response ended (or the connection closed): store it if the framer
+    // completed it, then drop the buffered copy
+    void finish(CacheManager& cache, const HttpRequest& request, const ResponseFramer& framer);
+
+    void reset();
+    size_t buffered() const { return response.body.size(); }
+
+    // Frame a complete, de-chunked response by Content-Length
+    static void frame_by_length(HttpResponse& response);
+
+private:
+    enum class State {
+        IDLE,       // Not collecting
+        WAITING,    // Collecting; head not looked at yet
+        BUFFERING,  // Cacheable so far
+        SKIPPED     // Uncacheable or too large; nothing is kept
+    };
+
+    size_t max_object_bytes;
+    State state;
+    HttpResponse response;
+
+    // Decide from the head whether the body is worth buffering
+    void take_head(const ResponseFramer& framer);
+    void on_body(const ResponseFramer& framer, const char* data, size_t length);
+    void skip(const std::string& reason);
+};
+
+#endif // CACHE_FILL_H
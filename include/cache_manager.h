@@ -3,50 +3,317 @@
 
 #include <string>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <atomic>
 #include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
 #include "http_handler.h"
+#include "disk_cache.h"
+#include "cache_compressor.h"
+
+// A response serialized once, when it is stored, then shared read-only by
+// every hit. Connection differs per client, so it is left out of the head and
+// written between head and body at send time. Blocks found in the disk
+// tier hold only the head; their body stays in the segment file.
+struct CachedBlock {
+    std::string bytes;   // Head without Connection or the blank line, then the body
+    size_t head_length;
+    bool framed;         // Content-Length matches the body, so the client connection can be kept
+    int status_code;
+
+    std::shared_ptr<DiskSegment> segment; // Disk tier only
+    uint64_t file_offset = 0;
+    uint64_t file_length = 0;
+
+    // Body gzipped by the cache (see CacheCompressor): the head announces
+    // the encoding, and identity_head is the one to send with the inflated body
+    bool gzipped = false;
+    std::string identity_head;
+    size_t identity_length = 0;
+
+    bool on_disk() const { return segment != nullptr; }
+    const char* head() const { return bytes.data(); }
+    const char* body() const { return bytes.data() + head_length; } // In-memory blocks only
+    size_t body_length() const { return on_disk() ? file_length : bytes.size() - head_length; }
+
+    static std::shared_ptr<const CachedBlock> from_response(const HttpResponse& response);
+};
 
 struct CachedResponse {
-    HttpResponse response;
+    std::shared_ptr<const CachedBlock> block;
     std::chrono::system_clock::time_point cached_time;
     int ttl_seconds; // Time to live in seconds
-    
+
+    // Validators for a conditional refresh, and how long past expiry the
+    // copy may still be served (Cache-Control stale-while-revalidate and
+    // stale-if-error)
+    std::string etag;
+    std::string last_modified;
+    int stale_while_revalidate = 0;
+    int stale_if_error = 0;
+
+    // Expired copies with validators are kept this long for revalidation
+    static const int REVALIDATE_WINDOW = 3600;
+
     bool is_expired() const {
+        return seconds_stale() > 0;
+    }
+
+    // Seconds since the copy expired; zero or less while fresh
+    long seconds_stale() const {
         auto now = std::chrono::system_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - cached_time);
-        return duration.count() > ttl_seconds;
+        return duration.count() - ttl_seconds;
+    }
+
+    bool has_validators() const { return !etag.empty() || !last_modified.empty(); }
+
+    // Worth keeping after expiry: it can be revalidated or served stale
+    bool is_retained() const {
+        long stale = seconds_stale();
+        return stale <= 0 || stale <= std::max({stale_while_revalidate, stale_if_error,
+                                                has_validators() ? REVALIDATE_WINDOW : 0});
     }
 };
 
-class CacheManager {
-private:
-    std::map<std::string, CachedResponse> cache;
-    mutable std::mutex cache_mutex;
-    bool cache_enabled;
-    
-    static std::string generate_cache_key(const HttpRequest& request);
-    static int extract_ttl_from_headers(const std::map<std::string, std::string>& headers);
+// What a conditional refresh needs from an expired entry
+struct StaleCopy {
+    std::string etag;
+    std::string last_modified;
+};
+
+enum class StaleUse {
+    WHILE_REVALIDATING, // Within stale-while-revalidate
+    ON_ERROR            // Within stale-if-error, after the refresh failed
+};
 
+// Response cache split into hash-selected shards, each with its own lock and
+// LRU list. A byte budget shared by all shards is enforced on put() by
+// evicting least recently used entries. With a compressor, text bodies are
+// gzipped in the background after put() and charged at their compressed
+// size; lookups hand gzip-capable clients the compressed block and inflate
+// it for the rest.
+class CacheManager {
 public:
-    CacheManager();
+    struct Stats {
+        uint64_t hits;         // Including disk_hits
+        uint64_t disk_hits;
+        uint64_t misses;
+        uint64_t insertions;
+        uint64_t evictions;    // Dropped to stay within the byte budget
+        uint64_t expirations;  // Dropped because their TTL ran out
+        uint64_t rejected;     // Too large to cache
+        uint64_t collapsed;    // Misses that waited for another client's fetch
+        uint64_t fetches_saved; // ... and were then answered from the cache
+        uint64_t collapse_timeouts; // ... or gave up waiting
+        uint64_t stale_hits;   // Expired copies served under stale-while-revalidate/stale-if-error
+        uint64_t revalidated;  // Copies renewed by a 304
+        uint64_t refreshed_ahead; // Hot entries refreshed before they expired
+        uint64_t ahead_throttled; // ... held back by the concurrency limit
+        uint64_t misses_avoided;  // Hits past the expiry a refresh-ahead put off
+        size_t entries;
+        size_t bytes;          // Approximate memory held by entries
+        size_t capacity;       // Byte budget
+    };
+
+    // Runs on the fetching thread once a fetch this miss waited for ends
+    using FetchWaiter = std::function<void()>;
+
+    // Refresh-ahead: an entry hit min_hits times since it was stored is
+    // refreshed in the background once a hit finds it in the last
+    // window_percent of its TTL, so hot objects do not expire under their
+    // clients. At most max_in_flight such refreshes run at once.
+    struct RefreshAhead {
+        int min_hits = 0; // 0 = off
+        int window_percent = 10;
+        int max_in_flight = 4;
+    };
+    // Starts a refresh of the entry for 'request', conditional on
+    // 'validators'; false if it could not be started. 'expires' is when
+    // the current copy runs out, for end_refresh_ahead().
+    using Refresher = std::function<bool(const HttpRequest& request, const StaleCopy& validators,
+                                         std::chrono::system_clock::time_point expires)>;
+
+    static const size_t DEFAULT_MAX_BYTES = 256 * 1024 * 1024;
+
+    explicit CacheManager(size_t max_bytes = DEFAULT_MAX_BYTES);
     ~CacheManager();
-    
-    // Check if response is in cache and not expired
-    bool get(const HttpRequest& request, HttpResponse& response);
-    
+
+    CacheManager(const CacheManager&) = delete;
+    CacheManager& operator=(const CacheManager&) = delete;
+
+    // Check if response is in cache and not expired. The block is shared
+    // with the cache, not copied, unless it had to be inflated for a
+    // client that does not accept gzip.
+    bool get(const HttpRequest& request, std::shared_ptr<const CachedBlock>& block);
+
     // Store response in cache
     void put(const HttpRequest& request, const HttpResponse& response);
-    
+
+    // Whether put() would keep a response with this status and these
+    // headers, so callers can skip buffering bodies that would be refused
+    static bool is_cacheable(const HttpResponse& response);
+
+    // "METHOD:host:/path" for a request in origin or absolute form
+    static std::string generate_cache_key(const HttpRequest& request);
+
+    // Collapsed forwarding. After a miss, begin_fetch() returns true for the
+    // first caller per key, which fetches from upstream and then calls
+    // end_fetch() whether or not the response was stored. Later callers get
+    // false and 'waiter' is queued; once it runs (or they stop waiting) they
+    // call get_collapsed(), and fetch themselves if that misses. It does not
+    // count a hit or miss again: the request was already counted a miss.
+    bool begin_fetch(const HttpRequest& request, FetchWaiter waiter);
+    void end_fetch(const HttpRequest& request);
+    bool get_collapsed(const HttpRequest& request, std::shared_ptr<const CachedBlock>& block, bool timed_out);
+
+    // Expired entries kept for revalidation (see CachedResponse::is_retained).
+    // get_stale() returns the validators of one; serve_stale() returns its
+    // block if 'use' is allowed for it now.
+    bool get_stale(const HttpRequest& request, StaleCopy& copy);
+    bool serve_stale(const HttpRequest& request, StaleUse use, std::shared_ptr<const CachedBlock>& block);
+    // A 304 for an expired entry: restart its TTL, taking new freshness and
+    // validators from the 304's headers. False if the entry is gone.
+    bool refresh(const HttpRequest& request, const HttpResponse& not_modified);
+    // Forget an entry, e.g. because its refresh turned out uncacheable
+    void invalidate(const HttpRequest& request);
+
+    // Drop expired entries
+    void prune();
+
+    // Enable refresh-ahead; call before serving
+    void set_refresh_ahead(const RefreshAhead& policy, Refresher refresher);
+    // Once per refresh the Refresher started, after it renewed or replaced
+    // the entry (or failed to)
+    void end_refresh_ahead(const HttpRequest& request, std::chrono::system_clock::time_point expires);
+
+    // Entries evicted from memory go to 'disk' and misses are looked up there
+    void set_disk_tier(std::shared_ptr<DiskCache> disk);
+    // Write everything still in memory to the disk tier and wait for the
+    // writes, so a restart finds it; used on shutdown
+    void flush_to_disk();
+    // flush_to_disk(), then close the disk tier for the process taking over
+    // on an upgrade; this one carries on with memory only
+    void release_disk_tier();
+    // Take the disk tier back after an upgrade that failed; false if the
+    // directory is still locked by the other process
+    bool reopen_disk_tier();
+
+    // Gzip cacheable text bodies on the compressor's threads
+    void set_compressor(std::shared_ptr<CacheCompressor> compressor);
+
     // Clear all cache
     void clear();
-    
+
     // Get cache size
     size_t size() const;
-    
+
+    Stats get_stats() const;
+
     // Enable/disable caching
     void set_enabled(bool enabled);
     bool is_enabled() const;
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::string key;    // Full key, to tell hash collisions apart
+        CachedResponse cached;
+        size_t charge;      // Bytes counted against the budget
+        Entry* prev;        // Towards the most recently used
+        Entry* next;        // Towards the least recently used
+        uint32_t hits = 0;  // Since stored or renewed
+        bool refreshing_ahead = false; // Refresh-ahead started for this copy
+        // Expiry a refresh-ahead moved, until the first hit after it
+        std::chrono::system_clock::time_point renewed_ahead_of{};
+    };
+
+    // An evicted entry on its way to the disk tier
+    struct Spilled {
+        uint64_t hash;
+        std::string key;
+        CachedResponse cached;
+    };
+
+    // An upstream fetch in progress and the misses waiting for it
+    struct Fetch {
+        std::string key;
+        std::vector<FetchWaiter> waiters;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<uint64_t, std::unique_ptr<Entry>> index;
+        std::unordered_map<uint64_t, Fetch> fetches;
+        Entry* head = nullptr; // Most recently used
+        Entry* tail = nullptr; // Least recently used
+    };
+
+    static const size_t SHARD_COUNT = 16;
+
+    Shard shards[SHARD_COUNT];
+    size_t max_bytes;
+    std::atomic<size_t> total_bytes;
+    std::atomic<size_t> entry_count;
+    std::atomic<size_t> evict_cursor; // Next shard to take from when over budget
+    std::atomic<bool> cache_enabled;
+    std::shared_ptr<DiskCache> disk;
+    std::shared_ptr<CacheCompressor> compressor;
+    RefreshAhead ahead_policy;
+    Refresher refresher;
+    std::atomic<int> ahead_in_flight;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> disk_hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> insertions;
+    std::atomic<uint64_t> evictions;
+    std::atomic<uint64_t> expirations;
+    std::atomic<uint64_t> rejected;
+    std::atomic<uint64_t> collapsed;
+    std::atomic<uint64_t> fetches_saved;
+    std::atomic<uint64_t> collapse_timeouts;
+    std::atomic<uint64_t> stale_hits;
+    std::atomic<uint64_t> revalidated;
+    std::atomic<uint64_t> refreshed_ahead;
+    std::atomic<uint64_t> ahead_throttled;
+    std::atomic<uint64_t> misses_avoided;
+
+    static uint64_t hash_key(const std::string& key);
+    static int extract_ttl_from_headers(const HttpHeaders& headers);
+    // Validators and stale-* windows from the response headers
+    static void extract_revalidation(const HttpHeaders& headers, CachedResponse& cached);
+    static size_t charge_for(const std::string& key, const CachedBlock& block);
+
+    Shard& shard_for(uint64_t hash);
+    enum class Lookup { MEMORY, DISK, EXPIRED, MISS };
+    // Find a fresh copy of 'key' without counting a hit or miss
+    Lookup lookup(const HttpRequest& request, const std::string& key, std::shared_ptr<const CachedBlock>& block);
+    // Callers hold the shard's lock
+    static void unlink(Shard& shard, Entry* entry);
+    static void push_front(Shard& shard, Entry* entry);
+    void erase(Shard& shard, Entry* entry);
+    // Count a hit on a fresh entry with 'remaining' seconds to live; true
+    // if it is due a refresh-ahead, which the caller then starts
+    bool note_hit(Entry& entry, long remaining, StaleCopy& validators,
+                  std::chrono::system_clock::time_point& expires);
+    // Evict the LRU entry of 'shard', keeping it in 'spill' for the disk tier
+    void evict(Shard& shard, Entry* entry, std::vector<Spilled>& spill);
+    // Evict from the LRU end of 'shard' while over budget, sparing 'keep'
+    bool evict_lru(Shard& shard, const Entry* keep, std::vector<Spilled>& spill);
+    // Evict from the other shards, one lock at a time, until within budget
+    void enforce_budget(const Shard* skip, std::vector<Spilled>& spill);
+    // Swap a stored block for its compressed copy if the entry still holds it
+    void store_compressed(uint64_t hash, const std::string& key, const CachedBlock* original,
+                          std::shared_ptr<const CachedBlock> compressed);
+    // The variant of a stored block to send for this request; false if a
+    // compressed body could not be inflated
+    bool select_variant(const HttpRequest& request, std::shared_ptr<const CachedBlock>& block);
 };
 
 #endif // CACHE_MANAGER_H
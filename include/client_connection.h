@@ -0,0 +1,146 @@
+#ifndef CLIENT_CONNECTION_H
+#define CLIENT_CONNECTION_H
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include "event_loop.h"
+#include "http_handler.h"
+#include "proxy_context.h"
+#include "relay_direction.h"
+#include "http_framing.h"
+#include "response_batch.h"
+#include "cache_fill.h"
+#include "connect_race.h"
+#include "metrics.h"
+
+// Per-connection state machine for the epoll reactor. Implements the same
+// flow as ProxyServer::handle_client / handle_connect_tunnel, but each step
+// is driven by readiness events on the owning EventLoop thread. Persistent
+// clients cycle back to READING_REQUEST after each response, so pipelined
+// requests are answered one at a time, in order. On an io_uring loop the
+// upstream connect and the relay run as ring operations; requests are still
+// read on readiness.
+class ClientConnection : public EventLoop::Handler,
+                         public std::enable_shared_from_this<ClientConnection> {
+public:
+    ClientConnection(EventLoop& loop, int client_socket, std::shared_ptr<ProxyContext> context);
+    ~ClientConnection() override;
+
+    // Register the client socket with the loop and start reading the request
+    void start();
+
+    void handle_event(int fd, uint32_t events) override;
+    // Close now if waiting for a further request; otherwise the response
+    // in hand is the last
+    void on_drain() override;
+
+private:
+    enum class State {
+        READING_REQUEST,
+        WAITING_FOR_FETCH, // Another client is fetching this URL
+        RESOLVING,
+        CONNECTING,
+        RELAYING,
+        CLOSED
+    };
+
+    EventLoop& loop;
+    std::shared_ptr<ProxyContext> context;
+    int client_socket;
+    std::string client_key;        // For AdmissionControl
+    int target_socket;
+    State state;
+    bool is_tunnel;
+
+    std::string request_buffer;    // May hold several pipelined requests
+    HttpParser request_parser;     // Resumes across reads of request_buffer
+    HttpRequest request;
+    bool keep_alive;               // Read another request after this response
+    bool answered;                 // A request was read: idle means between requests
+    EventLoop::TimerId idle_timer; // 0 when not armed
+
+    // Collapsed forwarding
+    bool has_stale;                // An expired copy is being refreshed
+    bool fetch_leader;             // Our fetch; waiters are woken when it ends
+    uint64_t fetch_wait;           // Tells a stale wake-up from the current one
+    EventLoop::TimerId fetch_timer;
+
+    // Responses for a run of pipelined cache hits, written with one writev
+    ResponseBatch outbox;
+    std::string target_host;
+    int target_port;
+    std::shared_ptr<ConnectRace> connect_race; // While CONNECTING
+
+    // Upstream request, kept so a stale pooled connection can be retried
+    std::string upstream_request;
+    std::string body_prefix;       // Body bytes read along with the headers
+    uint64_t body_remaining;       // Body bytes still to come from the client
+    bool body_length_known;        // false for chunked request bodies
+    // The body of a request answered from the cache, read and dropped
+    // before the next request is parsed
+    ResponseFramer body_skip;
+    bool skipping_body;
+    bool pool_upstream;
+    bool reused_target;
+
+    // Finds the end of the response so the upstream connection can be pooled
+    ResponseFramer framer;
+    bool framing_failed;
+
+    RelayDirection to_target;  // client -> target
+    RelayDirection to_client;  // target -> client
+    bool target_write_closed;  // Tunnel half-close state
+    bool client_write_closed;
+    bool relay_scheduled;
+
+    // Response tap for the cache (plain HTTP only)
+    CacheFill cache_fill;
+    uint64_t response_bytes;
+
+    Metrics::Clock::time_point resolve_start;
+    std::chrono::high_resolution_clock::time_point connect_start;
+    std::chrono::high_resolution_clock::time_point transfer_start;
+
+    void on_client_readable();
+    void on_request_complete();
+    // Refuse a request that waited past the queue target; true if it did
+    bool shed_late_request();
+    void serve_from_cache(std::shared_ptr<const CachedBlock> cached_block);
+    // Drop what has arrived of the body being skipped; false if the
+    // connection was closed because its framing is malformed
+    bool skip_request_body();
+    // Queue behind another client's fetch of the same URL; false if this
+    // connection is to fetch it instead
+    bool wait_for_fetch();
+    void on_fetch_done(uint64_t wait, bool timed_out);
+    void end_fetch();
+    void fetch_from_origin();
+    void connect_to_target();
+    void on_resolved(const DnsResolver::Result& result);
+    uint32_t target_events() const;
+    // The race's winner, or -1 if no address could be reached
+    void on_target_connected(int socket_fd);
+    void cancel_connect();
+    void start_relay();
+    void relay();
+    size_t on_response_data(const char* data, size_t length);
+    void finish_response();
+    bool can_retry_upstream() const;
+    void retry_upstream();
+    void reset_for_next_request();
+    void arm_idle_timer();
+
+    // Write as much of the outbox as the socket takes; false if the
+    // connection was closed on error
+    bool flush_outbox();
+    // Move unsent outbox bytes in front of the next relayed response
+    bool hand_outbox_to_relay();
+
+    // Queue a final message to the client and close once it is flushed
+    void respond_and_close(const std::string& message);
+    void close_connection();
+};
+
+#endif // CLIENT_CONNECTION_H
@@ -0,0 +1,78 @@
+#ifndef CONNECT_RACE_H
+#define CONNECT_RACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "event_loop.h"
+#include "metrics.h"
+#include "socket_utils.h"
+
+// Upstream connect raced across a name's addresses, Happy Eyeballs style
+// (RFC 8305). Addresses are tried with their families interleaved; a new
+// attempt starts every attempt_delay, or at once when one fails, and the
+// first to connect wins while the others are closed. Every attempt gives up
+// after 'timeout'.
+//
+// Instances run on an EventLoop thread; connect() is the blocking variant
+// for the threaded handlers and the revalidator.
+class ConnectRace : public EventLoop::Handler, public std::enable_shared_from_this<ConnectRace> {
+public:
+    struct Options {
+        std::chrono::milliseconds attempt_delay{250};
+        std::chrono::milliseconds timeout{5000}; // Per attempt
+    };
+
+    // The connected socket (non-blocking, TCP_NODELAY), or -1 once every
+    // address failed
+    using Done = std::function<void(int socket_fd)>;
+
+    // 'addresses' in preference order, with 'port' set and the families
+    // alternating, starting with the first address's
+    static std::vector<SocketAddress> interleave(const std::vector<SocketAddress>& addresses, int port);
+
+    // Race with poll(2) and return the winner in blocking mode, or -1
+    static int connect(const std::vector<SocketAddress>& addresses, int port, const Options& options);
+
+    ConnectRace(EventLoop& loop, const std::vector<SocketAddress>& addresses, int port,
+                const Options& options, Done done);
+    ~ConnectRace() override;
+
+    ConnectRace(const ConnectRace&) = delete;
+    ConnectRace& operator=(const ConnectRace&) = delete;
+
+    // 'done' runs once, possibly before this returns
+    void start();
+    // Close every attempt; 'done' is not called
+    void cancel();
+
+    void handle_event(int fd, uint32_t events) override;
+
+private:
+    struct Attempt {
+        uint64_t id;
+        int fd;
+        const SocketAddress* address;
+        Metrics::Clock::time_point start;
+        EventLoop::TimerId timer;
+    };
+
+    EventLoop& loop;
+    std::vector<SocketAddress> addresses;
+    size_t next_address;
+    Options options;
+    Done done;
+    std::vector<Attempt> attempts;
+    uint64_t next_attempt_id;
+    EventLoop::TimerId delay_timer; // Starts the next attempt; 0 when not armed
+
+    void start_next();
+    bool launch(const SocketAddress& address);
+    void on_attempt_done(uint64_t id, int error);
+    void close_attempts();
+    void finish(int socket_fd);
+};
+
+#endif // CONNECT_RACE_H
@@ -0,0 +1,67 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Idle keep-alive connections to upstream servers, keyed by (host, port).
+// Shared by all handler threads; sockets are owned by the pool while idle.
+class ConnectionPool {
+public:
+    struct Stats {
+        uint64_t reused;    // acquire() returned a pooled connection
+        uint64_t misses;    // acquire() found nothing usable
+        uint64_t released;  // Connections returned for reuse
+        uint64_t discarded; // Dropped: over a cap, expired or dead
+        size_t idle;        // Currently pooled
+    };
+
+    ConnectionPool(size_t max_idle_per_host, size_t max_idle_total, int idle_timeout_seconds);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Returns a live idle socket to host:port, or -1
+    int acquire(const std::string& host, int port);
+
+    // Hand back a socket whose last response was fully read and allows reuse.
+    // The pool closes it instead if a cap is reached.
+    void release(const std::string& host, int port, int socket_fd);
+
+    // Close idle connections past their timeout
+    void prune();
+
+    Stats get_stats() const;
+    bool is_enabled() const { return max_idle_total > 0 && max_idle_per_host > 0; }
+
+private:
+    struct IdleConnection {
+        int socket_fd;
+        std::chrono::steady_clock::time_point idle_since;
+    };
+
+    size_t max_idle_per_host;
+    size_t max_idle_total;
+    std::chrono::seconds idle_timeout;
+
+    mutable std::mutex pool_mutex;
+    std::unordered_map<std::string, std::deque<IdleConnection>> idle;
+    size_t idle_count;
+
+    std::atomic<uint64_t> reused;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> released;
+    std::atomic<uint64_t> discarded;
+
+    static std::string make_key(const std::string& host, int port);
+    // Peer closed, or sent unsolicited bytes while idle
+    static bool is_alive(int socket_fd);
+};
+
+#endif // CONNECTION_POOL_H
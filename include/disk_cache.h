@@ -0,0 +1,156 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "thread_pool.h"
+
+struct CachedBlock;
+
+// One append-only segment file, mapped read-only. Hits keep a reference so
+// the file stays open (and mapped) while its bytes are being sent, even if
+// the segment is dropped in the meantime.
+class DiskSegment {
+public:
+    DiskSegment(uint32_t id, int fd, const char* data, size_t mapped_length);
+    ~DiskSegment();
+
+    DiskSegment(const DiskSegment&) = delete;
+    DiskSegment& operator=(const DiskSegment&) = delete;
+
+    uint32_t id() const { return segment_id; }
+    int fd() const { return file_fd; }
+    const char* data() const { return mapping; }
+
+private:
+    uint32_t segment_id;
+    int file_fd;
+    const char* mapping;
+    size_t mapped_length;
+};
+
+// Second cache tier below CacheManager. Entries evicted from memory are
+// appended to fixed-size segment files in one directory by a writer thread
+// and found again through an in-memory index; bodies are sent straight from
+// the segment with sendfile(2). open() rebuilds the index by walking record
+// headers, so a warm restart only touches headers, not bodies. A record cut
+// short by a crash ends its segment and is trimmed off; its payload checksum
+// is checked the first time a record loaded from disk is served. When over
+// budget, the oldest segment is deleted whole. A lock file keeps a second
+// process out of the directory until close().
+class DiskCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t writes;
+        uint64_t dropped;           // Writer queue full, too large or I/O error
+        uint64_t corrupt;           // Records rejected by a checksum
+        uint64_t segments_deleted;
+        uint64_t loaded;            // Records indexed by open()
+        size_t entries;
+        size_t bytes;               // Segment bytes on disk
+        size_t segments;
+    };
+
+    DiskCache(const std::string& directory, size_t max_bytes);
+    ~DiskCache();
+
+    DiskCache(const DiskCache&) = delete;
+    DiskCache& operator=(const DiskCache&) = delete;
+
+    // Create the directory if needed, lock it and index the segments
+    // already in it. Fails if another process holds the lock. Also opens
+    // the directory again after close().
+    bool open();
+
+    // Queue an in-memory block for writing. After shutdown() the write
+    // happens on the calling thread instead.
+    void store(uint64_t hash, const std::string& key, std::shared_ptr<const CachedBlock> block,
+               std::chrono::system_clock::time_point cached_time, int ttl_seconds);
+    // Same, always on the calling thread
+    void store_now(uint64_t hash, const std::string& key, std::shared_ptr<const CachedBlock> block,
+                   std::chrono::system_clock::time_point cached_time, int ttl_seconds);
+
+    // On a hit, 'block' holds the head in memory and refers to the body in
+    // its segment file
+    bool lookup(uint64_t hash, const std::string& key, std::shared_ptr<const CachedBlock>& block);
+
+    // Forget an entry, e.g. because a newer copy is in memory
+    void erase(uint64_t hash);
+
+    // Wait for the writes queued so far; the writer keeps running
+    void wait_for_writes();
+    // Finish the queued writes and stop the writer thread
+    void shutdown();
+
+    // Finish writing, then let go of the directory so another process can
+    // open it: later stores are dropped and lookups miss until open()
+    void close();
+    bool is_open() const { return !closed; }
+
+    Stats get_stats() const;
+
+private:
+    struct Location {
+        uint32_t segment;
+        uint64_t offset;    // Record start within the segment
+        int64_t expires;    // Unix seconds
+        bool verified;      // Payload known good: checked, or written by this process
+    };
+
+    struct Segment {
+        std::shared_ptr<DiskSegment> file;
+        size_t size;        // Bytes of complete records
+    };
+
+    std::string directory;
+    size_t max_bytes;
+    size_t segment_size;
+
+    mutable std::mutex index_mutex;
+    std::unordered_map<uint64_t, Location> index;
+    std::map<uint32_t, Segment> segments; // Oldest first
+    size_t total_bytes;
+    uint32_t active_segment;              // Only the writer appends to it
+
+    int lock_fd;
+    // Let go of the directory lock, e.g. when open() fails after taking it
+    void unlock_directory();
+
+    std::unique_ptr<ThreadPool> writer;
+    std::atomic<bool> writer_stopped;
+    // Held for a whole write, so close() can wait out the last one
+    std::mutex write_mutex;
+    std::atomic<bool> closed;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> corrupt;
+    std::atomic<uint64_t> segments_deleted;
+    std::atomic<uint64_t> loaded;
+
+    std::string segment_path(uint32_t id) const;
+    std::shared_ptr<DiskSegment> map_segment(uint32_t id, int fd, size_t file_size);
+    // Index the complete records of one segment; returns its valid length
+    size_t scan_segment(uint32_t id, const DiskSegment& segment, size_t file_size);
+    // Callers hold index_mutex
+    bool start_segment(uint32_t id);
+    void drop_oldest_segment();
+
+    // Inflates a compressed block first
+    void write_block(uint64_t hash, const std::string& key, const std::shared_ptr<const CachedBlock>& block,
+                     std::chrono::system_clock::time_point cached_time, int ttl_seconds);
+    void write_record(uint64_t hash, const std::string& key, const CachedBlock& block,
+                      std::chrono::system_clock::time_point cached_time, int ttl_seconds);
+};
+
+#endif // DISK_CACHE_H
@@ -0,0 +1,101 @@
+#ifndef DNS_RESOLVER_H
+#define DNS_RESOLVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "socket_utils.h"
+#include "thread_pool.h"
+
+// Hostname resolution off the request path. getaddrinfo() runs on a small
+// dedicated thread pool; answers (including failures) are cached with a TTL
+// in a sharded table, and concurrent lookups of a name that is already being
+// resolved wait for that one query instead of issuing their own.
+class DnsResolver {
+public:
+    struct Result {
+        bool ok = false;
+        std::vector<SocketAddress> addresses; // Port 0; preference order
+        std::string error;
+        bool cached = false;                  // Answered without a new query
+    };
+
+    using Callback = std::function<void(const Result&)>;
+
+    struct Stats {
+        uint64_t hits;           // Positive answers served from the cache
+        uint64_t negative_hits;  // Cached failures served
+        uint64_t misses;         // Queries started
+        uint64_t merged;         // Lookups that joined a query in flight
+        uint64_t failures;       // Queries that failed
+        size_t entries;
+    };
+
+    DnsResolver(size_t thread_count, int ttl_seconds, int negative_ttl_seconds);
+    ~DnsResolver();
+
+    DnsResolver(const DnsResolver&) = delete;
+    DnsResolver& operator=(const DnsResolver&) = delete;
+
+    // Answer from the cache (or a numeric address) without blocking;
+    // false if a query is needed
+    bool lookup(const std::string& host, Result& result);
+
+    // Resolve asynchronously. The callback runs on the calling thread when
+    // the answer is cached, otherwise on a resolver thread.
+    void resolve(const std::string& host, Callback callback);
+
+    // Blocking convenience for the threaded handlers
+    Result resolve_sync(const std::string& host);
+
+    // Drop expired entries
+    void prune();
+
+    // Fail queued queries and join the resolver threads
+    void shutdown();
+
+    Stats get_stats() const;
+
+private:
+    struct Entry {
+        Result result;
+        std::chrono::steady_clock::time_point expires;
+        bool pending = false;
+        std::vector<Callback> waiters;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    static const size_t SHARD_COUNT = 16;
+    static const size_t MAX_ENTRIES_PER_SHARD = 1024;
+
+    Shard shards[SHARD_COUNT];
+    std::chrono::seconds ttl;
+    std::chrono::seconds negative_ttl;
+    std::unique_ptr<ThreadPool> workers;
+    std::atomic<bool> stopping;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> negative_hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> merged;
+    std::atomic<uint64_t> failures;
+
+    Shard& shard_for(const std::string& host);
+    void run_query(const std::string& host);
+    // Deliver an answer to everyone waiting; transient failures are not cached
+    void complete(const std::string& host, Result result, bool cacheable = true);
+    static Result query(const std::string& host);
+    static bool parse_numeric(const std::string& host, Result& result);
+};
+
+#endif // DNS_RESOLVER_H
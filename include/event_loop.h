@@ -0,0 +1,185 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include "io_ring.h"
+
+// Edge-triggered reactor. One EventLoop is driven by exactly one thread;
+// the only thread-safe entry points are post() and stop().
+//
+// The epoll backend waits with epoll_wait. The io_uring backend delivers the
+// same readiness events through multishot polls on registered fds, and also
+// runs I/O operations (accept, receive, send, connect, splice) whose
+// completions come back as callbacks; everything queued during one iteration
+// goes to the kernel with the next wait, in a single io_uring_enter.
+class EventLoop {
+public:
+    enum class Backend {
+        EPOLL,
+        IO_URING
+    };
+
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+        virtual void handle_event(int fd, uint32_t events) = 0;
+        // The process is draining before it exits: close what is idle
+        virtual void on_drain() {}
+    };
+
+    using Task = std::function<void()>;
+    using TimerId = uint64_t;
+    // The operation's result: bytes moved, a new fd, 0, or -errno
+    using Completion = std::function<void(int result)>;
+    // A receive's result and, if bytes arrived, the buffer holding them;
+    // 'more' is set while a multishot receive stays armed
+    using ReceiveDone = std::function<void(int result, IoRing::Buffer buffer, bool more)>;
+    using OperationId = uint64_t;
+
+    explicit EventLoop(Backend backend = Backend::EPOLL);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool is_valid() const;
+    Backend backend() const { return ring ? Backend::IO_URING : Backend::EPOLL; }
+    // Whether the io_uring backend can run on this kernel
+    static bool io_uring_supported();
+
+    // Register / update / deregister a file descriptor. EPOLLET is always added.
+    // A removed handler stays alive until the current dispatch round finishes,
+    // so a handler may safely remove itself from inside handle_event().
+    // With io_uring, 0 events means no readiness polling at all (epoll still
+    // reports errors and hangups), and remove() cancels the fd's operations;
+    // call it before closing an fd that operations were queued on.
+    bool add(int fd, uint32_t events, std::shared_ptr<Handler> handler);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+    // Call on_drain() on every registered handler (loop thread only)
+    void notify_drain();
+
+    // io_uring backend only. Each call queues one operation and 'done' runs
+    // on the loop thread when it completes (with -ECANCELED if remove()
+    // cancelled it). Buffers and fds must stay valid until then.
+    //
+    // Accept until stop_accept(); 'on_accept' gets each non-blocking
+    // client fd
+    void accept_multishot(int fd, std::function<void(int client)> on_accept);
+    // Receive up to 'length' bytes into a provided buffer; -ENOBUFS if none
+    // was free
+    void receive(int fd, size_t length, ReceiveDone done);
+    // Receive into provided buffers, one completion per arrival, until EOF,
+    // an error, -ENOBUFS or cancel_operation(). Returns the operation's id,
+    // 0 if it could not be queued.
+    OperationId receive_multishot(int fd, ReceiveDone done);
+    // Receive into the caller's buffer
+    void receive_into(int fd, char* data, size_t length, Completion done);
+    // sendmsg(2) of the message's iovecs, which must stay valid too
+    void send_message(int fd, const struct msghdr* message, Completion done);
+    void connect(int fd, const struct sockaddr* address, socklen_t length, Completion done);
+    // splice(2) once 'in' is readable (wait_for == EPOLLIN) or 'out'
+    // writable (EPOLLOUT): a poll linked to the splice
+    void splice(int in, int out, size_t length, uint32_t wait_for, Completion done);
+    // Ask the kernel to stop an operation; it still completes, typically
+    // with -ECANCELED
+    void cancel_operation(OperationId id);
+
+    // Stop accepting on a listener, whether it was registered with add()
+    // (epoll) or accept_multishot(); the listener itself stays open.
+    // 'stopped' runs on the loop thread once no further client can be
+    // delivered - with io_uring, after clients the kernel already accepted.
+    void stop_accept(int fd, Task stopped);
+
+    // Queue a task to run on the loop thread (thread-safe)
+    void post(Task task);
+    // Run a task once the events and completions of this iteration have
+    // been dispatched, before waiting again (loop thread only)
+    void defer(Task task);
+
+    // Run a task on the loop thread after a delay (loop thread only).
+    // Cancelling a timer that already fired is a no-op.
+    TimerId schedule(std::chrono::milliseconds delay, Task task);
+    void cancel(TimerId id);
+
+    void run();
+    void stop();
+
+    // When the loop last stopped waiting; the time since is how long the
+    // event being handled sat behind the others of its round
+    std::chrono::steady_clock::time_point woken_at() const { return woken; }
+
+    size_t handler_count() const { return handlers.size(); }
+
+private:
+    // An io_uring operation in flight; its id is the completion's user_data
+    struct Operation {
+        std::function<void(const struct io_uring_cqe& cqe)> done;
+        struct sockaddr_storage address; // connect() target, read at submission
+    };
+
+    int epoll_fd;
+    int wake_fd;
+    std::unique_ptr<IoRing> ring;
+    std::unordered_map<uint64_t, std::unique_ptr<Operation>> operations;
+    uint64_t next_operation_id;
+    // io_uring: the multishot poll standing in for each fd's epoll registration
+    struct Poll {
+        uint64_t operation;
+        uint32_t events;
+    };
+    std::unordered_map<int, Poll> polls;
+    // io_uring: each listener's multishot accept, 0 while waiting to re-arm
+    struct Accept {
+        std::function<void(int client)> on_accept;
+        uint64_t operation;
+        Task stopped; // Set by stop_accept()
+    };
+    std::unordered_map<int, Accept> accepts;
+    std::atomic<bool> running;
+    std::chrono::steady_clock::time_point woken;
+    std::unordered_map<int, std::shared_ptr<Handler>> handlers;
+    std::vector<std::shared_ptr<Handler>> retired;
+
+    std::mutex task_mutex;
+    std::vector<Task> pending_tasks;
+    std::vector<Task> deferred_tasks;
+
+    // Ordered by deadline; the id breaks ties and makes entries cancellable
+    using TimerKey = std::pair<std::chrono::steady_clock::time_point, TimerId>;
+    std::map<TimerKey, Task> timers;
+    std::unordered_map<TimerId, std::chrono::steady_clock::time_point> timer_deadlines;
+    TimerId next_timer_id;
+
+    void wake();
+    void drain_wake_fd();
+    void run_pending_tasks();
+    void run_deferred_tasks();
+    void run_due_timers();
+    int next_timeout_ms() const;
+
+    void run_epoll();
+    void run_ring();
+    // Queue an operation; the entry is returned with user_data set, or null
+    // (and 'done' dropped) if the ring is full
+    struct io_uring_sqe* queue_operation(std::function<void(const struct io_uring_cqe& cqe)> done,
+                                         Operation** operation = nullptr);
+    void complete(const struct io_uring_cqe& cqe);
+    void set_file(struct io_uring_sqe* sqe, int fd);
+    void arm_poll(int fd, uint32_t events);
+    void cancel_poll(int fd);
+    void on_poll(int fd, uint64_t operation, const struct io_uring_cqe& cqe);
+    void arm_accept(int fd);
+    void on_accept_done(int fd, const struct io_uring_cqe& cqe);
+};
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,90 @@
+#ifndef HTTP_FRAMING_H
+#define HTTP_FRAMING_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "http_parser.h"
+
+enum class BodyFraming {
+    NONE,            // No body (HEAD, 1xx, 204, 304)
+    CONTENT_LENGTH,  // Exactly content_length bytes
+    CHUNKED,         // Transfer-Encoding: chunked
+    UNTIL_CLOSE      // Body ends when the server closes the connection
+};
+
+// Incremental detector for the end of one HTTP/1.x response. Bytes are fed
+// as they arrive; consume() reports how many of them belong to the current
+// message, so the caller knows exactly where the response stops and whether
+// the upstream connection can be reused afterwards.
+class ResponseFramer {
+public:
+    enum class Result {
+        NEED_MORE,  // Message not finished yet
+        COMPLETE,   // Message ended within the consumed bytes
+        ERROR       // Malformed framing; connection must not be reused
+    };
+
+    // Receives the body as it is consumed, with chunked framing removed
+    using BodySink = std::function<void(const char* data, size_t length)>;
+
+    explicit ResponseFramer(bool head_request = false);
+
+    // Frame a request body alone, with no head before it: a chunked one, or
+    // one of 'length' bytes
+    static ResponseFramer chunked_body();
+    static ResponseFramer fixed_body(uint64_t length);
+
+    void set_body_sink(BodySink sink) { body_sink = std::move(sink); }
+
+    // Consume up to 'length' bytes; 'used' is set to the bytes belonging to
+    // this response (less than 'length' only when the message completed)
+    Result consume(const char* data, size_t length, size_t& used);
+
+    // Upstream closed the connection; a close-delimited body is now complete
+    Result finish_on_close();
+
+    bool headers_done() const { return state != State::HEADERS; }
+    bool is_complete() const { return state == State::DONE; }
+    bool keep_alive() const;
+
+    int status_code() const { return status; }
+    BodyFraming framing() const { return body_framing; }
+    uint64_t content_length() const { return declared_length; }
+    // Raw header block of the final (non-1xx) response, including "\r\n\r\n"
+    const std::string& header_block() const { return headers; }
+    // Parsed view of header_block(), valid once headers_done()
+    const HttpParser& head() const { return parser; }
+
+private:
+    enum class State {
+        HEADERS,
+        BODY,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        TRAILERS,
+        UNTIL_CLOSE,
+        DONE,
+        FAILED
+    };
+
+    bool head_request;
+    State state;
+    std::string headers;
+    HttpParser parser;
+    std::string line; // Partial chunk-size / trailer line
+    int status;
+    bool http_11;
+    bool connection_close;
+    bool connection_keep_alive;
+    BodyFraming body_framing;
+    uint64_t declared_length;
+    uint64_t remaining;
+    BodySink body_sink;
+
+    bool parse_headers();
+    bool on_line_complete();
+};
+
+#endif // HTTP_FRAMING_H
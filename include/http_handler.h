@@ -1,14 +1,16 @@
 #ifndef HTTP_HANDLER_H
 #define HTTP_HANDLER_H
 
+#include <cstdint>
 #include <string>
-#include <map>
+#include "http_headers.h"
+#include "http_parser.h"
 
 struct HttpRequest {
     std::string method;
     std::string path;
     std::string version;
-    std::map<std::string, std::string> headers;
+    HttpHeaders headers;
     std::string body;
 };
 
@@ -16,23 +18,76 @@ struct HttpResponse {
     std::string version;
     int status_code;
     std::string status_message;
-    std::map<std::string, std::string> headers;
+    HttpHeaders headers;
     std::string body;
 };
 
 class HttpHandler {
 public:
+    // Parse a complete message; everything after the head is the body
     static HttpRequest parse_request(const std::string& raw_request);
     static std::string serialize_request(const HttpRequest& request);
+    // Same, into 'out' (replacing its contents) so a kept buffer is reused
+    static void serialize_request(const HttpRequest& request, std::string& out);
     
     static HttpResponse parse_response(const std::string& raw_response);
     static std::string serialize_response(const HttpResponse& response);
     
+    // Copy the start line and headers out of a parser that reached COMPLETE
+    static HttpRequest build_request(const HttpParser& parser);
+    static HttpResponse build_response(const HttpParser& parser);
+    // Same, into a request kept by the connection: its strings and header
+    // storage are overwritten in place, so once they have grown to fit the
+    // connection's requests no further allocation is needed. The body is
+    // emptied.
+    static void build_request(const HttpParser& parser, HttpRequest& request);
+    
+    // Empty a connection's request (or scratch buffer) for the next one in a
+    // single step. The memory is kept for reuse unless this request grew it
+    // past RECYCLE_LIMIT_BYTES, so one large request does not pin memory for
+    // the rest of a persistent connection.
+    static const size_t RECYCLE_LIMIT_BYTES = 65536;
+    static void recycle(HttpRequest& request);
+    static void recycle(std::string& buffer);
+    
+    // Strip hop-by-hop connection headers before forwarding upstream and ask
+    // the origin to keep the connection open when it can be pooled
+    static void prepare_upstream_request(HttpRequest& request, bool keep_alive);
+    
+    // How the request body is delimited: 'chunked', or else 'length' bytes
+    // (0 without Content-Length). False if that is ambiguous, so the request
+    // must be refused: a Content-Length that is not all digits or appears
+    // more than once, Content-Length together with Transfer-Encoding, or a
+    // transfer coding that does not end in chunked.
+    static bool request_body_framing(const HttpRequest& request, uint64_t& length, bool& chunked);
+    
+    // Methods a request can be repeated with, e.g. on a fresh upstream
+    // connection after a pooled one turned out to be closed (RFC 9110 9.2.2)
+    static bool is_idempotent(const std::string& method);
+    
+    // HTTP/1.1 defaults to persistent connections, HTTP/1.0 to close;
+    // Connection / Proxy-Connection override either way
+    static bool client_wants_keep_alive(const HttpRequest& request);
+    
+    // Set the Connection header on a response we generate for the client.
+    // Returns whether the connection can really stay open, which needs a
+    // Content-Length that matches the body.
+    static bool prepare_client_response(HttpResponse& response, bool keep_alive);
+    
+    // Split "host", "host:port" or "[v6-literal]:port" into its parts, the
+    // host without brackets; false if the port is not a number in range
+    static bool split_authority(const std::string& authority, int default_port, std::string& host, int& port);
+
     static std::string extract_host(const HttpRequest& request);
+    // Throws std::invalid_argument for a malformed port
     static int extract_port(const HttpRequest& request);
     
 private:
-    static std::string trim(const std::string& str);
+    static std::string to_lower(std::string str);
+    static void copy_headers(const HttpParser& parser, HttpHeaders& headers);
+    // Bytes append_headers() writes: every field plus the blank line
+    static size_t serialized_size(const HttpHeaders& headers);
+    static void append_headers(const HttpHeaders& headers, std::string& out);
 };
 
 #endif // HTTP_HANDLER_H
@@ -0,0 +1,145 @@
+#ifndef HTTP_HEADERS_H
+#define HTTP_HEADERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Headers the proxy looks at, with fixed ids so lookups skip the name
+// comparison. OTHER marks every other name.
+enum class HeaderId : uint8_t {
+    HOST,
+    CONTENT_LENGTH,
+    TRANSFER_ENCODING,
+    TRAILER,
+    CONNECTION,
+    PROXY_CONNECTION,
+    KEEP_ALIVE,
+    UPGRADE,
+    TE,
+    CACHE_CONTROL,
+    PRAGMA,
+    EXPIRES,
+    AGE,
+    DATE,
+    ETAG,
+    LAST_MODIFIED,
+    IF_NONE_MATCH,
+    IF_MODIFIED_SINCE,
+    IF_MATCH,
+    IF_UNMODIFIED_SINCE,
+    IF_RANGE,
+    RANGE,
+    VARY,
+    CONTENT_TYPE,
+    CONTENT_ENCODING,
+    ACCEPT_ENCODING,
+    OTHER
+};
+
+// Header fields of one message, in arrival order. Names and values are
+// copied once into a single buffer and fields are offsets into it, so a
+// parsed head costs two allocations however many fields it has. Names match
+// case-insensitively; the first field of each well-known name also has a
+// slot indexed by its HeaderId. Repeated fields are kept (Set-Cookie);
+// get() returns the first, set() replaces all of them.
+//
+// Views returned by get() and iteration are valid until the next change.
+class HttpHeaders {
+public:
+    static const size_t WELL_KNOWN_COUNT = static_cast<size_t>(HeaderId::OTHER);
+
+    struct Field {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    class const_iterator {
+    public:
+        const_iterator(const HttpHeaders* headers, size_t index) : headers(headers), index(index) {}
+        Field operator*() const { return headers->field(index); }
+        const_iterator& operator++() { index++; return *this; }
+        bool operator!=(const const_iterator& other) const { return index != other.index; }
+        bool operator==(const const_iterator& other) const { return index == other.index; }
+
+    private:
+        const HttpHeaders* headers;
+        size_t index;
+    };
+
+    HttpHeaders();
+
+    // Id of a header name (any case); OTHER if it is not a well-known one
+    static HeaderId id_of(std::string_view name);
+    // Canonical spelling of a well-known header, e.g. "Content-Length"
+    static std::string_view name_of(HeaderId id);
+
+    // Body framing values, read strictly so that no peer can see a body end
+    // elsewhere: a Content-Length of digits only (no sign, spaces or list,
+    // and no overflow), and whether the last coding of a Transfer-Encoding
+    // value is chunked
+    static bool parse_content_length(std::string_view value, uint64_t& length);
+    static bool ends_in_chunked(std::string_view codings);
+
+    // Room for 'fields' fields totalling 'bytes' of names and values
+    void reserve(size_t fields, size_t bytes);
+    // Heap bytes held, used or not; clear() keeps them for the next message
+    size_t capacity() const { return storage.capacity() + fields.capacity() * sizeof(Entry); }
+    // clear() and give the memory back
+    void release();
+
+    size_t size() const { return fields.size(); }
+    bool empty() const { return fields.empty(); }
+    Field field(size_t index) const;
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, fields.size()); }
+
+    // Value of the first field with this name; empty if absent
+    std::string_view get(HeaderId id) const;
+    std::string_view get(std::string_view name) const;
+    bool has(HeaderId id) const { return id != HeaderId::OTHER && slots[static_cast<size_t>(id)] != 0; }
+    bool has(std::string_view name) const;
+
+    // Append a field, keeping any with the same name
+    void add(std::string_view name, std::string_view value);
+    // Replace every field with this name by one field
+    void set(HeaderId id, std::string_view value);
+    void set(std::string_view name, std::string_view value);
+    // Remove every field with this name; returns how many there were
+    size_t erase(HeaderId id);
+    size_t erase(std::string_view name);
+
+    void clear();
+
+private:
+    struct Entry {
+        uint32_t name_offset;
+        uint32_t name_length;
+        uint32_t value_offset;
+        uint32_t value_length;
+        HeaderId id;
+    };
+
+    std::string storage;
+    std::vector<Entry> fields;
+    // Index + 1 of the first field per well-known id; 0 = absent
+    uint16_t slots[WELL_KNOWN_COUNT];
+    size_t garbage; // Bytes of storage no field refers to any more
+
+    std::string_view name_at(const Entry& entry) const {
+        return std::string_view(storage.data() + entry.name_offset, entry.name_length);
+    }
+    std::string_view value_at(const Entry& entry) const {
+        return std::string_view(storage.data() + entry.value_offset, entry.value_length);
+    }
+    // Index of the first field named 'name' with id 'id'; size() if none
+    size_t find(HeaderId id, std::string_view name) const;
+    void append(HeaderId id, std::string_view name, std::string_view value);
+    size_t remove(HeaderId id, std::string_view name);
+    void rebuild_slots();
+    void compact();
+};
+
+#endif // HTTP_HEADERS_H
@@ -0,0 +1,100 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Incremental parser for the head (start line + header fields) of one
+// HTTP/1.x message. Call parse() with everything received so far whenever
+// more bytes arrive; scanning resumes where the previous call stopped, so a
+// head split over many reads is still scanned once. Line and colon
+// delimiters are located with SSE2/AVX2 when the CPU has them.
+//
+// Nothing is copied: accessors return string_views into the buffer passed to
+// the most recent parse() call, valid while that buffer is left unchanged.
+class HttpParser {
+public:
+    enum class Kind {
+        REQUEST,   // "GET /path HTTP/1.1"
+        RESPONSE   // "HTTP/1.1 200 OK"
+    };
+
+    enum class Result {
+        NEED_MORE,  // Head not finished; call again with more bytes
+        COMPLETE,   // head_length() bytes form the head
+        ERROR       // Malformed or oversized; see head_too_large()
+    };
+
+    struct Header {
+        std::string_view name;
+        std::string_view value;  // Leading/trailing whitespace removed
+    };
+
+    static constexpr size_t MAX_HEAD_SIZE = 65536;
+    static constexpr size_t MAX_HEADERS = 128;
+
+    explicit HttpParser(Kind kind);
+
+    // 'data' must start at the first byte of the message and extend the
+    // bytes given to the previous call (the buffer may have moved)
+    Result parse(const char* data, size_t length);
+    // Start over for the next message
+    void reset();
+
+    Result result() const { return state; }
+    bool head_too_large() const { return too_large; }
+    size_t head_length() const { return head_end; } // Includes the blank line
+
+    // Start line, request form
+    std::string_view method() const { return view(first); }
+    std::string_view target() const { return view(second); }
+    // Start line, response form
+    int status_code() const { return status; }
+    std::string_view reason() const { return view(third); }
+    std::string_view version() const { return view(kind == Kind::REQUEST ? third : first); }
+
+    size_t header_count() const { return headers.size(); }
+    Header header(size_t index) const;
+    // First header with this name (case-insensitive); empty if absent
+    std::string_view find_header(std::string_view name) const;
+    bool has_header(std::string_view name) const;
+
+    // "avx2", "sse2" or "scalar": the delimiter scanner in use on this CPU
+    static const char* scan_implementation();
+
+private:
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+    struct HeaderSpan {
+        Span name;
+        Span value;
+    };
+
+    Kind kind;
+    const char* base;
+    Result state;
+    bool too_large;
+    size_t scanned;      // Bytes already searched for line ends
+    size_t line_start;
+    bool start_line_done;
+    size_t head_end;
+
+    Span first;          // Method or version
+    Span second;         // Target or status code
+    Span third;          // Version or reason phrase
+    int status;
+    std::vector<HeaderSpan> headers;
+
+    std::string_view view(Span span) const {
+        return span.length ? std::string_view(base + span.offset, span.length) : std::string_view();
+    }
+    bool parse_start_line(size_t begin, size_t end);
+    bool parse_header_line(size_t begin, size_t end);
+    Result fail(bool oversized = false);
+};
+
+#endif // HTTP_PARSER_H
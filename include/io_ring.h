@@ -0,0 +1,117 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <linux/io_uring.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// An io_uring instance driven with raw syscalls. Owns the queue mappings, a
+// sparse table of registered files in which an fd's slot is its own number,
+// and a ring of provided buffers that receives take a buffer from only once
+// data has arrived. Used only by the thread running the owning EventLoop.
+class IoRing {
+public:
+    // Provided buffers, shared by every receive on this ring
+    static constexpr unsigned BUFFER_COUNT = 128;
+    static constexpr size_t BUFFER_SIZE = 32768;
+    static constexpr uint16_t BUFFER_GROUP = 0;
+
+    // A provided buffer filled by a receive; handed back to the kernel when
+    // dropped, so it must not outlive the ring
+    class Buffer {
+    public:
+        Buffer() = default;
+        Buffer(IoRing* ring, uint16_t id) : ring(ring), id(id) {}
+        ~Buffer() { release(); }
+
+        Buffer(Buffer&& other) noexcept : ring(other.ring), id(other.id) { other.ring = nullptr; }
+        Buffer& operator=(Buffer&& other) noexcept;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        char* data() const { return ring ? ring->buffer(id) : nullptr; }
+        explicit operator bool() const { return ring != nullptr; }
+        void release();
+
+    private:
+        IoRing* ring = nullptr;
+        uint16_t id = 0;
+    };
+
+    explicit IoRing(unsigned entries);
+    ~IoRing();
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // False if any part of the setup failed; nothing else may be called then
+    bool is_valid() const { return ring_fd >= 0; }
+
+    // Whether this kernel has every operation and feature the ring uses
+    // (Linux 6.0 or later: multishot receive, provided buffer rings)
+    static bool is_supported();
+
+    // A zeroed submission entry. Queued entries are submitted first if fewer
+    // than 'count' slots are free, so 'count' entries taken in a row (a
+    // linked chain) go to the kernel together. Null if that submit fails.
+    struct io_uring_sqe* get_sqe(unsigned count = 1);
+    // Submit everything queued; the number submitted or -errno
+    int submit();
+    // Submit, then wait for a completion or 'timeout_ms' (-1 = no limit)
+    int submit_and_wait(int timeout_ms);
+    // Copy out the oldest unseen completion; false if there is none
+    bool next_completion(struct io_uring_cqe& cqe);
+    // Completions posted and not yet copied out
+    unsigned completions_ready() const { return __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) - *cq_head; }
+
+    // Put an fd in its slot; false if it does not fit the table or the
+    // kernel refused, in which case operations use the plain fd
+    bool register_file(int fd);
+    // Queue the slot's release with the next submission
+    void unregister_file(int fd);
+    bool is_registered(int fd) const {
+        return fd >= 0 && static_cast<size_t>(fd) < registered.size() && registered[fd];
+    }
+
+    char* buffer(uint16_t id) const { return buffers + static_cast<size_t>(id) * BUFFER_SIZE; }
+    // Hand a provided buffer back to the kernel
+    void recycle_buffer(uint16_t id);
+
+private:
+    int ring_fd;
+
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail; // Entries handed out, published to *sq_tail on submit
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    std::vector<bool> registered;
+
+    struct io_uring_buf_ring* buffer_ring;
+    size_t buffer_ring_size;
+    char* buffers;
+    uint16_t buffer_tail;
+
+    bool map_queues(const struct io_uring_params& params);
+    bool register_file_table();
+    bool register_buffer_ring();
+    void add_buffer(uint16_t id);
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t arg_size);
+    void close_ring();
+};
+
+#endif // IO_RING_H
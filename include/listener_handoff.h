@@ -0,0 +1,51 @@
+#ifndef LISTENER_HANDOFF_H
+#define LISTENER_HANDOFF_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Zero-downtime binary upgrades over a Unix socket. The serving process
+// listens on 'path'; a new binary started with the same path connects,
+// receives the listening sockets with SCM_RIGHTS and starts accepting on
+// them at once, so queued and new clients never find the port closed. It
+// then confirms, after which the old process stops accepting and drains,
+// and the new one listens on 'path' for the next upgrade.
+//
+// Only a peer running as the same user is given the sockets.
+class ListenerHandoff {
+public:
+    explicit ListenerHandoff(const std::string& path);
+    ~ListenerHandoff();
+
+    ListenerHandoff(const ListenerHandoff&) = delete;
+    ListenerHandoff& operator=(const ListenerHandoff&) = delete;
+
+    // New process: take the listeners of the process serving on 'path'.
+    // False if none answers there, e.g. on a first start.
+    bool receive(std::vector<int>& listeners);
+    // New process: tell the old one it is accepting. False if the old one
+    // gave up waiting and serves on.
+    bool confirm();
+
+    // Listen on 'path' for the next upgrade, replacing a stale socket file
+    bool listen();
+    // Old process: wait up to 'wait' for a new process. If one connects,
+    // run 'release' (to free what it needs to start), send it 'listeners'
+    // and wait for its confirmation; true once it has taken over. If it
+    // does not, 'restore' runs to take back what 'release' gave up.
+    bool serve(const std::vector<int>& listeners, const std::function<void()>& release,
+               const std::function<void()>& restore, std::chrono::milliseconds wait);
+
+private:
+    std::string path;
+    int listen_fd;
+    int channel_fd; // New process: its connection to the old one
+    bool owns_path; // Whether to unlink 'path' when done
+
+    // Send the listeners and wait for the new process to confirm
+    bool hand_over(int peer, const std::vector<int>& listeners);
+};
+
+#endif // LISTENER_HANDOFF_H
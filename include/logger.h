@@ -1,8 +1,10 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
 #include <string>
-#include <iostream>
 
 enum LogLevel {
     DEBUG = 0,
@@ -11,22 +13,56 @@ enum LogLevel {
     ERROR = 3
 };
 
+// Lowest level compiled in; set with -DPROXY_LOG_LEVEL=... in CMake. Calls
+// through the LOG_* macros below it compile to nothing, message included.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 1
+#endif
+
+#define LOG_AT(level, function, message)                              \
+    do {                                                              \
+        if ((level) >= LOG_MIN_LEVEL && Logger::is_enabled(level)) {  \
+            Logger::function(message);                                \
+        }                                                             \
+    } while (0)
+
+#define LOG_DEBUG(message) LOG_AT(DEBUG, debug, message)
+#define LOG_INFO(message) LOG_AT(INFO, info, message)
+#define LOG_WARNING(message) LOG_AT(WARNING, warning, message)
+#define LOG_ERROR(message) LOG_AT(ERROR, error, message)
+
+// Each thread appends records to its own lock-free ring buffer; a background
+// thread formats them and writes them out in batches. A thread whose ring is
+// full drops the record (counted, and reported by the writer) instead of
+// waiting. Lines from different threads may interleave out of order within
+// one batch.
 class Logger {
 private:
-    static LogLevel current_level;
+    static std::atomic<int> current_level;
 
 public:
     static void set_level(LogLevel level);
-    
+    static bool is_enabled(LogLevel level) {
+        return level >= current_level.load(std::memory_order_relaxed);
+    }
+
+    // Where the writer thread writes; stdout by default
+    static void set_output(FILE* output);
+
     static void debug(const std::string& message);
     static void info(const std::string& message);
     static void warning(const std::string& message);
     static void error(const std::string& message);
-    
+
+    // Write everything queued so far and stop the writer thread; later
+    // records are written directly by the logging thread. Runs at exit.
+    static void shutdown();
+
+    // Records lost to full ring buffers since startup
+    static uint64_t dropped();
+
 private:
     static void log(LogLevel level, const std::string& message);
-    static std::string get_timestamp();
-    static std::string level_to_string(LogLevel level);
 };
 
 #endif // LOGGER_H
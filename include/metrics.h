@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Process-wide counters, gauges and latency histograms. Every thread records
+// into its own slot with plain relaxed stores, so the hot path takes no lock
+// and shares no cache line; render() sums the slots of all threads. A slot
+// outlives its thread and is handed to the next thread that starts recording,
+// so totals never go backwards.
+class Metrics {
+public:
+    enum Counter {
+        REQUESTS,            // Requests read from clients, tunnels included
+        CONNECTIONS,         // Client connections accepted
+        TUNNELS,             // CONNECT tunnels established
+        CLIENT_BYTES_IN,
+        CLIENT_BYTES_OUT,
+        UPSTREAM_BYTES_IN,
+        UPSTREAM_BYTES_OUT,
+        IO_BUFFER_ALLOCATIONS, // Pooled I/O buffers that had to be allocated
+        IO_URING_SUBMITS,    // io_uring_enter calls that submitted operations
+        IO_URING_OPERATIONS, // Operations they submitted
+        CONNECT_ATTEMPTS,    // Upstream connects started, one per address tried
+        CONNECT_FAILURES,    // ... that were refused or unreachable
+        CONNECT_TIMEOUTS,    // ... that got no answer in time
+        SHED_CONNECTIONS,    // Clients refused at --max-connections
+        SHED_IP_CONNECTIONS, // ... at --max-connections-per-ip
+        SHED_QUEUE_FULL,     // ... because a worker queue was full (threaded)
+        SHED_RATE,           // Requests refused by --rate-limit
+        SHED_IP_RATE,        // ... by --rate-limit-per-ip
+        SHED_QUEUE_TIME,     // ... that waited past --queue-target
+        SPARED_HITS,         // Requests past --queue-target served from the cache
+        COUNTER_COUNT
+    };
+
+    enum Gauge {
+        ACTIVE_CONNECTIONS,
+        ACTIVE_TUNNELS,
+        GAUGE_COUNT
+    };
+
+    // Latency histograms: log-linear buckets with 8 steps per power of two
+    // of microseconds (HDR style), so every value is kept to within 12.5%
+    enum Stage {
+        DNS,                 // Name lookup, cache hits included
+        CONNECT,             // TCP connect to the origin, all attempts included
+        CONNECT_IPV4,        // A single successful attempt, by address family
+        CONNECT_IPV6,
+        FIRST_BYTE,          // Request sent until the first response byte
+        TRANSFER,            // Request sent until the response was relayed
+        CACHE_HIT,           // Lookup and queueing of a cache hit
+        QUEUE,               // Ready until handled: loop lag, or the worker queue
+        STAGE_COUNT
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    static void add(Counter counter, uint64_t value = 1);
+    static void adjust(Gauge gauge, int64_t delta);
+    static void observe(Stage stage, Clock::duration elapsed);
+    static void observe_since(Stage stage, Clock::time_point start) { observe(stage, Clock::now() - start); }
+
+    // Prometheus text exposition format (version 0.0.4) of the above
+    static void render(std::string& out);
+
+    // Helpers for other components' stats in the same format
+    static void write_counter(std::string& out, const char* name, const char* help, uint64_t value);
+    static void write_counter(std::string& out, const char* name, const char* help, double value);
+    static void write_gauge(std::string& out, const char* name, const char* help, double value);
+};
+
+#endif // METRICS_H
@@ -0,0 +1,86 @@
+#ifndef PROXY_CONFIG_H
+#define PROXY_CONFIG_H
+
+#include <string>
+
+enum class IoMode {
+    THREADED,   // Blocking handlers on bounded per-shard worker pools
+    EPOLL,      // Edge-triggered epoll reactor on a fixed set of threads
+    IO_URING    // The same reactor with I/O queued on an io_uring per thread;
+                // falls back to EPOLL on kernels without support
+};
+
+struct ProxyConfig {
+    int port = 8080;
+    IoMode io_mode = IoMode::EPOLL;
+    // Listener shards: each owns an SO_REUSEPORT socket plus either an event
+    // loop (epoll, io_uring) or an acceptor thread with its own worker pool
+    // (threaded)
+    int listener_threads = 0; // 0 = one per available CPU
+    int worker_threads = 32;  // Per-shard worker pool size (threaded mode)
+    int queue_depth = 128;    // Per-shard pending connection limit (threaded mode)
+    bool pin_cpus = true;     // Pin shard i to the i-th available CPU
+    bool use_splice = true;   // Zero-copy tunnel relay via splice(2)
+
+    // Upstream keep-alive pool
+    bool upstream_keepalive = true;
+    int upstream_max_idle_per_host = 8;
+    int upstream_max_idle = 256;
+    int upstream_idle_timeout = 30; // Seconds
+
+    // Upstream connects: a name's addresses are raced (Happy Eyeballs)
+    int connect_timeout_ms = 5000;      // Per address tried
+    int connect_attempt_delay_ms = 250; // Head start of each address over the next
+
+    // DNS resolver: getaddrinfo on dedicated threads, answers cached.
+    // getaddrinfo does not report record TTLs, so fixed ones are applied.
+    int dns_threads = 4;
+    int dns_ttl = 60;           // Seconds a successful answer is reused
+    int dns_negative_ttl = 5;   // Seconds a failed lookup is remembered
+
+    // Response cache: sharded LRU held within a byte budget
+    int cache_size_mb = 256;
+    // Disk tier for entries evicted from memory; kept across restarts
+    std::string cache_dir;      // Empty = memory only
+    int cache_disk_size_mb = 4096;
+    // Concurrent misses for one URL wait for a single upstream fetch
+    bool collapsed_forwarding = true;
+    int collapse_timeout_ms = 2000; // Then a waiter fetches on its own
+    int revalidate_threads = 2;     // Background refreshes of expired entries
+    // Hot entries are refreshed before they expire: once hit this many times,
+    // in the last refresh_ahead_window percent of their TTL
+    int refresh_ahead_hits = 10;    // 0 = off
+    int refresh_ahead_window = 10;
+    int refresh_ahead_concurrency = 4; // Refreshes ahead in flight at once
+    int cache_max_object_kb = 8192; // Larger responses are relayed but not cached
+    // Text bodies are gzipped after they are stored, on these threads
+    bool cache_compression = true;
+    int compress_threads = 1;
+    int compress_level = 6;         // zlib level, 1 (fastest) to 9 (smallest)
+
+    // Client-side persistent connections
+    bool client_keepalive = true;
+    int client_idle_timeout = 15; // Seconds to wait for the next request
+    int admin_port = 0;             // Loopback port serving /metrics; 0 = off
+
+    // Admission control; 0 = no limit
+    int max_connections = 0;        // Open client connections
+    int max_connections_per_ip = 0;
+    int rate_limit = 0;             // Requests per second
+    int rate_limit_per_ip = 0;
+    int queue_target_ms = 0;        // Shed misses that waited longer than this
+
+    // Zero-downtime upgrades: listening sockets are handed over on this
+    // Unix socket, then the old process drains for up to drain_timeout
+    std::string upgrade_socket;     // Empty = off
+    int drain_timeout = 30;         // Seconds
+
+    // Parse "[port] [--option=value ...]" from the command line.
+    // Unknown or malformed options are logged and ignored.
+    static ProxyConfig from_args(int argc, char* argv[]);
+    static void print_usage(const char* program);
+};
+
+std::string io_mode_to_string(IoMode mode);
+
+#endif // PROXY_CONFIG_H
@@ -0,0 +1,34 @@
+#ifndef PROXY_CONTEXT_H
+#define PROXY_CONTEXT_H
+
+#include <atomic>
+#include <memory>
+#include "proxy_config.h"
+#include "admission_control.h"
+#include "cache_manager.h"
+#include "connect_race.h"
+#include "connection_pool.h"
+#include "dns_resolver.h"
+#include "revalidator.h"
+
+// Process-wide services shared by every connection handler, in either I/O
+// mode. Handlers keep a shared_ptr so the services outlive them.
+struct ProxyContext {
+    ProxyConfig config;
+    std::shared_ptr<CacheManager> cache_manager;
+    std::shared_ptr<DiskCache> disk_cache; // Null without --cache-dir
+    std::shared_ptr<CacheCompressor> cache_compressor; // Null with --cache-compression=off
+    std::shared_ptr<ConnectionPool> upstream_pool;
+    std::shared_ptr<DnsResolver> resolver;
+    std::shared_ptr<Revalidator> revalidator;
+    ConnectRace::Options connect_options;
+    std::shared_ptr<AdmissionControl> admission;
+    // Set once a new process has taken over the listeners: responses the
+    // proxy builds itself close the connection. Relayed responses carry the
+    // origin's Connection header, so those clients leave in their own time.
+    std::atomic<bool> draining{false};
+
+    explicit ProxyContext(const ProxyConfig& config);
+};
+
+#endif // PROXY_CONTEXT_H
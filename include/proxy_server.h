@@ -5,30 +5,132 @@
 #include <memory>
 #include <thread>
 #include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
 #include "http_handler.h"
 #include "cache_manager.h"
+#include "response_batch.h"
+#include "event_loop.h"
+#include "proxy_config.h"
+#include "proxy_context.h"
+#include "thread_pool.h"
+#include "admin_server.h"
+#include "metrics.h"
 
 class ProxyServer {
 private:
-    int server_socket;
+    std::shared_ptr<ProxyContext> context;
+    const ProxyConfig& config;
+    IoMode io_mode; // config.io_mode, or EPOLL if io_uring is unavailable
     int port;
     std::atomic<bool> running;
-    std::thread server_thread;
-    std::shared_ptr<CacheManager> cache_manager;
 
-    void start_listening();
-    void handle_client(int client_socket);
-    void handle_connect_tunnel(int client_socket, const HttpRequest& request);
-    static void forward_data(int source, int dest);
+    // Periodic housekeeping (idle upstream connection expiry)
+    std::thread maintenance_thread;
+    std::mutex maintenance_mutex;
+    std::condition_variable maintenance_cv;
+
+    // Metrics endpoint, with --admin-port
+    std::unique_ptr<AdminServer> admin_server;
+
+    // One non-blocking SO_REUSEPORT listening socket per shard; shard i is
+    // pinned to shard_cpus[i] (-1 = unpinned). The sockets may be inherited
+    // from, or handed on to, another process during an upgrade.
+    std::vector<int> server_sockets;
+    std::vector<int> shard_cpus;
+
+    // Shards still accepting. The listeners are never shut down, as another
+    // process may share them, so threaded acceptors also poll drain_fd.
+    std::atomic<int> accepting;
+    std::atomic<bool> accepts_stopped;
+    int drain_fd;
+
+    // Epoll and io_uring modes: one EventLoop per shard, each accepting on
+    // its own socket
+    std::vector<std::unique_ptr<EventLoop>> event_loops;
+    std::vector<std::thread> loop_threads;
+
+    // Threaded mode: one acceptor thread and bounded worker pool per shard
+    std::vector<std::thread> acceptor_threads;
+    std::vector<std::unique_ptr<ThreadPool>> worker_pools;
+
+    // Sockets owned by threaded-mode handlers; stop() shuts them down so
+    // blocked workers return and the pools can be joined
+    std::mutex active_mutex;
+    std::unordered_set<int> active_sockets;
+
+    bool open_listeners(int shard_count);
+    void stop_accepting();
+    bool start_event_loops();
+    void stop_event_loops();
+    void start_worker_pools();
+    void stop_worker_pools();
+    void start_listening(size_t shard);
+    void maintenance_loop();
+    void track_socket(int socket_fd);
+    void untrack_socket(int socket_fd);
+    void release_socket(int socket_fd);
+    int connect_upstream(const std::string& host, int port);
+    void start_admin_server();
+    // 'accepted' is when the client was queued for a worker
+    void handle_client(int client_socket, const std::string& client_key, Metrics::Clock::time_point accepted);
+    // Answer a request that waited past the queue target with 503
+    void shed_request(int client_socket, ResponseBatch& batch);
+    // 'answered': a request was read on this connection before, so it may be
+    // closed while idle if the process starts draining
+    bool read_request_head(int client_socket, std::string& pending, HttpParser& parser,
+                           ResponseBatch& batch, bool answered);
+    enum class BodyRelay { DONE, CLIENT_FAILED, MALFORMED, TARGET_FAILED };
+    // Read one request body, 'length' bytes or chunked with its framing, and
+    // send it on to 'target_socket' as it arrives, or drop it if that is -1.
+    // Only one buffer of it is held at a time; bytes after it stay in 'pending'.
+    BodyRelay relay_request_body(int client_socket, std::string& pending, uint64_t length, bool chunked,
+                                 int target_socket);
+    // Read past the body of a request answered from the cache, so the next
+    // request is parsed from where it ends
+    bool skip_request_body(int client_socket, std::string& pending, uint64_t length, bool chunked,
+                           ResponseBatch& batch);
+    bool flush_batch(int client_socket, ResponseBatch& batch);
+    // Collapsed forwarding: true if another client's fetch for the same URL
+    // (or a refresh of the expired copy) answered this request; otherwise
+    // 'leader' says whether to end_fetch()
+    bool wait_for_fetch(const HttpRequest& request, std::shared_ptr<const CachedBlock>& block, bool& leader,
+                        bool has_stale);
+    // 'serialized_request' is the connection's scratch buffer for the upstream
+    // request. The body ('body_length' bytes, or chunked) is streamed from the
+    // client after the head; false unless the connection can read another request.
+    bool forward_request(int client_socket, HttpRequest& request, std::string& serialized_request,
+                         std::string& pending, uint64_t body_length, bool chunked);
+    // 'early_data' is what the client sent after the CONNECT head, e.g. a
+    // TLS ClientHello; it goes to the target first
+    void handle_connect_tunnel(int client_socket, const HttpRequest& request, const std::string& early_data);
+    void relay_tunnel(int client_socket, int target_socket, const std::string& early_data);
 
 public:
     ProxyServer(int port);
+    explicit ProxyServer(const ProxyConfig& config);
     ~ProxyServer();
     
+    // Serve on listeners inherited from the process being upgraded instead
+    // of opening new ones; call before start(). One shard per listener.
+    void adopt_listeners(const std::vector<int>& sockets);
+    const std::vector<int>& listeners() const { return server_sockets; }
+    // Give up what the process taking over needs to start: the admin port
+    // and the disk cache directory (written out first)
+    void release_for_upgrade();
+    // Take them back when the new process did not take over
+    void resume_after_upgrade_failed();
+
     bool start();
+    // Stop accepting and wait until every client connection has closed, or
+    // 'timeout' passes; false in that case. Call stop() afterwards.
+    bool drain(std::chrono::seconds timeout);
     void stop();
     int get_port() const;
-    std::shared_ptr<CacheManager> get_cache_manager() const { return cache_manager; }
+    std::shared_ptr<CacheManager> get_cache_manager() const { return context->cache_manager; }
+    std::shared_ptr<ConnectionPool> get_upstream_pool() const { return context->upstream_pool; }
 };
 
 #endif // PROXY_SERVER_H
@@ -0,0 +1,124 @@
+#ifndef RELAY_DIRECTION_H
+#define RELAY_DIRECTION_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include "buffer_pool.h"
+#include "event_loop.h"
+#include "metrics.h"
+
+// One direction of a relay between two non-blocking sockets. Bytes are moved
+// socket -> pipe -> socket with splice(2) when enabled, so they never enter
+// user space; otherwise (or when a tap needs to see them) they go through a
+// user-space chunk, a pooled buffer held only while part of it is unsent.
+// At most one chunk is in flight, so a slow receiver applies backpressure to
+// the sender.
+//
+// On an io_uring loop the same moves are queued as ring operations instead
+// (see use_ring()). A multishot receive keeps filling provided buffers while
+// a single sendmsg writes out everything received so far; the receive is
+// cancelled while a few chunks wait to be written, for backpressure.
+class RelayDirection {
+public:
+    enum class Status {
+        BLOCKED,   // Waiting for the source to be readable or the sink writable
+        YIELDED,   // Budget used up; call pump() again without waiting
+        FINISHED,  // Source reached EOF and everything was written
+        FAILED     // Socket error on either side
+    };
+
+    // Sees each chunk read from the source and returns how many of its bytes
+    // to forward; bytes past that point are dropped
+    using Tap = std::function<size_t(const char* data, size_t length)>;
+
+    RelayDirection() = default;
+    ~RelayDirection();
+
+    RelayDirection(const RelayDirection&) = delete;
+    RelayDirection& operator=(const RelayDirection&) = delete;
+
+    // from < 0 means there is nothing to read: finish once queued data is written
+    void attach(int from, int to);
+    // Switch to the zero-copy path; returns false (and stays buffered) if no pipe
+    bool enable_splice();
+    // Observe relayed bytes; forces the buffered path
+    void set_tap(Tap tap);
+    // Bytes to write ahead of anything read from the source
+    void queue(const std::string& data);
+    // Read at most 'limit' more bytes from the source, then behave as at EOF
+    void set_read_limit(uint64_t limit);
+    // Add bytes read from the source and written to the sink to these
+    // counters (Metrics::COUNTER_COUNT for none)
+    void count_into(Metrics::Counter read, Metrics::Counter written) {
+        read_counter = read;
+        write_counter = written;
+    }
+    // Stop reading: finish once the bytes already accepted are written
+    void mark_complete() { eof = true; }
+    // Move bytes with io_uring operations on 'loop': pump() queues them and
+    // returns BLOCKED, and 'wake' runs when one completes, to pump again.
+    // Kept across reset().
+    void use_ring(EventLoop& loop, std::function<void()> wake);
+    // Back to the freshly constructed state (closes the pipe)
+    void reset();
+
+    Status pump(int budget);
+
+    bool is_attached() const { return to >= 0; }
+    bool has_pending() const;
+    bool at_eof() const { return eof; }
+    bool is_spliced() const { return pipe_fds[0] >= 0; }
+    int source() const { return from; }
+    int sink() const { return to; }
+    uint64_t bytes_relayed() const { return bytes; }
+
+private:
+    int from = -1;
+    int to = -1;
+    bool eof = false;
+    uint64_t bytes = 0;
+    bool limited = false;
+    uint64_t read_limit = 0;
+    Tap tap;
+    Metrics::Counter read_counter = Metrics::COUNTER_COUNT;
+    Metrics::Counter write_counter = Metrics::COUNTER_COUNT;
+
+    std::string pending; // Queued bytes
+    size_t pending_offset = 0;
+
+    PooledBuffer chunk;  // Last chunk read, while its tail is unsent
+    size_t chunk_offset = 0;
+    size_t chunk_length = 0;
+
+    int pipe_fds[2] = {-1, -1};
+    size_t piped = 0; // Bytes sitting in the pipe
+
+    // io_uring mode. Operations complete into a RingIo they share, which
+    // owns what they read into and write from, so reset() only orphans it
+    // and nothing they touch is freed under them.
+    struct RingIo;
+    EventLoop* ring_loop = nullptr;
+    std::function<void()> ring_wake;
+    std::shared_ptr<RingIo> ring_io;
+
+    Status flush();
+    Status fill();
+    Status pump_ring();
+    bool finish_ring_write();
+    bool take_ring_reads();
+    void start_ring_write();
+    void start_ring_read();
+    void detach_ring();
+    void consume_limit(uint64_t count);
+    void drop_chunk();
+    static void count(Metrics::Counter counter, size_t length) {
+        if (counter != Metrics::COUNTER_COUNT) {
+            Metrics::add(counter, length);
+        }
+    }
+    void close_pipe();
+};
+
+#endif // RELAY_DIRECTION_H
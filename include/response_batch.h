@@ -0,0 +1,49 @@
+#ifndef RESPONSE_BATCH_H
+#define RESPONSE_BATCH_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "cache_manager.h"
+
+// Cached responses queued for one gathered write. Slices point straight into
+// the shared cache blocks, which are held here until written, so queuing a
+// hit copies and allocates nothing once the vectors have grown. Bodies held
+// by the disk tier are file parts, sent with sendfile(2) in between.
+class ResponseBatch {
+public:
+    // Queue a cached response; returns whether the client connection can
+    // stay open after it (the block must be framed for that)
+    bool add(std::shared_ptr<const CachedBlock> block, bool keep_alive);
+
+    // One sendmsg of the memory slices up to the next file part, or one
+    // sendfile of that part. Returns the bytes written, 0 if the
+    // socket would block, -1 on error.
+    ssize_t send(int socket_fd);
+
+    // The unsent remainder as one string, for a relay queue; empties the batch
+    std::string take_remaining();
+
+    void clear();
+    bool empty() const { return first == slices.size(); }
+    size_t pending_bytes() const { return bytes; }
+
+private:
+    // A body in a segment file; its slice only carries the remaining length
+    struct FilePart {
+        size_t slice;
+        int fd;
+        uint64_t offset;
+    };
+
+    std::vector<struct iovec> slices;
+    std::vector<FilePart> files;
+    size_t next_file = 0;
+    std::vector<std::shared_ptr<const CachedBlock>> blocks;
+    size_t first = 0;
+    size_t bytes = 0;
+};
+
+#endif // RESPONSE_BATCH_H
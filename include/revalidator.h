@@ -0,0 +1,70 @@
+#ifndef REVALIDATOR_H
+#define REVALIDATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "cache_manager.h"
+#include "connect_race.h"
+#include "dns_resolver.h"
+#include "thread_pool.h"
+
+// Background refreshes of expired cache entries. A refresh sends the client's
+// request upstream from a worker thread, made conditional with the entry's
+// ETag/Last-Modified, and reads the whole response: a 304 renews the entry,
+// a cacheable 2xx replaces it and anything else that arrives removes it. If
+// the origin cannot be reached or answers 5xx, the stale copy is left for
+// stale-if-error. A refresh registers as the fetch in flight for its key, so
+// clients that need its result wait for it like any collapsed miss.
+//
+// The same workers run CacheManager's refresh-ahead of hot entries that are
+// still fresh.
+class Revalidator {
+public:
+    struct Stats {
+        uint64_t started;
+        uint64_t not_modified;  // 304: entry renewed without a body
+        uint64_t replaced;      // Full response: stored, or the entry dropped if uncacheable
+        uint64_t failed;        // Origin unreachable or 5xx; stale copy kept
+        uint64_t dropped;       // Refresh queue full
+    };
+
+    Revalidator(std::shared_ptr<CacheManager> cache, std::shared_ptr<DnsResolver> resolver,
+                size_t thread_count, const ConnectRace::Options& connect_options);
+    ~Revalidator();
+
+    Revalidator(const Revalidator&) = delete;
+    Revalidator& operator=(const Revalidator&) = delete;
+
+    // If the cache holds an expired copy for 'request', make sure a refresh
+    // is running (unless a fetch for it already is) and return true
+    bool refresh(const HttpRequest& request);
+    // CacheManager::Refresher: refresh a fresh entry before it expires
+    bool refresh_ahead(const HttpRequest& request, const StaleCopy& validators,
+                       std::chrono::system_clock::time_point expires);
+
+    // Finish queued refreshes and join the workers
+    void shutdown();
+
+    Stats get_stats() const;
+
+private:
+    std::shared_ptr<CacheManager> cache;
+    std::shared_ptr<DnsResolver> resolver;
+    ConnectRace::Options connect_options;
+    std::unique_ptr<ThreadPool> workers;
+
+    std::atomic<uint64_t> started;
+    std::atomic<uint64_t> not_modified;
+    std::atomic<uint64_t> replaced;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> dropped;
+
+    void run(HttpRequest request, StaleCopy stale);
+    // One blocking request/response exchange; false if the origin could
+    // not be reached or the response was cut short
+    bool fetch(const HttpRequest& request, HttpResponse& response);
+};
+
+#endif // REVALIDATOR_H
@@ -1,21 +1,66 @@
 #ifndef SOCKET_UTILS_H
 #define SOCKET_UTILS_H
 
+#include <cstdint>
 #include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+// An IPv4 or IPv6 endpoint as produced by the resolver
+struct SocketAddress {
+    struct sockaddr_storage storage;
+    socklen_t length = 0;
+
+    int family() const { return storage.ss_family; }
+    const struct sockaddr* get() const { return reinterpret_cast<const struct sockaddr*>(&storage); }
+    void set_port(int port);
+    std::string to_string() const; // "1.2.3.4:80" or "[::1]:80"
+    std::string host_string() const; // "1.2.3.4" or "::1"
+};
 
 class SocketUtils {
 public:
     // Socket creation and binding
-    static int create_socket();
-    static bool bind_socket(int socket_fd, int port);
+    static int create_socket(int family = AF_INET);
+    static bool bind_socket(int socket_fd, int port, bool reuse_port = false, bool loopback_only = false);
     static bool listen_on_socket(int socket_fd);
     
     // Connection management
-    static int accept_connection(int server_socket);
-    static bool connect_to_host(int socket_fd, const std::string& host, int port);
+    static int accept_connection(int server_socket); // Blocking client; -1 when nothing is pending
+    static bool connect_to_address(int socket_fd, const SocketAddress& address); // Blocking, no timeout
+    
+    // Non-blocking variants used by the epoll reactor
+    static bool set_non_blocking(int socket_fd);
+    static int accept_non_blocking(int server_socket); // -1 when nothing is pending
+    static std::string peer_address(int socket_fd); // Empty if unknown
+    static std::string peer_host(int socket_fd);    // Address without the port; empty if unknown
+    static int get_socket_error(int socket_fd);
+    
+    // Latency tuning for upstream sockets
+    static bool set_no_delay(int socket_fd);
+    // Acknowledge the next segments immediately. Linux drops back to delayed
+    // ACKs on its own, so callers re-arm it after each read.
+    static bool set_quick_ack(int socket_fd);
+    // Fail blocking sends and receives that make no progress for 'seconds'
+    static bool set_io_timeout(int socket_fd, int seconds);
     
     // Data transfer
     static int send_data(int socket_fd, const char* data, int length);
+    static bool send_all(int socket_fd, const char* data, size_t length); // Loops over partial sends
+    // One vectored write of parts[first..]. Advances 'first' past what was
+    // written and trims a partly written slice in place. Returns the bytes
+    // written, 0 if the socket would block, -1 on error.
+    // Only parts before 'end' are written; if that stops short of the last
+    // part, the kernel is told more data follows.
+    static ssize_t send_vectored(int socket_fd, std::vector<struct iovec>& parts, size_t& first,
+                                 size_t end = SIZE_MAX);
+    // sendfile(2) up to 'length' bytes of a file from 'offset', advancing it.
+    // Returns the bytes written, 0 if the socket would block, -1 on error or
+    // if the file ends early.
+    static ssize_t send_file(int socket_fd, int file_fd, uint64_t& offset, size_t length);
     static int receive_data(int socket_fd, char* buffer, int buffer_size);
     
     // Cleanup
@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool with a bounded task queue. Submitting to a full
+// queue fails immediately instead of blocking the caller (the acceptor).
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // cpu < 0 leaves the workers unpinned
+    ThreadPool(size_t thread_count, size_t queue_depth, int cpu = -1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Returns false if the queue is full or the pool is shutting down
+    bool try_submit(Task task);
+
+    // Run the tasks already queued, then join all workers
+    void shutdown();
+
+    size_t queued() const;
+    size_t thread_count() const { return workers.size(); }
+
+    // CPU affinity helpers
+    static bool pin_current_thread(int cpu);
+    static std::vector<int> available_cpus();
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<Task> tasks;
+    size_t queue_depth;
+    bool stopping;
+    mutable std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+
+    void worker_loop(int cpu);
+};
+
+#endif // THREAD_POOL_H
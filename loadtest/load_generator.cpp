@@ -0,0 +1,454 @@
+// Closed-loop load generator for proxy_server. Every virtual user is a thread
+// with one blocking connection at a time, sending a request and waiting for
+// the whole response before the next. The mix is set on the command line:
+// the share of requests for a small pre-warmed hot set (cache hits) against
+// unique URLs (misses), how many requests share a connection, and the share
+// of connections that open a CONNECT tunnel to the origin instead.
+// Run: ./bin/load_generator --proxy=127.0.0.1:8080 --origin=127.0.0.1:9080 --concurrency=64
+
+#include "http_framing.h"
+#include "http_parser.h"
+#include "logger.h"
+#include "socket_utils.h"
+#include <netdb.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadConfig {
+    std::string proxy = "127.0.0.1:8080";
+    std::string origin = "127.0.0.1:9080";
+    int concurrency = 16;
+    int duration = 10;                 // Seconds of measurement
+    double hit_ratio = 0.9;            // Requests for the hot set
+    int hot_urls = 100;
+    int requests_per_connection = 100; // 1 opens a new connection per request
+    double connect_ratio = 0.0;        // Connections that tunnel with CONNECT
+    int timeout = 5;                   // Seconds without progress before a request fails
+};
+
+enum RequestClass {
+    HIT,       // Hot URL, cached by the warm-up pass
+    MISS,      // URL never requested before
+    TUNNEL,    // Sent to the origin through a CONNECT tunnel
+    CLASS_COUNT
+};
+
+const char* CLASS_NAMES[CLASS_COUNT] = {"hit", "miss", "tunnel"};
+
+const size_t READ_SIZE = 65536;
+
+// Per-thread results, merged once the run is over
+struct WorkerStats {
+    std::vector<uint32_t> latencies[CLASS_COUNT]; // Microseconds
+    uint64_t errors[CLASS_COUNT] = {};
+    uint64_t bytes[CLASS_COUNT] = {};
+    uint64_t connections = 0;
+    uint64_t connect_failures = 0;
+    uint64_t resent = 0; // Requests resent after a keep-alive connection was closed
+};
+
+bool resolve(const std::string& host_port, SocketAddress& address) {
+    size_t colon = host_port.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string host = host_port.substr(0, colon);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    struct addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), host_port.c_str() + colon + 1, &hints, &result) != 0 || !result) {
+        return false;
+    }
+    std::memcpy(&address.storage, result->ai_addr, result->ai_addrlen);
+    address.length = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+class Client {
+public:
+    Client(const LoadConfig& config, const SocketAddress& proxy)
+        : config(config), proxy(proxy), fd(-1), dropped(false) {}
+    ~Client() { disconnect(); }
+
+    bool connect(bool tunnel) {
+        fd = SocketUtils::create_socket(proxy.family());
+        if (fd < 0) {
+            return false;
+        }
+        SocketUtils::set_io_timeout(fd, config.timeout);
+        if (!SocketUtils::connect_to_address(fd, proxy)) {
+            disconnect();
+            return false;
+        }
+        SocketUtils::set_no_delay(fd);
+        return !tunnel || open_tunnel();
+    }
+
+    void disconnect() {
+        if (fd >= 0) {
+            SocketUtils::close_socket(fd);
+            fd = -1;
+        }
+    }
+
+    // Sends one GET and reads the response to its end. 'bytes' is set to
+    // the response size; 'keep_alive' to whether the connection is reusable.
+    bool fetch(const std::string& request, uint64_t& bytes, bool& keep_alive) {
+        dropped = false;
+        if (!SocketUtils::send_all(fd, request.data(), request.size())) {
+            dropped = true;
+            return false;
+        }
+        ResponseFramer framer;
+        bytes = 0;
+        while (true) {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            ResponseFramer::Result result;
+            if (received > 0) {
+                size_t used = 0;
+                result = framer.consume(buffer, static_cast<size_t>(received), used);
+                bytes += used;
+            } else if (received == 0) {
+                dropped = bytes == 0;
+                result = framer.finish_on_close();
+            } else {
+                dropped = bytes == 0 && errno == ECONNRESET;
+                return false; // Timed out or reset
+            }
+            if (result == ResponseFramer::Result::ERROR) {
+                return false;
+            }
+            if (result == ResponseFramer::Result::COMPLETE) {
+                keep_alive = received > 0 && framer.keep_alive();
+                return framer.status_code() == 200;
+            }
+        }
+    }
+
+    // Whether the last fetch failed because the connection was closed
+    // before any of the response arrived
+    bool was_dropped() const { return dropped; }
+
+private:
+    const LoadConfig& config;
+    const SocketAddress& proxy;
+    int fd;
+    bool dropped;
+    char buffer[READ_SIZE];
+
+    bool open_tunnel() {
+        std::string request = "CONNECT " + config.origin + " HTTP/1.1\r\nHost: " + config.origin + "\r\n\r\n";
+        if (!SocketUtils::send_all(fd, request.data(), request.size())) {
+            return false;
+        }
+        // The origin speaks only after our first request, so the reply
+        // ends exactly at the blank line
+        std::string reply;
+        HttpParser parser(HttpParser::Kind::RESPONSE);
+        while (true) {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                return false;
+            }
+            reply.append(buffer, static_cast<size_t>(received));
+            HttpParser::Result result = parser.parse(reply.data(), reply.size());
+            if (result == HttpParser::Result::ERROR) {
+                return false;
+            }
+            if (result == HttpParser::Result::COMPLETE) {
+                return parser.status_code() == 200 && parser.head_length() == reply.size();
+            }
+        }
+    }
+};
+
+std::string build_request(const LoadConfig& config, const std::string& path, bool tunnel, bool last) {
+    std::string request = "GET ";
+    if (!tunnel) {
+        request += "http://" + config.origin;
+    }
+    request += path + " HTTP/1.1\r\nHost: " + config.origin + "\r\nUser-Agent: load_generator\r\n";
+    if (last) {
+        request += "Connection: close\r\n";
+    }
+    request += "\r\n";
+    return request;
+}
+
+// Misses carry a run id so a cache kept from an earlier run cannot answer them
+void run_worker(const LoadConfig& config, const SocketAddress& proxy, const std::string& run_id, int index,
+                Clock::time_point deadline, WorkerStats& stats) {
+    std::mt19937_64 random(static_cast<uint64_t>(index) * 0x9e3779b97f4a7c15ULL + 1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    Client client(config, proxy);
+    uint64_t sequence = 0;
+
+    while (Clock::now() < deadline) {
+        bool tunnel = uniform(random) < config.connect_ratio;
+        stats.connections++;
+        if (!client.connect(tunnel)) {
+            client.disconnect();
+            stats.connect_failures++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        for (int n = 0; n < config.requests_per_connection && Clock::now() < deadline; n++) {
+            RequestClass kind = tunnel ? TUNNEL : uniform(random) < config.hit_ratio ? HIT : MISS;
+            std::string path;
+            if (kind == HIT) {
+                path = "/hot/" + std::to_string(random() % static_cast<uint64_t>(config.hot_urls));
+            } else {
+                path = "/" + std::string(CLASS_NAMES[kind]) + "/" + run_id + "/" + std::to_string(index) +
+                       "/" + std::to_string(sequence++);
+            }
+            std::string request = build_request(config, path, tunnel, n + 1 == config.requests_per_connection);
+
+            uint64_t bytes = 0;
+            bool keep_alive = false;
+            Clock::time_point start = Clock::now();
+            bool fetched = client.fetch(request, bytes, keep_alive);
+            if (!fetched && n > 0 && !tunnel && client.was_dropped()) {
+                // The proxy closed the connection between requests, as it
+                // does when draining for an upgrade: resend on a new one,
+                // as browsers do
+                client.disconnect();
+                stats.connections++;
+                stats.resent++;
+                fetched = client.connect(false) && client.fetch(request, bytes, keep_alive);
+            }
+            if (!fetched) {
+                stats.errors[kind]++;
+                break;
+            }
+            auto micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+            stats.latencies[kind].push_back(static_cast<uint32_t>(std::min<int64_t>(micros, UINT32_MAX)));
+            stats.bytes[kind] += bytes;
+            if (!keep_alive) {
+                break;
+            }
+        }
+        client.disconnect();
+    }
+}
+
+// Requests every hot URL once so later requests for them are cache hits
+bool warm_up(const LoadConfig& config, const SocketAddress& proxy) {
+    Client client(config, proxy);
+    bool connected = false;
+    for (int i = 0; i < config.hot_urls; i++) {
+        if (!connected && !client.connect(false)) {
+            return false;
+        }
+        uint64_t bytes = 0;
+        bool keep_alive = false;
+        std::string request = build_request(config, "/hot/" + std::to_string(i), false, false);
+        if (!client.fetch(request, bytes, keep_alive)) {
+            return false;
+        }
+        connected = keep_alive;
+        if (!connected) {
+            client.disconnect();
+        }
+    }
+    return true;
+}
+
+double percentile_ms(const std::vector<uint32_t>& sorted, double quantile) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = static_cast<size_t>(quantile * static_cast<double>(sorted.size()));
+    return sorted[std::min(rank, sorted.size() - 1)] / 1000.0;
+}
+
+void print_row(const char* name, std::vector<uint32_t>& latencies, uint64_t errors, uint64_t bytes,
+               double seconds) {
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("  %-7s %10zu %8llu %10.0f %9.3f %9.3f %9.3f %9.1f\n", name, latencies.size(),
+                static_cast<unsigned long long>(errors), latencies.size() / seconds,
+                percentile_ms(latencies, 0.5), percentile_ms(latencies, 0.99), percentile_ms(latencies, 0.999),
+                bytes / seconds / 1e6);
+}
+
+bool parse_ratio(const std::string& value, double& out) {
+    char* end = nullptr;
+    double ratio = std::strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || ratio < 0.0 || ratio > 1.0) {
+        return false;
+    }
+    out = ratio;
+    return true;
+}
+
+bool parse_count(const std::string& value, int low, int high, int& out) {
+    char* end = nullptr;
+    long count = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || count < low || count > high) {
+        return false;
+    }
+    out = static_cast<int>(count);
+    return true;
+}
+
+bool parse_option(const std::string& arg, LoadConfig& config) {
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+        return false;
+    }
+    std::string name = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+    if (name == "--proxy" || name == "--origin") {
+        (name == "--proxy" ? config.proxy : config.origin) = value;
+        return value.find(':') != std::string::npos;
+    }
+    if (name == "--concurrency") {
+        return parse_count(value, 1, 10000, config.concurrency);
+    }
+    if (name == "--duration") {
+        return parse_count(value, 1, 86400, config.duration);
+    }
+    if (name == "--hit-ratio") {
+        return parse_ratio(value, config.hit_ratio);
+    }
+    if (name == "--hot-urls") {
+        return parse_count(value, 1, 1000000, config.hot_urls);
+    }
+    if (name == "--requests-per-connection") {
+        return parse_count(value, 1, 1000000000, config.requests_per_connection);
+    }
+    if (name == "--connect-ratio") {
+        return parse_ratio(value, config.connect_ratio);
+    }
+    if (name == "--timeout") {
+        return parse_count(value, 1, 3600, config.timeout);
+    }
+    return false;
+}
+
+void print_usage(const char* program) {
+    std::printf("Usage: %s [options]\n"
+                "  --proxy=HOST:PORT              Proxy under test (default: 127.0.0.1:8080)\n"
+                "  --origin=HOST:PORT             Origin behind it, e.g. origin_stub (default: 127.0.0.1:9080)\n"
+                "  --concurrency=N                Connections in flight, one thread each (default: 16)\n"
+                "  --duration=S                   Seconds to measure (default: 10)\n"
+                "  --hit-ratio=R                  Share of requests for the hot set (default: 0.9)\n"
+                "  --hot-urls=N                   URLs in the hot set, warmed before the run (default: 100)\n"
+                "  --requests-per-connection=N    Keep-alive requests per connection; 1 = new connection "
+                "each (default: 100)\n"
+                "  --connect-ratio=R              Share of connections tunnelled with CONNECT (default: 0)\n"
+                "  --timeout=S                    Seconds without progress before a request fails (default: 5)\n",
+                program);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    LoadConfig config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (!parse_option(arg, config)) {
+            std::fprintf(stderr, "Invalid option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    Logger::set_level(ERROR);
+    signal(SIGPIPE, SIG_IGN);
+
+    SocketAddress proxy;
+    if (!resolve(config.proxy, proxy)) {
+        std::fprintf(stderr, "Cannot resolve proxy address '%s'\n", config.proxy.c_str());
+        return 1;
+    }
+    if (config.hit_ratio > 0.0 && config.connect_ratio < 1.0 && !warm_up(config, proxy)) {
+        std::fprintf(stderr, "Warm-up through %s failed; are the proxy and origin running?\n",
+                     config.proxy.c_str());
+        return 1;
+    }
+
+    std::printf("Load test: %d connections for %d s through %s to %s\n", config.concurrency, config.duration,
+                config.proxy.c_str(), config.origin.c_str());
+    std::printf("  hit ratio %.2f over %d hot URLs, %d requests per connection, CONNECT ratio %.2f\n\n",
+                config.hit_ratio, config.hot_urls, config.requests_per_connection, config.connect_ratio);
+
+    std::string run_id = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    std::vector<WorkerStats> stats(static_cast<size_t>(config.concurrency));
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::seconds(config.duration);
+    for (int i = 0; i < config.concurrency; i++) {
+        workers.emplace_back(run_worker, std::cref(config), std::cref(proxy), std::cref(run_id), i, deadline,
+                             std::ref(stats[i]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<uint32_t> all;
+    std::vector<uint32_t> by_class[CLASS_COUNT];
+    uint64_t errors[CLASS_COUNT] = {};
+    uint64_t bytes[CLASS_COUNT] = {};
+    uint64_t total_errors = 0; // Failed connections included
+    uint64_t total_bytes = 0;
+    uint64_t connections = 0;
+    uint64_t connect_failures = 0;
+    uint64_t resent = 0;
+    for (const auto& worker : stats) {
+        for (int c = 0; c < CLASS_COUNT; c++) {
+            by_class[c].insert(by_class[c].end(), worker.latencies[c].begin(), worker.latencies[c].end());
+            all.insert(all.end(), worker.latencies[c].begin(), worker.latencies[c].end());
+            errors[c] += worker.errors[c];
+            bytes[c] += worker.bytes[c];
+            total_errors += worker.errors[c];
+            total_bytes += worker.bytes[c];
+        }
+        connections += worker.connections;
+        connect_failures += worker.connect_failures;
+        resent += worker.resent;
+    }
+    total_errors += connect_failures;
+
+    std::printf("  %-7s %10s %8s %10s %9s %9s %9s %9s\n", "class", "requests", "errors", "RPS", "p50 ms",
+                "p99 ms", "p999 ms", "MB/s");
+    print_row("all", all, total_errors, total_bytes, seconds);
+    for (int c = 0; c < CLASS_COUNT; c++) {
+        if (!by_class[c].empty() || errors[c] > 0) {
+            print_row(CLASS_NAMES[c], by_class[c], errors[c], bytes[c], seconds);
+        }
+    }
+    std::printf("\n  %llu connections opened, %llu failed, %llu requests resent on a new connection\n",
+                static_cast<unsigned long long>(connections), static_cast<unsigned long long>(connect_failures),
+                static_cast<unsigned long long>(resent));
+    return all.empty() ? 1 : 0;
+}
@@ -0,0 +1,431 @@
+// Local origin for load tests: answers every GET with a generated body, so
+// the proxy can be measured without network access. Body size, delay,
+// freshness and chunked output are set on the command line and may be
+// overridden per request with a query string, e.g.
+//   GET /any/path?size=65536&delay=20&max_age=0&chunked=1
+// A CONNECT tunnel to the stub carries the same HTTP/1.1 traffic.
+// Run: ./bin/origin_stub --port=9080 --body-size=1024-65536 --max-age=300
+
+#include "event_loop.h"
+#include "http_parser.h"
+#include "logger.h"
+#include "socket_utils.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct StubConfig {
+    int port = 9080;
+    int threads = 0;              // 0 = CPU count
+    uint64_t min_body = 1024;
+    uint64_t max_body = 1024;     // Above min_body: a size per path in [min, max]
+    int delay_ms = 0;             // Before the response head is sent
+    int max_age = 300;            // 0 sends Cache-Control: no-store
+    bool chunked = false;
+};
+
+const size_t READ_SIZE = 16384;
+const size_t CHUNK_SIZE = 16384;
+const uint64_t MAX_BODY = uint64_t(1) << 30;
+
+bool parse_number(std::string_view text, uint64_t& out) {
+    if (text.empty() || text.size() > 19) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+    out = value;
+    return true;
+}
+
+// Value of 'name' in the query string of 'target'; empty if absent
+std::string_view query_value(std::string_view target, std::string_view name) {
+    size_t query = target.find('?');
+    while (query != std::string_view::npos) {
+        size_t start = query + 1;
+        size_t end = target.find('&', start);
+        std::string_view pair = target.substr(start, end == std::string_view::npos ? end : end - start);
+        if (pair.size() > name.size() && pair.compare(0, name.size(), name) == 0 && pair[name.size()] == '=') {
+            return pair.substr(name.size() + 1);
+        }
+        query = end;
+    }
+    return std::string_view();
+}
+
+// FNV-1a, so a path keeps its size across requests and restarts
+uint64_t hash_path(std::string_view path) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (char c : path) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+class StubConnection : public EventLoop::Handler, public std::enable_shared_from_this<StubConnection> {
+public:
+    StubConnection(int fd, EventLoop& loop, const StubConfig& config)
+        : fd(fd), loop(loop), config(config), parser(HttpParser::Kind::REQUEST), body_remaining(0),
+          sent(0), delaying(false), close_after(false), closed(false) {}
+
+    void handle_event(int, uint32_t events) override {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            close();
+            return;
+        }
+        if (events & EPOLLIN) {
+            read_requests();
+        }
+        if (!closed && (events & EPOLLOUT)) {
+            flush();
+        }
+    }
+
+private:
+    int fd;
+    EventLoop& loop;
+    const StubConfig& config;
+    HttpParser parser;
+    std::string input;
+    uint64_t body_remaining;  // Request body bytes still to discard
+    std::string output;
+    size_t sent;
+    bool delaying;            // A delayed response holds back the ones after it
+    bool close_after;
+    bool closed;
+
+    void read_requests() {
+        char buffer[READ_SIZE];
+        while (true) {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received > 0) {
+                input.append(buffer, static_cast<size_t>(received));
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            // Peer closed; finish what is queued first
+            close_after = true;
+            break;
+        }
+        process();
+        flush();
+    }
+
+    void process() {
+        while (!delaying && !closed) {
+            if (body_remaining > 0) {
+                size_t skip = static_cast<size_t>(std::min<uint64_t>(body_remaining, input.size()));
+                input.erase(0, skip);
+                body_remaining -= skip;
+                if (body_remaining > 0) {
+                    return;
+                }
+            }
+            HttpParser::Result result = parser.parse(input.data(), input.size());
+            if (result == HttpParser::Result::NEED_MORE) {
+                return;
+            }
+            if (result == HttpParser::Result::ERROR) {
+                output += "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+                close_after = true;
+                input.clear();
+                return;
+            }
+            respond();
+            parser.reset();
+        }
+    }
+
+    // Answers the request in 'parser', then drops it from 'input'
+    void respond() {
+        std::string method(parser.method());
+        std::string_view version = parser.version();
+        std::string_view connection = parser.find_header("Connection");
+        bool keep_alive = version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+        uint64_t request_body = 0;
+        parse_number(parser.find_header("Content-Length"), request_body);
+
+        std::string head;
+        std::string target(parser.target());
+        if (method == "CONNECT") {
+            // The tunnel ends here: later bytes are requests to this stub
+            head = "HTTP/1.1 200 Connection Established\r\n\r\n";
+            keep_alive = true;
+        } else {
+            head = build_response(method, target, keep_alive);
+        }
+        input.erase(0, parser.head_length());
+        body_remaining = request_body;
+        if (!keep_alive) {
+            close_after = true;
+        }
+
+        uint64_t delay = static_cast<uint64_t>(config.delay_ms);
+        parse_number(query_value(target, "delay"), delay);
+        if (delay == 0 || method == "CONNECT") {
+            output += head;
+            return;
+        }
+        delaying = true;
+        std::weak_ptr<StubConnection> weak = shared_from_this();
+        loop.schedule(std::chrono::milliseconds(delay), [weak, head]() {
+            auto self = weak.lock();
+            if (!self || self->closed) {
+                return;
+            }
+            self->output += head;
+            self->delaying = false;
+            self->process();
+            self->flush();
+        });
+    }
+
+    std::string build_response(std::string_view method, const std::string& target, bool keep_alive) const {
+        if (method != "GET" && method != "HEAD") {
+            return std::string("HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n") +
+                   (keep_alive ? "" : "Connection: close\r\n") + "\r\n";
+        }
+        uint64_t size = config.min_body;
+        if (config.max_body > config.min_body) {
+            std::string_view path = std::string_view(target).substr(0, target.find('?'));
+            size += hash_path(path) % (config.max_body - config.min_body + 1);
+        }
+        parse_number(query_value(target, "size"), size);
+        size = std::min(size, MAX_BODY);
+        uint64_t max_age = static_cast<uint64_t>(config.max_age);
+        parse_number(query_value(target, "max_age"), max_age);
+        bool chunked = config.chunked;
+        std::string_view chunked_value = query_value(target, "chunked");
+        if (!chunked_value.empty()) {
+            chunked = chunked_value != "0";
+        }
+
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n";
+        response += max_age > 0 ? "Cache-Control: max-age=" + std::to_string(max_age) + "\r\n"
+                                : std::string("Cache-Control: no-store\r\n");
+        response += chunked ? std::string("Transfer-Encoding: chunked\r\n")
+                            : "Content-Length: " + std::to_string(size) + "\r\n";
+        if (!keep_alive) {
+            response += "Connection: close\r\n";
+        }
+        response += "\r\n";
+        if (method == "HEAD") {
+            return response;
+        }
+
+        if (!chunked) {
+            response.append(static_cast<size_t>(size), 'x');
+            return response;
+        }
+        char length[32];
+        for (uint64_t left = size; left > 0;) {
+            size_t piece = static_cast<size_t>(std::min<uint64_t>(left, CHUNK_SIZE));
+            std::snprintf(length, sizeof(length), "%zx\r\n", piece);
+            response += length;
+            response.append(piece, 'x');
+            response += "\r\n";
+            left -= piece;
+        }
+        response += "0\r\n\r\n";
+        return response;
+    }
+
+    void flush() {
+        while (sent < output.size()) {
+            ssize_t written = send(fd, output.data() + sent, output.size() - sent, MSG_NOSIGNAL);
+            if (written > 0) {
+                sent += static_cast<size_t>(written);
+                continue;
+            }
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return; // EPOLLOUT resumes
+            }
+            close();
+            return;
+        }
+        output.clear();
+        sent = 0;
+        if (close_after && !delaying) {
+            close();
+        }
+    }
+
+    void close() {
+        if (closed) {
+            return;
+        }
+        closed = true;
+        loop.remove(fd);
+        SocketUtils::close_socket(fd);
+    }
+};
+
+class StubAcceptor : public EventLoop::Handler {
+public:
+    StubAcceptor(int server_socket, EventLoop& loop, const StubConfig& config)
+        : server_socket(server_socket), loop(loop), config(config) {}
+
+    void handle_event(int, uint32_t) override {
+        while (true) {
+            int client = SocketUtils::accept_non_blocking(server_socket);
+            if (client < 0) {
+                return;
+            }
+            SocketUtils::set_no_delay(client);
+            auto connection = std::make_shared<StubConnection>(client, loop, config);
+            if (!loop.add(client, EPOLLIN | EPOLLOUT, connection)) {
+                SocketUtils::close_socket(client);
+            }
+        }
+    }
+
+private:
+    int server_socket;
+    EventLoop& loop;
+    const StubConfig& config;
+};
+
+bool parse_option(const std::string& arg, StubConfig& config) {
+    size_t equals = arg.find('=');
+    std::string name = arg.substr(0, equals);
+    std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    uint64_t number = 0;
+    if (name == "--port" && parse_number(value, number) && number > 0 && number <= 65535) {
+        config.port = static_cast<int>(number);
+    } else if (name == "--threads" && parse_number(value, number) && number <= 1024) {
+        config.threads = static_cast<int>(number);
+    } else if (name == "--body-size") {
+        size_t dash = value.find('-');
+        uint64_t low = 0;
+        uint64_t high = 0;
+        if (!parse_number(value.substr(0, dash), low) ||
+            !parse_number(dash == std::string::npos ? value : value.substr(dash + 1), high) || high < low ||
+            high > MAX_BODY) {
+            return false;
+        }
+        config.min_body = low;
+        config.max_body = high;
+    } else if (name == "--delay-ms" && parse_number(value, number) && number <= 600000) {
+        config.delay_ms = static_cast<int>(number);
+    } else if (name == "--max-age" && parse_number(value, number) && number <= 31536000) {
+        config.max_age = static_cast<int>(number);
+    } else if (name == "--chunked" && (value.empty() || value == "on" || value == "off")) {
+        config.chunked = value != "off";
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void print_usage(const char* program) {
+    std::printf("Usage: %s [options]\n"
+                "  --port=N              Listen port (default: 9080)\n"
+                "  --threads=N           Event loops, one SO_REUSEPORT socket each (default: CPU count)\n"
+                "  --body-size=N|MIN-MAX Body bytes; a range picks a fixed size per path (default: 1024)\n"
+                "  --delay-ms=N          Wait before each response (default: 0)\n"
+                "  --max-age=S           Cache-Control max-age; 0 sends no-store (default: 300)\n"
+                "  --chunked[=on|off]    Transfer-Encoding: chunked bodies (default: off)\n"
+                "Per request: ?size=N&delay=MS&max_age=S&chunked=0|1\n",
+                program);
+}
+
+std::atomic<bool> should_exit(false);
+
+void signal_handler(int) {
+    should_exit = true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    StubConfig config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (!parse_option(arg, config)) {
+            std::fprintf(stderr, "Invalid option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.threads == 0) {
+        config.threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    Logger::set_level(WARNING);
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::vector<int> sockets;
+    for (int i = 0; i < config.threads; i++) {
+        int server_socket = SocketUtils::create_socket();
+        if (server_socket < 0 || !SocketUtils::bind_socket(server_socket, config.port, true) ||
+            !SocketUtils::listen_on_socket(server_socket) || !SocketUtils::set_non_blocking(server_socket)) {
+            std::fprintf(stderr, "Cannot listen on port %d\n", config.port);
+            return 1;
+        }
+        auto loop = std::make_unique<EventLoop>();
+        if (!loop->is_valid() ||
+            !loop->add(server_socket, EPOLLIN, std::make_shared<StubAcceptor>(server_socket, *loop, config))) {
+            std::fprintf(stderr, "Cannot create event loop\n");
+            return 1;
+        }
+        sockets.push_back(server_socket);
+        loops.push_back(std::move(loop));
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& loop : loops) {
+        threads.emplace_back([&loop]() { loop->run(); });
+    }
+    std::fprintf(stderr, "Origin stub on port %d: %d threads, body %llu-%llu bytes, delay %d ms, %s%s\n",
+                 config.port, config.threads, static_cast<unsigned long long>(config.min_body),
+                 static_cast<unsigned long long>(config.max_body), config.delay_ms,
+                 config.max_age > 0 ? ("max-age=" + std::to_string(config.max_age)).c_str() : "no-store",
+                 config.chunked ? ", chunked" : "");
+
+    while (!should_exit) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    for (auto& loop : loops) {
+        loop->stop();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int server_socket : sockets) {
+        SocketUtils::close_socket(server_socket);
+    }
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "admin_server.h"
+#include "logger.h"
+#include "metrics.h"
+#include "socket_utils.h"
+#include <poll.h>
+#include <sys/socket.h>
+
+namespace {
+    const size_t MAX_REQUEST_HEAD = 8192;
+    const int POLL_INTERVAL_MS = 200; // How quickly stop() is noticed
+    const int IO_TIMEOUT_SECONDS = 5;
+}
+
+AdminServer::AdminServer(std::shared_ptr<ProxyContext> context, int port)
+    : context(std::move(context)), port(port), server_socket(-1), running(false) {}
+
+AdminServer::~AdminServer() {
+    stop();
+}
+
+bool AdminServer::start() {
+    server_socket = SocketUtils::create_socket();
+    if (server_socket < 0 || !SocketUtils::bind_socket(server_socket, port, false, true) ||
+        !SocketUtils::listen_on_socket(server_socket)) {
+        LOG_ERROR("Failed to open admin port " + std::to_string(port));
+        SocketUtils::close_socket(server_socket);
+        server_socket = -1;
+        return false;
+    }
+    running = true;
+    thread = std::thread(&AdminServer::serve, this);
+    LOG_INFO("Metrics at http://127.0.0.1:" + std::to_string(port) + "/metrics");
+    return true;
+}
+
+void AdminServer::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    thread.join();
+    SocketUtils::close_socket(server_socket);
+    server_socket = -1;
+}
+
+void AdminServer::serve() {
+    while (running) {
+        struct pollfd listener = {server_socket, POLLIN, 0};
+        if (poll(&listener, 1, POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+        int client_socket = accept(server_socket, nullptr, nullptr);
+        if (client_socket < 0) {
+            continue;
+        }
+        SocketUtils::set_io_timeout(client_socket, IO_TIMEOUT_SECONDS);
+        handle(client_socket);
+        SocketUtils::close_socket(client_socket);
+    }
+}
+
+void AdminServer::handle(int client_socket) {
+    std::string head;
+    char buffer[1024];
+    while (head.find("\r\n\r\n") == std::string::npos && head.size() < MAX_REQUEST_HEAD) {
+        int received = SocketUtils::receive_data(client_socket, buffer, sizeof(buffer));
+        if (received <= 0) {
+            return;
+        }
+        head.append(buffer, received);
+    }
+
+    std::string request_line = head.substr(0, head.find("\r\n"));
+    std::string status = "404 Not Found";
+    std::string body = "Not found\n";
+    std::string content_type = "text/plain";
+    if (request_line.compare(0, 13, "GET /metrics ") == 0) {
+        status = "200 OK";
+        body = render_metrics();
+        content_type = "text/plain; version=0.0.4";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: " + content_type +
+                           "\r\nContent-Length: " + std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n" + body;
+    SocketUtils::send_all(client_socket, response.data(), response.size());
+}
+
+std::string AdminServer::render_metrics() const {
+    std::string out;
+    Metrics::render(out);
+
+    CacheManager::Stats cache = context->cache_manager->get_stats();
+    uint64_t lookups = cache.hits + cache.misses;
+    Metrics::write_counter(out, "proxy_cache_hits_total", "Cache lookups answered, memory or disk", cache.hits);
+    Metrics::write_counter(out, "proxy_cache_disk_hits_total", "Cache lookups answered from disk", cache.disk_hits);
+    Metrics::write_counter(out, "proxy_cache_misses_total", "Cache lookups not answered", cache.misses);
+    Metrics::write_gauge(out, "proxy_cache_hit_ratio", "Hits over lookups since startup",
+                         lookups ? static_cast<double>(cache.hits) / lookups : 0.0);
+    Metrics::write_counter(out, "proxy_cache_insertions_total", "Responses stored", cache.insertions);
+    Metrics::write_counter(out, "proxy_cache_evictions_total", "Entries evicted for space", cache.evictions);
+    Metrics::write_counter(out, "proxy_cache_expirations_total", "Entries dropped after expiry", cache.expirations);
+    Metrics::write_counter(out, "proxy_cache_collapsed_total", "Misses that waited for another fetch", cache.collapsed);
+    Metrics::write_counter(out, "proxy_cache_stale_hits_total", "Expired entries served stale", cache.stale_hits);
+    Metrics::write_counter(out, "proxy_cache_revalidated_total", "Entries renewed by a 304", cache.revalidated);
+    Metrics::write_counter(out, "proxy_cache_refreshed_ahead_total", "Hot entries refreshed before expiry",
+                           cache.refreshed_ahead);
+    Metrics::write_counter(out, "proxy_cache_refresh_ahead_throttled_total",
+                           "Refreshes ahead held back by the concurrency limit", cache.ahead_throttled);
+    Metrics::write_counter(out, "proxy_cache_misses_avoided_total", "Hits past an expiry a refresh-ahead put off",
+                           cache.misses_avoided);
+    Metrics::write_gauge(out, "proxy_cache_entries", "Entries in memory", static_cast<double>(cache.entries));
+    Metrics::write_gauge(out, "proxy_cache_bytes", "Bytes held in memory", static_cast<double>(cache.bytes));
+
+    if (context->cache_compressor) {
+        CacheCompressor::Stats compression = context->cache_compressor->get_stats();
+        Metrics::write_counter(out, "proxy_cache_compressed_total", "Cached bodies stored gzipped",
+                               compression.compressed);
+        Metrics::write_counter(out, "proxy_cache_incompressible_total", "Bodies kept as is: gzip saved too little",
+                               compression.incompressible);
+        Metrics::write_counter(out, "proxy_cache_inflated_total", "Hits decompressed for clients without gzip",
+                               compression.inflated);
+        Metrics::write_gauge(out, "proxy_cache_compression_ratio", "Body bytes before over after compression",
+                             compression.output_bytes
+                                 ? static_cast<double>(compression.input_bytes) / compression.output_bytes : 0.0);
+        Metrics::write_counter(out, "proxy_cache_deflate_cpu_seconds_total", "CPU time compressing cached bodies",
+                               compression.deflate_seconds);
+        Metrics::write_counter(out, "proxy_cache_inflate_cpu_seconds_total", "CPU time decompressing hits",
+                               compression.inflate_seconds);
+    }
+
+    if (context->disk_cache) {
+        DiskCache::Stats disk = context->disk_cache->get_stats();
+        Metrics::write_gauge(out, "proxy_disk_cache_entries", "Entries on disk", static_cast<double>(disk.entries));
+        Metrics::write_gauge(out, "proxy_disk_cache_bytes", "Segment bytes on disk", static_cast<double>(disk.bytes));
+        Metrics::write_counter(out, "proxy_disk_cache_writes_total", "Records written", disk.writes);
+        Metrics::write_counter(out, "proxy_disk_cache_dropped_total", "Records not written", disk.dropped);
+    }
+
+    DnsResolver::Stats dns = context->resolver->get_stats();
+    Metrics::write_counter(out, "proxy_dns_cache_hits_total", "Lookups answered from the DNS cache",
+                           dns.hits + dns.negative_hits);
+    Metrics::write_counter(out, "proxy_dns_queries_total", "getaddrinfo queries started", dns.misses);
+    Metrics::write_counter(out, "proxy_dns_failures_total", "getaddrinfo queries that failed", dns.failures);
+
+    ConnectionPool::Stats pool = context->upstream_pool->get_stats();
+    Metrics::write_counter(out, "proxy_upstream_reused_total", "Requests sent on a pooled connection", pool.reused);
+    Metrics::write_gauge(out, "proxy_upstream_idle_connections", "Pooled idle connections",
+                         static_cast<double>(pool.idle));
+
+    Revalidator::Stats revalidation = context->revalidator->get_stats();
+    Metrics::write_counter(out, "proxy_revalidations_total", "Background refreshes started", revalidation.started);
+    Metrics::write_counter(out, "proxy_revalidation_failures_total", "Refreshes that failed", revalidation.failed);
+
+    Metrics::write_counter(out, "proxy_log_dropped_total", "Log records dropped with a full buffer",
+                           Logger::dropped());
+    return out;
+}
@@ -0,0 +1,151 @@
+#include "admission_control.h"
+#include "socket_utils.h"
+#include "logger.h"
+#include <algorithm>
+#include <functional>
+
+namespace {
+    const int64_t NANOS_PER_SECOND = 1000000000;
+
+    int64_t interval_for(int rate) {
+        return rate > 0 ? NANOS_PER_SECOND / rate : 0;
+    }
+
+    int64_t now_nanos() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Metrics::Clock::now().time_since_epoch()).count();
+    }
+}
+
+AdmissionControl::AdmissionControl(const Limits& limits)
+    : limits(limits), per_client(limits.max_connections_per_ip > 0 || limits.request_rate_per_ip > 0),
+      interval(interval_for(limits.request_rate)), interval_per_ip(interval_for(limits.request_rate_per_ip)),
+      connections(0), next_request(0) {}
+
+AdmissionControl::Shard& AdmissionControl::shard_for(const std::string& client) {
+    return shards[std::hash<std::string>()(client) % SHARD_COUNT];
+}
+
+bool AdmissionControl::admit_connection(int client_socket, std::string& client) {
+    client.clear();
+    int open = connections.fetch_add(1, std::memory_order_relaxed);
+    if (limits.max_connections > 0 && open >= limits.max_connections) {
+        connections.fetch_sub(1, std::memory_order_relaxed);
+        Metrics::add(Metrics::SHED_CONNECTIONS);
+        LOG_DEBUG("Connection limit reached, refusing client");
+        return false;
+    }
+    if (!per_client) {
+        return true;
+    }
+
+    std::string host = SocketUtils::peer_host(client_socket);
+    if (host.empty()) {
+        return true; // Unknown peer: only the global limits apply
+    }
+    Shard& shard = shard_for(host);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Client& entry = shard.clients[host];
+        if (limits.max_connections_per_ip <= 0 || entry.connections < limits.max_connections_per_ip) {
+            entry.connections++;
+            client = std::move(host);
+            return true;
+        }
+    }
+    connections.fetch_sub(1, std::memory_order_relaxed);
+    Metrics::add(Metrics::SHED_IP_CONNECTIONS);
+    LOG_DEBUG("Connection limit reached for " + host + ", refusing client");
+    return false;
+}
+
+void AdmissionControl::release_connection(const std::string& client) {
+    connections.fetch_sub(1, std::memory_order_relaxed);
+    if (client.empty()) {
+        return;
+    }
+    Shard& shard = shard_for(client);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.clients.find(client);
+    if (it != shard.clients.end() && it->second.connections > 0) {
+        it->second.connections--;
+    }
+}
+
+int64_t AdmissionControl::take_token(int64_t& next_request, int64_t interval, int64_t now) {
+    // A full bucket lets the next request through up to a second early
+    int64_t due = std::max(next_request, now);
+    int64_t wait = due - now - (NANOS_PER_SECOND - interval);
+    if (wait > 0) {
+        return wait;
+    }
+    next_request = due + interval;
+    return 0;
+}
+
+int AdmissionControl::retry_after_seconds(int64_t wait) {
+    return static_cast<int>(std::max<int64_t>(1, (wait + NANOS_PER_SECOND - 1) / NANOS_PER_SECOND));
+}
+
+int AdmissionControl::admit_request(const std::string& client) {
+    if (interval == 0 && (interval_per_ip == 0 || client.empty())) {
+        return 0;
+    }
+    int64_t now = now_nanos();
+
+    if (interval_per_ip > 0 && !client.empty()) {
+        Shard& shard = shard_for(client);
+        int64_t wait;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            wait = take_token(shard.clients[client].next_request, interval_per_ip, now);
+        }
+        if (wait > 0) {
+            Metrics::add(Metrics::SHED_IP_RATE);
+            return retry_after_seconds(wait);
+        }
+    }
+
+    if (interval > 0) {
+        int64_t current = next_request.load(std::memory_order_relaxed);
+        while (true) {
+            int64_t updated = current;
+            int64_t wait = take_token(updated, interval, now);
+            if (wait > 0) {
+                Metrics::add(Metrics::SHED_RATE);
+                return retry_after_seconds(wait);
+            }
+            if (next_request.compare_exchange_weak(current, updated, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+void AdmissionControl::prune() {
+    if (!per_client) {
+        return;
+    }
+    int64_t now = now_nanos();
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.clients.begin(); it != shard.clients.end(); ) {
+            if (it->second.connections == 0 && it->second.next_request <= now) {
+                it = shard.clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+std::string AdmissionControl::overloaded_response(int retry_after) {
+    return "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " + std::to_string(retry_after) +
+           "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+}
+
+std::string AdmissionControl::rate_limited_response(int retry_after) {
+    return "HTTP/1.1 429 Too Many Requests\r\nRetry-After: " + std::to_string(retry_after) +
+           "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+}
@@ -0,0 +1,81 @@
+#include "buffer_pool.h"
+#include "metrics.h"
+#include <cstring>
+
+namespace {
+    // Free buffers are chained through their first bytes
+    struct FreeList {
+        char* head = nullptr;
+        size_t count = 0;
+
+        ~FreeList();
+    };
+
+    thread_local FreeList free_list;
+    // Set once the list is destroyed at thread exit; buffers dropped after
+    // that (by other thread-local destructors) are freed directly
+    thread_local bool free_list_closed = false;
+
+    char* next_of(char* block) {
+        char* next;
+        std::memcpy(&next, block, sizeof(next));
+        return next;
+    }
+
+    FreeList::~FreeList() {
+        while (head) {
+            char* next = next_of(head);
+            delete[] head;
+            head = next;
+        }
+        count = 0;
+        free_list_closed = true;
+    }
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        block = other.block;
+        other.block = nullptr;
+    }
+    return *this;
+}
+
+PooledBuffer PooledBuffer::acquire() {
+    PooledBuffer buffer;
+    FreeList& list = free_list;
+    if (list.head && !free_list_closed) {
+        buffer.block = list.head;
+        list.head = next_of(list.head);
+        list.count--;
+    } else {
+        buffer.block = new char[SIZE];
+        Metrics::add(Metrics::IO_BUFFER_ALLOCATIONS);
+    }
+    return buffer;
+}
+
+void PooledBuffer::release() {
+    if (!block) {
+        return;
+    }
+    if (free_list_closed) {
+        delete[] block;
+        block = nullptr;
+        return;
+    }
+    FreeList& list = free_list;
+    if (list.count >= MAX_FREE_PER_THREAD) {
+        delete[] block;
+    } else {
+        std::memcpy(block, &list.head, sizeof(list.head));
+        list.head = block;
+        list.count++;
+    }
+    block = nullptr;
+}
+
+size_t PooledBuffer::free_count() {
+    return free_list_closed ? 0 : free_list.count;
+}
@@ -0,0 +1,276 @@
+#include "cache_compressor.h"
+#include "cache_manager.h"
+#include "logger.h"
+#include <cstdlib>
+#include <strings.h>
+#include <time.h>
+#include <zlib.h>
+
+namespace {
+    const size_t QUEUE_DEPTH = 1024;
+    // zlib's window bits plus 16 selects the gzip wrapper
+    const int GZIP_WINDOW_BITS = 15 + 16;
+
+    // A compressed body is kept only if it saves at least an eighth
+    bool worth_keeping(size_t original, size_t compressed) {
+        return compressed <= original - original / 8;
+    }
+
+    uint64_t thread_cpu_nanos() {
+        struct timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+    }
+
+    std::string_view trim(std::string_view text) {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+            text.remove_prefix(1);
+        }
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+            text.remove_suffix(1);
+        }
+        return text;
+    }
+
+    bool equals_ignore_case(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+    }
+
+    bool starts_with_ignore_case(std::string_view text, std::string_view prefix) {
+        return text.size() >= prefix.size() && strncasecmp(text.data(), prefix.data(), prefix.size()) == 0;
+    }
+
+    bool contains_ignore_case(std::string_view text, std::string_view needle) {
+        for (size_t i = 0; i + needle.size() <= text.size(); i++) {
+            if (strncasecmp(text.data() + i, needle.data(), needle.size()) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Text formats; images, video and archives are compressed already
+    bool is_text_type(std::string_view content_type) {
+        std::string_view media = trim(content_type.substr(0, content_type.find(';')));
+        return starts_with_ignore_case(media, "text/") || contains_ignore_case(media, "json") ||
+               contains_ignore_case(media, "javascript") || contains_ignore_case(media, "xml");
+    }
+
+    // q-value of one Accept-Encoding element's parameters; 1 if absent
+    double q_value(std::string_view parameters) {
+        while (!parameters.empty()) {
+            size_t semicolon = parameters.find(';');
+            std::string_view parameter = trim(parameters.substr(0, semicolon));
+            parameters = semicolon == std::string_view::npos ? std::string_view() : parameters.substr(semicolon + 1);
+            if (parameter.size() >= 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+                return std::atof(std::string(parameter.substr(2)).c_str());
+            }
+        }
+        return 1.0;
+    }
+
+    bool gzip(const char* data, size_t length, int level, std::string& out) {
+        z_stream stream = {};
+        if (deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        out.resize(deflateBound(&stream, length));
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = static_cast<uInt>(length);
+        stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        stream.avail_out = static_cast<uInt>(out.size());
+        int result = deflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+        return result == Z_STREAM_END;
+    }
+
+    // Append exactly 'expected' inflated bytes to 'out'
+    bool gunzip(const char* data, size_t length, size_t expected, std::string& out) {
+        z_stream stream = {};
+        if (inflateInit2(&stream, GZIP_WINDOW_BITS) != Z_OK) {
+            return false;
+        }
+        size_t start = out.size();
+        out.resize(start + expected);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = static_cast<uInt>(length);
+        stream.next_out = reinterpret_cast<Bytef*>(&out[start]);
+        stream.avail_out = static_cast<uInt>(expected);
+        int result = inflate(&stream, Z_FINISH);
+        bool complete = result == Z_STREAM_END && stream.total_out == expected;
+        inflateEnd(&stream);
+        return complete;
+    }
+
+    // Heads for both variants from the stored one (status line and fields,
+    // each ending in CRLF, no blank line). The gzip head gets the encoding,
+    // the compressed length and a weak ETag, since its bytes differ; both
+    // say they vary by Accept-Encoding.
+    void rewrite_heads(std::string_view head, size_t gzip_length, std::string& gzip_head,
+                       std::string& identity_head) {
+        gzip_head.reserve(head.size() + 64);
+        identity_head.reserve(head.size() + 32);
+        bool status_line = true;
+        while (!head.empty()) {
+            size_t end = head.find("\r\n");
+            std::string_view line = head.substr(0, end == std::string_view::npos ? head.size() : end + 2);
+            head.remove_prefix(line.size());
+            if (status_line) {
+                gzip_head.append(line);
+                identity_head.append(line);
+                status_line = false;
+                continue;
+            }
+            size_t colon = line.find(':');
+            HeaderId id = HttpHeaders::id_of(trim(line.substr(0, colon)));
+            if (id == HeaderId::VARY) {
+                continue;
+            }
+            identity_head.append(line);
+            if (id == HeaderId::CONTENT_LENGTH) {
+                continue;
+            }
+            if (id == HeaderId::ETAG && colon != std::string_view::npos) {
+                std::string_view etag = trim(line.substr(colon + 1, line.size() - colon - 3));
+                gzip_head.append("ETag: ");
+                if (!starts_with_ignore_case(etag, "W/")) {
+                    gzip_head.append("W/");
+                }
+                gzip_head.append(etag).append("\r\n");
+                continue;
+            }
+            gzip_head.append(line);
+        }
+        identity_head.append("Vary: Accept-Encoding\r\n");
+        gzip_head.append("Content-Encoding: gzip\r\nContent-Length: ");
+        gzip_head.append(std::to_string(gzip_length));
+        gzip_head.append("\r\nVary: Accept-Encoding\r\n");
+    }
+}
+
+CacheCompressor::CacheCompressor(size_t threads, int level)
+    : level(level), workers(std::make_unique<ThreadPool>(threads, QUEUE_DEPTH)),
+      compressed(0), incompressible(0), dropped(0), inflated(0), input_bytes(0), output_bytes(0),
+      deflate_nanos(0), inflate_nanos(0) {}
+
+CacheCompressor::~CacheCompressor() {
+    shutdown();
+}
+
+bool CacheCompressor::is_compressible(const HttpResponse& response) {
+    const HttpHeaders& headers = response.headers;
+    if (response.status_code != 200 || response.body.size() < MIN_BODY_BYTES ||
+        headers.has(HeaderId::CONTENT_ENCODING) || !is_text_type(headers.get(HeaderId::CONTENT_TYPE))) {
+        return false;
+    }
+    // A response that varies by anything else would need more than two variants
+    return !headers.has(HeaderId::VARY) || equals_ignore_case(trim(headers.get(HeaderId::VARY)), "Accept-Encoding");
+}
+
+bool CacheCompressor::accepts_gzip(const HttpRequest& request) {
+    std::string_view accepted = request.headers.get(HeaderId::ACCEPT_ENCODING);
+    double gzip_q = -1;
+    double any_q = -1;
+    while (!accepted.empty()) {
+        size_t comma = accepted.find(',');
+        std::string_view element = accepted.substr(0, comma);
+        accepted = comma == std::string_view::npos ? std::string_view() : accepted.substr(comma + 1);
+        size_t semicolon = element.find(';');
+        std::string_view coding = trim(element.substr(0, semicolon));
+        std::string_view parameters = semicolon == std::string_view::npos ? std::string_view()
+                                                                          : element.substr(semicolon + 1);
+        if (equals_ignore_case(coding, "gzip") || equals_ignore_case(coding, "x-gzip")) {
+            gzip_q = q_value(parameters);
+        } else if (coding == "*") {
+            any_q = q_value(parameters);
+        }
+    }
+    // An explicit gzip entry wins over the wildcard
+    return gzip_q >= 0 ? gzip_q > 0 : any_q > 0;
+}
+
+bool CacheCompressor::submit(std::shared_ptr<const CachedBlock> block, Done done) {
+    bool queued = workers->try_submit([this, block, done = std::move(done)]() {
+        compress(*block, done);
+    });
+    if (!queued) {
+        dropped++;
+    }
+    return queued;
+}
+
+void CacheCompressor::compress(const CachedBlock& block, const Done& done) {
+    uint64_t start = thread_cpu_nanos();
+    std::string body;
+    bool deflated = gzip(block.body(), block.body_length(), level, body);
+    bool keep = deflated && worth_keeping(block.body_length(), body.size());
+
+    std::shared_ptr<CachedBlock> result;
+    if (keep) {
+        result = std::make_shared<CachedBlock>();
+        result->status_code = block.status_code;
+        result->framed = true; // The new head's Content-Length matches
+        result->gzipped = true;
+        result->identity_length = block.body_length();
+        rewrite_heads(std::string_view(block.head(), block.head_length), body.size(), result->bytes,
+                      result->identity_head);
+        result->head_length = result->bytes.size();
+        result->bytes.append(body);
+        result->bytes.shrink_to_fit();
+    }
+    deflate_nanos += thread_cpu_nanos() - start;
+
+    if (!deflated) {
+        dropped++;
+        LOG_WARNING("Failed to compress a cached response");
+        return;
+    }
+    if (!keep) {
+        incompressible++;
+        return;
+    }
+    compressed++;
+    input_bytes += block.body_length();
+    output_bytes += body.size();
+    done(std::move(result));
+}
+
+std::shared_ptr<const CachedBlock> CacheCompressor::inflate(const CachedBlock& block) {
+    uint64_t start = thread_cpu_nanos();
+    std::shared_ptr<const CachedBlock> identity = decompress(block);
+    inflate_nanos += thread_cpu_nanos() - start;
+    inflated++;
+    return identity;
+}
+
+std::shared_ptr<const CachedBlock> CacheCompressor::decompress(const CachedBlock& block) {
+    auto identity = std::make_shared<CachedBlock>();
+    identity->status_code = block.status_code;
+    identity->framed = block.framed;
+    identity->bytes.reserve(block.identity_head.size() + block.identity_length);
+    identity->bytes = block.identity_head;
+    identity->head_length = identity->bytes.size();
+    if (!gunzip(block.body(), block.body_length(), block.identity_length, identity->bytes)) {
+        LOG_ERROR("Failed to decompress a cached response");
+        return nullptr;
+    }
+    return identity;
+}
+
+void CacheCompressor::shutdown() {
+    workers->shutdown();
+}
+
+CacheCompressor::Stats CacheCompressor::get_stats() const {
+    Stats stats;
+    stats.compressed = compressed;
+    stats.incompressible = incompressible;
+    stats.dropped = dropped;
+    stats.inflated = inflated;
+    stats.input_bytes = input_bytes;
+    stats.output_bytes = output_bytes;
+    stats.deflate_seconds = deflate_nanos / 1e9;
+    stats.inflate_seconds = inflate_nanos / 1e9;
+    return stats;
+}
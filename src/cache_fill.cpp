@@ -0,0 +1,79 @@
+#include "cache_fill.h"
+#include "logger.h"
+
+CacheFill::CacheFill(size_t max_object_bytes)
+    : max_object_bytes(max_object_bytes), state(State::IDLE) {}
+
+void CacheFill::begin(const HttpRequest& request, ResponseFramer& framer) {
+    reset();
+    if (max_object_bytes == 0 || request.method != "GET") {
+        return;
+    }
+    state = State::WAITING;
+    framer.set_body_sink([this, &framer](const char* data, size_t length) {
+        on_body(framer, data, length);
+    });
+}
+
+void CacheFill::take_head(const ResponseFramer& framer) {
+    response = HttpHandler::build_response(framer.head());
+    if (!CacheManager::is_cacheable(response)) {
+        state = State::SKIPPED;
+        return;
+    }
+    if (framer.framing() == BodyFraming::CONTENT_LENGTH && framer.content_length() > max_object_bytes) {
+        skip("declared " + std::to_string(framer.content_length()) + " bytes");
+        return;
+    }
+    if (framer.framing() == BodyFraming::CONTENT_LENGTH) {
+        response.body.reserve(framer.content_length());
+    }
+    state = State::BUFFERING;
+}
+
+void CacheFill::on_body(const ResponseFramer& framer, const char* data, size_t length) {
+    if (state == State::WAITING) {
+        take_head(framer);
+    }
+    if (state != State::BUFFERING) {
+        return;
+    }
+    if (response.body.size() + length > max_object_bytes) {
+        skip("over " + std::to_string(max_object_bytes) + " bytes");
+        return;
+    }
+    response.body.append(data, length);
+}
+
+void CacheFill::skip(const std::string& reason) {
+    LOG_INFO("Response too large to cache (" + reason + "), relaying without buffering");
+    state = State::SKIPPED;
+    // Give the memory back now rather than when the transfer ends
+    std::string().swap(response.body);
+}
+
+void CacheFill::finish(CacheManager& cache, const HttpRequest& request, const ResponseFramer& framer) {
+    if (state == State::WAITING && framer.headers_done()) {
+        take_head(framer); // No body bytes came through, e.g. Content-Length: 0
+    }
+    if (state == State::BUFFERING && framer.is_complete()) {
+        frame_by_length(response);
+        cache.put(request, response);
+    } else if (state == State::BUFFERING) {
+        LOG_INFO("Response ended early, not cached");
+    }
+    reset();
+}
+
+void CacheFill::frame_by_length(HttpResponse& response) {
+    // The body is kept de-chunked, so it is re-framed by length; that also
+    // lets hits keep the client connection open
+    response.headers.erase(HeaderId::TRANSFER_ENCODING);
+    response.headers.erase(HeaderId::TRAILER);
+    response.headers.set(HeaderId::CONTENT_LENGTH, std::to_string(response.body.size()));
+}
+
+void CacheFill::reset() {
+    state = State::IDLE;
+    response = HttpResponse();
+}
@@ -1,23 +1,67 @@
 #include "cache_manager.h"
 #include "logger.h"
-#include <sstream>
 #include <algorithm>
+#include <cstring>
 
-CacheManager::CacheManager() : cache_enabled(true) {}
+CacheManager::CacheManager(size_t max_bytes)
+    : max_bytes(max_bytes), total_bytes(0), entry_count(0), evict_cursor(0), cache_enabled(true),
+      ahead_in_flight(0), hits(0), disk_hits(0), misses(0), insertions(0), evictions(0), expirations(0),
+      rejected(0), collapsed(0), fetches_saved(0), collapse_timeouts(0), stale_hits(0), revalidated(0),
+      refreshed_ahead(0), ahead_throttled(0), misses_avoided(0) {}
 
 CacheManager::~CacheManager() {
+    // Queued compressions call back into this cache
+    if (compressor) {
+        compressor->shutdown();
+    }
     clear();
 }
 
+std::shared_ptr<const CachedBlock> CachedBlock::from_response(const HttpResponse& response) {
+    auto block = std::make_shared<CachedBlock>();
+    block->status_code = response.status_code;
+
+    size_t head_size = response.version.size() + response.status_message.size() + 16;
+    for (const auto& [name, value] : response.headers) {
+        head_size += name.size() + value.size() + 4;
+    }
+    block->bytes.reserve(head_size + response.body.size());
+
+    std::string& out = block->bytes;
+    out += response.version;
+    out += ' ';
+    out += std::to_string(response.status_code);
+    out += ' ';
+    out += response.status_message;
+    out += "\r\n";
+    for (size_t i = 0; i < response.headers.size(); i++) {
+        auto [name, value] = response.headers.field(i);
+        // Hop-by-hop; written per client
+        HeaderId id = HttpHeaders::id_of(name);
+        if (id == HeaderId::CONNECTION || id == HeaderId::KEEP_ALIVE) {
+            continue;
+        }
+        out += name;
+        out += ": ";
+        out += value;
+        out += "\r\n";
+    }
+    block->head_length = out.size();
+    out += response.body;
+
+    block->framed = !response.headers.has(HeaderId::TRANSFER_ENCODING) &&
+                    response.headers.has(HeaderId::CONTENT_LENGTH) &&
+                    response.headers.get(HeaderId::CONTENT_LENGTH) == std::to_string(response.body.size());
+    return block;
+}
+
 std::string CacheManager::generate_cache_key(const HttpRequest& request) {
     // Create a unique key based on method, host, and path
-    std::ostringstream oss;
-    
-    auto it = request.headers.find("Host");
-    std::string host = (it != request.headers.end()) ? it->second : "unknown";
+    std::string_view host = request.headers.has(HeaderId::HOST) ? request.headers.get(HeaderId::HOST)
+                                                                 : std::string_view("unknown");
     
     // Normalize path - remove scheme and host if present (proxy-style request)
-    std::string path = request.path;
+    std::string_view path = request.path;
     size_t scheme_end = path.find("://");
     if (scheme_end != std::string::npos) {
         // This is an absolute URL like "http://httpbin.org/get"
@@ -29,15 +73,16 @@ std::string CacheManager::generate_cache_key(const HttpRequest& request) {
         }
     }
     
-    oss << request.method << ":" << host << ":" << path;
-    return oss.str();
+    std::string key;
+    key.reserve(request.method.size() + host.size() + path.size() + 2);
+    key.append(request.method).append(1, ':').append(host).append(1, ':').append(path);
+    return key;
 }
 
-int CacheManager::extract_ttl_from_headers(const std::map<std::string, std::string>& headers) {
+int CacheManager::extract_ttl_from_headers(const HttpHeaders& headers) {
     // Look for Cache-Control header
-    auto it = headers.find("Cache-Control");
-    if (it != headers.end()) {
-        std::string cache_control = it->second;
+    if (headers.has(HeaderId::CACHE_CONTROL)) {
+        std::string cache_control(headers.get(HeaderId::CACHE_CONTROL));
         
         // Look for max-age directive
         size_t max_age_pos = cache_control.find("max-age=");
@@ -63,8 +108,7 @@ int CacheManager::extract_ttl_from_headers(const std::map<std::string, std::stri
     }
     
     // Check Expires header
-    it = headers.find("Expires");
-    if (it != headers.end()) {
+    if (headers.has(HeaderId::EXPIRES)) {
         // For simplicity, use a default TTL for pages with Expires header
         return 3600; // 1 hour default
     }
@@ -74,34 +118,203 @@ int CacheManager::extract_ttl_from_headers(const std::map<std::string, std::stri
     return 300;
 }
 
-bool CacheManager::get(const HttpRequest& request, HttpResponse& response) {
+void CacheManager::extract_revalidation(const HttpHeaders& headers, CachedResponse& cached) {
+    if (headers.has(HeaderId::ETAG)) {
+        cached.etag = std::string(headers.get(HeaderId::ETAG));
+    }
+    if (headers.has(HeaderId::LAST_MODIFIED)) {
+        cached.last_modified = std::string(headers.get(HeaderId::LAST_MODIFIED));
+    }
+    
+    if (!headers.has(HeaderId::CACHE_CONTROL)) {
+        return;
+    }
+    std::string cache_control(headers.get(HeaderId::CACHE_CONTROL));
+    for (auto [directive, window] : {std::make_pair("stale-while-revalidate=", &cached.stale_while_revalidate),
+                                     std::make_pair("stale-if-error=", &cached.stale_if_error)}) {
+        size_t pos = cache_control.find(directive);
+        if (pos == std::string::npos) {
+            continue;
+        }
+        try {
+            *window = std::max(0, std::stoi(cache_control.substr(pos + strlen(directive))));
+        } catch (...) {
+            // Ignore malformed values
+        }
+    }
+}
+
+uint64_t CacheManager::hash_key(const std::string& key) {
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+size_t CacheManager::charge_for(const std::string& key, const CachedBlock& block) {
+    // Payload plus a rough allowance for node and control block overheads
+    return sizeof(Entry) + sizeof(CachedBlock) + 64 + key.size() + block.bytes.capacity() +
+           block.identity_head.capacity();
+}
+
+CacheManager::Shard& CacheManager::shard_for(uint64_t hash) {
+    // High bits pick the shard; the index within a shard hashes all of them
+    return shards[(hash >> 32) % SHARD_COUNT];
+}
+
+void CacheManager::unlink(Shard& shard, Entry* entry) {
+    (entry->prev ? entry->prev->next : shard.head) = entry->next;
+    (entry->next ? entry->next->prev : shard.tail) = entry->prev;
+    entry->prev = entry->next = nullptr;
+}
+
+void CacheManager::push_front(Shard& shard, Entry* entry) {
+    entry->prev = nullptr;
+    entry->next = shard.head;
+    (shard.head ? shard.head->prev : shard.tail) = entry;
+    shard.head = entry;
+}
+
+void CacheManager::erase(Shard& shard, Entry* entry) {
+    unlink(shard, entry);
+    total_bytes -= entry->charge;
+    entry_count--;
+    shard.index.erase(entry->hash);
+}
+
+void CacheManager::evict(Shard& shard, Entry* entry, std::vector<Spilled>& spill) {
+    if (disk && !entry->cached.is_expired()) {
+        spill.push_back(Spilled{entry->hash, std::move(entry->key), std::move(entry->cached)});
+    }
+    erase(shard, entry);
+    evictions++;
+}
+
+bool CacheManager::evict_lru(Shard& shard, const Entry* keep, std::vector<Spilled>& spill) {
+    while (total_bytes > max_bytes) {
+        Entry* victim = shard.tail;
+        if (victim == keep) {
+            victim = victim ? victim->prev : nullptr;
+        }
+        if (!victim) {
+            return false;
+        }
+        evict(shard, victim, spill);
+    }
+    return true;
+}
+
+void CacheManager::enforce_budget(const Shard* skip, std::vector<Spilled>& spill) {
+    // One entry per shard per pass, so no single shard is emptied to make
+    // room while the others keep stale entries
+    while (total_bytes > max_bytes) {
+        bool evicted = false;
+        for (size_t n = 0; n < SHARD_COUNT && total_bytes > max_bytes; n++) {
+            Shard& shard = shards[evict_cursor++ % SHARD_COUNT];
+            if (&shard == skip) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (shard.tail) {
+                evict(shard, shard.tail, spill);
+                evicted = true;
+            }
+        }
+        if (!evicted) {
+            break;
+        }
+    }
+}
+
+bool CacheManager::get(const HttpRequest& request, std::shared_ptr<const CachedBlock>& block) {
     if (!cache_enabled || request.method != "GET") {
         return false;
     }
     
     std::string key = generate_cache_key(request);
-    
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    
-    auto it = cache.find(key);
-    if (it != cache.end()) {
-        if (it->second.is_expired()) {
-            Logger::info("⏱ Cache entry EXPIRED for: " + key);
-            cache.erase(it);
+    switch (lookup(request, key, block)) {
+        case Lookup::DISK:
+            hits++;
+            disk_hits++;
+            LOG_INFO("✓ CACHE HIT (disk) - Key: " + key);
+            return true;
+        case Lookup::MEMORY:
+            hits++;
+            LOG_INFO("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+            LOG_INFO("✓ CACHE HIT - Retrieved in 0ms");
+            LOG_INFO("Key: " + key);
+            LOG_INFO("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+            return true;
+        case Lookup::EXPIRED:
+            misses++;
+            LOG_INFO("⏱ Cache entry EXPIRED for: " + key);
             return false;
+        case Lookup::MISS:
+            break;
+    }
+    misses++;
+    LOG_INFO("➤ CACHE MISS - Will fetch from server");
+    LOG_INFO("  Key: " + key);
+    return false;
+}
+
+CacheManager::Lookup CacheManager::lookup(const HttpRequest& request, const std::string& key,
+                                          std::shared_ptr<const CachedBlock>& block) {
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
+    
+    bool hit = false;
+    bool expired = false;
+    bool refresh_due = false;
+    StaleCopy validators;
+    std::chrono::system_clock::time_point expires;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(hash);
+        if (it != shard.index.end() && it->second->key == key) {
+            Entry* entry = it->second.get();
+            long stale = entry->cached.seconds_stale();
+            if (stale > 0) {
+                // Kept if it can still be revalidated or served stale
+                if (!entry->cached.is_retained()) {
+                    erase(shard, entry);
+                    expirations++;
+                }
+                expired = true;
+            } else {
+                // Most recently used moves to the front
+                unlink(shard, entry);
+                push_front(shard, entry);
+                block = entry->cached.block;
+                hit = true;
+                refresh_due = note_hit(*entry, -stale, validators, expires);
+            }
+        }
+    }
+    if (refresh_due) {
+        if (refresher(request, validators, expires)) {
+            refreshed_ahead++;
+            LOG_DEBUG("Refreshing ahead of expiry: " + key);
+        } else {
+            ahead_in_flight--;
         }
-        
-        response = it->second.response;
-        Logger::info("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-        Logger::info("✓ CACHE HIT - Retrieved in 0ms");
-        Logger::info("Key: " + key);
-        Logger::info("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-        return true;
+    }
+    if (hit && !select_variant(request, block)) {
+        hit = false;
     }
     
-    Logger::info("➤ CACHE MISS - Will fetch from server");
-    Logger::info("  Key: " + key);
-    return false;
+    if (!hit && disk && disk->lookup(hash, key, block)) {
+        // Served from the segment file; not promoted, the page cache keeps
+        // hot segments in memory anyway
+        return Lookup::DISK;
+    }
+    if (hit) {
+        return Lookup::MEMORY;
+    }
+    return expired ? Lookup::EXPIRED : Lookup::MISS;
 }
 
 void CacheManager::put(const HttpRequest& request, const HttpResponse& response) {
@@ -109,49 +322,439 @@ void CacheManager::put(const HttpRequest& request, const HttpResponse& response)
         return;
     }
     
-    // Only cache successful responses (2xx status codes)
-    if (response.status_code < 200 || response.status_code >= 300) {
+    if (!is_cacheable(response)) {
+        LOG_DEBUG("Response not cacheable (status or no-cache/no-store headers)");
         return;
     }
-    
     int ttl = extract_ttl_from_headers(response.headers);
-    if (ttl <= 0) {
-        Logger::debug("Response not cacheable (no-cache/no-store headers)");
+    
+    std::string key = generate_cache_key(request);
+    std::shared_ptr<const CachedBlock> block = CachedBlock::from_response(response);
+    bool compress = compressor && block->framed && CacheCompressor::is_compressible(response);
+    size_t charge = charge_for(key, *block);
+    // An object bigger than one shard's share of the budget would push out
+    // too much of everything else
+    if (charge > max_bytes / SHARD_COUNT) {
+        rejected++;
+        LOG_INFO("Response too large to cache (" + std::to_string(charge) + " bytes): " + key);
         return;
     }
     
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
+    
+    auto entry = std::make_unique<Entry>();
+    entry->hash = hash;
+    entry->key = key;
+    entry->cached.block = block;
+    entry->cached.cached_time = std::chrono::system_clock::now();
+    entry->cached.ttl_seconds = ttl;
+    extract_revalidation(response.headers, entry->cached);
+    entry->charge = charge;
+    entry->prev = entry->next = nullptr;
+    
+    if (disk) {
+        disk->erase(hash); // Superseded
+    }
+    
+    std::vector<Spilled> spill;
+    bool within_budget;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(hash);
+        if (it != shard.index.end()) {
+            // Same key refreshed, or a hash collision: the newer one wins
+            erase(shard, it->second.get());
+        }
+        Entry* inserted = entry.get();
+        push_front(shard, inserted);
+        shard.index.emplace(hash, std::move(entry));
+        total_bytes += charge;
+        entry_count++;
+        insertions++;
+        within_budget = evict_lru(shard, inserted, spill);
+    }
+    if (!within_budget) {
+        enforce_budget(&shard, spill);
+    }
+    // Disk writes are queued outside the shard locks
+    for (Spilled& evicted : spill) {
+        disk->store(evicted.hash, evicted.key, std::move(evicted.cached.block),
+                    evicted.cached.cached_time, evicted.cached.ttl_seconds);
+    }
+    // The block's address tells whether the entry still holds it when the
+    // compressed copy is ready; the queued task keeps it alive until then
+    if (compress) {
+        const CachedBlock* original = block.get();
+        compressor->submit(std::move(block),
+                           [this, hash, key, original](std::shared_ptr<const CachedBlock> compressed) {
+                               store_compressed(hash, key, original, std::move(compressed));
+                           });
+    }
+    
+    LOG_INFO("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+    LOG_INFO("💾 CACHED - Saved to cache");
+    LOG_INFO("Key: " + key);
+    LOG_INFO("TTL: " + std::to_string(ttl) + "s | Size: " + std::to_string(response.body.length()) + " bytes");
+    LOG_INFO("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+}
+
+bool CacheManager::is_cacheable(const HttpResponse& response) {
+    // Only cache successful responses (2xx status codes)
+    if (response.status_code < 200 || response.status_code >= 300) {
+        return false;
+    }
+    return extract_ttl_from_headers(response.headers) > 0;
+}
+
+bool CacheManager::begin_fetch(const HttpRequest& request, FetchWaiter waiter) {
+    if (!cache_enabled) {
+        return true; // Nothing would be stored for the waiters
+    }
+    std::string key = generate_cache_key(request);
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
+    
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.fetches.find(hash);
+    if (it == shard.fetches.end()) {
+        shard.fetches.emplace(hash, Fetch{std::move(key), {}});
+        return true;
+    }
+    if (it->second.key != key) {
+        return true; // Hash collision: fetch without tracking
+    }
+    it->second.waiters.push_back(std::move(waiter));
+    collapsed++;
+    LOG_INFO("⧗ Waiting for fetch in flight - Key: " + key);
+    return false;
+}
+
+void CacheManager::end_fetch(const HttpRequest& request) {
+    std::string key = generate_cache_key(request);
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
+    
+    std::vector<FetchWaiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.fetches.find(hash);
+        if (it == shard.fetches.end() || it->second.key != key) {
+            return;
+        }
+        waiters.swap(it->second.waiters);
+        shard.fetches.erase(it);
+    }
+    // Waiters look the key up again, so they run without the lock
+    for (auto& waiter : waiters) {
+        waiter();
+    }
+}
+
+bool CacheManager::get_collapsed(const HttpRequest& request, std::shared_ptr<const CachedBlock>& block,
+                                 bool timed_out) {
+    if (timed_out) {
+        collapse_timeouts++;
+    }
+    // The request was counted as a miss when it found nothing; only the
+    // fetch it saved is counted here
+    if (!cache_enabled || request.method != "GET") {
+        return false;
+    }
+    std::string key = generate_cache_key(request);
+    Lookup found = lookup(request, key, block);
+    if (found != Lookup::MEMORY && found != Lookup::DISK) {
+        return false;
+    }
+    fetches_saved++;
+    return true;
+}
+
+bool CacheManager::get_stale(const HttpRequest& request, StaleCopy& copy) {
+    if (!cache_enabled || request.method != "GET") {
+        return false;
+    }
+    std::string key = generate_cache_key(request);
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
+    
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(hash);
+    if (it == shard.index.end() || it->second->key != key || !it->second->cached.is_expired() ||
+        !it->second->cached.is_retained()) {
+        return false;
+    }
+    copy.etag = it->second->cached.etag;
+    copy.last_modified = it->second->cached.last_modified;
+    return true;
+}
+
+bool CacheManager::serve_stale(const HttpRequest& request, StaleUse use,
+                               std::shared_ptr<const CachedBlock>& block) {
+    if (!cache_enabled || request.method != "GET") {
+        return false;
+    }
+    std::string key = generate_cache_key(request);
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
+    
+    long stale;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(hash);
+        if (it == shard.index.end() || it->second->key != key) {
+            return false;
+        }
+        const CachedResponse& cached = it->second->cached;
+        stale = cached.seconds_stale();
+        int window = use == StaleUse::WHILE_REVALIDATING ? cached.stale_while_revalidate : cached.stale_if_error;
+        if (stale > window) {
+            return false;
+        }
+        block = cached.block;
+    }
+    if (!select_variant(request, block)) {
+        return false;
+    }
+    stale_hits++;
+    LOG_INFO(std::string("✓ STALE HIT (") +
+                 (use == StaleUse::WHILE_REVALIDATING ? "stale-while-revalidate" : "stale-if-error") +
+                 ", " + std::to_string(std::max(0L, stale)) + "s past expiry) - Key: " + key);
+    return true;
+}
+
+bool CacheManager::refresh(const HttpRequest& request, const HttpResponse& not_modified) {
     std::string key = generate_cache_key(request);
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
     
-    std::lock_guard<std::mutex> lock(cache_mutex);
+    int ttl = 0;
+    if (not_modified.headers.has(HeaderId::CACHE_CONTROL) || not_modified.headers.has(HeaderId::EXPIRES)) {
+        ttl = extract_ttl_from_headers(not_modified.headers);
+    }
     
-    CachedResponse cached;
-    cached.response = response;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(hash);
+    if (it == shard.index.end() || it->second->key != key) {
+        return false;
+    }
+    Entry* entry = it->second.get();
+    CachedResponse& cached = entry->cached;
     cached.cached_time = std::chrono::system_clock::now();
-    cached.ttl_seconds = ttl;
+    if (ttl > 0) {
+        cached.ttl_seconds = ttl;
+    }
+    // The stored head is kept as is; only freshness and validators change
+    extract_revalidation(not_modified.headers, cached);
+    entry->hits = 0;
+    entry->refreshing_ahead = false;
+    unlink(shard, entry);
+    push_front(shard, entry);
+    revalidated++;
+    LOG_INFO("♻ REVALIDATED (304) - TTL: " + std::to_string(cached.ttl_seconds) + "s - Key: " + key);
+    return true;
+}
+
+bool CacheManager::note_hit(Entry& entry, long remaining, StaleCopy& validators,
+                            std::chrono::system_clock::time_point& expires) {
+    entry.hits++;
+    if (entry.renewed_ahead_of != std::chrono::system_clock::time_point{} &&
+        std::chrono::system_clock::now() >= entry.renewed_ahead_of) {
+        // Without the refresh this would have been a miss
+        entry.renewed_ahead_of = {};
+        misses_avoided++;
+    }
+    if (ahead_policy.min_hits <= 0 || entry.refreshing_ahead ||
+        entry.hits < static_cast<uint32_t>(ahead_policy.min_hits) ||
+        remaining * 100 > static_cast<long>(entry.cached.ttl_seconds) * ahead_policy.window_percent) {
+        return false;
+    }
+    if (ahead_in_flight.fetch_add(1) >= ahead_policy.max_in_flight) {
+        // Left for a later hit
+        ahead_in_flight--;
+        ahead_throttled++;
+        return false;
+    }
+    entry.refreshing_ahead = true;
+    validators.etag = entry.cached.etag;
+    validators.last_modified = entry.cached.last_modified;
+    expires = entry.cached.cached_time + std::chrono::seconds(entry.cached.ttl_seconds);
+    return true;
+}
+
+void CacheManager::set_refresh_ahead(const RefreshAhead& policy, Refresher refresher) {
+    ahead_policy = policy;
+    this->refresher = std::move(refresher);
+}
+
+void CacheManager::end_refresh_ahead(const HttpRequest& request, std::chrono::system_clock::time_point expires) {
+    ahead_in_flight--;
+    std::string key = generate_cache_key(request);
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
     
-    cache[key] = cached;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(hash);
+    if (it == shard.index.end() || it->second->key != key) {
+        return;
+    }
+    // A renewed or replaced copy outlives the old one; a failed refresh
+    // leaves the entry to expire and be revalidated as usual
+    Entry* entry = it->second.get();
+    if (entry->cached.cached_time + std::chrono::seconds(entry->cached.ttl_seconds) > expires) {
+        entry->renewed_ahead_of = expires;
+    }
+}
+
+void CacheManager::invalidate(const HttpRequest& request) {
+    std::string key = generate_cache_key(request);
+    uint64_t hash = hash_key(key);
+    Shard& shard = shard_for(hash);
     
-    Logger::info("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
-    Logger::info("💾 CACHED - Saved to cache");
-    Logger::info("Key: " + key);
-    Logger::info("TTL: " + std::to_string(ttl) + "s | Size: " + std::to_string(response.body.length()) + " bytes");
-    Logger::info("━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━");
+    if (disk) {
+        disk->erase(hash);
+    }
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(hash);
+    if (it != shard.index.end() && it->second->key == key) {
+        erase(shard, it->second.get());
+    }
+}
+
+void CacheManager::prune() {
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (Entry* entry = shard.tail; entry != nullptr; ) {
+            Entry* newer = entry->prev;
+            if (!entry->cached.is_retained()) {
+                erase(shard, entry);
+                expirations++;
+            }
+            entry = newer;
+        }
+    }
+}
+
+void CacheManager::set_disk_tier(std::shared_ptr<DiskCache> disk_tier) {
+    disk = std::move(disk_tier);
+}
+
+void CacheManager::set_compressor(std::shared_ptr<CacheCompressor> cache_compressor) {
+    compressor = std::move(cache_compressor);
+}
+
+void CacheManager::store_compressed(uint64_t hash, const std::string& key, const CachedBlock* original,
+                                    std::shared_ptr<const CachedBlock> compressed) {
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(hash);
+    // Replaced, refreshed or evicted meanwhile: the result is dropped
+    if (it == shard.index.end() || it->second->key != key || it->second->cached.block.get() != original) {
+        return;
+    }
+    Entry* entry = it->second.get();
+    size_t charge = charge_for(key, *compressed);
+    total_bytes -= entry->charge;
+    total_bytes += charge;
+    entry->charge = charge;
+    entry->cached.block = std::move(compressed);
+}
+
+bool CacheManager::select_variant(const HttpRequest& request, std::shared_ptr<const CachedBlock>& block) {
+    if (!block->gzipped || CacheCompressor::accepts_gzip(request)) {
+        return true;
+    }
+    block = compressor ? compressor->inflate(*block) : CacheCompressor::decompress(*block);
+    return block != nullptr;
+}
+
+void CacheManager::flush_to_disk() {
+    if (!disk || !disk->is_open()) {
+        return;
+    }
+    // Let queued evictions land first, so they do not overwrite newer copies
+    disk->wait_for_writes();
+    size_t written = 0;
+    std::vector<Spilled> spill;
+    for (Shard& shard : shards) {
+        // Only references are taken under the lock; the writes happen after,
+        // so requests on this shard are not held up by the disk
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            spill.reserve(shard.index.size());
+            // Least recently used first, so the hottest copy is the newest record
+            for (Entry* entry = shard.tail; entry != nullptr; entry = entry->prev) {
+                if (!entry->cached.is_expired()) {
+                    Spilled copy{entry->hash, entry->key, CachedResponse()};
+                    copy.cached.block = entry->cached.block;
+                    copy.cached.cached_time = entry->cached.cached_time;
+                    copy.cached.ttl_seconds = entry->cached.ttl_seconds;
+                    spill.push_back(std::move(copy));
+                }
+            }
+        }
+        for (Spilled& entry : spill) {
+            disk->store_now(entry.hash, entry.key, std::move(entry.cached.block),
+                            entry.cached.cached_time, entry.cached.ttl_seconds);
+        }
+        written += spill.size();
+        spill.clear();
+    }
+    LOG_INFO("Wrote " + std::to_string(written) + " cached responses to disk");
+}
+
+void CacheManager::release_disk_tier() {
+    if (!disk) {
+        return;
+    }
+    flush_to_disk();
+    disk->close();
+}
+
+bool CacheManager::reopen_disk_tier() {
+    return !disk || disk->is_open() || disk->open();
 }
 
 void CacheManager::clear() {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    cache.clear();
-    Logger::info("Cache cleared");
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        while (shard.tail) {
+            erase(shard, shard.tail);
+        }
+    }
+    LOG_INFO("Cache cleared");
 }
 
 size_t CacheManager::size() const {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    return cache.size();
+    return entry_count;
+}
+
+CacheManager::Stats CacheManager::get_stats() const {
+    Stats stats;
+    stats.hits = hits;
+    stats.disk_hits = disk_hits;
+    stats.misses = misses;
+    stats.insertions = insertions;
+    stats.evictions = evictions;
+    stats.expirations = expirations;
+    stats.rejected = rejected;
+    stats.collapsed = collapsed;
+    stats.fetches_saved = fetches_saved;
+    stats.collapse_timeouts = collapse_timeouts;
+    stats.stale_hits = stale_hits;
+    stats.revalidated = revalidated;
+    stats.refreshed_ahead = refreshed_ahead;
+    stats.ahead_throttled = ahead_throttled;
+    stats.misses_avoided = misses_avoided;
+    stats.entries = entry_count;
+    stats.bytes = total_bytes;
+    stats.capacity = max_bytes;
+    return stats;
 }
 
 void CacheManager::set_enabled(bool enabled) {
     cache_enabled = enabled;
-    Logger::info(std::string("Caching ") + (enabled ? "enabled" : "disabled"));
+    LOG_INFO(std::string("Caching ") + (enabled ? "enabled" : "disabled"));
 }
 
 bool CacheManager::is_enabled() const {
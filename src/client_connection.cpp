@@ -0,0 +1,838 @@
+#include "client_connection.h"
+#include "buffer_pool.h"
+#include "metrics.h"
+#include "socket_utils.h"
+#include "logger.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+    // Stop parsing pipelined cache hits while this much output is unsent
+    const size_t MAX_OUTBOX_BYTES = 1024 * 1024;
+    // Chunks moved per direction before yielding to other connections
+    const int PUMP_BUDGET = 16;
+    const uint32_t SOCKET_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+}
+
+uint32_t ClientConnection::target_events() const {
+    // With io_uring the upstream socket only sees ring operations
+    return loop.backend() == EventLoop::Backend::IO_URING ? 0 : SOCKET_EVENTS;
+}
+
+ClientConnection::ClientConnection(EventLoop& loop, int client_socket,
+                                   std::shared_ptr<ProxyContext> context)
+    : loop(loop), context(std::move(context)), client_socket(client_socket), target_socket(-1),
+      state(State::READING_REQUEST), is_tunnel(false),
+      request_parser(HttpParser::Kind::REQUEST), keep_alive(false),
+      answered(false), idle_timer(0), has_stale(false), fetch_leader(false), fetch_wait(0), fetch_timer(0), target_port(0),
+      body_remaining(0), body_length_known(true), skipping_body(false), pool_upstream(false), reused_target(false),
+      framing_failed(false), target_write_closed(false), client_write_closed(false),
+      relay_scheduled(false),
+      cache_fill(static_cast<size_t>(this->context->config.cache_max_object_kb) * 1024),
+      response_bytes(0) {}
+
+ClientConnection::~ClientConnection() {
+    // Only reached after the loop dropped its references, so just release fds
+    SocketUtils::close_socket(client_socket);
+    SocketUtils::close_socket(target_socket);
+}
+
+void ClientConnection::start() {
+    if (!context->admission->admit_connection(client_socket, client_key)) {
+        // Over a connection limit: say so if the socket takes it, and close
+        std::string refusal = AdmissionControl::overloaded_response();
+        send(client_socket, refusal.data(), refusal.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        SocketUtils::close_socket(client_socket);
+        client_socket = -1;
+        state = State::CLOSED;
+        return;
+    }
+    if (!loop.add(client_socket, SOCKET_EVENTS, shared_from_this())) {
+        context->admission->release_connection(client_key);
+        SocketUtils::close_socket(client_socket);
+        client_socket = -1;
+        state = State::CLOSED;
+        return;
+    }
+    Metrics::add(Metrics::CONNECTIONS);
+    Metrics::adjust(Metrics::ACTIVE_CONNECTIONS, 1);
+    if (loop.backend() == EventLoop::Backend::IO_URING) {
+        std::weak_ptr<ClientConnection> weak_self = shared_from_this();
+        // Once per loop iteration, so whatever completed in it is taken
+        // together and written with one operation
+        auto wake = [weak_self]() {
+            auto self = weak_self.lock();
+            if (self && !self->relay_scheduled) {
+                self->relay_scheduled = true;
+                self->loop.defer([self]() {
+                    self->relay_scheduled = false;
+                    self->relay();
+                });
+            }
+        };
+        to_target.use_ring(loop, wake);
+        to_client.use_ring(loop, wake);
+    }
+    arm_idle_timer();
+    on_client_readable();
+}
+
+void ClientConnection::handle_event(int fd, uint32_t events) {
+    switch (state) {
+        case State::READING_REQUEST:
+            if (fd == client_socket) {
+                on_client_readable();
+            }
+            break;
+        case State::WAITING_FOR_FETCH:
+            // Earlier cache hits may still be going out; requests are not read
+            if (fd == client_socket && (events & EPOLLOUT)) {
+                flush_outbox();
+            }
+            break;
+        case State::RESOLVING:
+            // Nothing to do until the resolver answers
+            break;
+        case State::CONNECTING:
+            // The race owns the upstream sockets. Client bytes that arrive
+            // meanwhile are picked up once relaying starts.
+            break;
+        case State::RELAYING:
+            relay();
+            break;
+        case State::CLOSED:
+            break;
+    }
+}
+
+void ClientConnection::on_drain() {
+    if (state != State::READING_REQUEST || !answered) {
+        // Mid-request, or a new client yet to send one: the response in hand
+        // is the last
+        return;
+    }
+    // A request that already arrived is still answered
+    on_client_readable();
+    if (state != State::READING_REQUEST || !request_buffer.empty() || skipping_body) {
+        return;
+    }
+    LOG_DEBUG("Closing idle client connection for the drain");
+    if (!outbox.empty()) {
+        if (hand_outbox_to_relay()) {
+            respond_and_close("");
+        }
+    } else {
+        close_connection();
+    }
+}
+
+void ClientConnection::on_client_readable() {
+    PooledBuffer buffer = PooledBuffer::acquire();
+
+    while (state == State::READING_REQUEST) {
+        if (skipping_body && !skip_request_body()) {
+            return;
+        }
+        // Pipelined requests may already be waiting in the buffer
+        HttpParser::Result parsed = skipping_body
+            ? HttpParser::Result::NEED_MORE
+            : request_parser.parse(request_buffer.data(), request_buffer.size());
+        if (parsed == HttpParser::Result::COMPLETE) {
+            if (outbox.pending_bytes() > MAX_OUTBOX_BYTES) {
+                // The client is not reading its responses; wait for EPOLLOUT
+                if (!flush_outbox() || outbox.pending_bytes() > MAX_OUTBOX_BYTES) {
+                    return;
+                }
+            }
+            LOG_DEBUG("Received request from client");
+            on_request_complete();
+            continue;
+        }
+        if (parsed == HttpParser::Result::ERROR) {
+            if (!hand_outbox_to_relay()) {
+                return;
+            }
+            if (request_parser.head_too_large()) {
+                LOG_ERROR("Request headers too large");
+                respond_and_close("HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\n\r\n");
+            } else {
+                LOG_ERROR("Malformed request");
+                respond_and_close("HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n");
+            }
+            return;
+        }
+
+        ssize_t received = recv(client_socket, buffer.data(), buffer.size(), 0);
+        if (received == 0) {
+            // Client is done sending; finish writing what it already asked for
+            if (!outbox.empty()) {
+                if (hand_outbox_to_relay()) {
+                    respond_and_close("");
+                }
+            } else {
+                close_connection();
+            }
+            return;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR("Failed to receive data");
+                close_connection();
+                return;
+            }
+            // Nothing more pipelined for now: send the batch of cache hits
+            flush_outbox();
+            return;
+        }
+
+        Metrics::add(Metrics::CLIENT_BYTES_IN, received);
+        request_buffer.append(buffer.data(), received);
+    }
+}
+
+void ClientConnection::on_request_complete() {
+    HttpHandler::build_request(request_parser, request);
+    Metrics::add(Metrics::REQUESTS);
+    request_buffer.erase(0, request_parser.head_length());
+    request_parser.reset();
+    answered = true;
+    keep_alive = context->config.client_keepalive && HttpHandler::client_wants_keep_alive(request);
+    Metrics::observe_since(Metrics::QUEUE, loop.woken_at());
+
+    // Where the body ends must be certain, or the next request would be
+    // read from the middle of it
+    bool chunked = false;
+    if (!HttpHandler::request_body_framing(request, body_remaining, chunked)) {
+        LOG_ERROR("Ambiguous request body length");
+        if (hand_outbox_to_relay()) {
+            respond_and_close("HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n");
+        }
+        return;
+    }
+    body_length_known = !chunked;
+
+    int retry_after = context->admission->admit_request(client_key);
+    if (retry_after > 0) {
+        if (hand_outbox_to_relay()) {
+            respond_and_close(AdmissionControl::rate_limited_response(retry_after));
+        }
+        return;
+    }
+
+    if (request.method == "CONNECT") {
+        // Bytes after the header block (early TLS data) are forwarded untouched
+        keep_alive = false;
+        if (!hand_outbox_to_relay() || shed_late_request()) {
+            return;
+        }
+        // The port is required: 0 is never valid
+        if (!HttpHandler::split_authority(request.path, 0, target_host, target_port) || target_port == 0) {
+            LOG_ERROR("Invalid CONNECT request format");
+            close_connection();
+            return;
+        }
+        is_tunnel = true;
+        to_target.queue(request_buffer);
+        request_buffer.clear();
+
+        LOG_INFO("CONNECT tunnel requested to " + target_host + ":" + std::to_string(target_port));
+        connect_to_target();
+        return;
+    }
+
+    // Check cache for GET requests
+    std::shared_ptr<const CachedBlock> cached_block;
+    auto cache_start = std::chrono::high_resolution_clock::now();
+    if (request.method == "GET" && context->cache_manager->get(request, cached_block)) {
+        if (context->admission->over_queue_target(loop.woken_at())) {
+            Metrics::add(Metrics::SPARED_HITS);
+        }
+        serve_from_cache(std::move(cached_block));
+        auto cache_end = std::chrono::high_resolution_clock::now();
+        auto cache_duration = std::chrono::duration_cast<std::chrono::milliseconds>(cache_end - cache_start);
+        Metrics::observe(Metrics::CACHE_HIT, cache_end - cache_start);
+
+        LOG_INFO("✓ Retrieved from CACHE in " + std::to_string(cache_duration.count()) + "ms");
+        return;
+    }
+
+    // An expired copy is refreshed in the background; within
+    // stale-while-revalidate it is served meanwhile
+    has_stale = request.method == "GET" && context->revalidator->refresh(request);
+    if (has_stale &&
+        context->cache_manager->serve_stale(request, StaleUse::WHILE_REVALIDATING, cached_block)) {
+        serve_from_cache(std::move(cached_block));
+        return;
+    }
+
+    if (shed_late_request()) {
+        return;
+    }
+
+    // Of concurrent misses for one URL only the first goes upstream; the
+    // others wait here and are answered from what it stores. Expired copies
+    // always wait for their refresh.
+    if (request.method == "GET" && (context->config.collapsed_forwarding || has_stale) && wait_for_fetch()) {
+        return;
+    }
+
+    fetch_from_origin();
+}
+
+bool ClientConnection::shed_late_request() {
+    if (!context->admission->over_queue_target(loop.woken_at())) {
+        return false;
+    }
+    Metrics::add(Metrics::SHED_QUEUE_TIME);
+    LOG_DEBUG("Request waited past the queue target, shedding it");
+    if (hand_outbox_to_relay()) {
+        respond_and_close(AdmissionControl::overloaded_response());
+    }
+    return true;
+}
+
+void ClientConnection::serve_from_cache(std::shared_ptr<const CachedBlock> cached_block) {
+    // Batched with any further pipelined hits into one writev, straight
+    // from the cache's copy. While draining for an upgrade, the response
+    // asks the client to reconnect (to the new process).
+    keep_alive = outbox.add(std::move(cached_block), keep_alive && !context->draining);
+    if (keep_alive) {
+        // The body is not needed, but the next request starts after it
+        if (!body_length_known || body_remaining > 0) {
+            body_skip = body_length_known ? ResponseFramer::fixed_body(body_remaining)
+                                          : ResponseFramer::chunked_body();
+            skipping_body = true;
+            body_remaining = 0;
+            body_length_known = true;
+        }
+        arm_idle_timer();
+    } else if (hand_outbox_to_relay()) {
+        respond_and_close("");
+    }
+}
+
+bool ClientConnection::skip_request_body() {
+    size_t used = 0;
+    ResponseFramer::Result result = body_skip.consume(request_buffer.data(), request_buffer.size(), used);
+    request_buffer.erase(0, used);
+    if (result == ResponseFramer::Result::ERROR) {
+        LOG_ERROR("Malformed chunked request body");
+        if (hand_outbox_to_relay()) {
+            respond_and_close("");
+        }
+        return false;
+    }
+    skipping_body = result != ResponseFramer::Result::COMPLETE;
+    return true;
+}
+
+bool ClientConnection::wait_for_fetch() {
+    uint64_t wait = ++fetch_wait;
+    std::weak_ptr<ClientConnection> weak_self = shared_from_this();
+    EventLoop* owner = &loop;
+    // The fetch ends on whichever thread ran it; continue on this loop
+    fetch_leader = context->cache_manager->begin_fetch(request, [weak_self, owner, wait]() {
+        owner->post([weak_self, wait]() {
+            if (auto self = weak_self.lock()) {
+                self->on_fetch_done(wait, false);
+            }
+        });
+    });
+    if (fetch_leader) {
+        return false;
+    }
+
+    state = State::WAITING_FOR_FETCH;
+    fetch_timer = loop.schedule(std::chrono::milliseconds(context->config.collapse_timeout_ms),
+                                [weak_self, wait]() {
+        if (auto self = weak_self.lock()) {
+            self->fetch_timer = 0;
+            self->on_fetch_done(wait, true);
+        }
+    });
+    // Hits queued before this request need not wait for the fetch
+    flush_outbox();
+    return true;
+}
+
+void ClientConnection::on_fetch_done(uint64_t wait, bool timed_out) {
+    if (state != State::WAITING_FOR_FETCH || wait != fetch_wait) {
+        return; // Already moved on, or closed
+    }
+    if (fetch_timer != 0) {
+        loop.cancel(fetch_timer);
+        fetch_timer = 0;
+    }
+    state = State::READING_REQUEST;
+
+    std::shared_ptr<const CachedBlock> cached_block;
+    // If the refresh failed, stale-if-error may allow the stale copy
+    if (context->cache_manager->get_collapsed(request, cached_block, timed_out) ||
+        (has_stale && context->cache_manager->serve_stale(request, StaleUse::ON_ERROR, cached_block))) {
+        serve_from_cache(std::move(cached_block));
+        LOG_INFO("✓ Retrieved from CACHE after waiting for a fetch in flight");
+        // Pipelined requests stayed in the buffer while we waited
+        if (state == State::READING_REQUEST) {
+            on_client_readable();
+        }
+        return;
+    }
+    if (timed_out) {
+        LOG_WARNING("Fetch in flight took too long, fetching separately");
+    }
+    fetch_from_origin();
+}
+
+void ClientConnection::end_fetch() {
+    if (fetch_leader) {
+        fetch_leader = false;
+        context->cache_manager->end_fetch(request);
+    }
+}
+
+void ClientConnection::fetch_from_origin() {
+    // Earlier responses go out before this one
+    if (!hand_outbox_to_relay()) {
+        return;
+    }
+
+    target_host = HttpHandler::extract_host(request);
+    try {
+        target_port = HttpHandler::extract_port(request);
+    } catch (...) {
+        LOG_ERROR("Invalid Host header");
+        respond_and_close("HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n");
+        return;
+    }
+
+    // Forward exactly one message so the next pipelined request stays in
+    // the buffer (body_remaining holds the body length read from the head);
+    // chunked bodies are relayed until the client stops sending
+    if (body_length_known) {
+        body_prefix.assign(request_buffer, 0, body_remaining);
+        request_buffer.erase(0, body_prefix.size());
+        body_remaining -= body_prefix.size();
+    } else {
+        body_prefix = std::move(request_buffer);
+        request_buffer.clear();
+        keep_alive = false;
+    }
+
+    pool_upstream = context->upstream_pool->is_enabled() && body_length_known;
+    HttpHandler::prepare_upstream_request(request, pool_upstream);
+    HttpHandler::serialize_request(request, upstream_request);
+    framer = ResponseFramer(request.method == "HEAD");
+    cache_fill.begin(request, framer);
+
+    connect_to_target();
+}
+
+void ClientConnection::connect_to_target() {
+    resolve_start = Metrics::Clock::now();
+
+    if (pool_upstream && !reused_target) {
+        int pooled = context->upstream_pool->acquire(target_host, target_port);
+        if (pooled >= 0) {
+            if (!loop.add(pooled, target_events(), shared_from_this())) {
+                SocketUtils::close_socket(pooled);
+            } else {
+                target_socket = pooled;
+                reused_target = true;
+                LOG_INFO("✓ Reusing pooled connection to " + target_host + ":" + std::to_string(target_port));
+                start_relay();
+                return;
+            }
+        }
+    }
+
+    if (!is_tunnel) {
+        LOG_INFO("Resolving " + target_host + ":" + std::to_string(target_port) + "...");
+    }
+
+    DnsResolver::Result resolved;
+    if (context->resolver->lookup(target_host, resolved)) {
+        on_resolved(resolved);
+        return;
+    }
+
+    // Not cached: the query runs on a resolver thread and the answer is
+    // posted back to this loop
+    state = State::RESOLVING;
+    std::weak_ptr<ClientConnection> weak_self = shared_from_this();
+    EventLoop* owner = &loop;
+    context->resolver->resolve(target_host, [weak_self, owner](const DnsResolver::Result& result) {
+        owner->post([weak_self, result]() {
+            if (auto self = weak_self.lock()) {
+                self->on_resolved(result);
+            }
+        });
+    });
+}
+
+void ClientConnection::on_resolved(const DnsResolver::Result& result) {
+    if (state == State::CLOSED) {
+        return;
+    }
+    Metrics::observe_since(Metrics::DNS, resolve_start);
+    if (!result.ok) {
+        respond_and_close("HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n");
+        return;
+    }
+    connect_start = std::chrono::high_resolution_clock::now();
+    state = State::CONNECTING;
+    std::weak_ptr<ClientConnection> weak_self = shared_from_this();
+    connect_race = std::make_shared<ConnectRace>(loop, result.addresses, target_port, context->connect_options,
+                                                 [weak_self](int socket_fd) {
+        if (auto self = weak_self.lock()) {
+            self->on_target_connected(socket_fd);
+        } else {
+            SocketUtils::close_socket(socket_fd);
+        }
+    });
+    connect_race->start();
+}
+
+void ClientConnection::on_target_connected(int socket_fd) {
+    connect_race.reset();
+    if (socket_fd < 0) {
+        LOG_ERROR("Failed to connect to " + target_host + ":" + std::to_string(target_port));
+        respond_and_close("HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n");
+        return;
+    }
+    if (!loop.add(socket_fd, target_events(), shared_from_this())) {
+        SocketUtils::close_socket(socket_fd);
+        respond_and_close("HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n");
+        return;
+    }
+    target_socket = socket_fd;
+
+    auto connect_end = std::chrono::high_resolution_clock::now();
+    auto connect_duration = std::chrono::duration_cast<std::chrono::milliseconds>(connect_end - connect_start);
+    Metrics::observe(Metrics::CONNECT, connect_end - connect_start);
+
+    if (is_tunnel) {
+        to_client.queue("HTTP/1.1 200 Connection Established\r\nConnection: close\r\n\r\n");
+        LOG_INFO("CONNECT tunnel established");
+        Metrics::add(Metrics::TUNNELS);
+        Metrics::adjust(Metrics::ACTIVE_TUNNELS, 1);
+    } else {
+        LOG_INFO("✓ Connected in " + std::to_string(connect_duration.count()) + "ms");
+    }
+
+    start_relay();
+}
+
+void ClientConnection::start_relay() {
+    state = State::RELAYING;
+    if (loop.backend() == EventLoop::Backend::IO_URING) {
+        // Ring operations drive the relay; readiness would only wake it twice
+        loop.modify(client_socket, 0);
+    }
+    to_target.attach(client_socket, target_socket);
+    to_client.attach(target_socket, client_socket);
+    to_target.count_into(Metrics::CLIENT_BYTES_IN, Metrics::UPSTREAM_BYTES_OUT);
+    to_client.count_into(Metrics::UPSTREAM_BYTES_IN, Metrics::CLIENT_BYTES_OUT);
+
+    const ProxyConfig& config = context->config;
+    if (is_tunnel) {
+        if (config.use_splice) {
+            to_target.enable_splice();
+            to_client.enable_splice();
+        }
+    } else {
+        // The origin may write its head and body separately; acknowledge
+        // promptly so its Nagle timer doesn't hold back the body
+        SocketUtils::set_quick_ack(target_socket);
+        to_target.queue(upstream_request);
+        to_target.queue(body_prefix);
+        if (body_length_known) {
+            to_target.set_read_limit(body_remaining);
+        }
+        if (config.use_splice) {
+            to_target.enable_splice(); // Request bodies
+        }
+        to_client.set_tap([this](const char* data, size_t length) {
+            return on_response_data(data, length);
+        });
+    }
+
+    transfer_start = std::chrono::high_resolution_clock::now();
+    relay();
+}
+
+void ClientConnection::relay() {
+    if (state != State::RELAYING) {
+        return;
+    }
+
+    RelayDirection::Status upstream = to_target.pump(PUMP_BUDGET);
+    RelayDirection::Status downstream = to_client.pump(PUMP_BUDGET);
+    if (upstream == RelayDirection::Status::FAILED || downstream == RelayDirection::Status::FAILED) {
+        if (can_retry_upstream()) {
+            retry_upstream();
+        } else {
+            close_connection();
+        }
+        return;
+    }
+
+    if (is_tunnel) {
+        // Propagate half-close: EOF from one side becomes FIN towards the other
+        if (upstream == RelayDirection::Status::FINISHED && !target_write_closed) {
+            shutdown(target_socket, SHUT_WR);
+            target_write_closed = true;
+        }
+        if (downstream == RelayDirection::Status::FINISHED && !client_write_closed) {
+            shutdown(client_socket, SHUT_WR);
+            client_write_closed = true;
+        }
+        if (target_write_closed && client_write_closed) {
+            close_connection();
+            return;
+        }
+    } else if (downstream == RelayDirection::Status::FINISHED) {
+        if (target_socket >= 0 && !framer.is_complete()) {
+            // Upstream closed: fine for close-delimited bodies, else truncated
+            if (can_retry_upstream()) {
+                retry_upstream();
+                return;
+            }
+            framer.finish_on_close();
+        }
+        finish_response();
+        return;
+    }
+
+    if ((upstream == RelayDirection::Status::YIELDED || downstream == RelayDirection::Status::YIELDED) &&
+        !relay_scheduled) {
+        // Edge-triggered: the remaining input will not be re-announced, so
+        // come back to it after other connections have had a turn
+        relay_scheduled = true;
+        auto self = shared_from_this();
+        loop.post([self]() {
+            self->relay_scheduled = false;
+            self->relay();
+        });
+    }
+}
+
+size_t ClientConnection::on_response_data(const char* data, size_t length) {
+    SocketUtils::set_quick_ack(target_socket); // Re-armed after every read
+    size_t used = length;
+    if (!framing_failed) {
+        ResponseFramer::Result result = framer.consume(data, length, used);
+        if (result == ResponseFramer::Result::COMPLETE) {
+            to_client.mark_complete();
+        } else if (result == ResponseFramer::Result::ERROR) {
+            // Unframeable response: relay until the server closes
+            framing_failed = true;
+            used = length;
+        }
+    }
+
+    if (response_bytes == 0 && used > 0) {
+        Metrics::observe(Metrics::FIRST_BYTE, std::chrono::high_resolution_clock::now() - transfer_start);
+    }
+    response_bytes += used;
+    return used;
+}
+
+bool ClientConnection::can_retry_upstream() const {
+    // Only a pooled connection that failed before any response byte arrived,
+    // and only if the whole request can be sent again and is safe to repeat
+    // Queued bytes for the client may include earlier pipelined responses
+    return reused_target && !is_tunnel && response_bytes == 0 && !to_client.has_pending() &&
+           body_length_known && body_remaining == 0 && HttpHandler::is_idempotent(request.method);
+}
+
+void ClientConnection::retry_upstream() {
+    LOG_INFO("Pooled connection was stale, reconnecting");
+    loop.remove(target_socket);
+    SocketUtils::close_socket(target_socket);
+    target_socket = -1;
+
+    to_target.reset();
+    to_client.reset();
+    framer = ResponseFramer(request.method == "HEAD");
+    cache_fill.begin(request, framer);
+    framing_failed = false;
+    pool_upstream = false; // reused_target stays set so the pool is skipped
+    connect_to_target();
+}
+
+void ClientConnection::finish_response() {
+    if (target_socket >= 0) {
+        // Stored only if the origin sent the whole response
+        if (!framing_failed) {
+            cache_fill.finish(*context->cache_manager, request, framer);
+        }
+
+        auto transfer_end = std::chrono::high_resolution_clock::now();
+        auto transfer_duration = std::chrono::duration_cast<std::chrono::milliseconds>(transfer_end - transfer_start);
+        Metrics::observe(Metrics::TRANSFER, transfer_end - transfer_start);
+
+        LOG_INFO("✓ Response received and transferred in " + std::to_string(transfer_duration.count()) + "ms");
+        LOG_INFO("Request completed (Response size: " + std::to_string(response_bytes) + " bytes)");
+
+        // Hand the upstream connection back if the response ended cleanly and
+        // the whole request body went out
+        bool request_sent = to_target.at_eof() && !to_target.has_pending();
+        if (pool_upstream && !framing_failed && framer.keep_alive() && request_sent) {
+            loop.remove(target_socket);
+            context->upstream_pool->release(target_host, target_port, target_socket);
+            target_socket = -1;
+        }
+
+        // The client connection survives only if this response had a
+        // definite end and the next request starts where this one stopped,
+        // and not once the process is draining for an upgrade
+        bool delimited = framer.is_complete() && !framing_failed &&
+                         framer.framing() != BodyFraming::UNTIL_CLOSE;
+        if (keep_alive && delimited && request_sent && !context->draining) {
+            reset_for_next_request();
+            return;
+        }
+    }
+
+    close_connection();
+}
+
+void ClientConnection::reset_for_next_request() {
+    // The response is stored by now; wake the clients that waited for it
+    end_fetch();
+    if (target_socket >= 0) {
+        loop.remove(target_socket);
+        SocketUtils::close_socket(target_socket);
+        target_socket = -1;
+    }
+    to_target.reset();
+    to_client.reset();
+
+    // The request and scratch strings keep their memory for the next request
+    HttpHandler::recycle(request);
+    has_stale = false;
+    target_host.clear();
+    target_port = 0;
+    HttpHandler::recycle(upstream_request);
+    HttpHandler::recycle(body_prefix);
+    body_remaining = 0;
+    body_length_known = true;
+    pool_upstream = false;
+    reused_target = false;
+    framer = ResponseFramer();
+    framing_failed = false;
+    cache_fill.reset();
+    response_bytes = 0;
+    target_write_closed = false;
+    client_write_closed = false;
+
+    state = State::READING_REQUEST;
+    if (loop.backend() == EventLoop::Backend::IO_URING) {
+        loop.modify(client_socket, SOCKET_EVENTS); // Paused while relaying
+    }
+    arm_idle_timer();
+    // Edge-triggered: bytes that arrived while relaying are not re-announced
+    on_client_readable();
+}
+
+void ClientConnection::arm_idle_timer() {
+    if (idle_timer != 0) {
+        loop.cancel(idle_timer);
+    }
+    std::weak_ptr<ClientConnection> weak_self = shared_from_this();
+    idle_timer = loop.schedule(std::chrono::seconds(context->config.client_idle_timeout), [weak_self]() {
+        auto self = weak_self.lock();
+        if (!self) {
+            return;
+        }
+        self->idle_timer = 0;
+        if (self->state == State::READING_REQUEST) {
+            LOG_DEBUG("Closing idle client connection");
+            self->close_connection();
+        }
+    });
+}
+
+bool ClientConnection::flush_outbox() {
+    while (!outbox.empty()) {
+        ssize_t sent = outbox.send(client_socket);
+        if (sent < 0) {
+            LOG_ERROR("Failed to send data");
+            close_connection();
+            return false;
+        }
+        Metrics::add(Metrics::CLIENT_BYTES_OUT, sent);
+        if (sent == 0) {
+            return true; // Rest goes out on the next EPOLLOUT
+        }
+    }
+    return true;
+}
+
+bool ClientConnection::hand_outbox_to_relay() {
+    if (!flush_outbox()) {
+        return false;
+    }
+    if (!outbox.empty()) {
+        // Only what the socket did not take is copied
+        to_client.queue(outbox.take_remaining());
+    }
+    return true;
+}
+
+void ClientConnection::respond_and_close(const std::string& message) {
+    keep_alive = false;
+    state = State::RELAYING;
+    is_tunnel = false;
+    to_client.attach(-1, client_socket);
+    to_client.count_into(Metrics::COUNTER_COUNT, Metrics::CLIENT_BYTES_OUT);
+    to_client.queue(message);
+    relay();
+}
+
+void ClientConnection::cancel_connect() {
+    if (connect_race) {
+        connect_race->cancel();
+        connect_race.reset();
+    }
+}
+
+void ClientConnection::close_connection() {
+    if (state == State::CLOSED) {
+        return;
+    }
+    if (is_tunnel && state == State::RELAYING) {
+        LOG_INFO("CONNECT tunnel closed (client→target " + std::to_string(to_target.bytes_relayed()) +
+                     " bytes, target→client " + std::to_string(to_client.bytes_relayed()) + " bytes, " +
+                     (to_client.is_spliced() ? "splice" : "buffered") + ")");
+        Metrics::adjust(Metrics::ACTIVE_TUNNELS, -1);
+    }
+    state = State::CLOSED;
+    Metrics::adjust(Metrics::ACTIVE_CONNECTIONS, -1);
+    context->admission->release_connection(client_key);
+    end_fetch();
+    if (idle_timer != 0) {
+        loop.cancel(idle_timer);
+        idle_timer = 0;
+    }
+    if (fetch_timer != 0) {
+        loop.cancel(fetch_timer);
+        fetch_timer = 0;
+    }
+
+    loop.remove(client_socket);
+    SocketUtils::close_socket(client_socket);
+    client_socket = -1;
+
+    cancel_connect();
+    if (target_socket >= 0) {
+        loop.remove(target_socket);
+        SocketUtils::close_socket(target_socket);
+        target_socket = -1;
+    }
+}
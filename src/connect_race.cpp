@@ -0,0 +1,286 @@
+#include "connect_race.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+    // A socket for one attempt, ready to connect; -1 on failure
+    int open_socket(const SocketAddress& address) {
+        int socket_fd = SocketUtils::create_socket(address.family());
+        if (socket_fd >= 0 && SocketUtils::set_non_blocking(socket_fd) && SocketUtils::set_no_delay(socket_fd)) {
+            return socket_fd;
+        }
+        SocketUtils::close_socket(socket_fd);
+        return -1;
+    }
+
+    // 'error' is the attempt's errno, 0 if it connected
+    void record_attempt(const SocketAddress& address, Metrics::Clock::time_point start, int error) {
+        if (error == 0) {
+            Metrics::observe_since(address.family() == AF_INET6 ? Metrics::CONNECT_IPV6 : Metrics::CONNECT_IPV4,
+                                   start);
+            LOG_DEBUG("Connected to " + address.to_string());
+            return;
+        }
+        Metrics::add(error == ETIMEDOUT ? Metrics::CONNECT_TIMEOUTS : Metrics::CONNECT_FAILURES);
+        LOG_WARNING("Failed to connect to " + address.to_string() + ": " + strerror(error));
+    }
+}
+
+std::vector<SocketAddress> ConnectRace::interleave(const std::vector<SocketAddress>& addresses, int port) {
+    std::vector<SocketAddress> first;
+    std::vector<SocketAddress> other;
+    for (SocketAddress address : addresses) {
+        address.set_port(port);
+        (address.family() == addresses.front().family() ? first : other).push_back(address);
+    }
+    std::vector<SocketAddress> ordered;
+    ordered.reserve(addresses.size());
+    for (size_t i = 0; i < first.size() || i < other.size(); i++) {
+        if (i < first.size()) {
+            ordered.push_back(first[i]);
+        }
+        if (i < other.size()) {
+            ordered.push_back(other[i]);
+        }
+    }
+    return ordered;
+}
+
+int ConnectRace::connect(const std::vector<SocketAddress>& addresses, int port, const Options& options) {
+    struct Pending {
+        int fd;
+        const SocketAddress* address;
+        Metrics::Clock::time_point start;
+    };
+
+    std::vector<SocketAddress> ordered = interleave(addresses, port);
+    std::vector<Pending> pending;
+    std::vector<struct pollfd> polled;
+    size_t next = 0;
+    auto next_start = Metrics::Clock::now();
+    int winner = -1;
+
+    while (winner < 0) {
+        auto now = Metrics::Clock::now();
+        if (next < ordered.size() && (pending.empty() || now >= next_start)) {
+            const SocketAddress& address = ordered[next++];
+            Metrics::add(Metrics::CONNECT_ATTEMPTS);
+            int socket_fd = open_socket(address);
+            if (socket_fd >= 0 && ::connect(socket_fd, address.get(), address.length) < 0 && errno != EINPROGRESS) {
+                record_attempt(address, now, errno);
+                SocketUtils::close_socket(socket_fd);
+            } else if (socket_fd >= 0) {
+                pending.push_back(Pending{socket_fd, &address, now});
+                next_start = now + options.attempt_delay;
+            } else {
+                Metrics::add(Metrics::CONNECT_FAILURES);
+            }
+            continue;
+        }
+        if (pending.empty()) {
+            break;
+        }
+
+        // Until an attempt finishes, the next is due, or the oldest times out
+        auto wake = pending.front().start + options.timeout;
+        if (next < ordered.size()) {
+            wake = std::min(wake, next_start);
+        }
+        int timeout_ms = static_cast<int>(
+            std::max<int64_t>(0, std::chrono::ceil<std::chrono::milliseconds>(wake - now).count()));
+        polled.clear();
+        for (const Pending& attempt : pending) {
+            polled.push_back(pollfd{attempt.fd, POLLOUT, 0});
+        }
+        int ready = poll(polled.data(), polled.size(), timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            LOG_ERROR("poll failed: " + std::string(strerror(errno)));
+            break;
+        }
+
+        now = Metrics::Clock::now();
+        for (size_t i = pending.size(); i-- > 0;) {
+            int error;
+            if (ready > 0 && polled[i].revents != 0) {
+                error = SocketUtils::get_socket_error(pending[i].fd);
+            } else if (now >= pending[i].start + options.timeout) {
+                error = ETIMEDOUT;
+            } else {
+                continue;
+            }
+            if (error == 0 && winner < 0) {
+                record_attempt(*pending[i].address, pending[i].start, 0);
+                winner = pending[i].fd;
+            } else {
+                if (error != 0) {
+                    record_attempt(*pending[i].address, pending[i].start, error);
+                    next_start = now; // A failure starts the next attempt at once
+                }
+                SocketUtils::close_socket(pending[i].fd);
+            }
+            pending.erase(pending.begin() + i);
+        }
+    }
+
+    for (const Pending& attempt : pending) {
+        SocketUtils::close_socket(attempt.fd);
+    }
+    if (winner >= 0) {
+        int flags = fcntl(winner, F_GETFL, 0);
+        fcntl(winner, F_SETFL, flags & ~O_NONBLOCK);
+    }
+    return winner;
+}
+
+ConnectRace::ConnectRace(EventLoop& loop, const std::vector<SocketAddress>& addresses, int port,
+                         const Options& options, Done done)
+    : loop(loop), addresses(interleave(addresses, port)), next_address(0), options(options),
+      done(std::move(done)), next_attempt_id(1), delay_timer(0) {}
+
+ConnectRace::~ConnectRace() {
+    // Only reached once the loop holds no reference, i.e. after cancel() or
+    // the loop's own teardown; either way the fds just need closing
+    for (const Attempt& attempt : attempts) {
+        SocketUtils::close_socket(attempt.fd);
+    }
+}
+
+void ConnectRace::start() {
+    auto self = shared_from_this(); // 'done' may drop the owner's reference
+    start_next();
+}
+
+void ConnectRace::cancel() {
+    done = nullptr;
+    close_attempts();
+}
+
+void ConnectRace::start_next() {
+    if (delay_timer != 0) {
+        loop.cancel(delay_timer);
+        delay_timer = 0;
+    }
+    while (next_address < addresses.size()) {
+        if (!launch(addresses[next_address++])) {
+            continue; // Failed at once: straight on to the next
+        }
+        if (next_address < addresses.size()) {
+            std::weak_ptr<ConnectRace> weak_self = shared_from_this();
+            delay_timer = loop.schedule(options.attempt_delay, [weak_self]() {
+                if (auto self = weak_self.lock()) {
+                    self->delay_timer = 0;
+                    self->start_next();
+                }
+            });
+        }
+        return;
+    }
+    if (attempts.empty()) {
+        finish(-1);
+    }
+}
+
+bool ConnectRace::launch(const SocketAddress& address) {
+    Metrics::add(Metrics::CONNECT_ATTEMPTS);
+    auto start = Metrics::Clock::now();
+    int socket_fd = open_socket(address);
+    if (socket_fd < 0) {
+        Metrics::add(Metrics::CONNECT_FAILURES);
+        return false;
+    }
+
+    uint64_t id = next_attempt_id++;
+    std::weak_ptr<ConnectRace> weak_self = shared_from_this();
+    if (loop.backend() == EventLoop::Backend::EPOLL) {
+        if (::connect(socket_fd, address.get(), address.length) < 0 && errno != EINPROGRESS) {
+            record_attempt(address, start, errno);
+            SocketUtils::close_socket(socket_fd);
+            return false;
+        }
+        if (!loop.add(socket_fd, EPOLLOUT, shared_from_this())) {
+            Metrics::add(Metrics::CONNECT_FAILURES);
+            SocketUtils::close_socket(socket_fd);
+            return false;
+        }
+    } else {
+        // The ring reports the outcome, so the socket is not polled
+        if (!loop.add(socket_fd, 0, shared_from_this())) {
+            Metrics::add(Metrics::CONNECT_FAILURES);
+            SocketUtils::close_socket(socket_fd);
+            return false;
+        }
+        loop.connect(socket_fd, address.get(), address.length, [weak_self, id](int result) {
+            if (auto self = weak_self.lock()) {
+                self->on_attempt_done(id, -result);
+            }
+        });
+    }
+
+    EventLoop::TimerId timer = loop.schedule(options.timeout, [weak_self, id]() {
+        if (auto self = weak_self.lock()) {
+            self->on_attempt_done(id, ETIMEDOUT);
+        }
+    });
+    attempts.push_back(Attempt{id, socket_fd, &address, start, timer});
+    return true;
+}
+
+void ConnectRace::handle_event(int fd, uint32_t events) {
+    auto attempt = std::find_if(attempts.begin(), attempts.end(), [fd](const Attempt& a) { return a.fd == fd; });
+    if (attempt != attempts.end() && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        on_attempt_done(attempt->id, SocketUtils::get_socket_error(fd));
+    }
+}
+
+void ConnectRace::on_attempt_done(uint64_t id, int error) {
+    auto it = std::find_if(attempts.begin(), attempts.end(), [id](const Attempt& a) { return a.id == id; });
+    if (it == attempts.end()) {
+        return; // Already decided, e.g. the connect completed as the timer fired
+    }
+    Attempt attempt = *it;
+    attempts.erase(it);
+    loop.cancel(attempt.timer);
+    // The winner goes to its owner, who registers it again
+    loop.remove(attempt.fd);
+    record_attempt(*attempt.address, attempt.start, error);
+
+    if (error == 0) {
+        close_attempts();
+        finish(attempt.fd);
+        return;
+    }
+    SocketUtils::close_socket(attempt.fd);
+    if (next_address < addresses.size()) {
+        start_next();
+    } else if (attempts.empty()) {
+        finish(-1);
+    }
+}
+
+void ConnectRace::close_attempts() {
+    if (delay_timer != 0) {
+        loop.cancel(delay_timer);
+        delay_timer = 0;
+    }
+    for (const Attempt& attempt : attempts) {
+        loop.cancel(attempt.timer);
+        loop.remove(attempt.fd);
+        SocketUtils::close_socket(attempt.fd);
+    }
+    attempts.clear();
+}
+
+void ConnectRace::finish(int socket_fd) {
+    Done callback = std::move(done);
+    done = nullptr;
+    if (callback) {
+        callback(socket_fd);
+    } else {
+        SocketUtils::close_socket(socket_fd);
+    }
+}
@@ -0,0 +1,117 @@
+#include "connection_pool.h"
+#include "socket_utils.h"
+#include "logger.h"
+#include <sys/socket.h>
+#include <cerrno>
+
+ConnectionPool::ConnectionPool(size_t max_idle_per_host, size_t max_idle_total, int idle_timeout_seconds)
+    : max_idle_per_host(max_idle_per_host), max_idle_total(max_idle_total),
+      idle_timeout(idle_timeout_seconds), idle_count(0),
+      reused(0), misses(0), released(0), discarded(0) {}
+
+ConnectionPool::~ConnectionPool() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for (auto& [key, connections] : idle) {
+        for (auto& connection : connections) {
+            SocketUtils::close_socket(connection.socket_fd);
+        }
+    }
+    idle.clear();
+    idle_count = 0;
+}
+
+std::string ConnectionPool::make_key(const std::string& host, int port) {
+    return host + ":" + std::to_string(port);
+}
+
+bool ConnectionPool::is_alive(int socket_fd) {
+    char byte;
+    ssize_t peeked = recv(socket_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (peeked < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    // 0 = orderly close; > 0 = stray data we could not frame
+    return false;
+}
+
+int ConnectionPool::acquire(const std::string& host, int port) {
+    if (!is_enabled()) {
+        return -1;
+    }
+
+    std::string key = make_key(host, port);
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    auto it = idle.find(key);
+    while (it != idle.end() && !it->second.empty()) {
+        // Most recently used first: it is the least likely to have timed out
+        IdleConnection connection = it->second.back();
+        it->second.pop_back();
+        idle_count--;
+
+        if (now - connection.idle_since < idle_timeout && is_alive(connection.socket_fd)) {
+            reused++;
+            LOG_DEBUG("Reusing pooled connection to " + key);
+            return connection.socket_fd;
+        }
+        SocketUtils::close_socket(connection.socket_fd);
+        discarded++;
+    }
+
+    misses++;
+    return -1;
+}
+
+void ConnectionPool::release(const std::string& host, int port, int socket_fd) {
+    if (socket_fd < 0) {
+        return;
+    }
+    std::string key = make_key(host, port);
+
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    auto& connections = idle[key];
+    if (!is_enabled() || connections.size() >= max_idle_per_host || idle_count >= max_idle_total) {
+        SocketUtils::close_socket(socket_fd);
+        discarded++;
+        return;
+    }
+
+    connections.push_back({socket_fd, std::chrono::steady_clock::now()});
+    idle_count++;
+    released++;
+}
+
+void ConnectionPool::prune() {
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for (auto it = idle.begin(); it != idle.end(); ) {
+        auto& connections = it->second;
+        // Oldest entries sit at the front
+        while (!connections.empty() && now - connections.front().idle_since >= idle_timeout) {
+            SocketUtils::close_socket(connections.front().socket_fd);
+            connections.pop_front();
+            idle_count--;
+            discarded++;
+        }
+        if (connections.empty()) {
+            it = idle.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+ConnectionPool::Stats ConnectionPool::get_stats() const {
+    Stats stats;
+    stats.reused = reused;
+    stats.misses = misses;
+    stats.released = released;
+    stats.discarded = discarded;
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        stats.idle = idle_count;
+    }
+    return stats;
+}
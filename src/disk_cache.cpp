@@ -0,0 +1,538 @@
+#include "disk_cache.h"
+#include "cache_manager.h"
+#include "logger.h"
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <thread>
+
+namespace {
+
+// Segment file: FILE_MAGIC, then records back to back, each 8-byte aligned
+const char FILE_MAGIC[8] = {'P', 'X', 'Y', 'S', 'E', 'G', '0', '1'};
+const size_t FILE_HEADER_SIZE = 16;
+const uint32_t RECORD_MAGIC = 0x43455250; // "PREC"
+const uint32_t FLAG_FRAMED = 1;
+const size_t WRITE_QUEUE_DEPTH = 512;
+const size_t MAX_SEGMENT_SIZE = 64 * 1024 * 1024;
+const size_t MIN_SEGMENT_SIZE = 1024 * 1024;
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t key_length;
+    uint64_t hash;
+    uint64_t head_length;
+    uint64_t body_length;
+    int64_t stored_at;          // Unix seconds
+    int32_t ttl_seconds;
+    int32_t status_code;
+    uint32_t flags;
+    uint32_t header_checksum;   // This header (with this field zero) and the key
+    uint64_t payload_checksum;  // Head and body
+};
+static_assert(sizeof(RecordHeader) == 64, "record header layout is part of the file format");
+
+size_t align8(size_t length) {
+    return (length + 7) & ~static_cast<size_t>(7);
+}
+
+size_t record_length(const RecordHeader& header) {
+    return align8(sizeof(RecordHeader) + header.key_length + header.head_length + header.body_length);
+}
+
+// Word-at-a-time mix; catches torn and zero-filled writes, not tampering
+uint64_t checksum(const char* data, size_t length, uint64_t seed = 0) {
+    uint64_t hash = seed ^ (length * 0x9E3779B97F4A7C15ULL);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash ^= word * 0x87C37B91114253D5ULL;
+        hash = ((hash << 31) | (hash >> 33)) * 0x4CF5AD432745937FULL;
+    }
+    for (; i < length; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001B3ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+uint32_t header_checksum(RecordHeader header, const char* key) {
+    header.header_checksum = 0;
+    uint64_t hash = checksum(reinterpret_cast<const char*>(&header), sizeof(header));
+    hash = checksum(key, header.key_length, hash);
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+int64_t unix_seconds(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+bool write_fully(int fd, struct iovec* parts, int count, off_t offset) {
+    while (count > 0) {
+        ssize_t written = pwritev(fd, parts, count, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        offset += written;
+        while (count > 0 && static_cast<size_t>(written) >= parts->iov_len) {
+            written -= parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0) {
+            parts->iov_base = static_cast<char*>(parts->iov_base) + written;
+            parts->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+DiskSegment::DiskSegment(uint32_t id, int fd, const char* data, size_t mapped_length)
+    : segment_id(id), file_fd(fd), mapping(data), mapped_length(mapped_length) {}
+
+DiskSegment::~DiskSegment() {
+    munmap(const_cast<char*>(mapping), mapped_length);
+    close(file_fd);
+}
+
+DiskCache::DiskCache(const std::string& directory, size_t max_bytes)
+    : directory(directory), max_bytes(max_bytes),
+      segment_size(std::min(MAX_SEGMENT_SIZE, std::max(MIN_SEGMENT_SIZE, max_bytes / 8))),
+      total_bytes(0), active_segment(0), lock_fd(-1),
+      writer(std::make_unique<ThreadPool>(1, WRITE_QUEUE_DEPTH)), writer_stopped(false), closed(false),
+      hits(0), misses(0), writes(0), dropped(0), corrupt(0), segments_deleted(0), loaded(0) {}
+
+DiskCache::~DiskCache() {
+    shutdown();
+    unlock_directory();
+}
+
+std::string DiskCache::segment_path(uint32_t id) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%08x.seg", id);
+    return directory + name;
+}
+
+std::shared_ptr<DiskSegment> DiskCache::map_segment(uint32_t id, int fd, size_t file_size) {
+    // Mapped at full capacity up front; only bytes below the written size
+    // are ever touched, so appends need no remapping
+    size_t length = std::max(file_size, segment_size);
+    void* data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("Failed to map cache segment " + segment_path(id) + ": " + strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+    madvise(data, length, MADV_RANDOM);
+    return std::make_shared<DiskSegment>(id, fd, static_cast<const char*>(data), length);
+}
+
+bool DiskCache::open() {
+    auto start = std::chrono::steady_clock::now();
+
+    if (mkdir(directory.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOG_ERROR("Failed to create cache directory " + directory + ": " + strerror(errno));
+        return false;
+    }
+    std::string lock_path = directory + "/lock";
+    lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX | LOCK_NB) < 0) {
+        LOG_ERROR("Cache directory " + directory + " is in use: " + strerror(errno));
+        unlock_directory();
+        return false;
+    }
+    // From here on a failure lets go of the lock, so a later open() can retry
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        LOG_ERROR("Failed to open cache directory " + directory + ": " + strerror(errno));
+        unlock_directory();
+        return false;
+    }
+    std::vector<uint32_t> ids;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() == 12 && name.compare(8, 4, ".seg") == 0 &&
+            name.find_first_not_of("0123456789abcdef") == 8) {
+            ids.push_back(static_cast<uint32_t>(std::stoul(name.substr(0, 8), nullptr, 16)));
+        }
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+
+    std::lock_guard<std::mutex> lock(index_mutex);
+    uint32_t next_id = 0;
+    for (uint32_t id : ids) {
+        next_id = id + 1;
+        std::string path = segment_path(id);
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat info;
+        char magic[sizeof(FILE_MAGIC)];
+        if (fd < 0 || fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < FILE_HEADER_SIZE ||
+            pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+            std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0) {
+            LOG_WARNING("Removing unreadable cache segment " + path);
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            unlink(path.c_str());
+            continue;
+        }
+
+        size_t file_size = info.st_size;
+        std::shared_ptr<DiskSegment> segment = map_segment(id, fd, file_size);
+        if (!segment) {
+            continue;
+        }
+        size_t valid = scan_segment(id, *segment, file_size);
+        if (valid < file_size) {
+            // Torn tail from a crash: cut it off so the file ends on a record
+            LOG_WARNING("Trimmed " + std::to_string(file_size - valid) +
+                            " bytes of incomplete records from " + path);
+            if (ftruncate(fd, valid) < 0) {
+                LOG_WARNING("Failed to trim " + path + ": " + strerror(errno));
+            }
+        }
+        segments[id] = Segment{segment, valid};
+        total_bytes += valid;
+    }
+    loaded = index.size();
+
+    while (total_bytes > max_bytes && !segments.empty()) {
+        drop_oldest_segment();
+    }
+    // Keep appending to the newest segment if it has room
+    if (!segments.empty() && segments.rbegin()->second.size < segment_size) {
+        active_segment = segments.rbegin()->first;
+    } else if (!start_segment(next_id)) {
+        index.clear();
+        segments.clear();
+        total_bytes = 0;
+        unlock_directory();
+        return false;
+    }
+
+    closed = false;
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    LOG_INFO("Disk cache: " + std::to_string(index.size()) + " entries in " +
+                 std::to_string(segments.size()) + " segment(s), " +
+                 std::to_string(total_bytes >> 20) + " MB, indexed in " + std::to_string(elapsed.count()) + "ms");
+    return true;
+}
+
+size_t DiskCache::scan_segment(uint32_t id, const DiskSegment& segment, size_t file_size) {
+    const char* data = segment.data();
+    size_t offset = FILE_HEADER_SIZE;
+
+    while (offset + sizeof(RecordHeader) <= file_size) {
+        RecordHeader header;
+        std::memcpy(&header, data + offset, sizeof(header));
+        if (header.magic != RECORD_MAGIC || header.key_length > file_size ||
+            header.head_length > file_size || header.body_length > file_size ||
+            offset + record_length(header) > file_size) {
+            break; // Unwritten or cut short
+        }
+        if (header_checksum(header, data + offset + sizeof(header)) != header.header_checksum) {
+            break;
+        }
+        // Later records replace earlier ones; expiry is checked on lookup
+        index[header.hash] = Location{id, offset, header.stored_at + header.ttl_seconds, false};
+        offset += record_length(header);
+    }
+    return offset;
+}
+
+bool DiskCache::start_segment(uint32_t id) {
+    while (!segments.empty() && total_bytes + segment_size > max_bytes) {
+        drop_oldest_segment();
+    }
+
+    std::string path = segment_path(id);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    char file_header[FILE_HEADER_SIZE] = {};
+    std::memcpy(file_header, FILE_MAGIC, sizeof(FILE_MAGIC));
+    std::memcpy(file_header + sizeof(FILE_MAGIC), &id, sizeof(id));
+    if (fd < 0 || pwrite(fd, file_header, sizeof(file_header), 0) != static_cast<ssize_t>(sizeof(file_header))) {
+        LOG_ERROR("Failed to create cache segment " + path + ": " + strerror(errno));
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    std::shared_ptr<DiskSegment> segment = map_segment(id, fd, FILE_HEADER_SIZE);
+    if (!segment) {
+        return false;
+    }
+    segments[id] = Segment{segment, FILE_HEADER_SIZE};
+    total_bytes += FILE_HEADER_SIZE;
+    active_segment = id;
+    return true;
+}
+
+void DiskCache::drop_oldest_segment() {
+    auto oldest = segments.begin();
+    uint32_t id = oldest->first;
+    for (auto it = index.begin(); it != index.end(); ) {
+        if (it->second.segment == id) {
+            it = index.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Hits in progress keep the file open through their reference
+    unlink(segment_path(id).c_str());
+    total_bytes -= oldest->second.size;
+    segments.erase(oldest);
+    segments_deleted++;
+}
+
+void DiskCache::store(uint64_t hash, const std::string& key, std::shared_ptr<const CachedBlock> block,
+                      std::chrono::system_clock::time_point cached_time, int ttl_seconds) {
+    if (!block || block->on_disk() || closed) {
+        return;
+    }
+    if (writer_stopped) {
+        write_block(hash, key, block, cached_time, ttl_seconds);
+        return;
+    }
+    bool queued = writer->try_submit([this, hash, key, block, cached_time, ttl_seconds]() {
+        write_block(hash, key, block, cached_time, ttl_seconds);
+    });
+    if (!queued) {
+        dropped++;
+    }
+}
+
+void DiskCache::store_now(uint64_t hash, const std::string& key, std::shared_ptr<const CachedBlock> block,
+                          std::chrono::system_clock::time_point cached_time, int ttl_seconds) {
+    if (block && !block->on_disk() && !closed) {
+        write_block(hash, key, block, cached_time, ttl_seconds);
+    }
+}
+
+void DiskCache::write_block(uint64_t hash, const std::string& key, const std::shared_ptr<const CachedBlock>& block,
+                            std::chrono::system_clock::time_point cached_time, int ttl_seconds) {
+    // A disk hit's head must suit any client, so compressed entries are
+    // written inflated (on the writer thread, for queued stores)
+    std::shared_ptr<const CachedBlock> identity = block->gzipped ? CacheCompressor::decompress(*block) : block;
+    if (identity) {
+        write_record(hash, key, *identity, cached_time, ttl_seconds);
+    }
+}
+
+void DiskCache::write_record(uint64_t hash, const std::string& key, const CachedBlock& block,
+                             std::chrono::system_clock::time_point cached_time, int ttl_seconds) {
+    RecordHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = RECORD_MAGIC;
+    header.key_length = key.size();
+    header.hash = hash;
+    header.head_length = block.head_length;
+    header.body_length = block.body_length();
+    header.stored_at = unix_seconds(cached_time);
+    header.ttl_seconds = ttl_seconds;
+    header.status_code = block.status_code;
+    header.flags = block.framed ? FLAG_FRAMED : 0;
+    header.payload_checksum = checksum(block.bytes.data(), block.bytes.size());
+    header.header_checksum = header_checksum(header, key.data());
+
+    size_t length = record_length(header);
+    if (FILE_HEADER_SIZE + length > segment_size) {
+        dropped++;
+        return;
+    }
+
+    std::lock_guard<std::mutex> writing(write_mutex);
+    if (closed) {
+        return;
+    }
+
+    std::shared_ptr<DiskSegment> file;
+    size_t offset;
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        auto active = segments.find(active_segment);
+        if (active == segments.end() || active->second.size + length > segment_size) {
+            if (!start_segment(active_segment + 1)) {
+                dropped++;
+                return;
+            }
+            active = segments.find(active_segment);
+        }
+        file = active->second.file;
+        offset = active->second.size;
+    }
+
+    static const char padding[8] = {};
+    struct iovec parts[4] = {
+        {&header, sizeof(header)},
+        {const_cast<char*>(key.data()), key.size()},
+        {const_cast<char*>(block.bytes.data()), block.bytes.size()},
+        {const_cast<char*>(padding), length - (sizeof(header) + key.size() + block.bytes.size())},
+    };
+    if (!write_fully(file->fd(), parts, 4, offset)) {
+        LOG_ERROR("Failed to write cache segment " + segment_path(file->id()) + ": " + strerror(errno));
+        dropped++;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(index_mutex);
+    auto segment = segments.find(file->id());
+    if (segment == segments.end()) {
+        return; // Dropped while we were writing
+    }
+    segment->second.size = offset + length;
+    total_bytes += length;
+    index[hash] = Location{file->id(), offset, header.stored_at + ttl_seconds, true};
+    writes++;
+}
+
+bool DiskCache::lookup(uint64_t hash, const std::string& key, std::shared_ptr<const CachedBlock>& block) {
+    Location location;
+    std::shared_ptr<DiskSegment> file;
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        auto it = index.find(hash);
+        if (it == index.end()) {
+            misses++;
+            return false;
+        }
+        auto segment = segments.find(it->second.segment);
+        if (segment == segments.end() ||
+            it->second.expires < unix_seconds(std::chrono::system_clock::now())) {
+            index.erase(it);
+            misses++;
+            return false;
+        }
+        location = it->second;
+        file = segment->second.file;
+    }
+
+    const char* record = file->data() + location.offset;
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    const char* payload = record + sizeof(header) + header.key_length;
+    if (header.key_length != key.size() || std::memcmp(record + sizeof(header), key.data(), key.size()) != 0) {
+        misses++; // Another key with the same hash
+        return false;
+    }
+
+    if (!location.verified) {
+        // Loaded at startup: make sure the body made it to disk before use
+        bool intact = checksum(payload, header.head_length + header.body_length) == header.payload_checksum;
+        std::lock_guard<std::mutex> lock(index_mutex);
+        auto it = index.find(hash);
+        bool same = it != index.end() && it->second.segment == location.segment &&
+                    it->second.offset == location.offset;
+        if (!intact) {
+            if (same) {
+                index.erase(it);
+            }
+            corrupt++;
+            misses++;
+            LOG_WARNING("Discarding corrupt disk cache entry for " + key);
+            return false;
+        }
+        if (same) {
+            it->second.verified = true;
+        }
+    }
+
+    auto result = std::make_shared<CachedBlock>();
+    result->bytes.assign(payload, header.head_length);
+    result->head_length = header.head_length;
+    result->framed = (header.flags & FLAG_FRAMED) != 0;
+    result->status_code = header.status_code;
+    result->segment = std::move(file);
+    result->file_offset = location.offset + sizeof(header) + header.key_length + header.head_length;
+    result->file_length = header.body_length;
+    block = std::move(result);
+    hits++;
+    return true;
+}
+
+void DiskCache::erase(uint64_t hash) {
+    std::lock_guard<std::mutex> lock(index_mutex);
+    index.erase(hash);
+}
+
+void DiskCache::wait_for_writes() {
+    if (writer_stopped) {
+        return;
+    }
+    // The single writer runs tasks in order: once this one has run, so
+    // have all queued before it
+    auto done = std::make_shared<std::promise<void>>();
+    std::future<void> written = done->get_future();
+    while (!writer->try_submit([done]() { done->set_value(); })) {
+        if (writer_stopped) {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    written.wait();
+}
+
+void DiskCache::shutdown() {
+    if (writer_stopped.exchange(true)) {
+        return;
+    }
+    writer->shutdown();
+}
+
+void DiskCache::close() {
+    wait_for_writes();
+    if (closed.exchange(true)) {
+        return;
+    }
+    std::lock_guard<std::mutex> writing(write_mutex);
+    {
+        std::lock_guard<std::mutex> lock(index_mutex);
+        // Hits in progress keep their segments mapped
+        index.clear();
+        segments.clear();
+        total_bytes = 0;
+    }
+    unlock_directory();
+    LOG_INFO("Released cache directory " + directory);
+}
+
+void DiskCache::unlock_directory() {
+    if (lock_fd >= 0) {
+        ::close(lock_fd);
+        lock_fd = -1;
+    }
+}
+
+DiskCache::Stats DiskCache::get_stats() const {
+    Stats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.writes = writes;
+    stats.dropped = dropped;
+    stats.corrupt = corrupt;
+    stats.segments_deleted = segments_deleted;
+    stats.loaded = loaded;
+    std::lock_guard<std::mutex> lock(index_mutex);
+    stats.entries = index.size();
+    stats.bytes = total_bytes;
+    stats.segments = segments.size();
+    return stats;
+}
@@ -0,0 +1,247 @@
+#include "dns_resolver.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <cstring>
+#include <future>
+
+namespace {
+    const size_t QUEUE_DEPTH = 1024;
+}
+
+DnsResolver::DnsResolver(size_t thread_count, int ttl_seconds, int negative_ttl_seconds)
+    : ttl(ttl_seconds), negative_ttl(negative_ttl_seconds),
+      workers(std::make_unique<ThreadPool>(thread_count, QUEUE_DEPTH)), stopping(false),
+      hits(0), negative_hits(0), misses(0), merged(0), failures(0) {}
+
+DnsResolver::~DnsResolver() {
+    shutdown();
+}
+
+DnsResolver::Shard& DnsResolver::shard_for(const std::string& host) {
+    return shards[std::hash<std::string>()(host) % SHARD_COUNT];
+}
+
+bool DnsResolver::parse_numeric(const std::string& host, Result& result) {
+    SocketAddress address;
+    std::memset(&address.storage, 0, sizeof(address.storage));
+
+    auto* v4 = reinterpret_cast<struct sockaddr_in*>(&address.storage);
+    auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&address.storage);
+    std::string literal = host;
+    if (literal.size() > 2 && literal.front() == '[' && literal.back() == ']') {
+        literal = literal.substr(1, literal.size() - 2);
+    }
+
+    if (inet_pton(AF_INET, literal.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        address.length = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, literal.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        address.length = sizeof(struct sockaddr_in6);
+    } else {
+        return false;
+    }
+
+    result.ok = true;
+    result.cached = true;
+    result.addresses.assign(1, address);
+    return true;
+}
+
+bool DnsResolver::lookup(const std::string& host, Result& result) {
+    if (parse_numeric(host, result)) {
+        return true;
+    }
+
+    Shard& shard = shard_for(host);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(host);
+    if (it == shard.entries.end() || it->second.pending ||
+        it->second.expires <= std::chrono::steady_clock::now()) {
+        return false;
+    }
+
+    result = it->second.result;
+    result.cached = true;
+    (result.ok ? hits : negative_hits)++;
+    return true;
+}
+
+void DnsResolver::resolve(const std::string& host, Callback callback) {
+    Result cached;
+    if (lookup(host, cached)) {
+        callback(cached);
+        return;
+    }
+
+    Shard& shard = shard_for(host);
+    {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        Entry& entry = shard.entries[host];
+        if (entry.pending) {
+            // Someone is already asking; share their answer
+            entry.waiters.push_back(std::move(callback));
+            merged++;
+            return;
+        }
+        if (entry.expires > std::chrono::steady_clock::now()) {
+            // Filled in between lookup() and taking the lock
+            cached = entry.result;
+            cached.cached = true;
+            (cached.ok ? hits : negative_hits)++;
+            lock.unlock();
+            callback(cached);
+            return;
+        }
+        entry.pending = true;
+        entry.waiters.push_back(std::move(callback));
+        misses++;
+    }
+
+    if (stopping || !workers->try_submit([this, host]() { run_query(host); })) {
+        Result result;
+        result.error = stopping ? "resolver stopped" : "resolver queue full";
+        complete(host, result, false);
+    }
+}
+
+DnsResolver::Result DnsResolver::resolve_sync(const std::string& host) {
+    Result cached;
+    if (lookup(host, cached)) {
+        return cached;
+    }
+
+    auto answer = std::make_shared<std::promise<Result>>();
+    std::future<Result> future = answer->get_future();
+    resolve(host, [answer](const Result& result) { answer->set_value(result); });
+    return future.get();
+}
+
+void DnsResolver::run_query(const std::string& host) {
+    if (stopping) {
+        Result result;
+        result.error = "resolver stopped";
+        complete(host, result, false);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Result result = query(host);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    if (result.ok) {
+        LOG_DEBUG("Resolved " + host + " in " + std::to_string(elapsed.count()) + "ms (" +
+                      std::to_string(result.addresses.size()) + " address(es))");
+    } else {
+        failures++;
+        LOG_ERROR("Failed to resolve host: " + host + " (" + result.error + ")");
+    }
+    complete(host, result);
+}
+
+DnsResolver::Result DnsResolver::query(const std::string& host) {
+    Result result;
+
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    struct addrinfo* list = nullptr;
+    int status = getaddrinfo(host.c_str(), nullptr, &hints, &list);
+    if (status != 0) {
+        result.error = gai_strerror(status);
+        return result;
+    }
+
+    for (struct addrinfo* info = list; info != nullptr; info = info->ai_next) {
+        if (info->ai_family != AF_INET && info->ai_family != AF_INET6) {
+            continue;
+        }
+        SocketAddress address;
+        std::memset(&address.storage, 0, sizeof(address.storage));
+        std::memcpy(&address.storage, info->ai_addr, info->ai_addrlen);
+        address.length = info->ai_addrlen;
+        result.addresses.push_back(address);
+    }
+    freeaddrinfo(list);
+
+    result.ok = !result.addresses.empty();
+    if (!result.ok) {
+        result.error = "no usable addresses";
+    }
+    return result;
+}
+
+void DnsResolver::complete(const std::string& host, Result result, bool cacheable) {
+    std::vector<Callback> waiters;
+    {
+        Shard& shard = shard_for(host);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Entry& entry = shard.entries[host];
+        waiters.swap(entry.waiters);
+
+        if (stopping || !cacheable) {
+            shard.entries.erase(host);
+        } else {
+            entry.result = result;
+            entry.pending = false;
+            entry.expires = std::chrono::steady_clock::now() + (result.ok ? ttl : negative_ttl);
+
+            if (shard.entries.size() > MAX_ENTRIES_PER_SHARD) {
+                // Over budget: drop something that is not in flight
+                for (auto it = shard.entries.begin(); it != shard.entries.end(); ++it) {
+                    if (!it->second.pending && it->first != host) {
+                        shard.entries.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    for (auto& waiter : waiters) {
+        waiter(result);
+    }
+}
+
+void DnsResolver::prune() {
+    auto now = std::chrono::steady_clock::now();
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.entries.begin(); it != shard.entries.end(); ) {
+            if (!it->second.pending && it->second.expires <= now) {
+                it = shard.entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+void DnsResolver::shutdown() {
+    if (stopping.exchange(true)) {
+        return;
+    }
+    // Queued queries complete with an error instead of calling getaddrinfo
+    workers->shutdown();
+}
+
+DnsResolver::Stats DnsResolver::get_stats() const {
+    Stats stats;
+    stats.hits = hits;
+    stats.negative_hits = negative_hits;
+    stats.misses = misses;
+    stats.merged = merged;
+    stats.failures = failures;
+    stats.entries = 0;
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.entries += shard.entries.size();
+    }
+    return stats;
+}
@@ -0,0 +1,635 @@
+#include "event_loop.h"
+#include "logger.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+    // Submission queue depth; completions get four times as many slots
+    const unsigned RING_ENTRIES = 1024;
+    // Pause before re-arming an accept that failed, e.g. with EMFILE
+    const std::chrono::milliseconds ACCEPT_RETRY_DELAY(100);
+}
+
+EventLoop::EventLoop(Backend backend)
+    : epoll_fd(-1), wake_fd(-1), next_operation_id(1), running(true), next_timer_id(1) {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        LOG_ERROR("Failed to create eventfd: " + std::string(strerror(errno)));
+        return;
+    }
+
+    if (backend == Backend::IO_URING) {
+        ring = std::make_unique<IoRing>(RING_ENTRIES);
+        if (ring->is_valid()) {
+            arm_poll(wake_fd, EPOLLIN);
+            return;
+        }
+        LOG_WARNING("io_uring setup failed, falling back to epoll");
+        ring.reset();
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        LOG_ERROR("Failed to create epoll instance: " + std::string(strerror(errno)));
+        return;
+    }
+
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+}
+
+EventLoop::~EventLoop() {
+    // Handlers own their sockets and close them on destruction
+    handlers.clear();
+    retired.clear();
+    timers.clear();
+    // Operations and tasks may hold provided buffers, which go back to the
+    // ring, so they go first
+    pending_tasks.clear();
+    deferred_tasks.clear();
+    operations.clear();
+    polls.clear();
+    ring.reset();
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+bool EventLoop::is_valid() const {
+    return (ring || epoll_fd >= 0) && wake_fd >= 0;
+}
+
+bool EventLoop::io_uring_supported() {
+    return IoRing::is_supported();
+}
+
+bool EventLoop::add(int fd, uint32_t events, std::shared_ptr<Handler> handler) {
+    if (ring) {
+        // Operations on a registered fd skip the kernel's fd table lookup
+        ring->register_file(fd);
+        handlers[fd] = std::move(handler);
+        if (events != 0) {
+            arm_poll(fd, events);
+        }
+        return true;
+    }
+
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG_ERROR("epoll_ctl ADD failed: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    handlers[fd] = std::move(handler);
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+    if (ring) {
+        auto poll = polls.find(fd);
+        if (poll != polls.end() && poll->second.events == events) {
+            return true;
+        }
+        cancel_poll(fd);
+        if (events != 0) {
+            arm_poll(fd, events);
+        }
+        return true;
+    }
+
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        LOG_ERROR("epoll_ctl MOD failed: " + std::string(strerror(errno)));
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::remove(int fd) {
+    auto it = handlers.find(fd);
+    if (it == handlers.end()) {
+        return;
+    }
+
+    if (ring) {
+        // The poll goes with the fd's other operations
+        polls.erase(fd);
+        struct io_uring_sqe* sqe = ring->get_sqe();
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        }
+        ring->unregister_file(fd);
+        // Now, while the fd is still open: a queued entry must never name
+        // an fd number that has been closed and reused
+        ring->submit();
+    } else {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    retired.push_back(std::move(it->second));
+    handlers.erase(it);
+}
+
+void EventLoop::notify_drain() {
+    // Handlers may remove themselves, or each other, when told
+    std::vector<std::shared_ptr<Handler>> current;
+    current.reserve(handlers.size());
+    for (const auto& entry : handlers) {
+        current.push_back(entry.second);
+    }
+    for (const auto& handler : current) {
+        handler->on_drain();
+    }
+}
+
+void EventLoop::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(task_mutex);
+        pending_tasks.push_back(std::move(task));
+    }
+    wake();
+}
+
+void EventLoop::defer(Task task) {
+    deferred_tasks.push_back(std::move(task));
+}
+
+void EventLoop::drain_wake_fd() {
+    uint64_t value;
+    while (read(wake_fd, &value, sizeof(value)) > 0) {
+    }
+}
+
+void EventLoop::wake() {
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;
+}
+
+void EventLoop::run_pending_tasks() {
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(task_mutex);
+        tasks.swap(pending_tasks);
+    }
+    for (auto& task : tasks) {
+        task();
+    }
+}
+
+void EventLoop::run_deferred_tasks() {
+    // Tasks may defer more; those run in this same pass
+    while (!deferred_tasks.empty()) {
+        std::vector<Task> tasks;
+        tasks.swap(deferred_tasks);
+        for (auto& task : tasks) {
+            task();
+        }
+    }
+}
+
+EventLoop::TimerId EventLoop::schedule(std::chrono::milliseconds delay, Task task) {
+    TimerId id = next_timer_id++;
+    auto deadline = std::chrono::steady_clock::now() + delay;
+    timers.emplace(TimerKey(deadline, id), std::move(task));
+    timer_deadlines[id] = deadline;
+    return id;
+}
+
+void EventLoop::cancel(TimerId id) {
+    auto it = timer_deadlines.find(id);
+    if (it == timer_deadlines.end()) {
+        return;
+    }
+    timers.erase(TimerKey(it->second, id));
+    timer_deadlines.erase(it);
+}
+
+void EventLoop::run_due_timers() {
+    auto now = std::chrono::steady_clock::now();
+    while (!timers.empty() && timers.begin()->first.first <= now) {
+        auto it = timers.begin();
+        Task task = std::move(it->second);
+        timer_deadlines.erase(it->first.second);
+        timers.erase(it);
+        task(); // May schedule or cancel other timers
+    }
+}
+
+int EventLoop::next_timeout_ms() const {
+    if (timers.empty()) {
+        return -1;
+    }
+    auto wait = timers.begin()->first.first - std::chrono::steady_clock::now();
+    if (wait <= std::chrono::steady_clock::duration::zero()) {
+        return 0;
+    }
+    // Round up so we never wake just before the deadline and spin
+    return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+}
+
+void EventLoop::run() {
+    woken = std::chrono::steady_clock::now();
+    if (ring) {
+        run_ring();
+    } else {
+        run_epoll();
+    }
+}
+
+void EventLoop::run_epoll() {
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, next_timeout_ms());
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("epoll_wait failed: " + std::string(strerror(errno)));
+            break;
+        }
+        woken = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd) {
+                drain_wake_fd();
+                continue;
+            }
+
+            auto it = handlers.find(fd);
+            if (it == handlers.end()) {
+                continue;
+            }
+            // Raw pointer is safe: remove() parks the handler in 'retired'
+            Handler* handler = it->second.get();
+            handler->handle_event(fd, events[i].events);
+        }
+
+        run_deferred_tasks();
+        run_pending_tasks();
+        run_due_timers();
+        retired.clear();
+    }
+}
+
+void EventLoop::run_ring() {
+    struct io_uring_cqe cqe;
+
+    while (running) {
+        // Everything queued since the last wait is submitted here
+        int result = ring->submit_and_wait(next_timeout_ms());
+        // EBUSY: completions must be reaped before more can be submitted
+        if (result < 0 && result != -EBUSY && result != -EAGAIN) {
+            LOG_ERROR("io_uring_enter failed: " + std::string(strerror(-result)));
+            break;
+        }
+        woken = std::chrono::steady_clock::now();
+
+        // Only those posted by now: completions keep arriving while these
+        // run, and taking them too could put off the tasks below for long
+        for (unsigned ready = ring->completions_ready(); ready > 0 && ring->next_completion(cqe); ready--) {
+            complete(cqe);
+        }
+
+        run_deferred_tasks();
+        run_pending_tasks();
+        run_due_timers();
+        retired.clear();
+    }
+}
+
+struct io_uring_sqe* EventLoop::queue_operation(std::function<void(const struct io_uring_cqe& cqe)> done,
+                                                Operation** operation) {
+    struct io_uring_sqe* sqe = ring->get_sqe();
+    if (!sqe) {
+        // Fail it on the next iteration, as the kernel would have
+        LOG_ERROR("io_uring submission queue is full");
+        post([done = std::move(done)]() {
+            struct io_uring_cqe failed;
+            std::memset(&failed, 0, sizeof(failed));
+            failed.res = -EAGAIN;
+            done(failed);
+        });
+        return nullptr;
+    }
+    uint64_t id = next_operation_id++;
+    std::unique_ptr<Operation>& entry = operations[id];
+    entry = std::make_unique<Operation>();
+    entry->done = std::move(done);
+    if (operation) {
+        *operation = entry.get();
+    }
+    sqe->user_data = id;
+    return sqe;
+}
+
+void EventLoop::complete(const struct io_uring_cqe& cqe) {
+    // Entries queued with user_data 0 (cancels, slot releases) only
+    // report failures, which need no handling
+    auto it = operations.find(cqe.user_data);
+    if (it == operations.end()) {
+        return;
+    }
+    if (cqe.flags & IORING_CQE_F_MORE) {
+        // Multishot: the operation stays armed
+        Operation* operation = it->second.get();
+        operation->done(cqe);
+        return;
+    }
+    std::unique_ptr<Operation> operation = std::move(it->second);
+    operations.erase(it);
+    operation->done(cqe);
+}
+
+void EventLoop::set_file(struct io_uring_sqe* sqe, int fd) {
+    sqe->fd = fd;
+    if (ring->is_registered(fd)) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+}
+
+void EventLoop::arm_poll(int fd, uint32_t events) {
+    struct io_uring_sqe* sqe = queue_operation([this, fd](const struct io_uring_cqe& cqe) {
+        on_poll(fd, cqe.user_data, cqe);
+    });
+    if (!sqe) {
+        polls.erase(fd);
+        return;
+    }
+    // Edge-triggered like the epoll backend, since IORING_POLL_ADD_LEVEL is not set
+    sqe->opcode = IORING_OP_POLL_ADD;
+    set_file(sqe, fd);
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    polls[fd] = Poll{sqe->user_data, events};
+}
+
+void EventLoop::cancel_poll(int fd) {
+    auto poll = polls.find(fd);
+    if (poll == polls.end()) {
+        return;
+    }
+    // Events still in flight find the fd's poll replaced and are dropped
+    struct io_uring_sqe* sqe = ring->get_sqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->addr = poll->second.operation;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    }
+    polls.erase(poll);
+}
+
+void EventLoop::on_poll(int fd, uint64_t operation, const struct io_uring_cqe& cqe) {
+    auto poll = polls.find(fd);
+    if (poll == polls.end() || poll->second.operation != operation) {
+        return; // Removed or modified since
+    }
+    uint32_t events = cqe.res >= 0 ? static_cast<uint32_t>(cqe.res) : (EPOLLERR | EPOLLHUP);
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        // The kernel ended the poll (it may on overflow); an error ends it for good
+        uint32_t wanted = poll->second.events;
+        polls.erase(poll);
+        if (cqe.res >= 0) {
+            arm_poll(fd, wanted);
+        }
+    }
+
+    if (fd == wake_fd) {
+        drain_wake_fd();
+        return;
+    }
+    auto it = handlers.find(fd);
+    if (it == handlers.end() || events == 0) {
+        return;
+    }
+    Handler* handler = it->second.get();
+    handler->handle_event(fd, events);
+}
+
+void EventLoop::accept_multishot(int fd, std::function<void(int client)> on_accept) {
+    accepts[fd] = Accept{std::move(on_accept), 0, nullptr};
+    arm_accept(fd);
+}
+
+void EventLoop::arm_accept(int fd) {
+    struct io_uring_sqe* sqe = queue_operation([this, fd](const struct io_uring_cqe& cqe) {
+        on_accept_done(fd, cqe);
+    });
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    set_file(sqe, fd);
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    accepts[fd].operation = sqe->user_data;
+}
+
+void EventLoop::on_accept_done(int fd, const struct io_uring_cqe& cqe) {
+    auto it = accepts.find(fd);
+    if (it == accepts.end()) {
+        if (cqe.res >= 0) {
+            close(cqe.res);
+        }
+        return;
+    }
+    if (cqe.res >= 0) {
+        it->second.on_accept(cqe.res);
+        it = accepts.find(fd); // on_accept may have stopped the listener
+        if (it == accepts.end()) {
+            return;
+        }
+    } else if (cqe.res != -ECANCELED && cqe.res != -EAGAIN) {
+        LOG_ERROR("Failed to accept connection: " + std::string(strerror(-cqe.res)));
+    }
+    if (cqe.flags & IORING_CQE_F_MORE) {
+        return;
+    }
+
+    it->second.operation = 0;
+    if (it->second.stopped || cqe.res == -ECANCELED || !running) {
+        Task stopped = std::move(it->second.stopped);
+        accepts.erase(it);
+        if (stopped) {
+            stopped();
+        }
+        return;
+    }
+    if (cqe.res >= 0) {
+        arm_accept(fd);
+    } else {
+        schedule(ACCEPT_RETRY_DELAY, [this, fd]() {
+            if (accepts.count(fd)) {
+                arm_accept(fd);
+            }
+        });
+    }
+}
+
+void EventLoop::stop_accept(int fd, Task stopped) {
+    auto it = accepts.find(fd);
+    if (it == accepts.end()) {
+        remove(fd);
+        stopped();
+        return;
+    }
+    if (it->second.operation == 0) {
+        // Between a failed accept and its retry: nothing is in flight
+        accepts.erase(it);
+        stopped();
+        return;
+    }
+    it->second.stopped = std::move(stopped);
+    cancel_operation(it->second.operation);
+}
+
+void EventLoop::receive(int fd, size_t length, ReceiveDone done) {
+    IoRing* owner = ring.get();
+    struct io_uring_sqe* sqe = queue_operation([owner, done = std::move(done)](const struct io_uring_cqe& cqe) {
+        IoRing::Buffer buffer;
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            buffer = IoRing::Buffer(owner, static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        done(cqe.res, std::move(buffer), false);
+    });
+    if (!sqe) {
+        return;
+    }
+    // The kernel picks the buffer once data is there, so an idle
+    // connection waiting here holds none
+    sqe->opcode = IORING_OP_RECV;
+    set_file(sqe, fd);
+    sqe->len = static_cast<uint32_t>(std::min(length, IoRing::BUFFER_SIZE));
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IoRing::BUFFER_GROUP;
+}
+
+EventLoop::OperationId EventLoop::receive_multishot(int fd, ReceiveDone done) {
+    IoRing* owner = ring.get();
+    struct io_uring_sqe* sqe = queue_operation([owner, done = std::move(done)](const struct io_uring_cqe& cqe) {
+        IoRing::Buffer buffer;
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            buffer = IoRing::Buffer(owner, static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        done(cqe.res, std::move(buffer), (cqe.flags & IORING_CQE_F_MORE) != 0);
+    });
+    if (!sqe) {
+        return 0;
+    }
+    // Each arrival takes a whole provided buffer
+    sqe->opcode = IORING_OP_RECV;
+    set_file(sqe, fd);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IoRing::BUFFER_GROUP;
+    return sqe->user_data;
+}
+
+void EventLoop::receive_into(int fd, char* data, size_t length, Completion done) {
+    struct io_uring_sqe* sqe = queue_operation([done = std::move(done)](const struct io_uring_cqe& cqe) {
+        done(cqe.res);
+    });
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    set_file(sqe, fd);
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(length);
+}
+
+void EventLoop::send_message(int fd, const struct msghdr* message, Completion done) {
+    struct io_uring_sqe* sqe = queue_operation([done = std::move(done)](const struct io_uring_cqe& cqe) {
+        done(cqe.res);
+    });
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    set_file(sqe, fd);
+    sqe->addr = reinterpret_cast<uint64_t>(message);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void EventLoop::connect(int fd, const struct sockaddr* address, socklen_t length, Completion done) {
+    Operation* operation = nullptr;
+    struct io_uring_sqe* sqe = queue_operation([done = std::move(done)](const struct io_uring_cqe& cqe) {
+        done(cqe.res);
+    }, &operation);
+    if (!sqe) {
+        return;
+    }
+    std::memcpy(&operation->address, address, std::min<size_t>(length, sizeof(operation->address)));
+    sqe->opcode = IORING_OP_CONNECT;
+    set_file(sqe, fd);
+    sqe->addr = reinterpret_cast<uint64_t>(&operation->address);
+    sqe->off = length;
+}
+
+void EventLoop::splice(int in, int out, size_t length, uint32_t wait_for, Completion done) {
+    // io_uring hands splices to its worker threads; the poll in front keeps
+    // them from blocking there on an idle socket
+    struct io_uring_sqe* poll = ring->get_sqe(2);
+    if (poll) {
+        poll->opcode = IORING_OP_POLL_ADD;
+        set_file(poll, wait_for == EPOLLIN ? in : out);
+        poll->poll32_events = wait_for;
+        poll->flags |= IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    }
+    struct io_uring_sqe* sqe = queue_operation([done = std::move(done)](const struct io_uring_cqe& cqe) {
+        done(cqe.res);
+    });
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_SPLICE;
+    set_file(sqe, out);
+    sqe->splice_fd_in = in;
+    sqe->splice_flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    if (ring->is_registered(in)) {
+        sqe->splice_flags |= SPLICE_F_FD_IN_FIXED;
+    }
+    sqe->len = static_cast<uint32_t>(length);
+    // No offsets: both ends are streams
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->splice_off_in = static_cast<uint64_t>(-1);
+}
+
+void EventLoop::cancel_operation(OperationId id) {
+    struct io_uring_sqe* sqe = ring->get_sqe();
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = id;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    }
+}
+
+void EventLoop::stop() {
+    running = false;
+    wake();
+}
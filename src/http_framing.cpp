@@ -0,0 +1,248 @@
+#include "http_framing.h"
+#include "http_headers.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace {
+    const size_t MAX_LINE_SIZE = 8192;
+
+    std::string to_lower(std::string_view value) {
+        std::string lowered(value);
+        std::transform(lowered.begin(), lowered.end(), lowered.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        return lowered;
+    }
+
+    std::string trim(const std::string& str) {
+        size_t first = str.find_first_not_of(" \t\r\n");
+        if (first == std::string::npos) return "";
+        size_t last = str.find_last_not_of(" \t\r\n");
+        return str.substr(first, (last - first + 1));
+    }
+}
+
+ResponseFramer::ResponseFramer(bool head_request)
+    : head_request(head_request), state(State::HEADERS), parser(HttpParser::Kind::RESPONSE),
+      status(0), http_11(false),
+      connection_close(false), connection_keep_alive(false),
+      body_framing(BodyFraming::UNTIL_CLOSE), declared_length(0), remaining(0) {}
+
+ResponseFramer ResponseFramer::chunked_body() {
+    ResponseFramer framer;
+    framer.body_framing = BodyFraming::CHUNKED;
+    framer.state = State::CHUNK_SIZE;
+    return framer;
+}
+
+ResponseFramer ResponseFramer::fixed_body(uint64_t length) {
+    ResponseFramer framer;
+    framer.body_framing = BodyFraming::CONTENT_LENGTH;
+    framer.declared_length = length;
+    framer.remaining = length;
+    framer.state = length == 0 ? State::DONE : State::BODY;
+    return framer;
+}
+
+bool ResponseFramer::keep_alive() const {
+    return state == State::DONE && body_framing != BodyFraming::UNTIL_CLOSE &&
+           !connection_close && (http_11 || connection_keep_alive);
+}
+
+ResponseFramer::Result ResponseFramer::consume(const char* data, size_t length, size_t& used) {
+    used = 0;
+
+    while (used < length) {
+        switch (state) {
+            case State::HEADERS: {
+                size_t old_size = headers.size();
+                headers.append(data + used, length - used);
+
+                HttpParser::Result parsed = parser.parse(headers.data(), headers.size());
+                if (parsed == HttpParser::Result::NEED_MORE) {
+                    used = length;
+                    return Result::NEED_MORE;
+                }
+                if (parsed == HttpParser::Result::ERROR) {
+                    state = State::FAILED;
+                    return Result::ERROR;
+                }
+
+                // Keep only this message's header bytes; the rest is body
+                headers.resize(parser.head_length());
+                used += parser.head_length() - old_size;
+                if (!parse_headers()) {
+                    state = State::FAILED;
+                    return Result::ERROR;
+                }
+                break;
+            }
+
+            case State::BODY:
+            case State::CHUNK_DATA: {
+                uint64_t take = std::min<uint64_t>(remaining, length - used);
+                if (body_sink) {
+                    body_sink(data + used, take);
+                }
+                used += take;
+                remaining -= take;
+                if (remaining == 0) {
+                    state = (state == State::BODY) ? State::DONE : State::CHUNK_DATA_END;
+                }
+                break;
+            }
+
+            case State::CHUNK_SIZE:
+            case State::CHUNK_DATA_END:
+            case State::TRAILERS: {
+                const char* newline = static_cast<const char*>(
+                    std::memchr(data + used, '\n', length - used));
+                size_t take = newline ? (newline - (data + used)) + 1 : length - used;
+                line.append(data + used, take);
+                used += take;
+
+                if (line.size() > MAX_LINE_SIZE) {
+                    state = State::FAILED;
+                    return Result::ERROR;
+                }
+                if (newline && !on_line_complete()) {
+                    state = State::FAILED;
+                    return Result::ERROR;
+                }
+                break;
+            }
+
+            case State::UNTIL_CLOSE:
+                if (body_sink && status != 101) {
+                    body_sink(data + used, length - used);
+                }
+                used = length;
+                return Result::NEED_MORE;
+
+            case State::DONE:
+                return Result::COMPLETE;
+
+            case State::FAILED:
+                return Result::ERROR;
+        }
+    }
+
+    if (state == State::DONE) {
+        return Result::COMPLETE;
+    }
+    return state == State::FAILED ? Result::ERROR : Result::NEED_MORE;
+}
+
+ResponseFramer::Result ResponseFramer::finish_on_close() {
+    if (state == State::UNTIL_CLOSE || state == State::DONE) {
+        state = State::DONE;
+        return Result::COMPLETE;
+    }
+    // Truncated: the server closed before the declared end of the message
+    state = State::FAILED;
+    return Result::ERROR;
+}
+
+bool ResponseFramer::parse_headers() {
+    status = parser.status_code();
+    http_11 = parser.version() != "HTTP/1.0";
+
+    // Interim responses (100 Continue etc.) are followed by the real one
+    if (status >= 100 && status < 200 && status != 101) {
+        headers.clear();
+        parser.reset();
+        return true;
+    }
+
+    size_t lengths = 0;
+    bool has_codings = false;
+    std::string_view codings;
+    connection_close = false;
+    connection_keep_alive = false;
+
+    for (size_t i = 0; i < parser.header_count(); i++) {
+        HttpParser::Header header = parser.header(i);
+        HeaderId id = HttpHeaders::id_of(header.name);
+
+        if (id == HeaderId::CONTENT_LENGTH) {
+            lengths++;
+            if (!HttpHeaders::parse_content_length(header.value, declared_length)) {
+                return false;
+            }
+        } else if (id == HeaderId::TRANSFER_ENCODING) {
+            has_codings = true;
+            codings = header.value;
+        } else if (id == HeaderId::CONNECTION) {
+            std::string value = to_lower(header.value);
+            if (value.find("close") != std::string::npos) {
+                connection_close = true;
+            }
+            if (value.find("keep-alive") != std::string::npos) {
+                connection_keep_alive = true;
+            }
+        }
+    }
+    // The same rules as for request bodies: where this body ends must not be
+    // open to interpretation, or the connection cannot be reused or the
+    // response stored
+    if (lengths > 1 || (lengths == 1 && has_codings)) {
+        return false;
+    }
+    bool has_length = lengths == 1;
+    // A last coding other than chunked leaves the body to run until close
+    bool chunked = has_codings && HttpHeaders::ends_in_chunked(codings);
+
+    if (status == 101) {
+        body_framing = BodyFraming::UNTIL_CLOSE; // Protocol switch: raw bytes follow
+        state = State::UNTIL_CLOSE;
+    } else if (head_request || status == 204 || status == 304) {
+        body_framing = BodyFraming::NONE;
+        state = State::DONE;
+    } else if (chunked) {
+        body_framing = BodyFraming::CHUNKED;
+        state = State::CHUNK_SIZE;
+    } else if (has_codings) {
+        body_framing = BodyFraming::UNTIL_CLOSE;
+        state = State::UNTIL_CLOSE;
+    } else if (has_length) {
+        body_framing = BodyFraming::CONTENT_LENGTH;
+        remaining = declared_length;
+        state = remaining == 0 ? State::DONE : State::BODY;
+    } else {
+        body_framing = BodyFraming::UNTIL_CLOSE;
+        state = State::UNTIL_CLOSE;
+    }
+    return true;
+}
+
+bool ResponseFramer::on_line_complete() {
+    std::string current = trim(line);
+    line.clear();
+
+    switch (state) {
+        case State::CHUNK_SIZE: {
+            size_t extension = current.find(';');
+            std::string size_text = trim(current.substr(0, extension));
+            if (size_text.empty() || size_text.size() > 15 ||
+                size_text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+                return false;
+            }
+            remaining = std::stoull(size_text, nullptr, 16);
+            state = remaining == 0 ? State::TRAILERS : State::CHUNK_DATA;
+            return true;
+        }
+        case State::CHUNK_DATA_END:
+            if (!current.empty()) {
+                return false;
+            }
+            state = State::CHUNK_SIZE;
+            return true;
+        case State::TRAILERS:
+            if (current.empty()) {
+                state = State::DONE;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
@@ -1,133 +1,248 @@
 #include "http_handler.h"
 #include "logger.h"
-#include <sstream>
 #include <algorithm>
+#include <cctype>
+#include <stdexcept>
 
-std::string HttpHandler::trim(const std::string& str) {
-    size_t first = str.find_first_not_of(" \t\r\n");
-    if (first == std::string::npos) return "";
-    size_t last = str.find_last_not_of(" \t\r\n");
-    return str.substr(first, (last - first + 1));
+std::string HttpHandler::to_lower(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return str;
 }
 
-HttpRequest HttpHandler::parse_request(const std::string& raw_request) {
-    HttpRequest req;
-    std::istringstream iss(raw_request);
-    std::string line;
-    
-    // Parse request line
-    if (std::getline(iss, line)) {
-        std::istringstream line_stream(line);
-        line_stream >> req.method >> req.path >> req.version;
+void HttpHandler::copy_headers(const HttpParser& parser, HttpHeaders& headers) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < parser.header_count(); i++) {
+        HttpParser::Header header = parser.header(i);
+        bytes += header.name.size() + header.value.size();
     }
-    
-    // Parse headers
-    while (std::getline(iss, line) && line != "\r") {
-        if (line.empty() || line == "\r") break;
-        
-        size_t colon = line.find(':');
-        if (colon != std::string::npos) {
-            std::string key = trim(line.substr(0, colon));
-            std::string value = trim(line.substr(colon + 1));
-            req.headers[key] = value;
-        }
+    headers.reserve(parser.header_count(), bytes);
+    for (size_t i = 0; i < parser.header_count(); i++) {
+        HttpParser::Header header = parser.header(i);
+        headers.add(header.name, header.value);
     }
-    
-    // Parse body
-    std::string body_content;
-    while (std::getline(iss, body_content)) {
-        req.body += body_content + "\n";
+}
+
+size_t HttpHandler::serialized_size(const HttpHeaders& headers) {
+    size_t size = 2; // Blank line
+    for (const auto& [name, value] : headers) {
+        size += name.size() + value.size() + 4;
     }
-    
+    return size;
+}
+
+void HttpHandler::append_headers(const HttpHeaders& headers, std::string& out) {
+    for (const auto& [name, value] : headers) {
+        out.append(name).append(": ").append(value).append("\r\n");
+    }
+    out.append("\r\n");
+}
+
+HttpRequest HttpHandler::build_request(const HttpParser& parser) {
+    HttpRequest req;
+    build_request(parser, req);
     return req;
 }
 
-std::string HttpHandler::serialize_request(const HttpRequest& request) {
-    std::ostringstream oss;
-    oss << request.method << " " << request.path << " " << request.version << "\r\n";
-    
-    for (const auto& [key, value] : request.headers) {
-        oss << key << ": " << value << "\r\n";
+void HttpHandler::build_request(const HttpParser& parser, HttpRequest& request) {
+    request.method.assign(parser.method());
+    request.path.assign(parser.target());
+    request.version.assign(parser.version());
+    request.headers.clear();
+    copy_headers(parser, request.headers);
+    request.body.clear();
+}
+
+void HttpHandler::recycle(HttpRequest& request) {
+    request.method.clear();
+    request.path.clear();
+    request.version.clear();
+    if (request.headers.capacity() > RECYCLE_LIMIT_BYTES) {
+        request.headers.release();
+    } else {
+        request.headers.clear();
     }
-    
-    oss << "\r\n";
-    if (!request.body.empty()) {
-        oss << request.body;
+    recycle(request.body);
+}
+
+void HttpHandler::recycle(std::string& buffer) {
+    if (buffer.capacity() > RECYCLE_LIMIT_BYTES) {
+        std::string().swap(buffer);
+    } else {
+        buffer.clear();
     }
+}
+
+HttpRequest HttpHandler::parse_request(const std::string& raw_request) {
+    HttpParser parser(HttpParser::Kind::REQUEST);
+    HttpParser::Result result = parser.parse(raw_request.data(), raw_request.size());
     
-    return oss.str();
+    // An unfinished head still yields whatever lines were complete
+    HttpRequest req = build_request(parser);
+    if (result == HttpParser::Result::COMPLETE) {
+        req.body = raw_request.substr(parser.head_length());
+    }
+    return req;
 }
 
-HttpResponse HttpHandler::parse_response(const std::string& raw_response) {
+std::string HttpHandler::serialize_request(const HttpRequest& request) {
+    std::string out;
+    serialize_request(request, out);
+    return out;
+}
+
+void HttpHandler::serialize_request(const HttpRequest& request, std::string& out) {
+    out.clear();
+    out.reserve(request.method.size() + request.path.size() + request.version.size() + 8 +
+                serialized_size(request.headers) + request.body.size());
+    out.append(request.method).append(1, ' ').append(request.path).append(1, ' ');
+    out.append(request.version).append("\r\n");
+    append_headers(request.headers, out);
+    out.append(request.body);
+}
+
+HttpResponse HttpHandler::build_response(const HttpParser& parser) {
     HttpResponse resp;
-    std::istringstream iss(raw_response);
-    std::string line;
+    resp.version = std::string(parser.version());
+    resp.status_code = parser.status_code();
+    resp.status_message = std::string(parser.reason());
+    copy_headers(parser, resp.headers);
+    return resp;
+}
+
+HttpResponse HttpHandler::parse_response(const std::string& raw_response) {
+    HttpParser parser(HttpParser::Kind::RESPONSE);
+    HttpParser::Result result = parser.parse(raw_response.data(), raw_response.size());
     
-    // Parse status line
-    if (std::getline(iss, line)) {
-        std::istringstream line_stream(line);
-        line_stream >> resp.version >> resp.status_code >> resp.status_message;
+    HttpResponse resp = build_response(parser);
+    if (result == HttpParser::Result::COMPLETE) {
+        resp.body = raw_response.substr(parser.head_length());
     }
-    
-    // Parse headers
-    while (std::getline(iss, line) && line != "\r") {
-        if (line.empty() || line == "\r") break;
-        
-        size_t colon = line.find(':');
-        if (colon != std::string::npos) {
-            std::string key = trim(line.substr(0, colon));
-            std::string value = trim(line.substr(colon + 1));
-            resp.headers[key] = value;
+    return resp;
+}
+
+std::string HttpHandler::serialize_response(const HttpResponse& response) {
+    std::string status = std::to_string(response.status_code);
+    std::string out;
+    out.reserve(response.version.size() + status.size() + response.status_message.size() + 8 +
+                serialized_size(response.headers) + response.body.size());
+    out.append(response.version).append(1, ' ').append(status).append(1, ' ');
+    out.append(response.status_message).append("\r\n");
+    append_headers(response.headers, out);
+    out.append(response.body);
+    return out;
+}
+
+void HttpHandler::prepare_upstream_request(HttpRequest& request, bool keep_alive) {
+    request.headers.erase(HeaderId::PROXY_CONNECTION);
+    request.headers.erase(HeaderId::KEEP_ALIVE);
+    request.headers.set(HeaderId::CONNECTION, keep_alive ? "keep-alive" : "close");
+}
+
+bool HttpHandler::request_body_framing(const HttpRequest& request, uint64_t& length, bool& chunked) {
+    length = 0;
+    chunked = false;
+    size_t lengths = 0;
+    std::string_view codings;
+    for (const auto& [name, value] : request.headers) {
+        HeaderId id = HttpHeaders::id_of(name);
+        if (id == HeaderId::CONTENT_LENGTH) {
+            lengths++;
+            if (!HttpHeaders::parse_content_length(value, length)) {
+                return false;
+            }
+        } else if (id == HeaderId::TRANSFER_ENCODING) {
+            codings = value;
         }
     }
-    
-    // Parse body
-    std::string body_content;
-    while (std::getline(iss, body_content)) {
-        resp.body += body_content + "\n";
+    if (request.headers.has(HeaderId::TRANSFER_ENCODING)) {
+        // The last field's last coding decides where the body ends
+        chunked = HttpHeaders::ends_in_chunked(codings);
+        return chunked && lengths == 0;
     }
-    
-    return resp;
+    return lengths <= 1;
 }
 
-std::string HttpHandler::serialize_response(const HttpResponse& response) {
-    std::ostringstream oss;
-    oss << response.version << " " << response.status_code << " "
-        << response.status_message << "\r\n";
-    
-    for (const auto& [key, value] : response.headers) {
-        oss << key << ": " << value << "\r\n";
+bool HttpHandler::is_idempotent(const std::string& method) {
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "TRACE" ||
+           method == "PUT" || method == "DELETE";
+}
+
+bool HttpHandler::client_wants_keep_alive(const HttpRequest& request) {
+    for (HeaderId id : {HeaderId::CONNECTION, HeaderId::PROXY_CONNECTION}) {
+        if (!request.headers.has(id)) {
+            continue;
+        }
+        std::string value = to_lower(std::string(request.headers.get(id)));
+        if (value.find("close") != std::string::npos) {
+            return false;
+        }
+        if (value.find("keep-alive") != std::string::npos) {
+            return true;
+        }
     }
-    
-    oss << "\r\n";
-    if (!response.body.empty()) {
-        oss << response.body;
+    return request.version == "HTTP/1.1";
+}
+
+bool HttpHandler::prepare_client_response(HttpResponse& response, bool keep_alive) {
+    if (keep_alive) {
+        keep_alive = !response.headers.has(HeaderId::TRANSFER_ENCODING) &&
+                     response.headers.has(HeaderId::CONTENT_LENGTH) &&
+                     response.headers.get(HeaderId::CONTENT_LENGTH) == std::to_string(response.body.size());
     }
-    
-    return oss.str();
+    response.headers.erase(HeaderId::KEEP_ALIVE);
+    response.headers.set(HeaderId::CONNECTION, keep_alive ? "keep-alive" : "close");
+    return keep_alive;
 }
 
-std::string HttpHandler::extract_host(const HttpRequest& request) {
-    auto it = request.headers.find("Host");
-    if (it != request.headers.end()) {
-        std::string host = it->second;
-        size_t colon = host.find(':');
-        if (colon != std::string::npos) {
-            return host.substr(0, colon);
+bool HttpHandler::split_authority(const std::string& authority, int default_port, std::string& host, int& port) {
+    size_t host_end;
+    size_t colon;
+    if (!authority.empty() && authority[0] == '[') {
+        host_end = authority.find(']');
+        if (host_end == std::string::npos) {
+            return false;
         }
+        host = authority.substr(1, host_end - 1);
+        colon = host_end + 1 < authority.size() ? host_end + 1 : std::string::npos;
+        if (colon != std::string::npos && authority[colon] != ':') {
+            return false;
+        }
+    } else {
+        colon = authority.find(':');
+        host = authority.substr(0, colon);
+    }
+
+    port = default_port;
+    if (colon == std::string::npos) {
+        return true;
+    }
+    std::string digits = authority.substr(colon + 1);
+    if (digits.empty() || digits.size() > 5 ||
+        !std::all_of(digits.begin(), digits.end(), [](unsigned char c) { return std::isdigit(c); })) {
+        return false;
+    }
+    port = std::stoi(digits);
+    return port > 0 && port <= 65535;
+}
+
+std::string HttpHandler::extract_host(const HttpRequest& request) {
+    if (request.headers.has(HeaderId::HOST)) {
+        std::string host;
+        int port;
+        split_authority(std::string(request.headers.get(HeaderId::HOST)), 80, host, port);
         return host;
     }
     return "localhost";
 }
 
 int HttpHandler::extract_port(const HttpRequest& request) {
-    auto it = request.headers.find("Host");
-    if (it != request.headers.end()) {
-        std::string host = it->second;
-        size_t colon = host.find(':');
-        if (colon != std::string::npos) {
-            return std::stoi(host.substr(colon + 1));
+    int port = 80; // Default HTTP port
+    if (request.headers.has(HeaderId::HOST)) {
+        std::string host;
+        if (!split_authority(std::string(request.headers.get(HeaderId::HOST)), 80, host, port)) {
+            throw std::invalid_argument("Invalid port in Host header");
         }
     }
-    return 80; // Default HTTP port
+    return port;
 }
@@ -0,0 +1,305 @@
+#include "http_headers.h"
+#include <cstring>
+#include <functional>
+#include <strings.h>
+
+namespace {
+    // Indexed by HeaderId
+    const std::string_view NAMES[HttpHeaders::WELL_KNOWN_COUNT] = {
+        "Host",
+        "Content-Length",
+        "Transfer-Encoding",
+        "Trailer",
+        "Connection",
+        "Proxy-Connection",
+        "Keep-Alive",
+        "Upgrade",
+        "TE",
+        "Cache-Control",
+        "Pragma",
+        "Expires",
+        "Age",
+        "Date",
+        "ETag",
+        "Last-Modified",
+        "If-None-Match",
+        "If-Modified-Since",
+        "If-Match",
+        "If-Unmodified-Since",
+        "If-Range",
+        "Range",
+        "Vary",
+        "Content-Type",
+        "Content-Encoding",
+        "Accept-Encoding",
+    };
+
+    // Storage is rewritten once this much of it, and at least half, is unused
+    const size_t COMPACT_THRESHOLD = 1024;
+
+    bool equals_ignore_case(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+    }
+}
+
+HttpHeaders::HttpHeaders() : slots(), garbage(0) {}
+
+HeaderId HttpHeaders::id_of(std::string_view name) {
+    // The length and first letter leave at most one candidate (two for
+    // length 8), so a name is compared once rather than against every entry
+    if (name.empty()) {
+        return HeaderId::OTHER;
+    }
+    char first = static_cast<char>(name[0] | 0x20);
+    HeaderId candidate = HeaderId::OTHER;
+    switch (name.size()) {
+        case 2:
+            candidate = HeaderId::TE;
+            break;
+        case 3:
+            candidate = HeaderId::AGE;
+            break;
+        case 4:
+            candidate = first == 'h' ? HeaderId::HOST
+                      : first == 'd' ? HeaderId::DATE
+                      : first == 'e' ? HeaderId::ETAG
+                      : first == 'v' ? HeaderId::VARY
+                                     : HeaderId::OTHER;
+            break;
+        case 5:
+            candidate = HeaderId::RANGE;
+            break;
+        case 6:
+            candidate = HeaderId::PRAGMA;
+            break;
+        case 7:
+            candidate = first == 't' ? HeaderId::TRAILER
+                      : first == 'u' ? HeaderId::UPGRADE
+                      : first == 'e' ? HeaderId::EXPIRES
+                                     : HeaderId::OTHER;
+            break;
+        case 8:
+            // If-Match, If-Range
+            candidate = (name[3] | 0x20) == 'm' ? HeaderId::IF_MATCH : HeaderId::IF_RANGE;
+            break;
+        case 10:
+            candidate = first == 'c' ? HeaderId::CONNECTION : first == 'k' ? HeaderId::KEEP_ALIVE : HeaderId::OTHER;
+            break;
+        case 12:
+            candidate = HeaderId::CONTENT_TYPE;
+            break;
+        case 13:
+            candidate = first == 'c' ? HeaderId::CACHE_CONTROL
+                      : first == 'l' ? HeaderId::LAST_MODIFIED
+                      : first == 'i' ? HeaderId::IF_NONE_MATCH
+                                     : HeaderId::OTHER;
+            break;
+        case 14:
+            candidate = HeaderId::CONTENT_LENGTH;
+            break;
+        case 15:
+            candidate = HeaderId::ACCEPT_ENCODING;
+            break;
+        case 16:
+            candidate = first == 'p' ? HeaderId::PROXY_CONNECTION
+                      : first == 'c' ? HeaderId::CONTENT_ENCODING
+                                     : HeaderId::OTHER;
+            break;
+        case 17:
+            candidate = first == 't' ? HeaderId::TRANSFER_ENCODING
+                      : first == 'i' ? HeaderId::IF_MODIFIED_SINCE
+                                     : HeaderId::OTHER;
+            break;
+        case 19:
+            candidate = HeaderId::IF_UNMODIFIED_SINCE;
+            break;
+        default:
+            break;
+    }
+    if (candidate == HeaderId::OTHER || !equals_ignore_case(name, NAMES[static_cast<size_t>(candidate)])) {
+        return HeaderId::OTHER;
+    }
+    return candidate;
+}
+
+std::string_view HttpHeaders::name_of(HeaderId id) {
+    return id == HeaderId::OTHER ? std::string_view() : NAMES[static_cast<size_t>(id)];
+}
+
+bool HttpHeaders::parse_content_length(std::string_view value, uint64_t& length) {
+    if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string_view::npos) {
+        return false;
+    }
+    length = 0;
+    for (char digit : value) {
+        length = length * 10 + static_cast<uint64_t>(digit - '0');
+    }
+    return true;
+}
+
+bool HttpHeaders::ends_in_chunked(std::string_view codings) {
+    size_t comma = codings.rfind(',');
+    std::string_view last = codings.substr(comma == std::string_view::npos ? 0 : comma + 1);
+    size_t first = last.find_first_not_of(" \t");
+    if (first == std::string_view::npos) {
+        return false;
+    }
+    size_t end = last.find_last_not_of(" \t");
+    return equals_ignore_case(last.substr(first, end - first + 1), "chunked");
+}
+
+void HttpHeaders::reserve(size_t field_count, size_t bytes) {
+    fields.reserve(field_count);
+    storage.reserve(bytes);
+}
+
+HttpHeaders::Field HttpHeaders::field(size_t index) const {
+    const Entry& entry = fields[index];
+    return Field{name_at(entry), value_at(entry)};
+}
+
+size_t HttpHeaders::find(HeaderId id, std::string_view name) const {
+    if (id != HeaderId::OTHER) {
+        uint16_t slot = slots[static_cast<size_t>(id)];
+        return slot ? slot - 1 : fields.size();
+    }
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i].id == HeaderId::OTHER && equals_ignore_case(name_at(fields[i]), name)) {
+            return i;
+        }
+    }
+    return fields.size();
+}
+
+std::string_view HttpHeaders::get(HeaderId id) const {
+    size_t index = find(id, name_of(id));
+    return index < fields.size() ? value_at(fields[index]) : std::string_view();
+}
+
+std::string_view HttpHeaders::get(std::string_view name) const {
+    size_t index = find(id_of(name), name);
+    return index < fields.size() ? value_at(fields[index]) : std::string_view();
+}
+
+bool HttpHeaders::has(std::string_view name) const {
+    return find(id_of(name), name) < fields.size();
+}
+
+void HttpHeaders::add(std::string_view name, std::string_view value) {
+    append(id_of(name), name, value);
+}
+
+void HttpHeaders::set(HeaderId id, std::string_view value) {
+    std::string_view name = name_of(id);
+    remove(id, name);
+    append(id, name, value);
+}
+
+void HttpHeaders::set(std::string_view name, std::string_view value) {
+    HeaderId id = id_of(name);
+    remove(id, name);
+    append(id, name, value);
+}
+
+size_t HttpHeaders::erase(HeaderId id) {
+    return remove(id, name_of(id));
+}
+
+size_t HttpHeaders::erase(std::string_view name) {
+    return remove(id_of(name), name);
+}
+
+void HttpHeaders::clear() {
+    storage.clear();
+    fields.clear();
+    std::memset(slots, 0, sizeof(slots));
+    garbage = 0;
+}
+
+void HttpHeaders::release() {
+    clear();
+    std::string().swap(storage);
+    std::vector<Entry>().swap(fields);
+}
+
+void HttpHeaders::append(HeaderId id, std::string_view name, std::string_view value) {
+    // The name or value may be a view of this object's storage, which
+    // compaction or growth below would move
+    std::less<const char*> before;
+    const char* begin = storage.data();
+    const char* end = begin + storage.size();
+    auto inside = [&](std::string_view text) {
+        return !text.empty() && !before(text.data(), begin) && before(text.data(), end);
+    };
+    std::string copy;
+    if (inside(name) || inside(value)) {
+        copy.reserve(name.size() + value.size());
+        copy.append(name).append(value);
+        name = std::string_view(copy.data(), name.size());
+        value = std::string_view(copy.data() + name.size(), value.size());
+    }
+    if (garbage >= COMPACT_THRESHOLD && garbage * 2 >= storage.size()) {
+        compact();
+    }
+
+    Entry entry;
+    entry.id = id;
+    entry.name_offset = static_cast<uint32_t>(storage.size());
+    entry.name_length = static_cast<uint32_t>(name.size());
+    storage.append(name);
+    entry.value_offset = static_cast<uint32_t>(storage.size());
+    entry.value_length = static_cast<uint32_t>(value.size());
+    storage.append(value);
+    fields.push_back(entry);
+
+    if (id != HeaderId::OTHER && slots[static_cast<size_t>(id)] == 0) {
+        slots[static_cast<size_t>(id)] = static_cast<uint16_t>(fields.size());
+    }
+}
+
+size_t HttpHeaders::remove(HeaderId id, std::string_view name) {
+    if (id != HeaderId::OTHER && !has(id)) {
+        return 0;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < fields.size(); i++) {
+        const Entry& entry = fields[i];
+        bool match = id != HeaderId::OTHER ? entry.id == id
+                                           : entry.id == HeaderId::OTHER && equals_ignore_case(name_at(entry), name);
+        if (match) {
+            garbage += entry.name_length + entry.value_length;
+        } else {
+            fields[kept++] = entry;
+        }
+    }
+    size_t removed = fields.size() - kept;
+    if (removed > 0) {
+        fields.resize(kept);
+        rebuild_slots();
+    }
+    return removed;
+}
+
+void HttpHeaders::rebuild_slots() {
+    std::memset(slots, 0, sizeof(slots));
+    for (size_t i = fields.size(); i-- > 0;) {
+        if (fields[i].id != HeaderId::OTHER) {
+            slots[static_cast<size_t>(fields[i].id)] = static_cast<uint16_t>(i + 1);
+        }
+    }
+}
+
+void HttpHeaders::compact() {
+    std::string packed;
+    packed.reserve(storage.size() - garbage);
+    for (Entry& entry : fields) {
+        std::string_view name = name_at(entry);
+        std::string_view value = value_at(entry);
+        entry.name_offset = static_cast<uint32_t>(packed.size());
+        packed.append(name);
+        entry.value_offset = static_cast<uint32_t>(packed.size());
+        packed.append(value);
+    }
+    storage.swap(packed);
+    garbage = 0;
+}
@@ -0,0 +1,259 @@
+#include "http_parser.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_PARSER_X86 1
+#endif
+
+namespace {
+
+// Each scanner returns the first occurrence of 'c' in [p, end), or nullptr
+
+const char* find_byte_scalar(const char* p, const char* end, char c) {
+    for (; p < end; p++) {
+        if (*p == c) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+#ifdef HTTP_PARSER_X86
+
+__attribute__((target("sse2")))
+const char* find_byte_sse2(const char* p, const char* end, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; end - p >= 16; p += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_byte_scalar(p, end, c);
+}
+
+__attribute__((target("avx2")))
+const char* find_byte_avx2(const char* p, const char* end, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; end - p >= 32; p += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return find_byte_sse2(p, end, c);
+}
+
+#endif
+
+using FindByte = const char* (*)(const char*, const char*, char);
+
+struct Scanner {
+    FindByte find;
+    const char* name;
+};
+
+Scanner select_scanner() {
+#ifdef HTTP_PARSER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {find_byte_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {find_byte_sse2, "sse2"};
+    }
+#endif
+    return {find_byte_scalar, "scalar"};
+}
+
+const Scanner& scanner() {
+    static const Scanner selected = select_scanner();
+    return selected;
+}
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (lower(a[i]) != lower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+HttpParser::HttpParser(Kind kind) : kind(kind) {
+    reset();
+}
+
+void HttpParser::reset() {
+    base = nullptr;
+    state = Result::NEED_MORE;
+    too_large = false;
+    scanned = 0;
+    line_start = 0;
+    start_line_done = false;
+    head_end = 0;
+    first = second = third = Span{0, 0};
+    status = 0;
+    headers.clear();
+}
+
+const char* HttpParser::scan_implementation() {
+    return scanner().name;
+}
+
+HttpParser::Result HttpParser::fail(bool oversized) {
+    too_large = oversized;
+    state = Result::ERROR;
+    return state;
+}
+
+HttpParser::Result HttpParser::parse(const char* data, size_t length) {
+    base = data;
+    if (state != Result::NEED_MORE) {
+        return state;
+    }
+
+    FindByte find = scanner().find;
+    while (scanned < length) {
+        size_t limit = std::min(length, MAX_HEAD_SIZE);
+        const char* newline = find(data + scanned, data + limit, '\n');
+        if (!newline) {
+            scanned = length;
+            return length >= MAX_HEAD_SIZE ? fail(true) : Result::NEED_MORE;
+        }
+
+        scanned = (newline - data) + 1;
+        size_t line_end = newline - data;
+        if (line_end > line_start && data[line_end - 1] == '\r') {
+            line_end--; // Bare LF line endings are tolerated
+        }
+
+        if (!start_line_done) {
+            // Stray CRLFs before a request (e.g. after a body) are skipped
+            if (line_end != line_start) {
+                if (!parse_start_line(line_start, line_end)) {
+                    return fail();
+                }
+                start_line_done = true;
+            }
+        } else if (line_end == line_start) {
+            head_end = scanned;
+            state = Result::COMPLETE;
+            return state;
+        } else if (!parse_header_line(line_start, line_end)) {
+            return fail(headers.size() >= MAX_HEADERS);
+        }
+        line_start = scanned;
+    }
+    return Result::NEED_MORE;
+}
+
+bool HttpParser::parse_start_line(size_t begin, size_t end) {
+    const char* line = base + begin;
+    size_t length = end - begin;
+
+    const char* space1 = static_cast<const char*>(std::memchr(line, ' ', length));
+    if (!space1 || space1 == line) {
+        return false;
+    }
+    size_t first_length = space1 - line;
+    const char* rest = space1 + 1;
+    size_t rest_length = length - first_length - 1;
+    const char* space2 = static_cast<const char*>(std::memchr(rest, ' ', rest_length));
+    size_t second_length = space2 ? static_cast<size_t>(space2 - rest) : rest_length;
+
+    first = {static_cast<uint32_t>(begin), static_cast<uint32_t>(first_length)};
+    second = {static_cast<uint32_t>(begin + first_length + 1), static_cast<uint32_t>(second_length)};
+    if (space2) {
+        size_t third_offset = (space2 + 1) - base;
+        third = {static_cast<uint32_t>(third_offset), static_cast<uint32_t>(end - third_offset)};
+    }
+
+    if (kind == Kind::REQUEST) {
+        // method SP request-target SP HTTP-version
+        return second_length > 0 && space2 && view(third).substr(0, 5) == "HTTP/";
+    }
+
+    // HTTP-version SP status-code [SP reason-phrase]
+    if (view(first).substr(0, 5) != "HTTP/" || second_length != 3) {
+        return false;
+    }
+    status = 0;
+    for (size_t i = 0; i < 3; i++) {
+        char digit = rest[i];
+        if (digit < '0' || digit > '9') {
+            return false;
+        }
+        status = status * 10 + (digit - '0');
+    }
+    return true;
+}
+
+bool HttpParser::parse_header_line(size_t begin, size_t end) {
+    if (headers.size() >= MAX_HEADERS) {
+        return false;
+    }
+    // Obsolete line folding is rejected rather than guessed at
+    if (is_space(base[begin])) {
+        return false;
+    }
+
+    const char* colon = scanner().find(base + begin, base + end, ':');
+    if (!colon || colon == base + begin || is_space(colon[-1])) {
+        return false;
+    }
+
+    size_t name_end = colon - base;
+    size_t value_begin = name_end + 1;
+    size_t value_end = end;
+    while (value_begin < value_end && is_space(base[value_begin])) {
+        value_begin++;
+    }
+    while (value_end > value_begin && is_space(base[value_end - 1])) {
+        value_end--;
+    }
+
+    headers.push_back({{static_cast<uint32_t>(begin), static_cast<uint32_t>(name_end - begin)},
+                       {static_cast<uint32_t>(value_begin), static_cast<uint32_t>(value_end - value_begin)}});
+    return true;
+}
+
+HttpParser::Header HttpParser::header(size_t index) const {
+    const HeaderSpan& span = headers[index];
+    return {view(span.name), view(span.value)};
+}
+
+std::string_view HttpParser::find_header(std::string_view name) const {
+    for (const HeaderSpan& span : headers) {
+        if (equals_ignore_case(view(span.name), name)) {
+            return view(span.value);
+        }
+    }
+    return std::string_view();
+}
+
+bool HttpParser::has_header(std::string_view name) const {
+    for (const HeaderSpan& span : headers) {
+        if (equals_ignore_case(view(span.name), name)) {
+            return true;
+        }
+    }
+    return false;
+}
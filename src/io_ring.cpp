@@ -0,0 +1,353 @@
+#include "io_ring.h"
+#include "logger.h"
+#include "metrics.h"
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+    // Registered file slots; fds above this are used unregistered
+    const size_t MAX_FILE_SLOTS = 65536;
+    // Released slots point at no file
+    const int NO_FILE = -1;
+
+    const uint8_t REQUIRED_OPS[] = {
+        IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL, IORING_OP_FILES_UPDATE,
+        IORING_OP_ACCEPT,   IORING_OP_CONNECT,     IORING_OP_RECV,         IORING_OP_SENDMSG,
+        IORING_OP_SPLICE,
+    };
+
+    int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_register(int ring_fd, unsigned opcode, const void* arg, unsigned count) {
+        return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, count));
+    }
+
+    template <typename T>
+    T* at_offset(void* base, uint32_t offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+    }
+
+    void* map_anonymous(size_t size) {
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+}
+
+IoRing::Buffer& IoRing::Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        ring = other.ring;
+        id = other.id;
+        other.ring = nullptr;
+    }
+    return *this;
+}
+
+void IoRing::Buffer::release() {
+    if (ring) {
+        ring->recycle_buffer(id);
+        ring = nullptr;
+    }
+}
+
+IoRing::IoRing(unsigned entries)
+    : ring_fd(-1), sq_map(nullptr), sq_map_size(0), cq_map(nullptr), cq_map_size(0), sqes(nullptr),
+      sqes_size(0), sq_head(nullptr), sq_tail(nullptr), sq_mask(0), sq_entries(0), sqe_tail(0),
+      cq_head(nullptr), cq_tail(nullptr), cq_mask(0), cqes(nullptr), buffer_ring(nullptr),
+      buffer_ring_size(0), buffers(nullptr), buffer_tail(0) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    // Room for a burst of completions beyond one full submission queue. A
+    // failed entry must not hold back the rest of the batch, and the single
+    // thread that reaps completions needs no interrupt to run task work.
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    ring_fd = io_uring_setup(entries, &params);
+    if (ring_fd < 0 && errno == EINVAL) {
+        // Older kernels reject the scheduling hints; they are optional
+        std::memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        ring_fd = io_uring_setup(entries, &params);
+    }
+    if (ring_fd < 0) {
+        LOG_DEBUG("io_uring_setup failed: " + std::string(strerror(errno)));
+        return;
+    }
+
+    // Waiting with a timeout and never losing a completion are relied on
+    const uint32_t required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required_features) != required_features) {
+        LOG_DEBUG("io_uring lacks required features");
+        close_ring();
+        return;
+    }
+    if (!map_queues(params) || !register_file_table() || !register_buffer_ring()) {
+        close_ring();
+    }
+}
+
+IoRing::~IoRing() {
+    close_ring();
+}
+
+void IoRing::close_ring() {
+    // Closing the ring cancels whatever is still in flight
+    if (ring_fd >= 0) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (sqes) {
+        munmap(sqes, sqes_size);
+        sqes = nullptr;
+    }
+    if (cq_map && cq_map != sq_map) {
+        munmap(cq_map, cq_map_size);
+    }
+    cq_map = nullptr;
+    if (sq_map) {
+        munmap(sq_map, sq_map_size);
+        sq_map = nullptr;
+    }
+    if (buffer_ring) {
+        munmap(buffer_ring, buffer_ring_size);
+        buffer_ring = nullptr;
+    }
+    if (buffers) {
+        munmap(buffers, BUFFER_COUNT * BUFFER_SIZE);
+        buffers = nullptr;
+    }
+    registered.clear();
+}
+
+bool IoRing::map_queues(const struct io_uring_params& params) {
+    // One mapping covers both rings (IORING_FEAT_SINGLE_MMAP)
+    sq_map_size = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                   params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                  IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+        sq_map = nullptr;
+        LOG_ERROR("Failed to map io_uring queues: " + std::string(strerror(errno)));
+        return false;
+    }
+    cq_map = sq_map;
+    cq_map_size = sq_map_size;
+
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqe_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_SQES);
+    if (sqe_map == MAP_FAILED) {
+        LOG_ERROR("Failed to map io_uring submission entries: " + std::string(strerror(errno)));
+        return false;
+    }
+    sqes = static_cast<struct io_uring_sqe*>(sqe_map);
+
+    sq_head = at_offset<unsigned>(sq_map, params.sq_off.head);
+    sq_tail = at_offset<unsigned>(sq_map, params.sq_off.tail);
+    sq_mask = *at_offset<unsigned>(sq_map, params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    sqe_tail = *sq_tail;
+    // Entry i of the queue is always submission entry i
+    unsigned* sq_array = at_offset<unsigned>(sq_map, params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; i++) {
+        sq_array[i] = i;
+    }
+
+    cq_head = at_offset<unsigned>(cq_map, params.cq_off.head);
+    cq_tail = at_offset<unsigned>(cq_map, params.cq_off.tail);
+    cq_mask = *at_offset<unsigned>(cq_map, params.cq_off.ring_mask);
+    cqes = at_offset<struct io_uring_cqe>(cq_map, params.cq_off.cqes);
+    return true;
+}
+
+bool IoRing::register_file_table() {
+    // The kernel caps the table at the open file limit
+    struct rlimit limit;
+    size_t slots = MAX_FILE_SLOTS;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < slots) {
+        slots = limit.rlim_cur;
+    }
+
+    struct io_uring_rsrc_register table;
+    std::memset(&table, 0, sizeof(table));
+    table.nr = static_cast<uint32_t>(slots);
+    table.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (io_uring_register(ring_fd, IORING_REGISTER_FILES2, &table, sizeof(table)) < 0) {
+        LOG_DEBUG("Failed to register io_uring file table: " + std::string(strerror(errno)));
+        return false;
+    }
+    registered.assign(slots, false);
+    return true;
+}
+
+bool IoRing::register_buffer_ring() {
+    buffer_ring_size = BUFFER_COUNT * sizeof(struct io_uring_buf);
+    buffer_ring = static_cast<struct io_uring_buf_ring*>(map_anonymous(buffer_ring_size));
+    buffers = static_cast<char*>(map_anonymous(BUFFER_COUNT * BUFFER_SIZE));
+    if (!buffer_ring || !buffers) {
+        LOG_ERROR("Failed to allocate io_uring buffers");
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        LOG_DEBUG("Failed to register io_uring buffer ring: " + std::string(strerror(errno)));
+        return false;
+    }
+    for (unsigned id = 0; id < BUFFER_COUNT; id++) {
+        add_buffer(static_cast<uint16_t>(id));
+    }
+    __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool IoRing::is_supported() {
+    IoRing ring(8);
+    if (!ring.is_valid()) {
+        return false;
+    }
+    const size_t op_count = 256;
+    std::vector<char> memory(sizeof(struct io_uring_probe) + op_count * sizeof(struct io_uring_probe_op));
+    auto* probe = reinterpret_cast<struct io_uring_probe*>(memory.data());
+    if (io_uring_register(ring.ring_fd, IORING_REGISTER_PROBE, probe, op_count) < 0) {
+        return false;
+    }
+    for (uint8_t op : REQUIRED_OPS) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            LOG_DEBUG("io_uring lacks operation " + std::to_string(op));
+            return false;
+        }
+    }
+    return true;
+}
+
+struct io_uring_sqe* IoRing::get_sqe(unsigned count) {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sqe_tail - head + count > sq_entries) {
+        if (submit() < 0) {
+            return nullptr;
+        }
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sqe_tail - head + count > sq_entries) {
+            return nullptr;
+        }
+    }
+    struct io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+    sqe_tail++;
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoRing::enter(unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t arg_size) {
+    while (true) {
+        int result = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+                                              arg, arg_size));
+        if (result >= 0) {
+            if (to_submit > 0) {
+                Metrics::add(Metrics::IO_URING_SUBMITS);
+                Metrics::add(Metrics::IO_URING_OPERATIONS, result);
+            }
+            return result;
+        }
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+int IoRing::submit() {
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0) {
+        return 0;
+    }
+    return enter(to_submit, 0, 0, nullptr, 0);
+}
+
+int IoRing::submit_and_wait(int timeout_ms) {
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+    if (timeout_ms >= 0) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    }
+    int result = enter(to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    return result == -ETIME ? 0 : result;
+}
+
+bool IoRing::next_completion(struct io_uring_cqe& cqe) {
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    cqe = cqes[head & cq_mask];
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool IoRing::register_file(int fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= registered.size()) {
+        return false;
+    }
+    struct io_uring_files_update update;
+    std::memset(&update, 0, sizeof(update));
+    update.offset = static_cast<uint32_t>(fd);
+    update.fds = reinterpret_cast<uint64_t>(&fd);
+    if (io_uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1) {
+        return false;
+    }
+    registered[fd] = true;
+    return true;
+}
+
+void IoRing::unregister_file(int fd) {
+    if (!is_registered(fd)) {
+        return;
+    }
+    struct io_uring_sqe* sqe = get_sqe();
+    if (!sqe) {
+        return; // The slot keeps the file until it is reused
+    }
+    sqe->opcode = IORING_OP_FILES_UPDATE;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(&NO_FILE);
+    sqe->len = 1;
+    sqe->off = static_cast<uint64_t>(fd);
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    registered[fd] = false;
+}
+
+void IoRing::add_buffer(uint16_t id) {
+    // Only the fields of an entry are written: the ring's tail shares the
+    // first entry's reserved word
+    struct io_uring_buf* entry = &buffer_ring->bufs[buffer_tail & (BUFFER_COUNT - 1)];
+    entry->addr = reinterpret_cast<uint64_t>(buffer(id));
+    entry->len = static_cast<uint32_t>(BUFFER_SIZE);
+    entry->bid = id;
+    buffer_tail++;
+}
+
+void IoRing::recycle_buffer(uint16_t id) {
+    if (!buffer_ring) {
+        return;
+    }
+    add_buffer(id);
+    __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+}
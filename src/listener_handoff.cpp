@@ -0,0 +1,226 @@
+#include "listener_handoff.h"
+#include "socket_utils.h"
+#include "logger.h"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+    // The kernel passes at most this many fds in one message (SCM_MAX_FD)
+    const size_t MAX_LISTENERS = 253;
+    // Time the new process has to start serving; a warm disk cache is
+    // indexed in that time
+    const std::chrono::seconds READY_TIMEOUT(60);
+    const char LISTENERS_MESSAGE[] = "LISTENERS ";
+    const char READY_MESSAGE[] = "READY\n";
+
+    bool make_address(const std::string& path, struct sockaddr_un& address) {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            LOG_ERROR("Upgrade socket path is too long: " + path);
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // Whether 'socket_fd' becomes readable within 'timeout'
+    bool wait_readable(int socket_fd, std::chrono::milliseconds timeout) {
+        struct pollfd polled = {socket_fd, POLLIN, 0};
+        int ready;
+        do {
+            ready = poll(&polled, 1, static_cast<int>(timeout.count()));
+        } while (ready < 0 && errno == EINTR);
+        return ready > 0;
+    }
+}
+
+ListenerHandoff::ListenerHandoff(const std::string& path)
+    : path(path), listen_fd(-1), channel_fd(-1), owns_path(false) {}
+
+ListenerHandoff::~ListenerHandoff() {
+    SocketUtils::close_socket(channel_fd);
+    SocketUtils::close_socket(listen_fd);
+    if (owns_path) {
+        unlink(path.c_str());
+    }
+}
+
+bool ListenerHandoff::receive(std::vector<int>& listeners) {
+    listeners.clear();
+    struct sockaddr_un address;
+    if (!make_address(path, address)) {
+        return false;
+    }
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0) {
+        LOG_ERROR("Failed to create upgrade socket: " + std::string(strerror(errno)));
+        return false;
+    }
+    if (connect(socket_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0) {
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            LOG_WARNING("Failed to reach a running proxy at " + path + ": " + strerror(errno));
+        }
+        SocketUtils::close_socket(socket_fd);
+        return false;
+    }
+
+    // The old process writes out its cache before it answers
+    char data[64];
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+    struct iovec part = {data, sizeof(data) - 1};
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t received = -1;
+    if (wait_readable(socket_fd, READY_TIMEOUT)) {
+        received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+    }
+
+    for (struct cmsghdr* header = received > 0 ? CMSG_FIRSTHDR(&message) : nullptr; header != nullptr;
+         header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* fds = reinterpret_cast<const int*>(CMSG_DATA(header));
+            listeners.insert(listeners.end(), fds, fds + count);
+        }
+    }
+    size_t expected = 0;
+    if (received > 0) {
+        data[received] = '\0';
+        if (std::strncmp(data, LISTENERS_MESSAGE, sizeof(LISTENERS_MESSAGE) - 1) == 0) {
+            expected = std::strtoul(data + sizeof(LISTENERS_MESSAGE) - 1, nullptr, 10);
+        }
+    }
+    if (expected == 0 || listeners.size() != expected || (message.msg_flags & MSG_CTRUNC)) {
+        LOG_ERROR("Bad listener handoff from " + path);
+        for (int listener : listeners) {
+            SocketUtils::close_socket(listener);
+        }
+        listeners.clear();
+        SocketUtils::close_socket(socket_fd);
+        return false;
+    }
+
+    channel_fd = socket_fd;
+    LOG_INFO("Took over " + std::to_string(listeners.size()) + " listener(s) from the running proxy");
+    return true;
+}
+
+bool ListenerHandoff::confirm() {
+    if (channel_fd < 0) {
+        return false;
+    }
+    bool sent = SocketUtils::send_all(channel_fd, READY_MESSAGE, sizeof(READY_MESSAGE) - 1);
+    SocketUtils::close_socket(channel_fd);
+    channel_fd = -1;
+    return sent;
+}
+
+bool ListenerHandoff::listen() {
+    struct sockaddr_un address;
+    if (!make_address(path, address)) {
+        return false;
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOG_ERROR("Failed to create upgrade socket: " + std::string(strerror(errno)));
+        return false;
+    }
+    // A previous process has either handed over or died by now
+    unlink(path.c_str());
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0 ||
+        chmod(path.c_str(), 0600) < 0 || ::listen(listen_fd, 1) < 0) {
+        LOG_ERROR("Failed to listen for upgrades on " + path + ": " + strerror(errno));
+        SocketUtils::close_socket(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    owns_path = true;
+    LOG_INFO("Listening for upgrades on " + path);
+    return true;
+}
+
+bool ListenerHandoff::serve(const std::vector<int>& listeners, const std::function<void()>& release,
+                            const std::function<void()>& restore, std::chrono::milliseconds wait) {
+    if (listen_fd < 0 || !wait_readable(listen_fd, wait)) {
+        return false;
+    }
+    int peer = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (peer < 0) {
+        return false;
+    }
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(peer, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0 || credentials.uid != geteuid()) {
+        LOG_WARNING("Refusing upgrade from a process of another user");
+        SocketUtils::close_socket(peer);
+        return false;
+    }
+
+    if (listeners.empty() || listeners.size() > MAX_LISTENERS) {
+        LOG_ERROR("Cannot hand over " + std::to_string(listeners.size()) + " listener(s)");
+        SocketUtils::close_socket(peer);
+        return false;
+    }
+    LOG_INFO("Upgrade requested, handing over " + std::to_string(listeners.size()) + " listener(s)");
+    release();
+    bool handed_over = hand_over(peer, listeners);
+    // Closed before restoring, so a new process that is late to confirm
+    // finds out it was given up on
+    SocketUtils::close_socket(peer);
+    if (!handed_over) {
+        LOG_WARNING("The new process did not take over; still serving");
+        restore();
+        return false;
+    }
+    // 'path' is the new process's now
+    SocketUtils::close_socket(listen_fd);
+    listen_fd = -1;
+    owns_path = false;
+    return true;
+}
+
+bool ListenerHandoff::hand_over(int peer, const std::vector<int>& listeners) {
+    std::string text = LISTENERS_MESSAGE + std::to_string(listeners.size()) + "\n";
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_LISTENERS)];
+    std::memset(control, 0, sizeof(control));
+    struct iovec part = {const_cast<char*>(text.data()), text.size()};
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * listeners.size());
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * listeners.size());
+    std::memcpy(CMSG_DATA(header), listeners.data(), sizeof(int) * listeners.size());
+    if (sendmsg(peer, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(text.size())) {
+        LOG_WARNING("Failed to send the listeners: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    // Until it confirms, the new process may still fail to start
+    char reply[16];
+    ssize_t received = -1;
+    if (wait_readable(peer, READY_TIMEOUT)) {
+        received = recv(peer, reply, sizeof(reply), 0);
+    }
+    if (received < static_cast<ssize_t>(sizeof(READY_MESSAGE) - 1) ||
+        std::memcmp(reply, READY_MESSAGE, sizeof(READY_MESSAGE) - 1) != 0) {
+        return false;
+    }
+    LOG_INFO("The new process is accepting");
+    return true;
+}
@@ -1,44 +1,319 @@
 #include "logger.h"
+#include <algorithm>
 #include <chrono>
-#include <iomanip>
-#include <sstream>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-LogLevel Logger::current_level = INFO;
+std::atomic<int> Logger::current_level(INFO);
 
-void Logger::set_level(LogLevel level) {
-    current_level = level;
-}
-
-std::string Logger::get_timestamp() {
-    auto now = std::chrono::system_clock::now();
-    auto time = std::chrono::system_clock::to_time_t(now);
-    std::ostringstream oss;
-    oss << std::put_time(std::localtime(&time), "%Y-%m-%d %H:%M:%S");
-    return oss.str();
-}
-
-std::string Logger::level_to_string(LogLevel level) {
-    switch (level) {
-        case DEBUG:
-            return "DEBUG";
-        case INFO:
-            return "INFO";
-        case WARNING:
-            return "WARNING";
-        case ERROR:
-            return "ERROR";
-        default:
-            return "UNKNOWN";
+namespace {
+    const size_t RING_SIZE = 128 * 1024;     // Per logging thread
+    const size_t MAX_MESSAGE = RING_SIZE / 4; // Longer messages are cut
+    const size_t RECORD_ALIGN = 16;
+    const uint32_t WRAP_MARKER = UINT32_MAX;  // Rest of the ring is unused
+    const auto WRITER_INTERVAL = std::chrono::milliseconds(10);
+
+    struct RecordHeader {
+        uint32_t length;
+        uint32_t level;
+        int64_t time;
+    };
+    static_assert(sizeof(RecordHeader) == RECORD_ALIGN, "records start on RECORD_ALIGN boundaries");
+
+    size_t record_size(size_t length) {
+        return (sizeof(RecordHeader) + length + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+    }
+
+    const char* level_to_string(int level) {
+        switch (level) {
+            case DEBUG:
+                return "DEBUG";
+            case INFO:
+                return "INFO";
+            case WARNING:
+                return "WARNING";
+            case ERROR:
+                return "ERROR";
+            default:
+                return "UNKNOWN";
+        }
+    }
+
+    // Single producer (the owning thread), single consumer (the writer).
+    // Positions only grow; the byte offset is position % RING_SIZE.
+    struct Ring {
+        std::unique_ptr<char[]> data;
+        alignas(64) std::atomic<uint64_t> head; // Written by the producer
+        alignas(64) std::atomic<uint64_t> tail; // Written by the writer
+        std::atomic<uint64_t> dropped;
+        std::atomic<bool> retired;              // Owning thread has exited
+
+        Ring() : data(new char[RING_SIZE]), head(0), tail(0), dropped(0), retired(false) {}
+
+        bool push(int level, int64_t time, const char* message, size_t length) {
+            uint64_t position = head.load(std::memory_order_relaxed);
+            uint64_t free_bytes = RING_SIZE - (position - tail.load(std::memory_order_acquire));
+            size_t offset = position % RING_SIZE;
+            size_t needed = record_size(length);
+            size_t before_wrap = RING_SIZE - offset;
+            if (needed > before_wrap) {
+                // Records never wrap; skip the tail end of the ring
+                if (before_wrap + needed > free_bytes) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                RecordHeader marker{WRAP_MARKER, 0, 0};
+                std::memcpy(data.get() + offset, &marker, sizeof(marker));
+                position += before_wrap;
+                offset = 0;
+            } else if (needed > free_bytes) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            RecordHeader header{static_cast<uint32_t>(length), static_cast<uint32_t>(level), time};
+            std::memcpy(data.get() + offset, &header, sizeof(header));
+            std::memcpy(data.get() + offset + sizeof(header), message, length);
+            head.store(position + needed, std::memory_order_release);
+            return true;
+        }
+    };
+
+    // "[2024-06-11 08:15:42] " for the current second, rebuilt when it changes
+    class Timestamp {
+    public:
+        const std::string& format(int64_t time) {
+            if (time != cached_time) {
+                std::time_t seconds = static_cast<std::time_t>(time);
+                std::tm parts;
+                localtime_r(&seconds, &parts);
+                char buffer[32];
+                std::strftime(buffer, sizeof(buffer), "[%Y-%m-%d %H:%M:%S] ", &parts);
+                text = buffer;
+                cached_time = time;
+            }
+            return text;
+        }
+
+    private:
+        int64_t cached_time = -1;
+        std::string text;
+    };
+
+    void append_line(std::string& out, Timestamp& timestamp, int64_t time, int level,
+                     const char* message, size_t length) {
+        out += timestamp.format(time);
+        out += '[';
+        out += level_to_string(level);
+        out += "] ";
+        out.append(message, length);
+        out += '\n';
+    }
+
+    class Backend {
+    public:
+        Backend() : output(stdout), stopped(false), retired_dropped(0), reported_dropped(0) {
+            writer = std::thread([this]() { run(); });
+            std::atexit([]() { Logger::shutdown(); });
+        }
+
+        void log(int level, const std::string& message) {
+            int64_t now = static_cast<int64_t>(std::time(nullptr));
+            size_t length = std::min(message.size(), MAX_MESSAGE);
+            if (stopped.load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lock(direct_mutex);
+                std::string line;
+                append_line(line, direct_timestamp, now, level, message.data(), length);
+                write_out(line);
+                return;
+            }
+            Ring& own = ring();
+            own.push(level, now, message.data(), length);
+            if (stopped.load(std::memory_order_acquire)) {
+                // shutdown() may have drained the rings for the last time
+                // before this record went in. It holds direct_mutex until the
+                // writer has exited, so this thread is then the only reader.
+                std::lock_guard<std::mutex> lock(direct_mutex);
+                std::string batch;
+                drain(own, direct_timestamp, batch);
+                if (!batch.empty()) {
+                    write_out(batch);
+                }
+                return;
+            }
+            if (level >= WARNING) {
+                wake.notify_one();
+            }
+        }
+
+        void set_output(FILE* file) {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            output = file;
+        }
+
+        void shutdown() {
+            // Held until the writer is gone; see log()
+            std::lock_guard<std::mutex> direct(direct_mutex);
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+                if (stopped.exchange(true)) {
+                    return;
+                }
+            }
+            wake.notify_one();
+            writer.join();
+        }
+
+        uint64_t dropped() {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            uint64_t total = retired_dropped;
+            for (const auto& ring : rings) {
+                total += ring->dropped.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+    private:
+        // Marks the thread's ring retired when the thread exits; the writer
+        // drains and then forgets it
+        struct ThreadRing {
+            std::shared_ptr<Ring> ring;
+            ~ThreadRing() {
+                if (ring) {
+                    ring->retired.store(true, std::memory_order_release);
+                }
+            }
+        };
+
+        FILE* output;
+        std::mutex output_mutex;
+        std::thread writer;
+        std::atomic<bool> stopped;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+
+        std::mutex rings_mutex;
+        std::vector<std::shared_ptr<Ring>> rings;
+        uint64_t retired_dropped; // From rings already forgotten
+
+        // Writer thread only
+        Timestamp timestamp;
+        uint64_t reported_dropped;
+
+        std::mutex direct_mutex; // Logging after shutdown()
+        Timestamp direct_timestamp;
+
+        Ring& ring() {
+            thread_local ThreadRing local;
+            if (!local.ring) {
+                local.ring = std::make_shared<Ring>();
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                rings.push_back(local.ring);
+            }
+            return *local.ring;
+        }
+
+        void write_out(const std::string& text) {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::fwrite(text.data(), 1, text.size(), output);
+            std::fflush(output);
+        }
+
+        void run() {
+            std::string batch;
+            while (true) {
+                bool stopping = stopped.load(std::memory_order_acquire);
+                drain_all(batch);
+                if (!batch.empty()) {
+                    write_out(batch);
+                    batch.clear();
+                }
+                if (stopping) {
+                    return;
+                }
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake.wait_for(lock, WRITER_INTERVAL);
+            }
+        }
+
+        void drain_all(std::string& batch) {
+            std::vector<std::shared_ptr<Ring>> snapshot;
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex);
+                snapshot = rings;
+            }
+            for (const auto& ring : snapshot) {
+                // Read 'retired' first: a retired ring drained now stays empty
+                bool retired = ring->retired.load(std::memory_order_acquire);
+                drain(*ring, timestamp, batch);
+                if (retired) {
+                    std::lock_guard<std::mutex> lock(rings_mutex);
+                    retired_dropped += ring->dropped.load(std::memory_order_relaxed);
+                    rings.erase(std::find(rings.begin(), rings.end(), ring));
+                }
+            }
+            uint64_t total_dropped = dropped();
+            if (total_dropped > reported_dropped) {
+                std::string message = std::to_string(total_dropped - reported_dropped) +
+                                      " log records dropped, log buffer full";
+                append_line(batch, timestamp, static_cast<int64_t>(std::time(nullptr)), WARNING,
+                            message.data(), message.size());
+                reported_dropped = total_dropped;
+            }
+        }
+
+        void drain(Ring& ring, Timestamp& stamp, std::string& batch) {
+            uint64_t position = ring.tail.load(std::memory_order_relaxed);
+            uint64_t end = ring.head.load(std::memory_order_acquire);
+            while (position < end) {
+                size_t offset = position % RING_SIZE;
+                RecordHeader header;
+                std::memcpy(&header, ring.data.get() + offset, sizeof(header));
+                if (header.length == WRAP_MARKER) {
+                    position += RING_SIZE - offset;
+                    continue;
+                }
+                append_line(batch, stamp, header.time, static_cast<int>(header.level),
+                            ring.data.get() + offset + sizeof(header), header.length);
+                position += record_size(header.length);
+            }
+            ring.tail.store(position, std::memory_order_release);
+        }
+    };
+
+    // Never destroyed: threads may still log while the process exits
+    Backend& backend() {
+        static Backend* instance = new Backend();
+        return *instance;
     }
 }
 
+void Logger::set_level(LogLevel level) {
+    current_level.store(level, std::memory_order_relaxed);
+}
+
+void Logger::set_output(FILE* output) {
+    backend().set_output(output);
+}
+
 void Logger::log(LogLevel level, const std::string& message) {
-    if (level < current_level) {
+    if (level < LOG_MIN_LEVEL || !is_enabled(level)) {
         return;
     }
-    
-    std::cout << "[" << get_timestamp() << "] [" << level_to_string(level) << "] "
-              << message << std::endl;
+    backend().log(level, message);
+}
+
+void Logger::shutdown() {
+    backend().shutdown();
+}
+
+uint64_t Logger::dropped() {
+    return backend().dropped();
 }
 
 void Logger::debug(const std::string& message) {
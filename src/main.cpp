@@ -1,4 +1,6 @@
 #include "proxy_server.h"
+#include "proxy_config.h"
+#include "listener_handoff.h"
 #include "logger.h"
 #include <iostream>
 #include <signal.h>
@@ -17,36 +19,66 @@ int main(int argc, char* argv[]) {
     Logger::set_level(INFO);
     
     // Parse command line arguments
-    int port = 8080; // Default port
-    if (argc > 1) {
-        try {
-            port = std::stoi(argv[1]);
-        } catch (...) {
-            Logger::error("Invalid port number. Using default port 8080");
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--help" || std::string(argv[i]) == "-h") {
+            ProxyConfig::print_usage(argv[0]);
+            return 0;
         }
     }
+    ProxyConfig config = ProxyConfig::from_args(argc, argv);
+    int port = config.port;
     
     // Register signal handler for graceful shutdown
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    // A peer closing mid-write must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    
+    // With --upgrade-socket, a proxy already running there hands over its
+    // listeners, and this one starts accepting on them
+    ListenerHandoff handoff(config.upgrade_socket);
+    std::vector<int> inherited;
+    bool upgrading = !config.upgrade_socket.empty() && handoff.receive(inherited);
     
     // Create and start proxy server
-    ProxyServer proxy(port);
+    ProxyServer proxy(config);
+    if (upgrading) {
+        proxy.adopt_listeners(inherited);
+    }
     
     if (!proxy.start()) {
-        Logger::error("Failed to start proxy server");
+        LOG_ERROR("Failed to start proxy server");
+        return 1;
+    }
+    if (upgrading && !handoff.confirm()) {
+        // It has taken its cache directory and admin port back
+        LOG_ERROR("The previous process gave up on the handoff and serves on; exiting");
+        proxy.drain(std::chrono::seconds(config.drain_timeout));
+        proxy.stop();
         return 1;
     }
+    bool upgradable = !config.upgrade_socket.empty() && handoff.listen();
     
-    Logger::info("Proxy server running on port " + std::to_string(port));
-    Logger::info("Press Ctrl+C to shutdown...");
+    LOG_INFO("Proxy server running on port " + std::to_string(port));
+    LOG_INFO("Press Ctrl+C to shutdown...");
     
-    // Keep the server running until interrupted
-    while (!should_exit) {
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+    // Keep the server running until interrupted or upgraded
+    bool upgraded = false;
+    while (!should_exit && !upgraded) {
+        if (upgradable) {
+            upgraded = handoff.serve(proxy.listeners(), [&proxy]() { proxy.release_for_upgrade(); },
+                                     [&proxy]() { proxy.resume_after_upgrade_failed(); },
+                                     std::chrono::milliseconds(100));
+        } else {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
     }
     
-    Logger::info("Shutting down...");
+    if (upgraded) {
+        // The new process accepts from here on; finish what this one has
+        proxy.drain(std::chrono::seconds(config.drain_timeout));
+    }
+    LOG_INFO("Shutting down...");
     proxy.stop();
     
     return 0;
@@ -0,0 +1,306 @@
+#include "metrics.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    // Log-linear buckets over microseconds: values below 8 get a bucket each,
+    // then every power of two is split into 8 equal steps
+    const int SUB_BITS = 3;
+    const int SUB_BUCKETS = 1 << SUB_BITS;
+    const int MAX_BITS = 40;  // ~12 days; longer values land in the last bucket
+    const int BUCKET_COUNT = (MAX_BITS - SUB_BITS + 2) * SUB_BUCKETS;
+
+    // Exported cumulative buckets: powers of two from 16 us to ~67 s
+    const int EXPORT_MIN_BITS = 4;
+    const int EXPORT_MAX_BITS = 26;
+
+    const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+    struct CounterInfo {
+        const char* name;
+        const char* help;
+    };
+
+    const CounterInfo COUNTERS[Metrics::COUNTER_COUNT] = {
+        {"proxy_requests_total", "Requests read from clients"},
+        {"proxy_connections_total", "Client connections accepted"},
+        {"proxy_tunnels_total", "CONNECT tunnels established"},
+        {"proxy_client_received_bytes_total", "Bytes read from clients"},
+        {"proxy_client_sent_bytes_total", "Bytes written to clients"},
+        {"proxy_upstream_received_bytes_total", "Bytes read from origin servers"},
+        {"proxy_upstream_sent_bytes_total", "Bytes written to origin servers"},
+        {"proxy_io_buffer_allocations_total", "I/O buffers allocated because the thread's free list was empty"},
+        {"proxy_io_uring_submits_total", "io_uring_enter calls that submitted operations"},
+        {"proxy_io_uring_operations_total", "Operations submitted to io_uring"},
+        {"proxy_upstream_connect_attempts_total", "Upstream connects started, one per address tried"},
+        {"proxy_upstream_connect_failures_total", "Upstream connect attempts refused or unreachable"},
+        {"proxy_upstream_connect_timeouts_total", "Upstream connect attempts that timed out"},
+        {"proxy_shed_connections_total", "Client connections refused at the connection limit"},
+        {"proxy_shed_ip_connections_total", "Client connections refused at the per-address connection limit"},
+        {"proxy_shed_queue_full_total", "Client connections refused because a worker queue was full"},
+        {"proxy_shed_rate_limited_total", "Requests refused by the request rate limit"},
+        {"proxy_shed_ip_rate_limited_total", "Requests refused by the per-address request rate limit"},
+        {"proxy_shed_queue_time_total", "Requests answered 503 after waiting past the queue target"},
+        {"proxy_shed_spared_hits_total", "Requests past the queue target served from the cache"},
+    };
+
+    const CounterInfo GAUGES[Metrics::GAUGE_COUNT] = {
+        {"proxy_active_connections", "Client connections open"},
+        {"proxy_active_tunnels", "CONNECT tunnels open"},
+    };
+
+    const char* STAGE_NAMES[Metrics::STAGE_COUNT] = {"dns", "connect", "connect_ipv4", "connect_ipv6",
+                                                  "first_byte", "transfer", "cache_hit", "queue"};
+
+    int bucket_for(uint64_t micros) {
+        if (micros < static_cast<uint64_t>(SUB_BUCKETS)) {
+            return static_cast<int>(micros);
+        }
+        int top_bit = 63 - __builtin_clzll(micros);
+        if (top_bit > MAX_BITS) {
+            return BUCKET_COUNT - 1;
+        }
+        int shift = top_bit - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<int>((micros >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // First value past the bucket, in microseconds
+    uint64_t bucket_limit(int bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return static_cast<uint64_t>(bucket) + 1;
+        }
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t step = bucket % SUB_BUCKETS;
+        return (static_cast<uint64_t>(SUB_BUCKETS) + step + 1) << shift;
+    }
+
+    // Only the owning thread writes, so a load and a store replace the
+    // locked read-modify-write; readers may see a value a moment old
+    template <typename T>
+    void bump(std::atomic<T>& value, T delta) {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[BUCKET_COUNT];
+        std::atomic<uint64_t> sum_micros;
+        std::atomic<uint64_t> count;
+    };
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> counters[Metrics::COUNTER_COUNT];
+        std::atomic<int64_t> gauges[Metrics::GAUGE_COUNT];
+        Histogram histograms[Metrics::STAGE_COUNT];
+
+        Slot() {
+            for (auto& counter : counters) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+            for (auto& gauge : gauges) {
+                gauge.store(0, std::memory_order_relaxed);
+            }
+            for (auto& histogram : histograms) {
+                for (auto& bucket : histogram.buckets) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+                histogram.sum_micros.store(0, std::memory_order_relaxed);
+                histogram.count.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    class Registry {
+    public:
+        Slot& local() {
+            thread_local Owner owner(*this);
+            return *owner.slot;
+        }
+
+        // Calls 'visit' for every slot, live or free, under the registry lock
+        template <typename Visit>
+        void for_each(Visit visit) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& slot : slots) {
+                visit(*slot);
+            }
+        }
+
+    private:
+        // Claims a slot for the thread and gives it back when the thread exits
+        struct Owner {
+            Registry& registry;
+            Slot* slot;
+
+            explicit Owner(Registry& registry) : registry(registry), slot(registry.acquire()) {}
+            ~Owner() { registry.release(slot); }
+        };
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Slot>> slots;
+        std::vector<Slot*> free_slots;
+
+        Slot* acquire() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free_slots.empty()) {
+                Slot* slot = free_slots.back();
+                free_slots.pop_back();
+                return slot;
+            }
+            slots.push_back(std::make_unique<Slot>());
+            return slots.back().get();
+        }
+
+        void release(Slot* slot) {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_slots.push_back(slot);
+        }
+    };
+
+    // Never destroyed: threads may still record while the process exits
+    Registry& registry() {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+
+    void append_header(std::string& out, const char* name, const char* help, const char* type) {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+
+    std::string format_number(double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return buffer;
+    }
+}
+
+void Metrics::add(Counter counter, uint64_t value) {
+    bump(registry().local().counters[counter], value);
+}
+
+void Metrics::adjust(Gauge gauge, int64_t delta) {
+    bump(registry().local().gauges[gauge], delta);
+}
+
+void Metrics::observe(Stage stage, Clock::duration elapsed) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    uint64_t value = micros > 0 ? static_cast<uint64_t>(micros) : 0;
+    Histogram& histogram = registry().local().histograms[stage];
+    bump(histogram.buckets[bucket_for(value)], uint64_t(1));
+    bump(histogram.sum_micros, value);
+    bump(histogram.count, uint64_t(1));
+}
+
+void Metrics::write_counter(std::string& out, const char* name, const char* help, uint64_t value) {
+    append_header(out, name, help, "counter");
+    out += name;
+    out += ' ';
+    out += std::to_string(value);
+    out += '\n';
+}
+
+void Metrics::write_counter(std::string& out, const char* name, const char* help, double value) {
+    append_header(out, name, help, "counter");
+    out += name;
+    out += ' ';
+    out += format_number(value);
+    out += '\n';
+}
+
+void Metrics::write_gauge(std::string& out, const char* name, const char* help, double value) {
+    append_header(out, name, help, "gauge");
+    out += name;
+    out += ' ';
+    out += format_number(value);
+    out += '\n';
+}
+
+void Metrics::render(std::string& out) {
+    uint64_t counters[COUNTER_COUNT] = {};
+    int64_t gauges[GAUGE_COUNT] = {};
+    std::vector<uint64_t> buckets(static_cast<size_t>(STAGE_COUNT) * BUCKET_COUNT, 0);
+    uint64_t sums[STAGE_COUNT] = {};
+    uint64_t counts[STAGE_COUNT] = {};
+
+    registry().for_each([&](const Slot& slot) {
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            counters[i] += slot.counters[i].load(std::memory_order_relaxed);
+        }
+        for (int i = 0; i < GAUGE_COUNT; i++) {
+            gauges[i] += slot.gauges[i].load(std::memory_order_relaxed);
+        }
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            const Histogram& histogram = slot.histograms[stage];
+            for (int b = 0; b < BUCKET_COUNT; b++) {
+                buckets[stage * BUCKET_COUNT + b] += histogram.buckets[b].load(std::memory_order_relaxed);
+            }
+            sums[stage] += histogram.sum_micros.load(std::memory_order_relaxed);
+            counts[stage] += histogram.count.load(std::memory_order_relaxed);
+        }
+    });
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        write_counter(out, COUNTERS[i].name, COUNTERS[i].help, counters[i]);
+    }
+    for (int i = 0; i < GAUGE_COUNT; i++) {
+        write_gauge(out, GAUGES[i].name, GAUGES[i].help, static_cast<double>(gauges[i]));
+    }
+
+    // Histogram buckets are counted from the fine buckets, so their bounds
+    // are exclusive at microsecond resolution
+    const char* histogram_name = "proxy_stage_duration_seconds";
+    append_header(out, histogram_name, "Time spent per request stage", "histogram");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        const uint64_t* fine = &buckets[stage * BUCKET_COUNT];
+        std::string labels = std::string("stage=\"") + STAGE_NAMES[stage] + "\"";
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (int bits = EXPORT_MIN_BITS; bits <= EXPORT_MAX_BITS; bits++) {
+            uint64_t bound = uint64_t(1) << bits;
+            for (; b < BUCKET_COUNT && bucket_limit(b) <= bound; b++) {
+                cumulative += fine[b];
+            }
+            out += histogram_name;
+            out += "_bucket{" + labels + ",le=\"" + format_number(bound / 1e6) + "\"} ";
+            out += std::to_string(cumulative) + '\n';
+        }
+        out += histogram_name;
+        out += "_bucket{" + labels + ",le=\"+Inf\"} " + std::to_string(counts[stage]) + '\n';
+        out += histogram_name;
+        out += "_sum{" + labels + "} " + format_number(sums[stage] / 1e6) + '\n';
+        out += histogram_name;
+        out += "_count{" + labels + "} " + std::to_string(counts[stage]) + '\n';
+    }
+
+    // Quantiles at full resolution: the upper bound of the bucket they fall in
+    const char* quantile_name = "proxy_stage_duration_quantile_seconds";
+    append_header(out, quantile_name, "Per-stage latency quantiles since startup", "gauge");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        const uint64_t* fine = &buckets[stage * BUCKET_COUNT];
+        for (double quantile : QUANTILES) {
+            uint64_t rank = static_cast<uint64_t>(quantile * counts[stage] + 0.5);
+            uint64_t cumulative = 0;
+            double value = 0;
+            for (int b = 0; b < BUCKET_COUNT && counts[stage] > 0; b++) {
+                cumulative += fine[b];
+                if (cumulative >= rank && cumulative > 0) {
+                    value = bucket_limit(b) / 1e6;
+                    break;
+                }
+            }
+            out += quantile_name;
+            out += std::string("{stage=\"") + STAGE_NAMES[stage] + "\",quantile=\"" + format_number(quantile) +
+                   "\"} " + format_number(value) + '\n';
+        }
+    }
+}
@@ -0,0 +1,288 @@
+#include "proxy_config.h"
+#include "logger.h"
+#include <iostream>
+
+std::string io_mode_to_string(IoMode mode) {
+    switch (mode) {
+        case IoMode::THREADED:
+            return "threaded";
+        case IoMode::EPOLL:
+            return "epoll";
+        case IoMode::IO_URING:
+            return "io_uring";
+        default:
+            return "unknown";
+    }
+}
+
+static bool parse_switch(const std::string& name, const std::string& value, bool& out) {
+    if (value == "on") {
+        out = true;
+    } else if (value == "off") {
+        out = false;
+    } else {
+        LOG_WARNING("Invalid --" + name + " value '" + value + "', expected on|off");
+        return false;
+    }
+    return true;
+}
+
+static bool parse_int(const std::string& value, int& out) {
+    try {
+        size_t used = 0;
+        int parsed = std::stoi(value, &used);
+        if (used != value.length()) {
+            return false;
+        }
+        out = parsed;
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+ProxyConfig ProxyConfig::from_args(int argc, char* argv[]) {
+    ProxyConfig config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg.rfind("--", 0) != 0) {
+            // Positional argument: listening port
+            if (!parse_int(arg, config.port)) {
+                LOG_ERROR("Invalid port number. Using default port 8080");
+                config.port = 8080;
+            }
+            continue;
+        }
+
+        std::string name = arg.substr(2);
+        std::string value;
+        size_t eq = name.find('=');
+        if (eq != std::string::npos) {
+            value = name.substr(eq + 1);
+            name = name.substr(0, eq);
+        }
+
+        if (name == "mode") {
+            if (value == "threaded") {
+                config.io_mode = IoMode::THREADED;
+            } else if (value == "epoll") {
+                config.io_mode = IoMode::EPOLL;
+            } else if (value == "io_uring") {
+                config.io_mode = IoMode::IO_URING;
+            } else {
+                LOG_WARNING("Unknown I/O mode '" + value + "', using " +
+                                io_mode_to_string(config.io_mode));
+            }
+        } else if (name == "threads") {
+            if (!parse_int(value, config.listener_threads) || config.listener_threads < 0) {
+                LOG_WARNING("Invalid --threads value '" + value + "', using default");
+                config.listener_threads = 0;
+            }
+        } else if (name == "workers") {
+            if (!parse_int(value, config.worker_threads) || config.worker_threads < 1) {
+                LOG_WARNING("Invalid --workers value '" + value + "', using default");
+                config.worker_threads = 32;
+            }
+        } else if (name == "queue-depth") {
+            if (!parse_int(value, config.queue_depth) || config.queue_depth < 1) {
+                LOG_WARNING("Invalid --queue-depth value '" + value + "', using default");
+                config.queue_depth = 128;
+            }
+        } else if (name == "cpu-affinity") {
+            parse_switch(name, value, config.pin_cpus);
+        } else if (name == "splice") {
+            parse_switch(name, value, config.use_splice);
+        } else if (name == "upstream-keepalive") {
+            parse_switch(name, value, config.upstream_keepalive);
+        } else if (name == "upstream-max-idle-per-host") {
+            if (!parse_int(value, config.upstream_max_idle_per_host) || config.upstream_max_idle_per_host < 0) {
+                LOG_WARNING("Invalid --upstream-max-idle-per-host value '" + value + "', using default");
+                config.upstream_max_idle_per_host = 8;
+            }
+        } else if (name == "upstream-max-idle") {
+            if (!parse_int(value, config.upstream_max_idle) || config.upstream_max_idle < 0) {
+                LOG_WARNING("Invalid --upstream-max-idle value '" + value + "', using default");
+                config.upstream_max_idle = 256;
+            }
+        } else if (name == "upstream-idle-timeout") {
+            if (!parse_int(value, config.upstream_idle_timeout) || config.upstream_idle_timeout < 1) {
+                LOG_WARNING("Invalid --upstream-idle-timeout value '" + value + "', using default");
+                config.upstream_idle_timeout = 30;
+            }
+        } else if (name == "connect-timeout") {
+            if (!parse_int(value, config.connect_timeout_ms) || config.connect_timeout_ms < 1) {
+                LOG_WARNING("Invalid --connect-timeout value '" + value + "', using default");
+                config.connect_timeout_ms = 5000;
+            }
+        } else if (name == "connect-attempt-delay") {
+            if (!parse_int(value, config.connect_attempt_delay_ms) || config.connect_attempt_delay_ms < 10) {
+                LOG_WARNING("Invalid --connect-attempt-delay value '" + value + "', using default");
+                config.connect_attempt_delay_ms = 250;
+            }
+        } else if (name == "dns-threads") {
+            if (!parse_int(value, config.dns_threads) || config.dns_threads < 1) {
+                LOG_WARNING("Invalid --dns-threads value '" + value + "', using default");
+                config.dns_threads = 4;
+            }
+        } else if (name == "dns-ttl") {
+            if (!parse_int(value, config.dns_ttl) || config.dns_ttl < 0) {
+                LOG_WARNING("Invalid --dns-ttl value '" + value + "', using default");
+                config.dns_ttl = 60;
+            }
+        } else if (name == "dns-negative-ttl") {
+            if (!parse_int(value, config.dns_negative_ttl) || config.dns_negative_ttl < 0) {
+                LOG_WARNING("Invalid --dns-negative-ttl value '" + value + "', using default");
+                config.dns_negative_ttl = 5;
+            }
+        } else if (name == "cache-size") {
+            if (!parse_int(value, config.cache_size_mb) || config.cache_size_mb < 1) {
+                LOG_WARNING("Invalid --cache-size value '" + value + "', using default");
+                config.cache_size_mb = 256;
+            }
+        } else if (name == "cache-dir") {
+            config.cache_dir = value;
+        } else if (name == "cache-disk-size") {
+            if (!parse_int(value, config.cache_disk_size_mb) || config.cache_disk_size_mb < 16) {
+                LOG_WARNING("Invalid --cache-disk-size value '" + value + "', using default");
+                config.cache_disk_size_mb = 4096;
+            }
+        } else if (name == "collapsed-forwarding") {
+            parse_switch(name, value, config.collapsed_forwarding);
+        } else if (name == "collapse-timeout") {
+            if (!parse_int(value, config.collapse_timeout_ms) || config.collapse_timeout_ms < 1) {
+                LOG_WARNING("Invalid --collapse-timeout value '" + value + "', using default");
+                config.collapse_timeout_ms = 2000;
+            }
+        } else if (name == "revalidate-threads") {
+            if (!parse_int(value, config.revalidate_threads) || config.revalidate_threads < 1) {
+                LOG_WARNING("Invalid --revalidate-threads value '" + value + "', using default");
+                config.revalidate_threads = 2;
+            }
+        } else if (name == "refresh-ahead-hits") {
+            if (!parse_int(value, config.refresh_ahead_hits) || config.refresh_ahead_hits < 0) {
+                LOG_WARNING("Invalid --refresh-ahead-hits value '" + value + "', using default");
+                config.refresh_ahead_hits = 10;
+            }
+        } else if (name == "refresh-ahead-window") {
+            if (!parse_int(value, config.refresh_ahead_window) || config.refresh_ahead_window < 1 ||
+                config.refresh_ahead_window > 100) {
+                LOG_WARNING("Invalid --refresh-ahead-window value '" + value + "', using default");
+                config.refresh_ahead_window = 10;
+            }
+        } else if (name == "refresh-ahead-concurrency") {
+            if (!parse_int(value, config.refresh_ahead_concurrency) || config.refresh_ahead_concurrency < 1) {
+                LOG_WARNING("Invalid --refresh-ahead-concurrency value '" + value + "', using default");
+                config.refresh_ahead_concurrency = 4;
+            }
+        } else if (name == "cache-max-object") {
+            if (!parse_int(value, config.cache_max_object_kb) || config.cache_max_object_kb < 1) {
+                LOG_WARNING("Invalid --cache-max-object value '" + value + "', using default");
+                config.cache_max_object_kb = 8192;
+            }
+        } else if (name == "cache-compression") {
+            parse_switch(name, value, config.cache_compression);
+        } else if (name == "compress-threads") {
+            if (!parse_int(value, config.compress_threads) || config.compress_threads < 1) {
+                LOG_WARNING("Invalid --compress-threads value '" + value + "', using default");
+                config.compress_threads = 1;
+            }
+        } else if (name == "compress-level") {
+            if (!parse_int(value, config.compress_level) || config.compress_level < 1 || config.compress_level > 9) {
+                LOG_WARNING("Invalid --compress-level value '" + value + "', using default");
+                config.compress_level = 6;
+            }
+        } else if (name == "client-keepalive") {
+            parse_switch(name, value, config.client_keepalive);
+        } else if (name == "client-idle-timeout") {
+            if (!parse_int(value, config.client_idle_timeout) || config.client_idle_timeout < 1) {
+                LOG_WARNING("Invalid --client-idle-timeout value '" + value + "', using default");
+                config.client_idle_timeout = 15;
+            }
+        } else if (name == "admin-port") {
+            if (!parse_int(value, config.admin_port) || config.admin_port < 0 || config.admin_port > 65535) {
+                LOG_WARNING("Invalid --admin-port value '" + value + "', metrics disabled");
+                config.admin_port = 0;
+            }
+        } else if (name == "max-connections") {
+            if (!parse_int(value, config.max_connections) || config.max_connections < 0) {
+                LOG_WARNING("Invalid --max-connections value '" + value + "', no limit");
+                config.max_connections = 0;
+            }
+        } else if (name == "max-connections-per-ip") {
+            if (!parse_int(value, config.max_connections_per_ip) || config.max_connections_per_ip < 0) {
+                LOG_WARNING("Invalid --max-connections-per-ip value '" + value + "', no limit");
+                config.max_connections_per_ip = 0;
+            }
+        } else if (name == "rate-limit") {
+            if (!parse_int(value, config.rate_limit) || config.rate_limit < 0) {
+                LOG_WARNING("Invalid --rate-limit value '" + value + "', no limit");
+                config.rate_limit = 0;
+            }
+        } else if (name == "rate-limit-per-ip") {
+            if (!parse_int(value, config.rate_limit_per_ip) || config.rate_limit_per_ip < 0) {
+                LOG_WARNING("Invalid --rate-limit-per-ip value '" + value + "', no limit");
+                config.rate_limit_per_ip = 0;
+            }
+        } else if (name == "queue-target") {
+            if (!parse_int(value, config.queue_target_ms) || config.queue_target_ms < 0) {
+                LOG_WARNING("Invalid --queue-target value '" + value + "', shedding disabled");
+                config.queue_target_ms = 0;
+            }
+        } else if (name == "upgrade-socket") {
+            config.upgrade_socket = value;
+        } else if (name == "drain-timeout") {
+            if (!parse_int(value, config.drain_timeout) || config.drain_timeout < 0) {
+                LOG_WARNING("Invalid --drain-timeout value '" + value + "', using default");
+                config.drain_timeout = 30;
+            }
+        } else {
+            LOG_WARNING("Unknown option --" + name);
+        }
+    }
+
+    return config;
+}
+
+void ProxyConfig::print_usage(const char* program) {
+    std::cout << "Usage: " << program << " [port] [options]\n"
+              << "  --mode=epoll|io_uring|threaded  I/O model (default: epoll)\n"
+              << "  --threads=N             Listener shards, one SO_REUSEPORT socket each (default: CPU count)\n"
+              << "  --workers=N             Worker threads per shard in threaded mode (default: 32)\n"
+              << "  --queue-depth=N         Pending connections per shard in threaded mode (default: 128)\n"
+              << "  --cpu-affinity=on|off   Pin each shard to its own CPU (default: on)\n"
+              << "  --splice=on|off         Zero-copy tunnel relay with splice(2) (default: on)\n"
+              << "  --upstream-keepalive=on|off     Pool idle upstream connections (default: on)\n"
+              << "  --upstream-max-idle-per-host=N  Idle connections kept per origin (default: 8)\n"
+              << "  --upstream-max-idle=N           Idle connections kept in total (default: 256)\n"
+              << "  --upstream-idle-timeout=S       Seconds before an idle connection is closed (default: 30)\n"
+              << "  --connect-timeout=MS            Give up on an upstream address after this long (default: 5000)\n"
+              << "  --connect-attempt-delay=MS      Try a name's next address in parallel after this long (default: 250)\n"
+              << "  --dns-threads=N                 Resolver threads running getaddrinfo (default: 4)\n"
+              << "  --dns-ttl=S                     Seconds to cache a resolved name (default: 60)\n"
+              << "  --dns-negative-ttl=S            Seconds to cache a failed lookup (default: 5)\n"
+              << "  --cache-size=MB                 Memory budget for cached responses (default: 256)\n"
+              << "  --cache-dir=PATH                Keep evicted responses on disk across restarts (default: off)\n"
+              << "  --cache-disk-size=MB            Disk budget for --cache-dir (default: 4096)\n"
+              << "  --collapsed-forwarding=on|off   Let concurrent misses share one upstream fetch (default: on)\n"
+              << "  --collapse-timeout=MS           Wait for a shared fetch before fetching alone (default: 2000)\n"
+              << "  --revalidate-threads=N          Threads refreshing expired cache entries (default: 2)\n"
+              << "  --refresh-ahead-hits=N          Refresh entries hit N times before they expire; 0 = off (default: 10)\n"
+              << "  --refresh-ahead-window=PCT      ... once in the last PCT% of their TTL (default: 10)\n"
+              << "  --refresh-ahead-concurrency=N   Refreshes ahead of expiry in flight at once (default: 4)\n"
+              << "  --cache-max-object=KB           Largest response body to cache (default: 8192)\n"
+              << "  --cache-compression=on|off      Store text bodies gzipped, inflating for other clients (default: on)\n"
+              << "  --compress-threads=N            Threads compressing cached bodies (default: 1)\n"
+              << "  --compress-level=N              zlib level for cached bodies, 1-9 (default: 6)\n"
+              << "  --client-keepalive=on|off       Serve several requests per client connection (default: on)\n"
+              << "  --client-idle-timeout=S         Seconds to wait for a client's next request (default: 15)\n"
+              << "  --admin-port=N                  Serve Prometheus metrics at 127.0.0.1:N/metrics (default: off)\n"
+              << "  --max-connections=N             Refuse clients beyond N open connections with 503 (default: off)\n"
+              << "  --max-connections-per-ip=N      The same limit per client address (default: off)\n"
+              << "  --rate-limit=N                  Requests per second across all clients, then 429 (default: off)\n"
+              << "  --rate-limit-per-ip=N           Requests per second per client address (default: off)\n"
+              << "  --queue-target=MS               Answer misses that waited longer with 503 (default: off)\n"
+              << "  --upgrade-socket=PATH           Hand the listeners to a new binary started with the same PATH (default: off)\n"
+              << "  --drain-timeout=S               Seconds an upgraded process waits for its connections (default: 30)\n";
+}
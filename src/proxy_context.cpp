@@ -0,0 +1,51 @@
+#include "proxy_context.h"
+#include "logger.h"
+
+ProxyContext::ProxyContext(const ProxyConfig& config) : config(config) {
+    cache_manager = std::make_shared<CacheManager>(static_cast<size_t>(config.cache_size_mb) * 1024 * 1024);
+    if (!config.cache_dir.empty()) {
+        auto disk = std::make_shared<DiskCache>(config.cache_dir,
+                                                static_cast<size_t>(config.cache_disk_size_mb) * 1024 * 1024);
+        if (disk->open()) {
+            cache_manager->set_disk_tier(disk);
+            disk_cache = disk;
+        } else {
+            LOG_WARNING("Disk cache disabled");
+        }
+    }
+    if (config.cache_compression) {
+        cache_compressor = std::make_shared<CacheCompressor>(config.compress_threads, config.compress_level);
+        cache_manager->set_compressor(cache_compressor);
+    }
+    upstream_pool = std::make_shared<ConnectionPool>(
+        config.upstream_keepalive ? config.upstream_max_idle_per_host : 0,
+        config.upstream_keepalive ? config.upstream_max_idle : 0,
+        config.upstream_idle_timeout);
+    connect_options.attempt_delay = std::chrono::milliseconds(config.connect_attempt_delay_ms);
+    connect_options.timeout = std::chrono::milliseconds(config.connect_timeout_ms);
+    resolver = std::make_shared<DnsResolver>(config.dns_threads, config.dns_ttl, config.dns_negative_ttl);
+    revalidator = std::make_shared<Revalidator>(cache_manager, resolver, config.revalidate_threads,
+                                                connect_options);
+    if (config.refresh_ahead_hits > 0) {
+        CacheManager::RefreshAhead ahead;
+        ahead.min_hits = config.refresh_ahead_hits;
+        ahead.window_percent = config.refresh_ahead_window;
+        ahead.max_in_flight = config.refresh_ahead_concurrency;
+        // Weak: the revalidator already holds the cache
+        std::weak_ptr<Revalidator> weak_revalidator = revalidator;
+        cache_manager->set_refresh_ahead(ahead, [weak_revalidator](const HttpRequest& request,
+                                                                   const StaleCopy& validators,
+                                                                   std::chrono::system_clock::time_point expires) {
+            std::shared_ptr<Revalidator> refresher = weak_revalidator.lock();
+            return refresher && refresher->refresh_ahead(request, validators, expires);
+        });
+    }
+
+    AdmissionControl::Limits limits;
+    limits.max_connections = config.max_connections;
+    limits.max_connections_per_ip = config.max_connections_per_ip;
+    limits.request_rate = config.rate_limit;
+    limits.request_rate_per_ip = config.rate_limit_per_ip;
+    limits.queue_target = std::chrono::milliseconds(config.queue_target_ms);
+    admission = std::make_shared<AdmissionControl>(limits);
+}
@@ -2,244 +2,1040 @@
 #include "socket_utils.h"
 #include "http_handler.h"
 #include "logger.h"
+#include "client_connection.h"
+#include "relay_direction.h"
+#include "http_framing.h"
+#include "cache_fill.h"
+#include "metrics.h"
+#include "buffer_pool.h"
+#include "connect_race.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <thread>
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <cerrno>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 
-ProxyServer::ProxyServer(int port) : server_socket(-1), port(port), running(false) {
-    cache_manager = std::make_shared<CacheManager>();
-}
+namespace {
+
+// Drains a shard's non-blocking listening socket; accepted clients stay on
+// the same event loop (and CPU) as the listener.
+class Acceptor : public EventLoop::Handler {
+public:
+    Acceptor(int server_socket, EventLoop& loop, std::shared_ptr<ProxyContext> context)
+        : server_socket(server_socket), loop(loop), context(std::move(context)) {}
+
+    void handle_event(int, uint32_t) override {
+        while (true) {
+            int client_socket = SocketUtils::accept_non_blocking(server_socket);
+            if (client_socket < 0) {
+                return;
+            }
+            std::make_shared<ClientConnection>(loop, client_socket, context)->start();
+        }
+    }
+
+private:
+    int server_socket;
+    EventLoop& loop;
+    std::shared_ptr<ProxyContext> context;
+};
+
+// Set by the fetching thread when a fetch this handler waits for ends
+struct FetchSignal {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+};
+
+} // namespace
+
+ProxyServer::ProxyServer(int port) : ProxyServer([port]() {
+    ProxyConfig config;
+    config.port = port;
+    return config;
+}()) {}
+
+ProxyServer::ProxyServer(const ProxyConfig& proxy_config)
+    : context(std::make_shared<ProxyContext>(proxy_config)), config(context->config),
+      io_mode(config.io_mode), port(config.port), running(false), accepting(0), accepts_stopped(false),
+      drain_fd(-1) {}
 
 ProxyServer::~ProxyServer() {
     stop();
 }
 
+void ProxyServer::adopt_listeners(const std::vector<int>& sockets) {
+    for (int socket_fd : sockets) {
+        SocketUtils::set_non_blocking(socket_fd);
+        server_sockets.push_back(socket_fd);
+    }
+}
+
+void ProxyServer::release_for_upgrade() {
+    if (admin_server) {
+        admin_server->stop();
+        admin_server.reset();
+    }
+    context->cache_manager->release_disk_tier();
+}
+
+void ProxyServer::resume_after_upgrade_failed() {
+    if (!context->cache_manager->reopen_disk_tier()) {
+        LOG_WARNING("Cache directory is still in use by the new process; caching in memory only");
+    }
+    start_admin_server();
+}
+
+void ProxyServer::start_admin_server() {
+    if (config.admin_port > 0 && !admin_server) {
+        admin_server = std::make_unique<AdminServer>(context, config.admin_port);
+        if (!admin_server->start()) {
+            admin_server.reset();
+        }
+    }
+}
+
 bool ProxyServer::start() {
-    server_socket = SocketUtils::create_socket();
-    if (server_socket < 0) {
-        return false;
+    std::vector<int> cpus = ThreadPool::available_cpus();
+    int shard_count = config.listener_threads;
+    if (!server_sockets.empty()) {
+        if (shard_count > 0 && shard_count != static_cast<int>(server_sockets.size())) {
+            LOG_WARNING("Using the " + std::to_string(server_sockets.size()) +
+                        " inherited listener(s); --threads is ignored");
+        }
+        shard_count = server_sockets.size();
+    } else if (shard_count <= 0) {
+        shard_count = std::max<int>(1, cpus.size());
     }
     
-    if (!SocketUtils::bind_socket(server_socket, port)) {
-        SocketUtils::close_socket(server_socket);
-        return false;
+    for (int i = 0; i < shard_count; i++) {
+        shard_cpus.push_back(config.pin_cpus && !cpus.empty() ? cpus[i % cpus.size()] : -1);
+    }
+
+    if (io_mode == IoMode::IO_URING && !EventLoop::io_uring_supported()) {
+        LOG_WARNING("io_uring is not available on this kernel, using epoll");
+        io_mode = IoMode::EPOLL;
     }
     
-    if (!SocketUtils::listen_on_socket(server_socket)) {
-        SocketUtils::close_socket(server_socket);
+    drain_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (drain_fd < 0 || (server_sockets.empty() && !open_listeners(shard_count))) {
+        LOG_ERROR("Failed to open listeners: " + std::string(strerror(errno)));
+        for (int socket_fd : server_sockets) {
+            SocketUtils::close_socket(socket_fd);
+        }
+        server_sockets.clear();
+        SocketUtils::close_socket(drain_fd);
+        drain_fd = -1;
         return false;
     }
     
     running = true;
-    server_thread = std::thread(&ProxyServer::start_listening, this);
-    Logger::info("Proxy server started on port " + std::to_string(port));
+    accepting = shard_count;
+    accepts_stopped = false;
+    if (io_mode != IoMode::THREADED) {
+        if (!start_event_loops()) {
+            running = false;
+            stop_event_loops();
+            event_loops.clear();
+            for (int socket_fd : server_sockets) {
+                SocketUtils::close_socket(socket_fd);
+            }
+            server_sockets.clear();
+            SocketUtils::close_socket(drain_fd);
+            drain_fd = -1;
+            return false;
+        }
+    } else {
+        start_worker_pools();
+    }
+    maintenance_thread = std::thread(&ProxyServer::maintenance_loop, this);
+    start_admin_server();
+    LOG_INFO("Proxy server started on port " + std::to_string(port) +
+                 " (" + io_mode_to_string(io_mode) + " mode, " +
+                 std::to_string(shard_count) + " listener shard(s))");
     
     return true;
 }
 
+bool ProxyServer::open_listeners(int shard_count) {
+    for (int i = 0; i < shard_count; i++) {
+        int socket_fd = SocketUtils::create_socket();
+        if (socket_fd < 0) {
+            return false;
+        }
+        server_sockets.push_back(socket_fd);
+        
+        if (!SocketUtils::bind_socket(socket_fd, port, true) ||
+            !SocketUtils::listen_on_socket(socket_fd) ||
+            !SocketUtils::set_non_blocking(socket_fd)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void ProxyServer::stop() {
-    running = false;
-    if (server_socket >= 0) {
-        SocketUtils::close_socket(server_socket);
+    if (!running.exchange(false)) {
+        return;
+    }
+    if (admin_server) {
+        admin_server->stop();
+        admin_server.reset();
+    }
+    stop_accepting();
+    stop_event_loops();
+    stop_worker_pools();
+    for (int socket_fd : server_sockets) {
+        SocketUtils::close_socket(socket_fd);
+    }
+    server_sockets.clear();
+    SocketUtils::close_socket(drain_fd);
+    drain_fd = -1;
+    
+    // Resolver callbacks and finished refreshes post to the event loops, so
+    // the loops are only destroyed once neither can complete any more
+    context->revalidator->shutdown();
+    context->resolver->shutdown();
+    event_loops.clear();
+    
+    // Nothing serves from the cache any more; keep it for the next start
+    context->cache_manager->flush_to_disk();
+    
+    maintenance_cv.notify_all();
+    if (maintenance_thread.joinable()) {
+        maintenance_thread.join();
+    }
+    LOG_INFO("Proxy server stopped");
+}
+
+void ProxyServer::stop_accepting() {
+    if (accepts_stopped.exchange(true)) {
+        return;
+    }
+    // Threaded acceptors see drain_fd readable and return
+    uint64_t one = 1;
+    ssize_t written = write(drain_fd, &one, sizeof(one));
+    (void)written;
+    for (size_t i = 0; i < event_loops.size(); i++) {
+        EventLoop* loop = event_loops[i].get();
+        int socket_fd = server_sockets[i];
+        loop->post([this, loop, socket_fd]() {
+            loop->stop_accept(socket_fd, [this]() { accepting--; });
+        });
+    }
+}
+
+bool ProxyServer::drain(std::chrono::seconds timeout) {
+    if (!running) {
+        return true;
+    }
+    context->draining = true;
+    stop_accepting();
+    // Idle keep-alive connections close now, the others after their response
+    for (auto& loop : event_loops) {
+        EventLoop* target = loop.get();
+        target->post([target]() { target->notify_drain(); });
+    }
+    LOG_INFO("Draining connections for up to " + std::to_string(timeout.count()) + "s");
+    
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (accepting > 0 || context->admission->open_connections() > 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            LOG_WARNING("Drain timed out with " + std::to_string(context->admission->open_connections()) +
+                        " connection(s) open");
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    LOG_INFO("All connections drained");
+    return true;
+}
+
+void ProxyServer::maintenance_loop() {
+    std::unique_lock<std::mutex> lock(maintenance_mutex);
+    while (running) {
+        maintenance_cv.wait_for(lock, std::chrono::seconds(1));
+        context->upstream_pool->prune();
+        context->admission->prune();
+        context->resolver->prune();
+        context->cache_manager->prune();
+    }
+}
+
+bool ProxyServer::start_event_loops() {
+    EventLoop::Backend backend = io_mode == IoMode::IO_URING ? EventLoop::Backend::IO_URING
+                                                              : EventLoop::Backend::EPOLL;
+    for (size_t i = 0; i < server_sockets.size(); i++) {
+        auto loop = std::make_unique<EventLoop>(backend);
+        if (!loop->is_valid()) {
+            return false;
+        }
+        
+        if (loop->backend() == EventLoop::Backend::IO_URING) {
+            // One multishot accept keeps delivering clients
+            EventLoop* owner = loop.get();
+            std::shared_ptr<ProxyContext> shared_context = context;
+            loop->accept_multishot(server_sockets[i], [owner, shared_context](int client_socket) {
+                LOG_INFO("New connection from " + SocketUtils::peer_address(client_socket));
+                std::make_shared<ClientConnection>(*owner, client_socket, shared_context)->start();
+            });
+        } else {
+            auto acceptor = std::make_shared<Acceptor>(server_sockets[i], *loop, context);
+            if (!loop->add(server_sockets[i], EPOLLIN, acceptor)) {
+                return false;
+            }
+        }
+        event_loops.push_back(std::move(loop));
+    }
+    
+    for (size_t i = 0; i < event_loops.size(); i++) {
+        EventLoop* loop = event_loops[i].get();
+        int cpu = shard_cpus[i];
+        loop_threads.emplace_back([loop, cpu]() {
+            if (cpu >= 0) {
+                ThreadPool::pin_current_thread(cpu);
+            }
+            loop->run();
+        });
+    }
+    
+    LOG_INFO("Started " + std::to_string(event_loops.size()) + " event loop thread(s)");
+    return true;
+}
+
+void ProxyServer::stop_event_loops() {
+    for (auto& loop : event_loops) {
+        loop->stop();
+    }
+    for (auto& thread : loop_threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    loop_threads.clear();
+}
+
+void ProxyServer::start_worker_pools() {
+    for (size_t i = 0; i < server_sockets.size(); i++) {
+        worker_pools.push_back(std::make_unique<ThreadPool>(
+            config.worker_threads, config.queue_depth, shard_cpus[i]));
     }
-    if (server_thread.joinable()) {
-        server_thread.join();
+    for (size_t i = 0; i < server_sockets.size(); i++) {
+        acceptor_threads.emplace_back(&ProxyServer::start_listening, this, i);
     }
-    Logger::info("Proxy server stopped");
+    
+    LOG_INFO("Started " + std::to_string(server_sockets.size()) + " acceptor(s) with " +
+                 std::to_string(config.worker_threads) + " worker(s) each");
+}
+
+void ProxyServer::stop_worker_pools() {
+    for (auto& thread : acceptor_threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    acceptor_threads.clear();
+    
+    // Unblock handlers waiting on their sockets so the workers can be joined
+    {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        for (int socket_fd : active_sockets) {
+            shutdown(socket_fd, SHUT_RDWR);
+        }
+    }
+    for (auto& pool : worker_pools) {
+        pool->shutdown();
+    }
+    worker_pools.clear();
 }
 
-void ProxyServer::start_listening() {
+void ProxyServer::start_listening(size_t shard) {
+    if (shard_cpus[shard] >= 0) {
+        ThreadPool::pin_current_thread(shard_cpus[shard]);
+    }
+    
+    // Wait in poll() rather than accept(), so drain_fd can end the loop
+    // without touching the listener
+    struct pollfd polled[2] = {{server_sockets[shard], POLLIN, 0}, {drain_fd, POLLIN, 0}};
     while (running) {
-        int client_socket = SocketUtils::accept_connection(server_socket);
-        if (client_socket < 0) {
-            if (running) {
+        if (poll(polled, 2, -1) < 0) {
+            if (errno == EINTR) {
                 continue;
-            } else {
-                break;
             }
+            LOG_ERROR("poll failed: " + std::string(strerror(errno)));
+            break;
+        }
+        if (polled[1].revents != 0) {
+            break;
         }
         
-        // Handle each client in a separate thread
-        std::thread(&ProxyServer::handle_client, this, client_socket).detach();
+        int client_socket;
+        while ((client_socket = SocketUtils::accept_connection(server_sockets[shard])) >= 0) {
+            std::string client_key;
+            if (!context->admission->admit_connection(client_socket, client_key)) {
+                std::string refusal = AdmissionControl::overloaded_response();
+                SocketUtils::send_data(client_socket, refusal.data(), refusal.size());
+                SocketUtils::close_socket(client_socket);
+                continue;
+            }
+            
+            // Hand the client to this shard's bounded worker pool
+            track_socket(client_socket);
+            auto accepted = Metrics::Clock::now();
+            auto task = [this, client_socket, client_key, accepted]() {
+                Metrics::add(Metrics::CONNECTIONS);
+                Metrics::adjust(Metrics::ACTIVE_CONNECTIONS, 1);
+                Metrics::observe_since(Metrics::QUEUE, accepted);
+                handle_client(client_socket, client_key, accepted);
+                Metrics::adjust(Metrics::ACTIVE_CONNECTIONS, -1);
+                context->admission->release_connection(client_key);
+            };
+            if (!worker_pools[shard]->try_submit(task)) {
+                LOG_WARNING("Worker queue full - rejecting connection");
+                Metrics::add(Metrics::SHED_QUEUE_FULL);
+                std::string refusal = AdmissionControl::overloaded_response();
+                SocketUtils::send_data(client_socket, refusal.data(), refusal.size());
+                release_socket(client_socket);
+                context->admission->release_connection(client_key);
+            }
+        }
     }
+    accepting--;
 }
 
-void ProxyServer::handle_client(int client_socket) {
-    const int BUFFER_SIZE = 4096;
-    char buffer[BUFFER_SIZE];
-    
-    // Receive request from client
-    int received = SocketUtils::receive_data(client_socket, buffer, BUFFER_SIZE - 1);
-    if (received <= 0) {
-        SocketUtils::close_socket(client_socket);
+void ProxyServer::track_socket(int socket_fd) {
+    if (socket_fd < 0) {
         return;
     }
+    std::lock_guard<std::mutex> lock(active_mutex);
+    active_sockets.insert(socket_fd);
+    if (!running) {
+        shutdown(socket_fd, SHUT_RDWR);
+    }
+}
+
+void ProxyServer::untrack_socket(int socket_fd) {
+    std::lock_guard<std::mutex> lock(active_mutex);
+    active_sockets.erase(socket_fd);
+}
+
+void ProxyServer::release_socket(int socket_fd) {
+    if (socket_fd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(active_mutex);
+    active_sockets.erase(socket_fd);
+    SocketUtils::close_socket(socket_fd);
+}
+
+int ProxyServer::connect_upstream(const std::string& host, int port) {
+    auto resolve_start = Metrics::Clock::now();
+    DnsResolver::Result resolved = context->resolver->resolve_sync(host);
+    Metrics::observe_since(Metrics::DNS, resolve_start);
+    if (!resolved.ok) {
+        LOG_ERROR("Failed to resolve host: " + host + " (" + resolved.error + ")");
+        return -1;
+    }
     
-    buffer[received] = '\0';
-    std::string request_data(buffer);
-    
-    Logger::debug("Received request from client");
+    // Bounded by the connect timeout, so stop() need not interrupt it
+    auto connect_start = Metrics::Clock::now();
+    int target_socket = ConnectRace::connect(resolved.addresses, port, context->connect_options);
+    if (target_socket < 0) {
+        return -1;
+    }
+    Metrics::observe_since(Metrics::CONNECT, connect_start);
+    track_socket(target_socket);
+    return target_socket;
+}
+
+void ProxyServer::handle_client(int client_socket, const std::string& client_key,
+                                Metrics::Clock::time_point accepted) {
+    // Bytes read from the client but not yet consumed; with pipelining this
+    // can hold several requests
+    std::string pending;
+    // Responses to consecutive cache hits, sent together with one writev
+    ResponseBatch batch;
+    HttpParser parser(HttpParser::Kind::REQUEST);
+    // Kept across requests so their memory is reused; see HttpHandler::recycle
+    HttpRequest request;
+    std::string serialized_request;
+    bool keep_alive = true;
+    bool answered = false;
+    // Only the first request waited in the worker queue
+    bool late = context->admission->over_queue_target(accepted);
     
-    // Parse HTTP request
-    HttpRequest request = HttpHandler::parse_request(request_data);
+    while (keep_alive && running) {
+        HttpHandler::recycle(request);
+        HttpHandler::recycle(serialized_request);
+        if (!read_request_head(client_socket, pending, parser, batch, answered)) {
+            break;
+        }
+        
+        LOG_DEBUG("Received request from client");
+        
+        // Parse HTTP request
+        HttpHandler::build_request(parser, request);
+        Metrics::add(Metrics::REQUESTS);
+        pending.erase(0, parser.head_length());
+        parser.reset();
+        answered = true;
+        keep_alive = config.client_keepalive && HttpHandler::client_wants_keep_alive(request);
+        
+        // Where the body ends must be certain, or the next request would be
+        // read from the middle of it
+        uint64_t body_length = 0;
+        bool chunked = false;
+        if (!HttpHandler::request_body_framing(request, body_length, chunked)) {
+            LOG_ERROR("Ambiguous request body length");
+            const char* bad_request = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+            if (flush_batch(client_socket, batch)) {
+                SocketUtils::send_all(client_socket, bad_request, strlen(bad_request));
+            }
+            break;
+        }
+        bool shed = late;
+        late = false;
+        
+        int retry_after = context->admission->admit_request(client_key);
+        if (retry_after > 0) {
+            std::string refusal = AdmissionControl::rate_limited_response(retry_after);
+            if (flush_batch(client_socket, batch)) {
+                SocketUtils::send_all(client_socket, refusal.data(), refusal.size());
+            }
+            break;
+        }
+        
+        // Check if this is a CONNECT request (for HTTPS tunneling)
+        if (request.method == "CONNECT") {
+            if (shed) {
+                shed_request(client_socket, batch);
+                release_socket(client_socket);
+            } else if (flush_batch(client_socket, batch)) {
+                handle_connect_tunnel(client_socket, request, pending);
+            } else {
+                release_socket(client_socket);
+            }
+            return;
+        }
+        
+        // Check cache for GET requests
+        std::shared_ptr<const CachedBlock> cached_block;
+        auto cache_start = std::chrono::high_resolution_clock::now();
+        if (request.method == "GET" && context->cache_manager->get(request, cached_block)) {
+            if (shed) {
+                Metrics::add(Metrics::SPARED_HITS);
+            }
+            // Serve from cache; the batch points into the cached block. While
+            // draining, the response sends the client on to the new process.
+            keep_alive = batch.add(std::move(cached_block), keep_alive && !context->draining);
+            if (keep_alive && !skip_request_body(client_socket, pending, body_length, chunked, batch)) {
+                break;
+            }
+            auto cache_end = std::chrono::high_resolution_clock::now();
+            auto cache_duration = std::chrono::duration_cast<std::chrono::milliseconds>(cache_end - cache_start);
+            Metrics::observe(Metrics::CACHE_HIT, cache_end - cache_start);
+            
+            LOG_INFO("✓ Retrieved from CACHE in " + std::to_string(cache_duration.count()) + "ms");
+            continue;
+        }
+        
+        // An expired copy is refreshed in the background; within
+        // stale-while-revalidate it is served meanwhile
+        bool has_stale = request.method == "GET" && context->revalidator->refresh(request);
+        if (has_stale &&
+            context->cache_manager->serve_stale(request, StaleUse::WHILE_REVALIDATING, cached_block)) {
+            keep_alive = batch.add(std::move(cached_block), keep_alive && !context->draining);
+            if (keep_alive && !skip_request_body(client_socket, pending, body_length, chunked, batch)) {
+                break;
+            }
+            continue;
+        }
+        
+        if (shed) {
+            shed_request(client_socket, batch);
+            break;
+        }
+        
+        // Earlier responses go out before this one
+        if (!flush_batch(client_socket, batch)) {
+            break;
+        }
+        
+        // Of concurrent misses for one URL only the first goes upstream; the
+        // others are answered from what it stores. Expired copies always
+        // wait for their refresh.
+        bool fetch_leader = false;
+        if (request.method == "GET" && (config.collapsed_forwarding || has_stale) &&
+            wait_for_fetch(request, cached_block, fetch_leader, has_stale)) {
+            keep_alive = batch.add(std::move(cached_block), keep_alive && !context->draining);
+            LOG_INFO("✓ Retrieved from CACHE after waiting for a fetch in flight");
+            if (keep_alive && !skip_request_body(client_socket, pending, body_length, chunked, batch)) {
+                break;
+            }
+            continue;
+        }
+        
+        // Exactly one body is read, so the next pipelined request starts
+        // where this one ends
+        bool delimited = forward_request(client_socket, request, serialized_request, pending, body_length, chunked);
+        if (fetch_leader) {
+            context->cache_manager->end_fetch(request);
+        }
+        // Closed once the process is draining for an upgrade, so the client
+        // reconnects to the new one
+        if (!delimited || context->draining) {
+            keep_alive = false;
+        }
+    }
     
-    // Check if this is a CONNECT request (for HTTPS tunneling)
-    if (request.method == "CONNECT") {
-        handle_connect_tunnel(client_socket, request);
-        return;
+    flush_batch(client_socket, batch);
+    release_socket(client_socket);
+}
+
+void ProxyServer::shed_request(int client_socket, ResponseBatch& batch) {
+    Metrics::add(Metrics::SHED_QUEUE_TIME);
+    LOG_DEBUG("Request waited past the queue target, shedding it");
+    std::string refusal = AdmissionControl::overloaded_response();
+    if (flush_batch(client_socket, batch)) {
+        SocketUtils::send_all(client_socket, refusal.data(), refusal.size());
     }
+}
+
+bool ProxyServer::read_request_head(int client_socket, std::string& pending, HttpParser& parser,
+                                    ResponseBatch& batch, bool answered) {
+    PooledBuffer buffer = PooledBuffer::acquire();
     
-    // Check cache for GET requests
-    HttpResponse cached_response;
-    if (request.method == "GET" && cache_manager->get(request, cached_response)) {
-        // Serve from cache
-        auto cache_start = std::chrono::high_resolution_clock::now();
-        std::string serialized_response = HttpHandler::serialize_response(cached_response);
-        SocketUtils::send_data(client_socket, serialized_response.c_str(), serialized_response.length());
-        auto cache_end = std::chrono::high_resolution_clock::now();
-        auto cache_duration = std::chrono::duration_cast<std::chrono::milliseconds>(cache_end - cache_start);
+    while (true) {
+        // Each call only scans the bytes appended since the last one
+        HttpParser::Result parsed = parser.parse(pending.data(), pending.size());
+        if (parsed == HttpParser::Result::COMPLETE) {
+            return true;
+        }
+        if (parsed == HttpParser::Result::ERROR) {
+            const char* error_response = parser.head_too_large()
+                ? "HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\n\r\n"
+                : "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+            LOG_ERROR(parser.head_too_large() ? "Request headers too large" : "Malformed request");
+            if (flush_batch(client_socket, batch)) {
+                SocketUtils::send_all(client_socket, error_response, strlen(error_response));
+            }
+            return false;
+        }
         
-        Logger::info("✓ Retrieved from CACHE in " + std::to_string(cache_duration.count()) + "ms");
-        SocketUtils::close_socket(client_socket);
-        return;
+        // About to wait on the client: send the cache hits gathered so far
+        if (!flush_batch(client_socket, batch)) {
+            return false;
+        }
+        
+        // Between requests the connection is idle, and a drain closes it
+        bool idle = answered && pending.empty();
+        struct pollfd polled[2] = {{client_socket, POLLIN, 0}, {drain_fd, POLLIN, 0}};
+        int ready = poll(polled, idle ? 2 : 1, config.client_idle_timeout * 1000);
+        if (ready == 0) {
+            LOG_DEBUG("Closing idle client connection");
+            return false;
+        }
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (idle && polled[0].revents == 0) {
+            LOG_DEBUG("Closing idle client connection for the drain");
+            return false;
+        }
+        
+        int received = SocketUtils::receive_data(client_socket, buffer.data(), buffer.size());
+        if (received <= 0) {
+            return false;
+        }
+        Metrics::add(Metrics::CLIENT_BYTES_IN, received);
+        pending.append(buffer.data(), received);
+    }
+}
+
+ProxyServer::BodyRelay ProxyServer::relay_request_body(int client_socket, std::string& pending, uint64_t length,
+                                                      bool chunked, int target_socket) {
+    auto send_part = [target_socket](const char* data, size_t size) {
+        if (target_socket < 0 || size == 0) {
+            return true;
+        }
+        if (!SocketUtils::send_all(target_socket, data, size)) {
+            return false;
+        }
+        Metrics::add(Metrics::UPSTREAM_BYTES_OUT, size);
+        return true;
+    };
+    
+    // What arrived along with the head goes first
+    ResponseFramer framer = chunked ? ResponseFramer::chunked_body() : ResponseFramer::fixed_body(length);
+    size_t used = 0;
+    ResponseFramer::Result result = framer.consume(pending.data(), pending.size(), used);
+    if (result != ResponseFramer::Result::ERROR && !send_part(pending.data(), used)) {
+        return BodyRelay::TARGET_FAILED;
     }
+    pending.erase(0, used);
+    
+    PooledBuffer buffer = PooledBuffer::acquire();
+    while (result == ResponseFramer::Result::NEED_MORE) {
+        int received = SocketUtils::receive_data(client_socket, buffer.data(), buffer.size());
+        if (received <= 0) {
+            return BodyRelay::CLIENT_FAILED;
+        }
+        Metrics::add(Metrics::CLIENT_BYTES_IN, received);
+        result = framer.consume(buffer.data(), received, used);
+        // Pipelined bytes after the body belong to the next request
+        pending.append(buffer.data() + used, received - used);
+        if (result != ResponseFramer::Result::ERROR && !send_part(buffer.data(), used)) {
+            return BodyRelay::TARGET_FAILED;
+        }
+    }
+    if (result == ResponseFramer::Result::ERROR) {
+        LOG_ERROR("Malformed chunked request body");
+        return BodyRelay::MALFORMED;
+    }
+    return BodyRelay::DONE;
+}
+
+bool ProxyServer::skip_request_body(int client_socket, std::string& pending, uint64_t length, bool chunked,
+                                    ResponseBatch& batch) {
+    if (!chunked && length == 0) {
+        return true;
+    }
+    // May wait on the client: send the responses gathered so far
+    return flush_batch(client_socket, batch) &&
+           relay_request_body(client_socket, pending, length, chunked, -1) == BodyRelay::DONE;
+}
+
+bool ProxyServer::flush_batch(int client_socket, ResponseBatch& batch) {
+    while (!batch.empty()) {
+        ssize_t sent = batch.send(client_socket);
+        if (sent <= 0) {
+            LOG_ERROR("Failed to send data");
+            batch.clear();
+            return false;
+        }
+        Metrics::add(Metrics::CLIENT_BYTES_OUT, sent);
+    }
+    batch.clear();
+    return true;
+}
+
+bool ProxyServer::wait_for_fetch(const HttpRequest& request, std::shared_ptr<const CachedBlock>& block,
+                                 bool& leader, bool has_stale) {
+    auto signal = std::make_shared<FetchSignal>();
+    leader = context->cache_manager->begin_fetch(request, [signal]() {
+        std::lock_guard<std::mutex> lock(signal->mutex);
+        signal->done = true;
+        signal->cv.notify_one();
+    });
+    if (leader) {
+        return false;
+    }
+    
+    bool done;
+    {
+        std::unique_lock<std::mutex> lock(signal->mutex);
+        done = signal->cv.wait_for(lock, std::chrono::milliseconds(config.collapse_timeout_ms),
+                                   [&signal]() { return signal->done; });
+    }
+    if (context->cache_manager->get_collapsed(request, block, !done)) {
+        return true;
+    }
+    // The refresh failed: fall back to the stale copy if stale-if-error allows
+    if (has_stale && context->cache_manager->serve_stale(request, StaleUse::ON_ERROR, block)) {
+        return true;
+    }
+    if (!done) {
+        LOG_WARNING("Fetch in flight took too long, fetching separately");
+    }
+    return false;
+}
+
+bool ProxyServer::forward_request(int client_socket, HttpRequest& request, std::string& serialized_request,
+                                  std::string& pending, uint64_t body_length, bool chunked) {
     
     // Extract target host and port
     std::string target_host = HttpHandler::extract_host(request);
-    int target_port = HttpHandler::extract_port(request);
+    int target_port = 0;
+    try {
+        target_port = HttpHandler::extract_port(request);
+    } catch (...) {
+        LOG_ERROR("Invalid Host header");
+        const char* bad_request = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+        SocketUtils::send_all(client_socket, bad_request, strlen(bad_request));
+        return false;
+    }
     
-    Logger::info("Resolving " + target_host + ":" + std::to_string(target_port) + "...");
+    // The body is framed as it is relayed, so the upstream connection may be
+    // reused after it
+    bool has_body = chunked || body_length > 0;
+    bool body_relayed = !has_body;
+    auto& upstream_pool = context->upstream_pool;
+    bool pool_upstream = upstream_pool->is_enabled();
+    HttpHandler::prepare_upstream_request(request, pool_upstream);
+    HttpHandler::serialize_request(request, serialized_request);
     
-    // Connect to target server and measure time
+    // Connect to target server (or reuse an idle one) and measure time
     auto resolve_start = std::chrono::high_resolution_clock::now();
-    int target_socket = SocketUtils::create_socket();
-    if (target_socket < 0 || !SocketUtils::connect_to_host(target_socket, target_host, target_port)) {
-        Logger::error("Failed to connect to target server");
-        SocketUtils::close_socket(client_socket);
-        SocketUtils::close_socket(target_socket);
-        return;
+    bool reused = false;
+    int target_socket = pool_upstream ? upstream_pool->acquire(target_host, target_port) : -1;
+    if (target_socket >= 0) {
+        reused = true;
+        track_socket(target_socket);
+        LOG_INFO("✓ Reusing pooled connection to " + target_host + ":" + std::to_string(target_port));
+    } else {
+        LOG_INFO("Resolving " + target_host + ":" + std::to_string(target_port) + "...");
+        target_socket = connect_upstream(target_host, target_port);
+        if (target_socket < 0) {
+            LOG_ERROR("Failed to connect to target server");
+            const char* bad_gateway = "HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n";
+            SocketUtils::send_all(client_socket, bad_gateway, strlen(bad_gateway));
+            return false;
+        }
+        auto resolve_end = std::chrono::high_resolution_clock::now();
+        auto resolve_duration = std::chrono::duration_cast<std::chrono::milliseconds>(resolve_end - resolve_start);
+        
+        LOG_INFO("✓ Connected in " + std::to_string(resolve_duration.count()) + "ms");
     }
-    auto resolve_end = std::chrono::high_resolution_clock::now();
-    auto resolve_duration = std::chrono::duration_cast<std::chrono::milliseconds>(resolve_end - resolve_start);
-    
-    Logger::info("✓ Connected in " + std::to_string(resolve_duration.count()) + "ms");
     
-    // Forward request to target server
-    std::string serialized_request = HttpHandler::serialize_request(request);
-    SocketUtils::send_data(target_socket, serialized_request.c_str(), serialized_request.length());
-    
-    // Collect response headers first
+    PooledBuffer buffer = PooledBuffer::acquire();
     auto transfer_start = std::chrono::high_resolution_clock::now();
-    std::string full_response;
-    std::string headers_only;
-    bool headers_complete = false;
+    size_t response_bytes = 0;
+    ResponseFramer framer(request.method == "HEAD");
+    CacheFill fill(static_cast<size_t>(config.cache_max_object_kb) * 1024);
+    fill.begin(request, framer);
+    bool reusable = false;
+    bool framing_failed = false;
     
     while (true) {
-        int response_received = SocketUtils::receive_data(target_socket, buffer, BUFFER_SIZE);
-        if (response_received <= 0) {
-            break;
+        // Forward request to target server; the origin may write its head and
+        // body separately, so don't sit on the ACK for the first part
+        SocketUtils::set_quick_ack(target_socket);
+        bool request_sent = SocketUtils::send_all(target_socket, serialized_request.c_str(), serialized_request.length());
+        if (request_sent) {
+            Metrics::add(Metrics::UPSTREAM_BYTES_OUT, serialized_request.length());
+        }
+        if (request_sent && has_body) {
+            // Streamed as it arrives rather than held whole
+            BodyRelay relayed = relay_request_body(client_socket, pending, body_length, chunked, target_socket);
+            if (relayed == BodyRelay::CLIENT_FAILED || relayed == BodyRelay::MALFORMED) {
+                if (relayed == BodyRelay::MALFORMED) {
+                    const char* bad_request = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+                    SocketUtils::send_all(client_socket, bad_request, strlen(bad_request));
+                }
+                release_socket(target_socket);
+                return false;
+            }
+            body_relayed = relayed == BodyRelay::DONE;
+            request_sent = body_relayed;
         }
         
-        full_response.append(buffer, response_received);
-        SocketUtils::send_data(client_socket, buffer, response_received);
-        
-        // Cache as soon as we have complete headers
-        if (!headers_complete && full_response.find("\r\n\r\n") != std::string::npos) {
-            headers_complete = true;
+        while (request_sent) {
+            int response_received = SocketUtils::receive_data(target_socket, buffer.data(), buffer.size());
+            if (response_received <= 0) {
+                framer.finish_on_close();
+                break;
+            }
+            SocketUtils::set_quick_ack(target_socket); // Re-armed after every read
+            Metrics::add(Metrics::UPSTREAM_BYTES_IN, response_received);
             
-            // Parse and cache the response if it's a GET request
-            if (request.method == "GET") {
-                HttpResponse response = HttpHandler::parse_response(full_response);
-                cache_manager->put(request, response);
-                Logger::info("💾 Response headers received - CACHED immediately");
+            // Stop exactly at the end of the response so the connection can be reused
+            size_t used = 0;
+            ResponseFramer::Result result = framer.consume(buffer.data(), response_received, used);
+            if (result == ResponseFramer::Result::ERROR) {
+                used = response_received; // Unframeable: relay until close
+                framing_failed = true;
             }
+            
+            if (response_bytes == 0 && used > 0) {
+                Metrics::observe(Metrics::FIRST_BYTE, std::chrono::high_resolution_clock::now() - transfer_start);
+            }
+            response_bytes += used;
+            if (SocketUtils::send_all(client_socket, buffer.data(), used)) {
+                Metrics::add(Metrics::CLIENT_BYTES_OUT, used);
+            }
+            
+            if (result == ResponseFramer::Result::COMPLETE) {
+                reusable = pool_upstream && framer.keep_alive() && used == static_cast<size_t>(response_received);
+                break;
+            }
+        }
+        
+        // A pooled connection may have been closed by the server just before
+        // we used it; retry once on a fresh connection if nothing was relayed
+        // and the request is safe to send twice
+        if (reused && response_bytes == 0 && !has_body && HttpHandler::is_idempotent(request.method)) {
+            LOG_INFO("Pooled connection was stale, reconnecting");
+            release_socket(target_socket);
+            reused = false;
+            framer = ResponseFramer(request.method == "HEAD");
+            fill.begin(request, framer);
+            target_socket = connect_upstream(target_host, target_port);
+            if (target_socket < 0) {
+                LOG_ERROR("Failed to connect to target server");
+                const char* bad_gateway = "HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n";
+                SocketUtils::send_all(client_socket, bad_gateway, strlen(bad_gateway));
+                return false;
+            }
+            continue;
+        }
+        if (response_bytes == 0) {
+            // Nothing reached the client yet, so it can still be told
+            LOG_ERROR("Target server closed without a response");
+            const char* bad_gateway = "HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n";
+            SocketUtils::send_all(client_socket, bad_gateway, strlen(bad_gateway));
         }
+        break;
     }
     
-    if (!headers_complete && request.method == "GET" && !full_response.empty()) {
-        // Fallback: cache even if headers weren't complete
-        HttpResponse response = HttpHandler::parse_response(full_response);
-        cache_manager->put(request, response);
+    // Stored only if the origin sent the whole response
+    if (!framing_failed) {
+        fill.finish(*context->cache_manager, request, framer);
     }
     
     auto transfer_end = std::chrono::high_resolution_clock::now();
     auto transfer_duration = std::chrono::duration_cast<std::chrono::milliseconds>(transfer_end - transfer_start);
+    Metrics::observe(Metrics::TRANSFER, transfer_end - transfer_start);
     
-    Logger::info("✓ Response received and transferred in " + std::to_string(transfer_duration.count()) + "ms");
-    Logger::info("Request completed (Response size: " + std::to_string(full_response.length()) + " bytes)");
+    LOG_INFO("✓ Response received and transferred in " + std::to_string(transfer_duration.count()) + "ms");
+    LOG_INFO("Request completed (Response size: " + std::to_string(response_bytes) + " bytes)");
     
-    // Clean up
-    SocketUtils::close_socket(client_socket);
-    SocketUtils::close_socket(target_socket);
+    if (reusable) {
+        untrack_socket(target_socket);
+        upstream_pool->release(target_host, target_port, target_socket);
+    } else {
+        release_socket(target_socket);
+    }
+    
+    // The client can send another request only if this response had a
+    // definite end and its whole request body was read
+    return framer.is_complete() && !framing_failed && framer.framing() != BodyFraming::UNTIL_CLOSE &&
+           body_relayed;
 }
 
-void ProxyServer::handle_connect_tunnel(int client_socket, const HttpRequest& request) {
+void ProxyServer::handle_connect_tunnel(int client_socket, const HttpRequest& request,
+                                        const std::string& early_data) {
     // CONNECT method is used for HTTPS tunneling
     // Format: CONNECT host:port HTTP/1.1
     
     // Parse the host:port from the path
-    std::string host_port = request.path;
-    size_t colon = host_port.find(':');
-    
-    if (colon == std::string::npos) {
-        Logger::error("Invalid CONNECT request format");
-        SocketUtils::close_socket(client_socket);
+    std::string target_host;
+    int target_port;
+    if (!HttpHandler::split_authority(request.path, 0, target_host, target_port) || target_port == 0) {
+        LOG_ERROR("Invalid CONNECT request format");
+        release_socket(client_socket);
         return;
     }
     
-    std::string target_host = host_port.substr(0, colon);
-    int target_port = std::stoi(host_port.substr(colon + 1));
-    
-    Logger::info("CONNECT tunnel requested to " + target_host + ":" + std::to_string(target_port));
+    LOG_INFO("CONNECT tunnel requested to " + target_host + ":" + std::to_string(target_port));
     
     // Connect to target server
-    int target_socket = SocketUtils::create_socket();
-    if (target_socket < 0 || !SocketUtils::connect_to_host(target_socket, target_host, target_port)) {
-        Logger::error("Failed to connect to target server for CONNECT tunnel");
+    int target_socket = connect_upstream(target_host, target_port);
+    if (target_socket < 0) {
+        LOG_ERROR("Failed to connect to target server for CONNECT tunnel");
         const char* error_response = "HTTP/1.1 502 Bad Gateway\r\nConnection: close\r\n\r\n";
         SocketUtils::send_data(client_socket, error_response, strlen(error_response));
-        SocketUtils::close_socket(client_socket);
-        SocketUtils::close_socket(target_socket);
+        release_socket(client_socket);
         return;
     }
     
     // Send 200 OK response to client
     const char* success_response = "HTTP/1.1 200 Connection Established\r\nConnection: close\r\n\r\n";
-    SocketUtils::send_data(client_socket, success_response, strlen(success_response));
+    if (SocketUtils::send_data(client_socket, success_response, strlen(success_response)) > 0) {
+        Metrics::add(Metrics::CLIENT_BYTES_OUT, strlen(success_response));
+    }
     
-    Logger::info("CONNECT tunnel established");
+    LOG_INFO("CONNECT tunnel established");
+    Metrics::add(Metrics::TUNNELS);
+    Metrics::adjust(Metrics::ACTIVE_TUNNELS, 1);
     
-    // Bidirectional tunnel: forward data between client and target
-    std::thread client_to_target([client_socket, target_socket]() {
-        const int BUFFER_SIZE = 4096;
-        char buffer[BUFFER_SIZE];
-        while (true) {
-            int received = SocketUtils::receive_data(client_socket, buffer, BUFFER_SIZE);
-            if (received <= 0) break;
-            SocketUtils::send_data(target_socket, buffer, received);
-        }
-    });
+    relay_tunnel(client_socket, target_socket, early_data);
+    Metrics::adjust(Metrics::ACTIVE_TUNNELS, -1);
     
-    std::thread target_to_client([client_socket, target_socket]() {
-        const int BUFFER_SIZE = 4096;
-        char buffer[BUFFER_SIZE];
-        while (true) {
-            int received = SocketUtils::receive_data(target_socket, buffer, BUFFER_SIZE);
-            if (received <= 0) break;
-            SocketUtils::send_data(client_socket, buffer, received);
-        }
-    });
+    // Clean up
+    release_socket(client_socket);
+    release_socket(target_socket);
+}
+
+void ProxyServer::relay_tunnel(int client_socket, int target_socket, const std::string& early_data) {
+    // Bidirectional tunnel on this worker thread: both directions are pumped
+    // without blocking and poll() waits for whichever side is stalled
+    const int PUMP_BUDGET = 64;
     
-    client_to_target.join();
-    target_to_client.join();
+    SocketUtils::set_non_blocking(client_socket);
+    SocketUtils::set_non_blocking(target_socket);
     
-    Logger::info("CONNECT tunnel closed");
+    RelayDirection to_target;
+    RelayDirection to_client;
+    to_target.attach(client_socket, target_socket);
+    to_client.attach(target_socket, client_socket);
+    to_target.count_into(Metrics::CLIENT_BYTES_IN, Metrics::UPSTREAM_BYTES_OUT);
+    to_client.count_into(Metrics::UPSTREAM_BYTES_IN, Metrics::CLIENT_BYTES_OUT);
+    // Read along with the CONNECT head, ahead of anything still to come
+    to_target.queue(early_data);
+    if (config.use_splice) {
+        to_target.enable_splice();
+        to_client.enable_splice();
+    }
     
-    // Clean up
-    SocketUtils::close_socket(client_socket);
-    SocketUtils::close_socket(target_socket);
+    bool target_write_closed = false;
+    bool client_write_closed = false;
+    
+    while (!target_write_closed || !client_write_closed) {
+        RelayDirection::Status upstream = to_target.pump(PUMP_BUDGET);
+        RelayDirection::Status downstream = to_client.pump(PUMP_BUDGET);
+        if (upstream == RelayDirection::Status::FAILED || downstream == RelayDirection::Status::FAILED) {
+            break;
+        }
+        
+        // Propagate half-close: EOF from one side becomes FIN towards the other
+        if (upstream == RelayDirection::Status::FINISHED && !target_write_closed) {
+            shutdown(target_socket, SHUT_WR);
+            target_write_closed = true;
+        }
+        if (downstream == RelayDirection::Status::FINISHED && !client_write_closed) {
+            shutdown(client_socket, SHUT_WR);
+            client_write_closed = true;
+        }
+        if (upstream == RelayDirection::Status::YIELDED || downstream == RelayDirection::Status::YIELDED) {
+            continue;
+        }
+        
+        struct pollfd fds[2];
+        fds[0] = {client_socket, 0, 0};
+        fds[1] = {target_socket, 0, 0};
+        if (upstream == RelayDirection::Status::BLOCKED) {
+            if (to_target.has_pending()) {
+                fds[1].events |= POLLOUT;
+            } else {
+                fds[0].events |= POLLIN;
+            }
+        }
+        if (downstream == RelayDirection::Status::BLOCKED) {
+            if (to_client.has_pending()) {
+                fds[0].events |= POLLOUT;
+            } else {
+                fds[1].events |= POLLIN;
+            }
+        }
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            break;
+        }
+    }
+    
+    LOG_INFO("CONNECT tunnel closed (client→target " + std::to_string(to_target.bytes_relayed()) +
+                 " bytes, target→client " + std::to_string(to_client.bytes_relayed()) + " bytes, " +
+                 (to_client.is_spliced() ? "splice" : "buffered") + ")");
 }
 
 int ProxyServer::get_port() const {
@@ -0,0 +1,567 @@
+#include "relay_direction.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iterator>
+
+namespace {
+    const size_t SPLICE_CHUNK_SIZE = 65536;
+    // io_uring: chunks waiting to be written before the receive is stopped
+    const size_t MAX_RING_CHUNKS = 4;
+
+    bool would_block() {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    // A ring operation that made no progress but may be retried
+    bool is_retryable(int result) {
+        return result == -EAGAIN || result == -EINTR;
+    }
+}
+
+struct RelayDirection::RingIo {
+    // A read's result, not yet taken by pump()
+    struct Received {
+        int result;
+        IoRing::Buffer provided; // Holds the bytes, or else 'pooled' does
+        PooledBuffer pooled;
+    };
+    // Bytes taken and waiting to be written
+    struct Chunk {
+        IoRing::Buffer provided;
+        PooledBuffer pooled;
+        const char* data;
+        size_t length;
+    };
+
+    std::function<void()> wake; // Cleared once orphaned
+
+    bool reading = false;      // A receive or splice is in flight
+    EventLoop::OperationId multishot = 0; // The multishot receive, until cancelled
+    bool use_pooled = false;   // The provided buffers ran out
+    bool read_stalled = false; // The pipe was full; wait for a write
+    PooledBuffer pooled;       // Target of a one-shot receive into a pooled buffer
+    std::deque<Received> received;
+
+    // The write in flight, or finished and not yet taken by pump()
+    bool writing = false;
+    bool write_ready = false;
+    int write_result = 0;
+    bool write_from_pipe = false;
+
+    std::string text; // Queued bytes, written ahead of the chunks
+    size_t text_offset = 0;
+    std::deque<Chunk> chunks;
+    size_t chunk_offset = 0; // Into the first chunk
+    struct msghdr message;
+    struct iovec parts[1 + MAX_RING_CHUNKS];
+
+    int pipe_fds[2] = {-1, -1}; // Adopted when orphaned
+
+    ~RingIo() {
+        if (pipe_fds[0] >= 0) {
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+        }
+    }
+
+    void complete_read(int result, IoRing::Buffer buffer, PooledBuffer buffer_pooled, bool more) {
+        received.push_back(Received{result, std::move(buffer), std::move(buffer_pooled)});
+        if (!more) {
+            reading = false;
+            multishot = 0;
+        }
+        if (wake) {
+            wake();
+        }
+    }
+
+    void complete_write(int result) {
+        writing = false;
+        write_ready = true;
+        write_result = result;
+        if (wake) {
+            wake();
+        }
+    }
+};
+
+RelayDirection::~RelayDirection() {
+    detach_ring();
+    close_pipe();
+}
+
+void RelayDirection::use_ring(EventLoop& loop, std::function<void()> wake) {
+    detach_ring();
+    ring_loop = &loop;
+    ring_wake = std::move(wake);
+    ring_io = std::make_shared<RingIo>();
+    ring_io->wake = ring_wake;
+}
+
+void RelayDirection::detach_ring() {
+    if (!ring_io) {
+        return;
+    }
+    // Operations still in flight finish into the orphaned state, which
+    // closes the pipe after the last of them
+    ring_io->wake = nullptr;
+    ring_io->pipe_fds[0] = pipe_fds[0];
+    ring_io->pipe_fds[1] = pipe_fds[1];
+    pipe_fds[0] = pipe_fds[1] = -1;
+    piped = 0;
+    ring_io.reset();
+}
+
+bool RelayDirection::has_pending() const {
+    if (pending_offset < pending.size() || chunk_offset < chunk_length || piped > 0) {
+        return true;
+    }
+    if (!ring_io) {
+        return false;
+    }
+    if (ring_io->text_offset < ring_io->text.size() || !ring_io->chunks.empty()) {
+        return true;
+    }
+    return std::any_of(ring_io->received.begin(), ring_io->received.end(),
+                       [](const RingIo::Received& read) { return read.result > 0; });
+}
+
+void RelayDirection::attach(int from_fd, int to_fd) {
+    from = from_fd;
+    to = to_fd;
+    if (from < 0) {
+        eof = true;
+    }
+}
+
+bool RelayDirection::enable_splice() {
+    if (is_spliced() || tap) {
+        return is_spliced();
+    }
+    if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG_DEBUG("pipe2 failed, using buffered relay");
+        pipe_fds[0] = pipe_fds[1] = -1;
+        return false;
+    }
+    return true;
+}
+
+void RelayDirection::set_tap(Tap new_tap) {
+    tap = std::move(new_tap);
+    if (tap && piped == 0) {
+        close_pipe();
+    }
+}
+
+void RelayDirection::queue(const std::string& data) {
+    if (pending_offset == pending.size()) {
+        pending.clear();
+        pending_offset = 0;
+    }
+    // Keep the order: an unsent chunk tail goes out before the new bytes
+    if (chunk_offset < chunk_length) {
+        pending.append(chunk.data() + chunk_offset, chunk_length - chunk_offset);
+        drop_chunk();
+    }
+    pending.append(data);
+}
+
+void RelayDirection::set_read_limit(uint64_t limit) {
+    limited = true;
+    read_limit = limit;
+    if (read_limit == 0) {
+        eof = true;
+    }
+}
+
+void RelayDirection::reset() {
+    if (ring_io) {
+        detach_ring();
+        ring_io = std::make_shared<RingIo>();
+        ring_io->wake = ring_wake;
+    }
+    close_pipe();
+    from = to = -1;
+    eof = false;
+    bytes = 0;
+    limited = false;
+    read_limit = 0;
+    tap = nullptr;
+    read_counter = write_counter = Metrics::COUNTER_COUNT;
+    pending.clear();
+    pending_offset = 0;
+    drop_chunk();
+}
+
+void RelayDirection::drop_chunk() {
+    chunk.release();
+    chunk_offset = 0;
+    chunk_length = 0;
+}
+
+void RelayDirection::consume_limit(uint64_t count) {
+    if (limited) {
+        read_limit -= std::min(read_limit, count);
+        if (read_limit == 0) {
+            eof = true;
+        }
+    }
+}
+
+void RelayDirection::close_pipe() {
+    if (pipe_fds[0] >= 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        pipe_fds[0] = pipe_fds[1] = -1;
+    }
+    piped = 0;
+}
+
+RelayDirection::Status RelayDirection::pump(int budget) {
+    if (to < 0) {
+        return Status::FINISHED;
+    }
+    if (ring_io) {
+        return pump_ring();
+    }
+
+    for (int round = 0; ; round++) {
+        Status flushed = flush();
+        if (flushed != Status::FINISHED) {
+            return flushed;
+        }
+        if (eof) {
+            return Status::FINISHED;
+        }
+        if (round >= budget) {
+            return Status::YIELDED;
+        }
+
+        Status filled = fill();
+        if (filled != Status::YIELDED) {
+            return filled;
+        }
+    }
+}
+
+// Write out everything buffered; FINISHED means nothing is left
+RelayDirection::Status RelayDirection::flush() {
+    while (pending_offset < pending.size()) {
+        ssize_t sent = send(to, pending.data() + pending_offset,
+                            pending.size() - pending_offset, MSG_NOSIGNAL);
+        if (sent > 0) {
+            pending_offset += sent;
+            count(write_counter, sent);
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && would_block()) {
+            return Status::BLOCKED;
+        } else {
+            return Status::FAILED;
+        }
+    }
+    pending.clear();
+    pending_offset = 0;
+
+    while (chunk_offset < chunk_length) {
+        ssize_t sent = send(to, chunk.data() + chunk_offset, chunk_length - chunk_offset, MSG_NOSIGNAL);
+        if (sent > 0) {
+            chunk_offset += sent;
+            count(write_counter, sent);
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && would_block()) {
+            return Status::BLOCKED;
+        } else {
+            return Status::FAILED;
+        }
+    }
+    drop_chunk();
+
+    while (piped > 0) {
+        ssize_t moved = splice(pipe_fds[0], nullptr, to, nullptr, piped,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved > 0) {
+            piped -= moved; // Partial writes leave the rest in the pipe
+            count(write_counter, moved);
+        } else if (moved < 0 && errno == EINTR) {
+            continue;
+        } else if (moved < 0 && would_block()) {
+            return Status::BLOCKED;
+        } else {
+            return Status::FAILED;
+        }
+    }
+    return Status::FINISHED;
+}
+
+// Read one chunk from the source; YIELDED means data was moved (or EOF seen)
+RelayDirection::Status RelayDirection::fill() {
+    if (is_spliced()) {
+        size_t wanted = limited ? std::min<uint64_t>(SPLICE_CHUNK_SIZE, read_limit) : SPLICE_CHUNK_SIZE;
+        ssize_t moved = splice(from, nullptr, pipe_fds[1], nullptr, wanted,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved > 0) {
+            piped += moved;
+            bytes += moved;
+            count(read_counter, moved);
+            consume_limit(moved);
+            return Status::YIELDED;
+        }
+        if (moved == 0) {
+            eof = true;
+            return Status::YIELDED;
+        }
+        if (would_block()) {
+            return Status::BLOCKED;
+        }
+        if (errno == EINTR) {
+            return Status::YIELDED;
+        }
+        if (errno != EINVAL && errno != ENOSYS) {
+            return Status::FAILED;
+        }
+        // Not spliceable (e.g. unsupported socket type): the pipe is empty
+        // here, so dropping to the buffered path loses nothing
+        LOG_DEBUG("splice unsupported, falling back to buffered relay");
+        close_pipe();
+    }
+
+    // Between reads the buffer sits on the thread's free list, so idle
+    // relays hold no memory for it
+    PooledBuffer buffer = PooledBuffer::acquire();
+    size_t wanted = limited ? std::min<uint64_t>(buffer.size(), read_limit) : buffer.size();
+    ssize_t received = recv(from, buffer.data(), wanted, 0);
+    if (received == 0) {
+        eof = true;
+        return Status::YIELDED;
+    }
+    if (received < 0) {
+        if (would_block()) {
+            return Status::BLOCKED;
+        }
+        return errno == EINTR ? Status::YIELDED : Status::FAILED;
+    }
+
+    bytes += received;
+    count(read_counter, received);
+    consume_limit(received);
+    if (tap) {
+        received = std::min<size_t>(received, tap(buffer.data(), received));
+    }
+
+    // Try to write straight through; the buffer is kept only for an unsent tail
+    ssize_t sent = send(to, buffer.data(), received, MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (!would_block() && errno != EINTR) {
+            return Status::FAILED;
+        }
+        sent = 0;
+    }
+    count(write_counter, sent);
+    if (sent < received) {
+        chunk = std::move(buffer);
+        chunk_offset = sent;
+        chunk_length = received;
+    }
+    return Status::YIELDED;
+}
+
+// Take finished operations and queue the next ones. Never YIELDED: the
+// completions bring the loop back here.
+RelayDirection::Status RelayDirection::pump_ring() {
+    RingIo& io = *ring_io;
+    if (io.write_ready && !finish_ring_write()) {
+        return Status::FAILED;
+    }
+    if (!take_ring_reads()) {
+        return Status::FAILED;
+    }
+    if (!io.writing) {
+        start_ring_write();
+    }
+
+    bool backlogged = io.chunks.size() >= MAX_RING_CHUNKS;
+    if (io.multishot && (eof || backlogged)) {
+        // Armed again once the backlog is written; anything that arrives
+        // meanwhile is still taken
+        ring_loop->cancel_operation(io.multishot);
+        io.multishot = 0;
+    }
+    if (!io.reading && !io.read_stalled && !eof && !backlogged) {
+        start_ring_read();
+    }
+
+    // Past EOF a read still in flight is of no interest
+    if (io.writing || (!eof && (io.reading || !io.received.empty()))) {
+        return Status::BLOCKED;
+    }
+    return eof ? Status::FINISHED : Status::BLOCKED;
+}
+
+bool RelayDirection::finish_ring_write() {
+    RingIo& io = *ring_io;
+    io.write_ready = false;
+    int result = io.write_result;
+    if (result < 0) {
+        return is_retryable(result);
+    }
+
+    count(write_counter, result);
+    if (io.write_from_pipe) {
+        piped -= std::min<size_t>(piped, result);
+        io.read_stalled = false;
+        return true;
+    }
+    size_t sent = result;
+    size_t from_text = std::min(sent, io.text.size() - io.text_offset);
+    io.text_offset += from_text;
+    sent -= from_text;
+    if (io.text_offset == io.text.size()) {
+        io.text.clear();
+        io.text_offset = 0;
+    }
+    while (sent > 0 && !io.chunks.empty()) {
+        size_t from_chunk = std::min(sent, io.chunks.front().length - io.chunk_offset);
+        io.chunk_offset += from_chunk;
+        sent -= from_chunk;
+        if (io.chunk_offset == io.chunks.front().length) {
+            io.chunks.pop_front();
+            io.chunk_offset = 0;
+        }
+    }
+    return true;
+}
+
+bool RelayDirection::take_ring_reads() {
+    RingIo& io = *ring_io;
+    while (!io.received.empty()) {
+        RingIo::Received read = std::move(io.received.front());
+        io.received.pop_front();
+        if (eof) {
+            continue; // Past the end of what is relayed
+        }
+
+        int result = read.result;
+        if (result == 0) {
+            eof = true;
+            continue;
+        }
+        if (result < 0) {
+            if (result == -ENOBUFS) {
+                // Every provided buffer is taken; use pooled ones until one is back
+                io.use_pooled = true;
+            } else if (is_spliced() && (result == -EINVAL || result == -ENOSYS) && piped == 0) {
+                LOG_DEBUG("splice unsupported, falling back to buffered relay");
+                close_pipe();
+            } else if (is_spliced() && is_retryable(result)) {
+                io.read_stalled = piped > 0; // Full pipe: read again once it drains
+            } else if (!is_retryable(result) && result != -ECANCELED) {
+                return false;
+            }
+            continue;
+        }
+
+        bytes += result;
+        count(read_counter, result);
+        consume_limit(result);
+        if (is_spliced()) {
+            piped += result;
+            continue;
+        }
+        io.use_pooled = false;
+        const char* data = read.provided ? read.provided.data() : read.pooled.data();
+        size_t length = result;
+        if (tap) {
+            length = std::min(length, tap(data, length));
+        }
+        if (length > 0) {
+            io.chunks.push_back(RingIo::Chunk{std::move(read.provided), std::move(read.pooled), data, length});
+        }
+    }
+    return true;
+}
+
+void RelayDirection::start_ring_write() {
+    RingIo& io = *ring_io;
+    if (io.text_offset == io.text.size() && pending_offset < pending.size()) {
+        // The write owns the queued bytes now; queue() starts over in 'pending'
+        io.text.swap(pending);
+        io.text_offset = pending_offset;
+        pending.clear();
+        pending_offset = 0;
+    }
+
+    // Everything waiting goes out in one sendmsg
+    size_t count = 0;
+    if (io.text_offset < io.text.size()) {
+        io.parts[count].iov_base = &io.text[io.text_offset];
+        io.parts[count].iov_len = io.text.size() - io.text_offset;
+        count++;
+    }
+    for (size_t i = 0; i < io.chunks.size() && count < std::size(io.parts); i++) {
+        size_t offset = i == 0 ? io.chunk_offset : 0;
+        io.parts[count].iov_base = const_cast<char*>(io.chunks[i].data + offset);
+        io.parts[count].iov_len = io.chunks[i].length - offset;
+        count++;
+    }
+
+    std::shared_ptr<RingIo> state = ring_io;
+    auto done = [state](int result) { state->complete_write(result); };
+    if (count > 0) {
+        std::memset(&io.message, 0, sizeof(io.message));
+        io.message.msg_iov = io.parts;
+        io.message.msg_iovlen = count;
+        io.write_from_pipe = false;
+        io.writing = true;
+        ring_loop->send_message(to, &io.message, done);
+    } else if (piped > 0) {
+        io.write_from_pipe = true;
+        io.writing = true;
+        ring_loop->splice(pipe_fds[0], to, piped, EPOLLOUT, done);
+    }
+}
+
+void RelayDirection::start_ring_read() {
+    RingIo& io = *ring_io;
+    // Queued bytes go out ahead of anything read from the source
+    if (pending_offset < pending.size() || io.text_offset < io.text.size()) {
+        return;
+    }
+
+    std::shared_ptr<RingIo> state = ring_io;
+    auto done = [state](int result, IoRing::Buffer buffer, bool more) {
+        state->complete_read(result, std::move(buffer), PooledBuffer(), more);
+    };
+    io.reading = true;
+    if (is_spliced()) {
+        size_t wanted = limited ? std::min<uint64_t>(SPLICE_CHUNK_SIZE, read_limit) : SPLICE_CHUNK_SIZE;
+        ring_loop->splice(from, pipe_fds[1], wanted, EPOLLIN, [state](int result) {
+            state->complete_read(result, IoRing::Buffer(), PooledBuffer(), false);
+        });
+        return;
+    }
+
+    size_t wanted = limited ? std::min<uint64_t>(IoRing::BUFFER_SIZE, read_limit) : IoRing::BUFFER_SIZE;
+    if (io.use_pooled) {
+        io.pooled = PooledBuffer::acquire();
+        ring_loop->receive_into(from, io.pooled.data(), std::min(wanted, io.pooled.size()), [state](int result) {
+            state->complete_read(result, IoRing::Buffer(), std::move(state->pooled), false);
+        });
+        return;
+    }
+    if (limited) {
+        // A multishot receive could read past the limit
+        ring_loop->receive(from, wanted, done);
+        return;
+    }
+    io.multishot = ring_loop->receive_multishot(from, done);
+}
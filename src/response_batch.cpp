@@ -0,0 +1,92 @@
+#include "response_batch.h"
+#include "socket_utils.h"
+#include <unistd.h>
+#include <algorithm>
+
+namespace {
+    const std::string KEEP_ALIVE = "Connection: keep-alive\r\n\r\n";
+    const std::string CLOSE = "Connection: close\r\n\r\n";
+
+    struct iovec slice(const char* data, size_t length) {
+        struct iovec part;
+        part.iov_base = const_cast<char*>(data);
+        part.iov_len = length;
+        return part;
+    }
+}
+
+bool ResponseBatch::add(std::shared_ptr<const CachedBlock> block, bool keep_alive) {
+    keep_alive = keep_alive && block->framed;
+    const std::string& connection = keep_alive ? KEEP_ALIVE : CLOSE;
+
+    slices.push_back(slice(block->head(), block->head_length));
+    slices.push_back(slice(connection.data(), connection.size()));
+    if (block->on_disk() && block->body_length() > 0) {
+        files.push_back(FilePart{slices.size(), block->segment->fd(), block->file_offset});
+        slices.push_back(slice(nullptr, block->body_length()));
+    } else if (block->body_length() > 0) {
+        slices.push_back(slice(block->body(), block->body_length()));
+    }
+    bytes += block->head_length + connection.size() + block->body_length();
+    blocks.push_back(std::move(block));
+    return keep_alive;
+}
+
+ssize_t ResponseBatch::send(int socket_fd) {
+    ssize_t sent;
+    if (next_file < files.size() && files[next_file].slice == first) {
+        FilePart& part = files[next_file];
+        sent = SocketUtils::send_file(socket_fd, part.fd, part.offset, slices[first].iov_len);
+        if (sent > 0) {
+            slices[first].iov_len -= sent;
+            if (slices[first].iov_len == 0) {
+                first++;
+                next_file++;
+            }
+        }
+    } else {
+        size_t end = next_file < files.size() ? files[next_file].slice : slices.size();
+        sent = SocketUtils::send_vectored(socket_fd, slices, first, end);
+    }
+    if (sent > 0) {
+        bytes -= sent;
+        if (empty()) {
+            clear();
+        }
+    }
+    return sent;
+}
+
+std::string ResponseBatch::take_remaining() {
+    std::string remaining;
+    remaining.reserve(bytes);
+    size_t file = next_file;
+    for (size_t i = first; i < slices.size(); i++) {
+        if (file < files.size() && files[file].slice == i) {
+            size_t start = remaining.size();
+            remaining.resize(start + slices[i].iov_len);
+            ssize_t got = pread(files[file].fd, &remaining[start], slices[i].iov_len,
+                                static_cast<off_t>(files[file].offset));
+            if (got != static_cast<ssize_t>(slices[i].iov_len)) {
+                // The client gets a short response and the connection closes
+                remaining.resize(start + std::max<ssize_t>(got, 0));
+                break;
+            }
+            file++;
+        } else {
+            remaining.append(static_cast<const char*>(slices[i].iov_base), slices[i].iov_len);
+        }
+    }
+    clear();
+    return remaining;
+}
+
+void ResponseBatch::clear() {
+    // Capacity is kept for the next run of hits
+    slices.clear();
+    files.clear();
+    blocks.clear();
+    next_file = 0;
+    first = 0;
+    bytes = 0;
+}
@@ -0,0 +1,166 @@
+#include "revalidator.h"
+#include "buffer_pool.h"
+#include "cache_fill.h"
+#include "http_framing.h"
+#include "logger.h"
+#include "socket_utils.h"
+
+namespace {
+    const size_t QUEUE_DEPTH = 256;
+    // Refreshes hold the whole response; larger objects are not worth it
+    const size_t MAX_RESPONSE_BYTES = 64 * 1024 * 1024;
+    const int IO_TIMEOUT_SECONDS = 10;
+}
+
+Revalidator::Revalidator(std::shared_ptr<CacheManager> cache, std::shared_ptr<DnsResolver> resolver,
+                         size_t thread_count, const ConnectRace::Options& connect_options)
+    : cache(std::move(cache)), resolver(std::move(resolver)), connect_options(connect_options),
+      workers(std::make_unique<ThreadPool>(thread_count, QUEUE_DEPTH)),
+      started(0), not_modified(0), replaced(0), failed(0), dropped(0) {}
+
+Revalidator::~Revalidator() {
+    shutdown();
+}
+
+bool Revalidator::refresh(const HttpRequest& request) {
+    StaleCopy stale;
+    if (!cache->get_stale(request, stale)) {
+        return false;
+    }
+    // A fetch already in flight will replace the entry anyway
+    if (!cache->begin_fetch(request, nullptr)) {
+        return true;
+    }
+    bool queued = workers->try_submit([this, request, stale]() {
+        run(request, stale);
+    });
+    if (!queued) {
+        cache->end_fetch(request);
+        dropped++;
+        return true;
+    }
+    started++;
+    return true;
+}
+
+bool Revalidator::refresh_ahead(const HttpRequest& request, const StaleCopy& validators,
+                                std::chrono::system_clock::time_point expires) {
+    if (!cache->begin_fetch(request, nullptr)) {
+        return false;
+    }
+    bool queued = workers->try_submit([this, request, validators, expires]() {
+        run(request, validators);
+        cache->end_refresh_ahead(request, expires);
+    });
+    if (!queued) {
+        cache->end_fetch(request);
+        dropped++;
+        return false;
+    }
+    started++;
+    return true;
+}
+
+void Revalidator::run(HttpRequest request, StaleCopy stale) {
+    HttpRequest upstream = request;
+    // The answer is for the cache, not for whichever client asked first
+    for (HeaderId id : {HeaderId::IF_NONE_MATCH, HeaderId::IF_MODIFIED_SINCE, HeaderId::IF_MATCH,
+                        HeaderId::IF_UNMODIFIED_SINCE, HeaderId::IF_RANGE, HeaderId::RANGE}) {
+        upstream.headers.erase(id);
+    }
+    if (!stale.etag.empty()) {
+        upstream.headers.set(HeaderId::IF_NONE_MATCH, stale.etag);
+    }
+    if (!stale.last_modified.empty()) {
+        upstream.headers.set(HeaderId::IF_MODIFIED_SINCE, stale.last_modified);
+    }
+    upstream.body.clear();
+    HttpHandler::prepare_upstream_request(upstream, false);
+
+    HttpResponse response;
+    if (!fetch(upstream, response) || response.status_code >= 500) {
+        failed++;
+        LOG_WARNING("Revalidation failed for " + request.path + ", keeping the cached copy");
+    } else if (response.status_code == 304) {
+        if (cache->refresh(request, response)) {
+            not_modified++;
+        }
+    } else {
+        cache->invalidate(request);
+        cache->put(request, response); // No-op for uncacheable responses
+        replaced++;
+    }
+    // Wake the clients that waited for this refresh
+    cache->end_fetch(request);
+}
+
+bool Revalidator::fetch(const HttpRequest& request, HttpResponse& response) {
+    std::string host = HttpHandler::extract_host(request);
+    int port = 0;
+    try {
+        port = HttpHandler::extract_port(request);
+    } catch (...) {
+        return false;
+    }
+
+    DnsResolver::Result resolved = resolver->resolve_sync(host);
+    if (!resolved.ok) {
+        return false;
+    }
+    int target_socket = ConnectRace::connect(resolved.addresses, port, connect_options);
+    if (target_socket < 0) {
+        return false;
+    }
+    SocketUtils::set_io_timeout(target_socket, IO_TIMEOUT_SECONDS);
+
+    std::string serialized = HttpHandler::serialize_request(request);
+    bool complete = false;
+    std::string body;
+    ResponseFramer framer;
+    framer.set_body_sink([&body](const char* data, size_t length) {
+        body.append(data, length);
+    });
+    if (SocketUtils::send_all(target_socket, serialized.data(), serialized.size())) {
+        PooledBuffer buffer = PooledBuffer::acquire();
+        while (body.size() <= MAX_RESPONSE_BYTES) {
+            int received = SocketUtils::receive_data(target_socket, buffer.data(), buffer.size());
+            if (received <= 0) {
+                complete = framer.finish_on_close() == ResponseFramer::Result::COMPLETE;
+                break;
+            }
+            size_t used = 0;
+            ResponseFramer::Result result = framer.consume(buffer.data(), received, used);
+            if (result == ResponseFramer::Result::ERROR) {
+                break;
+            }
+            if (result == ResponseFramer::Result::COMPLETE) {
+                complete = true;
+                break;
+            }
+        }
+    }
+    SocketUtils::close_socket(target_socket);
+    if (!complete) {
+        return false;
+    }
+    response = HttpHandler::build_response(framer.head());
+    response.body = std::move(body);
+    if (response.status_code != 304) {
+        CacheFill::frame_by_length(response);
+    }
+    return true;
+}
+
+void Revalidator::shutdown() {
+    workers->shutdown();
+}
+
+Revalidator::Stats Revalidator::get_stats() const {
+    Stats stats;
+    stats.started = started;
+    stats.not_modified = not_modified;
+    stats.replaced = replaced;
+    stats.failed = failed;
+    stats.dropped = dropped;
+    return stats;
+}
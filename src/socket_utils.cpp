@@ -1,53 +1,96 @@
 #include "socket_utils.h"
 #include "logger.h"
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <cstring>
+#include <cerrno>
 #include <ifaddrs.h>
+#include <climits>
+#include <algorithm>
 
-int SocketUtils::create_socket() {
-    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+void SocketAddress::set_port(int port) {
+    if (family() == AF_INET6) {
+        reinterpret_cast<struct sockaddr_in6*>(&storage)->sin6_port = htons(port);
+    } else {
+        reinterpret_cast<struct sockaddr_in*>(&storage)->sin_port = htons(port);
+    }
+}
+
+std::string SocketAddress::to_string() const {
+    if (family() == AF_INET6) {
+        auto* v6 = reinterpret_cast<const struct sockaddr_in6*>(&storage);
+        return "[" + host_string() + "]:" + std::to_string(ntohs(v6->sin6_port));
+    }
+    auto* v4 = reinterpret_cast<const struct sockaddr_in*>(&storage);
+    return host_string() + ":" + std::to_string(ntohs(v4->sin_port));
+}
+
+std::string SocketAddress::host_string() const {
+    char text[INET6_ADDRSTRLEN] = "";
+    if (family() == AF_INET6) {
+        inet_ntop(AF_INET6, &reinterpret_cast<const struct sockaddr_in6*>(&storage)->sin6_addr, text, sizeof(text));
+    } else {
+        inet_ntop(AF_INET, &reinterpret_cast<const struct sockaddr_in*>(&storage)->sin_addr, text, sizeof(text));
+    }
+    return text;
+}
+
+int SocketUtils::create_socket(int family) {
+    int socket_fd = socket(family, SOCK_STREAM, 0);
     if (socket_fd < 0) {
-        Logger::error("Failed to create socket");
+        LOG_ERROR("Failed to create socket");
         return -1;
     }
     
     // Set socket options to allow reuse
     int opt = 1;
     if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        Logger::warning("Failed to set socket options");
+        LOG_WARNING("Failed to set socket options");
     }
     
     return socket_fd;
 }
 
-bool SocketUtils::bind_socket(int socket_fd, int port) {
+bool SocketUtils::bind_socket(int socket_fd, int port, bool reuse_port, bool loopback_only) {
+    if (reuse_port) {
+        // Lets several listeners share the port; the kernel balances accepts
+        int opt = 1;
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            LOG_ERROR("Failed to set SO_REUSEPORT");
+            return false;
+        }
+    }
+    
     struct sockaddr_in server_addr;
     std::memset(&server_addr, 0, sizeof(server_addr));
     
     server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
     server_addr.sin_port = htons(port);
     
     if (bind(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        Logger::error("Failed to bind socket on port " + std::to_string(port));
+        LOG_ERROR("Failed to bind socket on port " + std::to_string(port));
         return false;
     }
     
-    Logger::info("Socket bound to port " + std::to_string(port));
+    LOG_INFO("Socket bound to port " + std::to_string(port));
     return true;
 }
 
 bool SocketUtils::listen_on_socket(int socket_fd) {
     if (listen(socket_fd, SOMAXCONN) < 0) {
-        Logger::error("Failed to listen on socket");
+        LOG_ERROR("Failed to listen on socket");
         return false;
     }
-    Logger::info("Server listening...");
+    LOG_INFO("Server listening...");
     return true;
 }
 
@@ -57,49 +100,187 @@ int SocketUtils::accept_connection(int server_socket) {
     
     int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &addr_len);
     if (client_socket < 0) {
-        Logger::error("Failed to accept connection");
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            LOG_ERROR("Failed to accept connection");
+        }
         return -1;
     }
     
-    Logger::info("New connection from " + std::string(inet_ntoa(client_addr.sin_addr)));
+    char client_ip[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+    LOG_INFO("New connection from " + std::string(client_ip));
     return client_socket;
 }
 
-bool SocketUtils::connect_to_host(int socket_fd, const std::string& host, int port) {
-    struct hostent* server = gethostbyname(host.c_str());
-    if (server == nullptr) {
-        Logger::error("Failed to resolve host: " + host);
+bool SocketUtils::connect_to_address(int socket_fd, const SocketAddress& address) {
+    if (connect(socket_fd, address.get(), address.length) < 0) {
+        LOG_ERROR("Failed to connect to " + address.to_string() + ": " + strerror(errno));
         return false;
     }
     
-    struct sockaddr_in server_addr;
-    std::memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    std::memcpy(&server_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-    
-    if (connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        Logger::error("Failed to connect to " + host + ":" + std::to_string(port));
+    LOG_INFO("Connected to " + address.to_string());
+    return true;
+}
+
+bool SocketUtils::set_non_blocking(int socket_fd) {
+    int flags = fcntl(socket_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        LOG_ERROR("Failed to set socket non-blocking");
         return false;
     }
+    return true;
+}
+
+int SocketUtils::accept_non_blocking(int server_socket) {
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
     
-    Logger::info("Connected to " + host + ":" + std::to_string(port));
+    int client_socket = accept4(server_socket, (struct sockaddr*)&client_addr, &addr_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_socket < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            LOG_ERROR("Failed to accept connection");
+        }
+        return -1;
+    }
+    
+    char client_ip[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+    LOG_INFO("New connection from " + std::string(client_ip));
+    return client_socket;
+}
+
+std::string SocketUtils::peer_address(int socket_fd) {
+    SocketAddress address;
+    address.length = sizeof(address.storage);
+    if (getpeername(socket_fd, reinterpret_cast<struct sockaddr*>(&address.storage), &address.length) < 0) {
+        return "";
+    }
+    return address.to_string();
+}
+
+std::string SocketUtils::peer_host(int socket_fd) {
+    SocketAddress address;
+    address.length = sizeof(address.storage);
+    if (getpeername(socket_fd, reinterpret_cast<struct sockaddr*>(&address.storage), &address.length) < 0) {
+        return "";
+    }
+    return address.host_string();
+}
+
+int SocketUtils::get_socket_error(int socket_fd) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+        return errno;
+    }
+    return error;
+}
+
+bool SocketUtils::set_no_delay(int socket_fd) {
+    int opt = 1;
+    if (setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0) {
+        LOG_WARNING("Failed to set TCP_NODELAY");
+        return false;
+    }
     return true;
 }
 
+bool SocketUtils::set_quick_ack(int socket_fd) {
+    int opt = 1;
+    return setsockopt(socket_fd, IPPROTO_TCP, TCP_QUICKACK, &opt, sizeof(opt)) == 0;
+}
+
+bool SocketUtils::set_io_timeout(int socket_fd, int seconds) {
+    struct timeval timeout = {seconds, 0};
+    return setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+           setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
 int SocketUtils::send_data(int socket_fd, const char* data, int length) {
     int sent = send(socket_fd, data, length, 0);
     if (sent < 0) {
-        Logger::error("Failed to send data");
+        LOG_ERROR("Failed to send data");
+        return -1;
+    }
+    return sent;
+}
+
+bool SocketUtils::send_all(int socket_fd, const char* data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t sent = send(socket_fd, data + total, length - total, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Failed to send data");
+            return false;
+        }
+        total += sent;
+    }
+    return true;
+}
+
+ssize_t SocketUtils::send_vectored(int socket_fd, std::vector<struct iovec>& parts, size_t& first,
+                                   size_t end) {
+    end = std::min(end, parts.size());
+    while (first < end && parts[first].iov_len == 0) {
+        first++;
+    }
+    if (first == end) {
+        return 0;
+    }
+
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &parts[first];
+    message.msg_iovlen = std::min<size_t>(end - first, IOV_MAX);
+    int flags = MSG_NOSIGNAL;
+    if (end < parts.size()) {
+        flags |= MSG_MORE;
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket_fd, &message, flags);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    size_t remaining = sent;
+    while (first < end && remaining >= parts[first].iov_len) {
+        remaining -= parts[first].iov_len;
+        first++;
+    }
+    if (remaining > 0) {
+        parts[first].iov_base = static_cast<char*>(parts[first].iov_base) + remaining;
+        parts[first].iov_len -= remaining;
+    }
+    return sent;
+}
+
+ssize_t SocketUtils::send_file(int socket_fd, int file_fd, uint64_t& offset, size_t length) {
+    off_t position = static_cast<off_t>(offset);
+    ssize_t sent;
+    do {
+        sent = sendfile(socket_fd, file_fd, &position, length);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    if (sent == 0 && length > 0) {
         return -1;
     }
+    offset = static_cast<uint64_t>(position);
     return sent;
 }
 
 int SocketUtils::receive_data(int socket_fd, char* buffer, int buffer_size) {
     int received = recv(socket_fd, buffer, buffer_size, 0);
     if (received < 0) {
-        Logger::error("Failed to receive data");
+        LOG_ERROR("Failed to receive data");
         return -1;
     }
     return received;
@@ -0,0 +1,93 @@
+#include "thread_pool.h"
+#include "logger.h"
+#include <pthread.h>
+#include <sched.h>
+
+ThreadPool::ThreadPool(size_t thread_count, size_t queue_depth, int cpu)
+    : queue_depth(queue_depth), stopping(false) {
+    for (size_t i = 0; i < thread_count; i++) {
+        workers.emplace_back(&ThreadPool::worker_loop, this, cpu);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    shutdown();
+}
+
+bool ThreadPool::try_submit(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (stopping || tasks.size() >= queue_depth) {
+            return false;
+        }
+        tasks.push_back(std::move(task));
+    }
+    queue_cv.notify_one();
+    return true;
+}
+
+void ThreadPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (stopping) {
+            return;
+        }
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+size_t ThreadPool::queued() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return tasks.size();
+}
+
+void ThreadPool::worker_loop(int cpu) {
+    if (cpu >= 0) {
+        pin_current_thread(cpu);
+    }
+
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return; // stopping and fully drained
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+bool ThreadPool::pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        LOG_WARNING("Failed to pin thread to CPU " + std::to_string(cpu));
+        return false;
+    }
+    return true;
+}
+
+std::vector<int> ThreadPool::available_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
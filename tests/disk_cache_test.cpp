@@ -0,0 +1,314 @@
+// Crash consistency of the disk cache tier: write records, damage the tail
+// of the segment the way a crash or bad sector would, reopen, and check that
+// the intact records are served and the damaged ones are dropped and trimmed.
+// Run: ./bin/disk_cache_test (exits non-zero on failure)
+
+#include "disk_cache.h"
+#include "cache_manager.h"
+#include "logger.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+const size_t MAX_BYTES = 64 * 1024 * 1024;
+const int RECORDS = 5;
+const size_t RECORD_HEADER_SIZE = 64; // RecordHeader in disk_cache.cpp
+
+int failures = 0;
+
+#define CHECK(condition)                                                               \
+    do {                                                                               \
+        if (!(condition)) {                                                            \
+            std::fprintf(stderr, "  FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                                \
+        }                                                                              \
+    } while (0)
+
+std::string key_of(int i) {
+    return "GET:test.example:/object/" + std::to_string(i);
+}
+
+std::string head_of(int i) {
+    return "HTTP/1.1 200 OK\r\nX-Record: " + std::to_string(i) + "\r\n";
+}
+
+std::string body_of(int i) {
+    std::string body;
+    while (body.size() < 3000) {
+        body += "record " + std::to_string(i) + " body line " + std::to_string(body.size()) + "\n";
+    }
+    return body;
+}
+
+// Offset within its record of the first body byte of record i
+size_t body_offset(int i) {
+    return RECORD_HEADER_SIZE + key_of(i).size() + head_of(i).size();
+}
+
+std::shared_ptr<const CachedBlock> make_block(int i) {
+    auto block = std::make_shared<CachedBlock>();
+    block->bytes = head_of(i) + body_of(i);
+    block->head_length = head_of(i).size();
+    block->framed = true;
+    block->status_code = 200;
+    return block;
+}
+
+std::string make_directory() {
+    char path[] = "/tmp/disk_cache_test.XXXXXX";
+    if (!mkdtemp(path)) {
+        std::perror("mkdtemp");
+        std::exit(2);
+    }
+    return path;
+}
+
+void remove_directory(const std::string& path) {
+    if (DIR* dir = opendir(path.c_str())) {
+        while (struct dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                unlink((path + "/" + name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(path.c_str());
+}
+
+std::string segment_path(const std::string& directory) {
+    return directory + "/00000000.seg";
+}
+
+size_t file_size(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+}
+
+// Write record i synchronously; the segment size afterwards
+size_t write(DiskCache& cache, const std::string& directory, int i) {
+    cache.store(static_cast<uint64_t>(i) + 1, key_of(i), make_block(i), std::chrono::system_clock::now(), 3600);
+    return file_size(segment_path(directory));
+}
+
+// Records 0..RECORDS-1 in one segment; ends[i] is where record i ends
+std::vector<size_t> populate(const std::string& directory) {
+    DiskCache cache(directory, MAX_BYTES);
+    std::vector<size_t> ends;
+    if (!cache.open()) {
+        return ends;
+    }
+    cache.shutdown(); // Store on this thread
+    for (int i = 0; i < RECORDS; i++) {
+        ends.push_back(write(cache, directory, i));
+    }
+    return ends;
+}
+
+// Whether record i is served whole, head from the index and body from the file
+bool served(DiskCache& cache, int i) {
+    std::shared_ptr<const CachedBlock> block;
+    if (!cache.lookup(static_cast<uint64_t>(i) + 1, key_of(i), block)) {
+        return false;
+    }
+    std::string head(block->head(), block->head_length);
+    std::string body(block->file_length, '\0');
+    ssize_t got = pread(block->segment->fd(), &body[0], body.size(), static_cast<off_t>(block->file_offset));
+    return head == head_of(i) && got == static_cast<ssize_t>(body.size()) && body == body_of(i);
+}
+
+bool damage(const std::string& path, const std::function<bool(int fd)>& change) {
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+    bool done = change(fd);
+    close(fd);
+    return done;
+}
+
+bool flip_byte(int fd, size_t offset) {
+    char byte;
+    if (pread(fd, &byte, 1, static_cast<off_t>(offset)) != 1) {
+        return false;
+    }
+    byte ^= 0x5a;
+    return pwrite(fd, &byte, 1, static_cast<off_t>(offset)) == 1;
+}
+
+// A crash part way through appending the last record, at several points:
+// inside its header, inside its key, inside its body, one byte short
+void test_torn_tail() {
+    for (int point = 0; point < 5; point++) {
+        std::string directory = make_directory();
+        std::vector<size_t> ends = populate(directory);
+        CHECK(ends.size() == RECORDS);
+        if (ends.size() != RECORDS) {
+            remove_directory(directory);
+            return;
+        }
+        size_t last_start = ends[RECORDS - 2];
+        size_t cuts[] = {1, RECORD_HEADER_SIZE / 2, RECORD_HEADER_SIZE + 4, body_offset(RECORDS - 1) + 100,
+                         ends[RECORDS - 1] - last_start - 1};
+        size_t cut = cuts[point];
+        std::string path = segment_path(directory);
+        CHECK(truncate(path.c_str(), static_cast<off_t>(last_start + cut)) == 0);
+
+        {
+            DiskCache cache(directory, MAX_BYTES);
+            CHECK(cache.open());
+            CHECK(cache.get_stats().loaded == RECORDS - 1);
+            for (int i = 0; i < RECORDS - 1; i++) {
+                CHECK(served(cache, i));
+            }
+            CHECK(!served(cache, RECORDS - 1));
+            CHECK(file_size(path) == last_start);
+
+            // New records go after the trimmed tail and survive a restart
+            cache.shutdown();
+            write(cache, directory, RECORDS);
+        }
+        {
+            DiskCache cache(directory, MAX_BYTES);
+            CHECK(cache.open());
+            CHECK(cache.get_stats().loaded == RECORDS);
+            for (int i = 0; i < RECORDS - 1; i++) {
+                CHECK(served(cache, i));
+            }
+            CHECK(served(cache, RECORDS));
+            CHECK(cache.get_stats().corrupt == 0);
+        }
+        remove_directory(directory);
+    }
+}
+
+// Blocks allocated but never written: the file ends in zeros
+void test_zero_filled_tail() {
+    std::string directory = make_directory();
+    std::vector<size_t> ends = populate(directory);
+    CHECK(ends.size() == RECORDS);
+    if (ends.size() == RECORDS) {
+        std::string path = segment_path(directory);
+        CHECK(truncate(path.c_str(), static_cast<off_t>(ends.back() + 8192)) == 0);
+
+        DiskCache cache(directory, MAX_BYTES);
+        CHECK(cache.open());
+        CHECK(cache.get_stats().loaded == RECORDS);
+        for (int i = 0; i < RECORDS; i++) {
+            CHECK(served(cache, i));
+        }
+        CHECK(file_size(path) == ends.back());
+    }
+    remove_directory(directory);
+}
+
+// The last record's header made it to disk but part of its body did not:
+// the header is indexed, and the payload checksum rejects it when served
+void test_corrupt_body() {
+    std::string directory = make_directory();
+    std::vector<size_t> ends = populate(directory);
+    CHECK(ends.size() == RECORDS);
+    if (ends.size() == RECORDS) {
+        std::string path = segment_path(directory);
+        size_t offset = ends[RECORDS - 2] + body_offset(RECORDS - 1) + 1000;
+        CHECK(damage(path, [offset](int fd) { return flip_byte(fd, offset); }));
+
+        DiskCache cache(directory, MAX_BYTES);
+        CHECK(cache.open());
+        CHECK(cache.get_stats().loaded == RECORDS);
+        for (int i = 0; i < RECORDS - 1; i++) {
+            CHECK(served(cache, i));
+        }
+        CHECK(!served(cache, RECORDS - 1));
+        CHECK(cache.get_stats().corrupt == 1);
+        // Dropped from the index, not checked again
+        CHECK(!served(cache, RECORDS - 1));
+        CHECK(cache.get_stats().corrupt == 1);
+        CHECK(cache.get_stats().entries == RECORDS - 1);
+    }
+    remove_directory(directory);
+}
+
+// A damaged record header ends the segment there: it and every record
+// after it are cut off, the ones before it are served
+void test_corrupt_header() {
+    std::string directory = make_directory();
+    std::vector<size_t> ends = populate(directory);
+    CHECK(ends.size() == RECORDS);
+    if (ends.size() == RECORDS) {
+        std::string path = segment_path(directory);
+        size_t start = ends[RECORDS - 3];
+        // The hash field, covered by the header checksum
+        CHECK(damage(path, [start](int fd) { return flip_byte(fd, start + 8); }));
+
+        DiskCache cache(directory, MAX_BYTES);
+        CHECK(cache.open());
+        CHECK(cache.get_stats().loaded == RECORDS - 2);
+        for (int i = 0; i < RECORDS - 2; i++) {
+            CHECK(served(cache, i));
+        }
+        CHECK(!served(cache, RECORDS - 2));
+        CHECK(!served(cache, RECORDS - 1));
+        CHECK(file_size(path) == start);
+    }
+    remove_directory(directory);
+}
+
+// The directory lock is held until close(), then free for the next process,
+// and a closed cache can open it again
+void test_directory_lock() {
+    std::string directory = make_directory();
+    {
+        DiskCache first(directory, MAX_BYTES);
+        CHECK(first.open());
+        DiskCache second(directory, MAX_BYTES);
+        CHECK(!second.open());
+        first.close();
+        CHECK(!first.is_open());
+        CHECK(second.open());
+
+        // Taken back after the other process lets go, records and all
+        second.shutdown();
+        write(second, directory, 0);
+        CHECK(!first.open());
+        second.close();
+        CHECK(first.open());
+        CHECK(first.is_open());
+        CHECK(served(first, 0));
+    }
+    remove_directory(directory);
+}
+
+} // namespace
+
+int main() {
+    Logger::set_level(ERROR);
+
+    struct {
+        const char* name;
+        void (*run)();
+    } tests[] = {
+        {"torn tail", test_torn_tail},
+        {"zero-filled tail", test_zero_filled_tail},
+        {"corrupt body", test_corrupt_body},
+        {"corrupt header", test_corrupt_header},
+        {"directory lock", test_directory_lock},
+    };
+    for (const auto& test : tests) {
+        int before = failures;
+        test.run();
+        std::printf("%-20s %s\n", test.name, failures == before ? "ok" : "FAILED");
+    }
+    Logger::shutdown();
+    return failures == 0 ? 0 : 1;
+}